@@ -18,10 +18,14 @@ module DpimIf(
 	 output [31:0] program_data,
 	 input input1_rdy,
 	 input input2_rdy,
+	 input [1:0] input1_half_rdy,
+	 input [1:0] input2_half_rdy,
 	 output input1_set,
 	 output input2_set,
 	 output [10:0] input_addr,
-	 output [11:0] input_data
+	 output [11:0] input_data,
+	 output cpu_hold,
+	 input [31:0] in_stall_count
     );
 
 // Top 4 bits define state, bottom 4 bits set control signals
@@ -72,10 +76,16 @@ module DpimIf(
    //		 0x82: Commit input 1 data.
    //		 0x83: Commit input 2 data.
 	//     0xc1-c3: Set remaining addresses to current contents of data registers.
+	//     0x10: Hold the CPU, FIFO and input read address in reset while set, can be
+	//           combined with any of the above so memories can be loaded during reset.
 	// 1: Address register
 	// 2-3/2-5: Input / program data bytes (little endian, so reg 2 contains bit 31-24, etc)
 	// 6: High address register (for input data only)
-	// 7: Input required - bitfield: 1, input 1; 2 input 2
+	// 7: Input required - bitfield: 1, input 1; 2 input 2;
+	//    4, input 1 addresses 0-0x3ff drained; 8, input 1 addresses 0x400-0x7ff drained
+	//    0x10, 0x20, the same for input 2 when it is streamed (see hovalaag_top.v)
+	// 8-11: Number of clocks the CPU has waited for input (reg 8 contains bits 31-24, etc),
+	//    latched when register 8 is addressed so read 8 first.
 	//
 	// Examples:
 	// To write one 32-bit word of program:
@@ -90,6 +100,7 @@ module DpimIf(
 	reg [7:0] ctrlReg = 8'h00;
 	reg [10:0] programAddr = 11'h000;
 	reg [31:0] programData = 8'h00;
+	reg [31:0] stallCount = 32'h00000000;
 	
 	assign busEppOut = (EppAstb == 1'b0) ? regAddr : dataOut;
 	assign dataOut = (regAddr == 8'h00) ? ctrlReg :
@@ -99,7 +110,11 @@ module DpimIf(
 	                 (regAddr == 8'h04) ? programData[15:8] :
 	                 (regAddr == 8'h05) ? programData[7:0] :
 	                 (regAddr == 8'h06) ? {5'b00000,programAddr[10:8]} : 
-						  (regAddr == 8'h07) ? {6'b000000,input2_rdy,input1_rdy} :
+						  (regAddr == 8'h07) ? {2'b00,input2_half_rdy,input1_half_rdy,input2_rdy,input1_rdy} :
+						  (regAddr == 8'h08) ? stallCount[31:24] :
+						  (regAddr == 8'h09) ? stallCount[23:16] :
+						  (regAddr == 8'h0a) ? stallCount[15:8] :
+						  (regAddr == 8'h0b) ? stallCount[7:0] :
 						  8'h00;
 
 	assign program_set = ((ctrlReg & 8'h8F) == 8'h81);
@@ -109,6 +124,7 @@ module DpimIf(
 	assign program_data = programData;
 	assign input_addr = programAddr;
 	assign input_data = programData[27:16];
+	assign cpu_hold = ctrlReg[4];
 	
 	always @(posedge clk)
 		state <= nextState;
@@ -164,8 +180,10 @@ module DpimIf(
 	end
 	
 	always @(posedge clk) begin
-		if (EppAddrWr)
+		if (EppAddrWr) begin
 			regAddr <= busEppIn;
+			if (busEppIn == 8'h08) stallCount <= in_stall_count;
+		end
 		else if (EppDataWr)
 			case (regAddr)
 			8'h00: ctrlReg <= busEppIn;
@@ -0,0 +1,779 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Software model of the Hovalaag CPU, see Hovalaag.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Hovalaag.h"
+#include "TextInput.h"
+
+// Fewest cycles of a loop worth skipping with the matrix powers, see SkipLoop
+#define LoopSkipMinCycles 64
+// Most passes of a loop that aren't affine between looking for a fixed point, as a power of 2
+#define LoopMaxWait 10
+// Rows of input.txt parsed at a time
+#define InputBlockRows 4096
+
+HovalaagOp HovalaagDecode(uint32_t instr)
+{
+  HovalaagOp op;
+  op.alu = instr >> 28;
+  op.aOp = (instr >> 26) & 3;
+  op.bOp = (instr >> 24) & 3;
+  op.cOp = (instr >> 22) & 3;
+  op.dOp = (instr >> 21) & 1;
+  op.wOp = (instr >> 19) & 3;
+  op.fOp = (instr >> 17) & 3;
+  op.pcOp = (instr >> 15) & 3;
+  op.out = (instr >> 14) & 1;
+  op.io = (instr >> 13) & 1;
+  if (instr & 0x1000)
+  {
+    // One constant: K and L share the value field
+    op.K = instr & 0xfff;
+    op.L = instr & 0xff;
+  }
+  else
+  {
+    // Two constants: K is a sign extended 6-bit value, L a 6-bit address
+    op.K = (instr & 0x800) ? (0xfc0 | ((instr >> 6) & 0x3f)) : ((instr >> 6) & 0x3f);
+    op.L = instr & 0x3f;
+  }
+  return op;
+}
+
+HovalaagCpu::HovalaagCpu()
+{
+  op14Source = 0;
+  op15Source = 0;
+  profile = NULL;
+  runs = 0;
+  Load(NULL, 0);
+  Reset();
+}
+
+void HovalaagCpu::Load(const uint32_t* prog, int numWords)
+{
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+  {
+    program[i] = (i < numWords) ? prog[i] : 0;
+    ops[i] = HovalaagDecode(program[i]);
+
+    // Build the dispatch table entry, the handlers are bound on the next Run
+    const HovalaagOp& op = ops[i];
+    HovalaagExec& e = exec[i];
+    e.stage1 = NULL;
+    e.stage2 = NULL;
+    e.stage1Index = (op.alu * 4 + op.aOp) * 4 + op.bOp;
+    e.stage2Index = ((op.cOp * 4 + op.wOp) * 4 + op.fOp) * 4 + op.pcOp;
+    e.K = HovalaagSigned(op.K);
+    e.L = op.L;
+    e.dOp = op.dOp;
+    e.out = op.out;
+    e.io = op.io;
+    e.loop = 0;
+  }
+  FindLoops();
+}
+
+// The registers as loop variables, LOOP_ONE is the constant term
+enum { LOOP_A, LOOP_B, LOOP_C, LOOP_D, LOOP_W, LOOP_F, LOOP_ONE };
+
+// A register during one pass of a loop body as an affine function, mod 4096,
+// of the registers at the start of the pass.  Not known if it isn't one.
+struct LoopForm
+{
+  bool known;
+  uint16_t k[HOVALAAG_LOOP_VARS];
+};
+
+static LoopForm LoopVar(int v)
+{
+  LoopForm f = { true, { 0 } };
+  f.k[v] = 1;
+  return f;
+}
+
+static LoopForm LoopConst(uint16_t value)
+{
+  LoopForm f = LoopVar(LOOP_ONE);
+  f.k[LOOP_ONE] = value & 0xfff;
+  return f;
+}
+
+static LoopForm LoopUnknown()
+{
+  LoopForm f = { false, { 0 } };
+  return f;
+}
+
+// a + sign * b
+static LoopForm LoopAdd(const LoopForm& a, const LoopForm& b, int sign)
+{
+  LoopForm f = a;
+  f.known = a.known && b.known;
+  for (int v = 0; v < HOVALAAG_LOOP_VARS; ++v)
+    f.k[v] = (a.k[v] + sign * b.k[v]) & 0xfff;
+  return f;
+}
+
+static LoopForm LoopNeg(const LoopForm& a)
+{
+  return LoopAdd(LoopConst(0), a, -1);
+}
+
+// The ALU result for the affine ops.  Also notes the registers the op reads.
+static LoopForm LoopAlu(int alu, const LoopForm* reg, bool* reads)
+{
+  switch (alu)
+  {
+    case 0:  return LoopConst(0);
+    case 1:  reads[LOOP_A] = true; return LoopNeg(reg[LOOP_A]);
+    case 2:  reads[LOOP_B] = true; return reg[LOOP_B];
+    case 3:  reads[LOOP_C] = true; return reg[LOOP_C];
+    case 4:
+    case 12: reads[LOOP_A] = true; return LoopUnknown();
+    case 13: reads[LOOP_A] = true; return reg[LOOP_A];
+    case 5:  reads[LOOP_A] = reads[LOOP_B] = true; return LoopAdd(reg[LOOP_A], reg[LOOP_B], 1);
+    case 6:  reads[LOOP_A] = reads[LOOP_B] = true; return LoopAdd(reg[LOOP_B], reg[LOOP_A], -1);
+    case 7:
+      reads[LOOP_A] = reads[LOOP_B] = reads[LOOP_F] = true;
+      return LoopAdd(LoopAdd(reg[LOOP_A], reg[LOOP_B], 1), reg[LOOP_F], 1);
+    case 8:
+      reads[LOOP_A] = reads[LOOP_B] = reads[LOOP_F] = true;
+      return LoopAdd(LoopAdd(reg[LOOP_B], reg[LOOP_A], -1), reg[LOOP_F], -1);
+    case 9:
+    case 10:
+    case 11: reads[LOOP_A] = reads[LOOP_B] = true; return LoopUnknown();
+    default: return LoopUnknown();    // 14 and 15, the sources can change after loading
+  }
+}
+
+// Work out one pass of the loop from start to the DECNZ at end, see HovalaagLoop
+static bool AnalyzeLoop(const HovalaagOp* ops, int start, int end, HovalaagLoop* loop)
+{
+  LoopForm reg[LOOP_ONE];
+  bool written[LOOP_ONE] = { false };
+  bool liveIn[LOOP_ONE] = { false };
+  bool bodyReadsC = false;
+  for (int r = 0; r < LOOP_ONE; ++r)
+    reg[r] = LoopVar(r);
+
+  for (int i = start; i <= end; ++i)
+  {
+    const HovalaagOp& op = ops[i];
+    if (op.aOp == A_FROM_IN || op.out) return false;
+    if (i < end && (op.pcOp != PC_STEP || op.cOp != C_HOLD)) return false;
+
+    // Everything is read before anything is written
+    bool reads[LOOP_ONE] = { false };
+    LoopForm M = LoopUnknown();
+    if (op.aOp == A_FROM_M || op.bOp == B_FROM_M || op.wOp == W_FROM_M || op.fOp != F_HOLD)
+    {
+      M = LoopAlu(op.alu, reg, reads);
+      bodyReadsC |= reads[LOOP_C];
+    }
+    LoopForm next[LOOP_ONE];
+    bool writes[LOOP_ONE] = { false };
+    for (int r = 0; r < LOOP_ONE; ++r)
+      next[r] = reg[r];
+
+    if (op.aOp == A_FROM_M) next[LOOP_A] = M;
+    else if (op.aOp == A_FROM_D) { reads[LOOP_D] = true; next[LOOP_A] = reg[LOOP_D]; }
+    if (op.bOp == B_FROM_M) next[LOOP_B] = M;
+    else if (op.bOp == B_FROM_A) { reads[LOOP_A] = true; next[LOOP_B] = reg[LOOP_A]; }
+    else if (op.bOp == B_FROM_K) next[LOOP_B] = LoopConst(op.K);
+    if (op.cOp == C_DECNZ) { reads[LOOP_C] = true; next[LOOP_C] = LoopAdd(reg[LOOP_C], LoopConst(1), -1); }
+    if (op.dOp) { reads[LOOP_A] = true; next[LOOP_D] = reg[LOOP_A]; }
+    if (op.wOp == W_FROM_M) next[LOOP_W] = M;
+    else if (op.wOp == W_FROM_A) { reads[LOOP_A] = true; next[LOOP_W] = reg[LOOP_A]; }
+    else if (op.wOp == W_FROM_K) next[LOOP_W] = LoopConst(op.K);
+    if (op.fOp != F_HOLD) next[LOOP_F] = LoopUnknown();
+
+    // OUT is left holding W from the start of the DECNZ, and a conditional
+    // jump with it reads F when the loop exits
+    if (i == end)
+    {
+      reads[LOOP_W] = true;
+      if (op.pcOp == PC_JMPT || op.pcOp == PC_JMPF) reads[LOOP_F] = true;
+    }
+    writes[LOOP_A] = op.aOp != A_HOLD;
+    writes[LOOP_B] = op.bOp != B_HOLD;
+    writes[LOOP_C] = op.cOp != C_HOLD;
+    writes[LOOP_D] = op.dOp;
+    writes[LOOP_W] = op.wOp != W_HOLD;
+    writes[LOOP_F] = op.fOp != F_HOLD;
+
+    for (int r = 0; r < LOOP_ONE; ++r)
+    {
+      if (reads[r] && !written[r]) liveIn[r] = true;
+      written[r] |= writes[r];
+      reg[r] = next[r];
+    }
+  }
+
+  loop->start = start;
+  loop->end = end;
+  loop->length = end - start + 1;
+  loop->powersReady = false;
+  loop->lastRun = 0;
+  loop->lastCycle = UINT64_MAX;
+  loop->wait = 0;
+  loop->misses = 0;
+
+  // Registers written before being read are left alone, the interpreter
+  // sets them again in the pass after the skip
+  loop->affine = true;
+  memset(loop->pass[0], 0, sizeof(loop->pass[0]));
+  for (int r = 0; r < LOOP_ONE; ++r)
+  {
+    if (liveIn[r] && !reg[r].known) loop->affine = false;
+    const LoopForm& f = reg[r].known ? reg[r] : LoopVar(r);
+    for (int v = 0; v < HOVALAAG_LOOP_VARS; ++v)
+      loop->pass[0][r][v] = f.k[v];
+  }
+  loop->pass[0][LOOP_ONE][LOOP_ONE] = 1;
+  return loop->affine || !bodyReadsC;
+}
+
+void HovalaagCpu::FindLoops()
+{
+  loops.clear();
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+  {
+    HovalaagLoop loop;
+    if (ops[i].cOp == C_DECNZ && ops[i].L <= i && AnalyzeLoop(ops, ops[i].L, i, &loop))
+    {
+      loops.push_back(loop);
+      exec[i].loop = loops.size();
+    }
+  }
+}
+
+void HovalaagCpu::Reset()
+{
+  memset(&state, 0, sizeof(state));
+}
+
+HovalaagStop HovalaagCpu::Step(HovalaagIo& io)
+{
+  const HovalaagOp& op = ops[state.PC];
+  HovalaagState& s = state;
+
+  // Every unit reads the values the registers held at the start of the cycle,
+  // as the non-blocking assignments in Hovalaag.v do.
+  uint16_t in = 0;
+  if (op.aOp == A_FROM_IN)
+  {
+    io.cycle = s.cycles;
+    if (!io.In(op.io, &in)) return HOVALAAG_INPUT_STALL;
+    in &= 0xfff;
+  }
+
+  uint32_t alu = HovalaagAlu(op.alu, s.A, s.B, s.C, s.F, op14Source, op15Source);
+  uint16_t M = alu & 0xfff;
+
+  uint16_t A = s.A;
+  switch (op.aOp)
+  {
+    case A_FROM_M: A = M; break;
+    case A_FROM_D: A = s.D; break;
+    case A_FROM_IN: A = in; break;
+  }
+
+  uint16_t B = s.B;
+  switch (op.bOp)
+  {
+    case B_FROM_M: B = M; break;
+    case B_FROM_A: B = s.A; break;
+    case B_FROM_K: B = op.K; break;
+  }
+
+  uint16_t D = op.dOp ? s.A : s.D;
+
+  uint16_t W = s.W;
+  switch (op.wOp)
+  {
+    case W_FROM_M: W = M; break;
+    case W_FROM_A: W = s.A; break;
+    case W_FROM_K: W = op.K; break;
+  }
+
+  uint8_t F = HovalaagFlag(op.fOp, s.F, alu);
+
+  uint16_t C = s.C;
+  switch (op.cOp)
+  {
+    case C_FROM_M: C = M; break;
+    case C_DEC:
+    case C_DECNZ: C = (s.C - 1) & 0xfff; break;
+  }
+
+  uint8_t PC;
+  if (op.cOp == C_DECNZ && s.C != 1)
+  {
+    // DECNZ overrides normal PC operation.
+    PC = op.L;
+  }
+  else
+  {
+    switch (op.pcOp)
+    {
+      default:
+      case PC_STEP: PC = s.PC + 1; break;
+      case PC_JMP: PC = op.L; break;
+      case PC_JMPT: PC = s.F ? op.L : s.PC + 1; break;
+      case PC_JMPF: PC = s.F ? s.PC + 1 : op.L; break;
+    }
+  }
+
+  // OUT <= W every cycle, the harness picks it up when OUT_valid is set
+  s.OUT = s.W;
+  if (op.out)
+  {
+    io.cycle = s.cycles;
+    io.Out(op.io, s.OUT);
+  }
+
+  s.A = A;
+  s.B = B;
+  s.C = C;
+  s.D = D;
+  s.W = W;
+  s.F = F;
+  s.PC = PC;
+  s.cycles++;
+  return (op.out && io.halt) ? HOVALAAG_HALTED : HOVALAAG_CYCLE_LIMIT;
+}
+
+// Sign extend the low 12 bits.  While running, registers are held sign extended
+// so the 13-bit ALU results are plain int arithmetic: newF is the sign of the
+// result, and {newF, M} is zero exactly when the result is zero.
+static inline int32_t Extend(int32_t v)
+{
+  return (int32_t)((uint32_t)v << 20) >> 20;
+}
+
+template <int ALU>
+static inline int32_t Alu(int32_t A, int32_t B, int32_t C, int32_t F, int32_t op14, int32_t op15)
+{
+  switch (ALU)
+  {
+    default:
+    case 0:  return 0;
+    case 1:  return -A;
+    case 2:  return B;
+    case 3:  return C;
+    case 4:  return ((A >> 1) & 0xfff) - ((A & 1) << 12);
+    case 5:  return A + B;
+    case 6:  return B - A;
+    case 7:  return A + B + F;
+    case 8:  return B - A - F;
+    case 9:  return A | B;
+    case 10: return A & B;
+    case 11: return A ^ B;
+    case 12: return ~A;
+    case 13: return A;
+    case 14: return op14;
+    case 15: return op15;
+  }
+}
+
+// The fast interpreter used by Run.
+//
+// Each instruction is executed by two handlers, reached by computed goto through
+// the stage1 and stage2 pointers in its dispatch table entry:
+//   Stage 1 is specialised on the ALU op and the A and B units (256 handlers).
+//     It reads the input if required, and computes M and the new A and B.
+//   Stage 2 is specialised on the C, W, F and PC units (256 handlers).
+//     It writes the output, updates the other registers and dispatches the
+//     instruction at the new PC.
+// With the unit ops as compile time constants each handler is only a few host
+// instructions, and the two indirect jumps are well predicted.
+// The new A and B are only committed at the end of stage 2, so everything in the
+// cycle sees the register values from the start of the cycle.
+
+#define STAGE1_B(X, alu, a) X(alu, a, 0) X(alu, a, 1) X(alu, a, 2) X(alu, a, 3)
+#define STAGE1_A(X, alu) STAGE1_B(X, alu, 0) STAGE1_B(X, alu, 1) STAGE1_B(X, alu, 2) STAGE1_B(X, alu, 3)
+#define STAGE1_ALL(X) \
+  STAGE1_A(X, 0) STAGE1_A(X, 1) STAGE1_A(X, 2) STAGE1_A(X, 3) \
+  STAGE1_A(X, 4) STAGE1_A(X, 5) STAGE1_A(X, 6) STAGE1_A(X, 7) \
+  STAGE1_A(X, 8) STAGE1_A(X, 9) STAGE1_A(X, 10) STAGE1_A(X, 11) \
+  STAGE1_A(X, 12) STAGE1_A(X, 13) STAGE1_A(X, 14) STAGE1_A(X, 15)
+
+#define STAGE2_PC(X, c, w, f) X(c, w, f, 0) X(c, w, f, 1) X(c, w, f, 2) X(c, w, f, 3)
+#define STAGE2_F(X, c, w) STAGE2_PC(X, c, w, 0) STAGE2_PC(X, c, w, 1) STAGE2_PC(X, c, w, 2) STAGE2_PC(X, c, w, 3)
+#define STAGE2_W(X, c) STAGE2_F(X, c, 0) STAGE2_F(X, c, 1) STAGE2_F(X, c, 2) STAGE2_F(X, c, 3)
+#define STAGE2_ALL(X) STAGE2_W(X, 0) STAGE2_W(X, 1) STAGE2_W(X, 2) STAGE2_W(X, 3)
+
+#define STAGE1_LABEL(alu, a, b) &&S1_##alu##_##a##_##b,
+#define STAGE2_LABEL(c, w, f, pc) &&S2_##c##_##w##_##f##_##pc,
+
+#define STAGE1_HANDLER(alu, a, b) \
+  S1_##alu##_##a##_##b: \
+  { \
+    int32_t in = 0; \
+    if (a == A_FROM_IN) \
+    { \
+      uint16_t v; \
+      io.cycle = startCycles + n; \
+      if (!io.In(e->io, &v)) \
+      { \
+        stop = HOVALAAG_INPUT_STALL; \
+        goto done; \
+      } \
+      in = Extend(v); \
+    } \
+    result = Alu<alu>(A, B, C, F, src14, src15); \
+    M = Extend(result); \
+    newA = (a == A_HOLD) ? A : (a == A_FROM_M) ? M : (a == A_FROM_D) ? D : in; \
+    newB = (b == B_HOLD) ? B : (b == B_FROM_M) ? M : (b == B_FROM_A) ? A : e->K; \
+    goto *e->stage2; \
+  }
+
+#define STAGE2_HANDLER(c, w, f, pc) \
+  S2_##c##_##w##_##f##_##pc: \
+  { \
+    OUT = W; \
+    if (e->out) \
+    { \
+      if (profiled) prof->Output(startCycles + n); \
+      io.cycle = startCycles + n; \
+      io.Out(e->io, OUT & 0xfff); \
+      if (io.halt) \
+      { \
+        end = n + 1; \
+        stop = HOVALAAG_HALTED; \
+      } \
+    } \
+    if (e->dOp) D = A; \
+    if (w == W_FROM_M) W = M; \
+    else if (w == W_FROM_A) W = A; \
+    else if (w == W_FROM_K) W = e->K; \
+    uint32_t newPC = (PC + 1) & 0xff; \
+    bool taken = true; \
+    const bool back = (c == C_DECNZ && C != 1); \
+    if (back) newPC = e->L; \
+    else if (pc == PC_JMP) newPC = e->L; \
+    else if (pc == PC_JMPT && F) newPC = e->L; \
+    else if (pc == PC_JMPF && !F) newPC = e->L; \
+    else taken = false; \
+    if (profiled) \
+    { \
+      prof->executed[PC]++; \
+      prof->taken[PC] += taken; \
+    } \
+    if (f == F_ZERO) F = (result == 0); \
+    else if (f == F_NEG) F = (result < 0); \
+    else if (f == F_POS) F = (result > 0); \
+    if (c == C_FROM_M) C = M; \
+    else if (c == C_DEC || c == C_DECNZ) C = Extend(C - 1); \
+    A = newA; \
+    B = newB; \
+    PC = newPC; \
+    if (++n == end) goto done; \
+    if (c == C_DECNZ && back && e->loop) \
+    { \
+      HovalaagLoop& loop = loopTable[e->loop - 1]; \
+      if (loop.wait) --loop.wait; \
+      else \
+      { \
+        int32_t regs[LOOP_ONE] = { A, B, C, D, W, F }; \
+        uint64_t skipped = SkipLoop(loop, regs, startCycles + n, end - n); \
+        if (skipped) \
+        { \
+          A = regs[LOOP_A]; \
+          B = regs[LOOP_B]; \
+          C = regs[LOOP_C]; \
+          D = regs[LOOP_D]; \
+          W = regs[LOOP_W]; \
+          n += skipped; \
+        } \
+      } \
+    } \
+    e = &table[PC]; \
+    goto *e->stage1; \
+  }
+
+// Skip passes of a loop whose DECNZ has just jumped back, see HovalaagLoop.
+// At least the last pass is left to the interpreter, and the skip stops a
+// pass short of the budget, so F and OUT are always set by a real pass before
+// Run returns.  regs holds A, B, C, D, W and F at the start of the next pass,
+// sign extended, cycle is the cycle it starts in.  Returns the cycles skipped.
+uint64_t HovalaagCpu::SkipLoop(HovalaagLoop& loop, int32_t* regs, uint64_t cycle, uint64_t budget)
+{
+  uint64_t passes = ((regs[LOOP_C] - 1) & 0xfff) + 1;   // The last of them exits
+  uint64_t fit = budget / loop.length;
+  if (passes < 2 || fit < 2) return 0;
+  uint64_t skip = (passes - 1 < fit - 1) ? passes - 1 : fit - 1;
+
+  if (loop.affine)
+  {
+    // Not worth the matrix products for a few passes
+    if (skip * loop.length < LoopSkipMinCycles) return 0;
+    if (!loop.powersReady)
+    {
+      for (int i = 1; i < HOVALAAG_LOOP_POWERS; ++i)
+      {
+        for (int r = 0; r < HOVALAAG_LOOP_VARS; ++r)
+        {
+          for (int v = 0; v < HOVALAAG_LOOP_VARS; ++v)
+          {
+            uint32_t sum = 0;
+            for (int j = 0; j < HOVALAAG_LOOP_VARS; ++j)
+              sum += loop.pass[i - 1][r][j] * loop.pass[i - 1][j][v];
+            loop.pass[i][r][v] = sum & 0xfff;
+          }
+        }
+      }
+      loop.powersReady = true;
+    }
+
+    uint32_t x[HOVALAAG_LOOP_VARS];
+    for (int r = 0; r < LOOP_ONE; ++r)
+      x[r] = regs[r] & 0xfff;
+    x[LOOP_ONE] = 1;
+    for (int i = 0; skip >> i; ++i)
+    {
+      if (!((skip >> i) & 1)) continue;
+      uint32_t y[HOVALAAG_LOOP_VARS];
+      for (int r = 0; r < HOVALAAG_LOOP_VARS; ++r)
+      {
+        uint32_t sum = 0;
+        for (int v = 0; v < HOVALAAG_LOOP_VARS; ++v)
+          sum += loop.pass[i][r][v] * x[v];
+        y[r] = sum & 0xfff;
+      }
+      memcpy(x, y, sizeof(x));
+    }
+    for (int r = 0; r < LOOP_F; ++r)
+      regs[r] = Extend(x[r]);
+  }
+  else
+  {
+    // Registers as they were at the start of the previous pass mean no pass
+    // changes them.  Passes are only compared now and then, less often each
+    // time they differ, as for most loops they always will.
+    if (loop.lastRun != runs)
+    {
+      loop.lastRun = runs;
+      loop.lastCycle = UINT64_MAX;
+      loop.misses = 0;
+    }
+    if (loop.lastCycle == UINT64_MAX || loop.lastCycle + loop.length != cycle)
+    {
+      loop.lastCycle = cycle;
+      loop.last[0] = regs[LOOP_A];
+      loop.last[1] = regs[LOOP_B];
+      loop.last[2] = regs[LOOP_D];
+      loop.last[3] = regs[LOOP_W];
+      loop.last[4] = regs[LOOP_F];
+      return 0;
+    }
+    if (loop.last[0] != regs[LOOP_A] || loop.last[1] != regs[LOOP_B] || loop.last[2] != regs[LOOP_D] ||
+        loop.last[3] != regs[LOOP_W] || loop.last[4] != regs[LOOP_F])
+    {
+      if (loop.misses < LoopMaxWait) ++loop.misses;
+      loop.wait = (1u << loop.misses) - 1;
+      loop.lastCycle = UINT64_MAX;
+      return 0;
+    }
+    regs[LOOP_C] = Extend(regs[LOOP_C] - skip);
+    loop.lastCycle = UINT64_MAX;
+  }
+
+  if (profile)
+  {
+    for (int i = loop.start; i <= loop.end; ++i)
+      profile->executed[i] += skip;
+    profile->taken[loop.end] += skip;
+  }
+  return skip * loop.length;
+}
+
+HovalaagStop HovalaagCpu::Run(HovalaagIo& io, uint64_t maxCycles)
+{
+  if (maxCycles == 0) return HOVALAAG_CYCLE_LIMIT;
+  return profile ? RunLoop<true>(io, maxCycles) : RunLoop<false>(io, maxCycles);
+}
+
+// The profiled and plain interpreters each have their own handlers
+template <bool profiled>
+HovalaagStop HovalaagCpu::RunLoop(HovalaagIo& io, uint64_t maxCycles)
+{
+  static const void* const stage1Labels[] = { STAGE1_ALL(STAGE1_LABEL) };
+  static const void* const stage2Labels[] = { STAGE2_ALL(STAGE2_LABEL) };
+
+  // Bind the dispatch table to the handlers on the first run after loading,
+  // or after running with the other interpreter
+  if (exec[0].stage1 != stage1Labels[exec[0].stage1Index])
+  {
+    for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+    {
+      exec[i].stage1 = stage1Labels[exec[i].stage1Index];
+      exec[i].stage2 = stage2Labels[exec[i].stage2Index];
+    }
+  }
+
+  int32_t A = Extend(state.A);
+  int32_t B = Extend(state.B);
+  int32_t C = Extend(state.C);
+  int32_t D = Extend(state.D);
+  int32_t W = Extend(state.W);
+  int32_t OUT = state.OUT;
+  int32_t F = state.F;
+  uint32_t PC = state.PC;
+  const int32_t src14 = Extend(op14Source);
+  const int32_t src15 = Extend(op15Source);
+  HovalaagProfile* const prof = profile;
+  const uint64_t startCycles = state.cycles;
+  ++runs;
+
+  int32_t result = 0;
+  int32_t M = 0;
+  int32_t newA = 0;
+  int32_t newB = 0;
+  uint64_t n = 0;
+  uint64_t end = maxCycles;
+  HovalaagStop stop = HOVALAAG_CYCLE_LIMIT;
+  const HovalaagExec* table = exec;
+  HovalaagLoop* const loopTable = loops.data();
+  const HovalaagExec* e = &table[PC];
+  goto *e->stage1;
+
+  STAGE1_ALL(STAGE1_HANDLER)
+  STAGE2_ALL(STAGE2_HANDLER)
+
+done:
+  state.A = A & 0xfff;
+  state.B = B & 0xfff;
+  state.C = C & 0xfff;
+  state.D = D & 0xfff;
+  state.W = W & 0xfff;
+  state.OUT = OUT & 0xfff;
+  state.F = F;
+  state.PC = PC;
+  state.cycles += n;
+  return stop;
+}
+
+HovalaagStreamIo::HovalaagStreamIo()
+{
+  for (int i = 0; i < 2; ++i)
+  {
+    in[i] = NULL;
+    inLen[i] = 0;
+  }
+  loopback = false;
+  stopAtEnd = false;
+  collect = true;
+  haltAfter = 0;
+  Reset();
+}
+
+void HovalaagStreamIo::SetInput(int port, const uint16_t* data, size_t len)
+{
+  in[port] = data;
+  inLen[port] = len;
+  inPos[port] = 0;
+}
+
+void HovalaagStreamIo::Reset()
+{
+  for (int i = 0; i < 2; ++i)
+  {
+    inPos[i] = 0;
+    out[i].clear();
+    outCount[i] = 0;
+  }
+  fifo.Reset();
+  halt = false;
+}
+
+int HovalaagLoadProgram(const char* fileName, uint32_t program[HOVALAAG_PROGRAM_SIZE])
+{
+  FILE* binFile = fopen(fileName, "rb");
+  if (!binFile)
+  {
+    printf("Failed to open %s\n", fileName);
+    return -1;
+  }
+
+  // Determine file size
+  fseek(binFile, 0, SEEK_END);
+  size_t fileSize = ftell(binFile);
+  fseek(binFile, 0, SEEK_SET);
+  if ((fileSize % 4) != 0 || fileSize > HOVALAAG_PROGRAM_SIZE * 4)
+  {
+    printf("Invalid program\n");
+    fclose(binFile);
+    return -1;
+  }
+
+  // a.out is little endian 32-bit words
+  uint8_t binaryProgram[HOVALAAG_PROGRAM_SIZE * 4];
+  size_t numRead = fread(binaryProgram, 1, fileSize, binFile);
+  fclose(binFile);
+  if (numRead != fileSize)
+  {
+    printf("Failed to read %s\n", fileName);
+    return -1;
+  }
+
+  int programSize = fileSize / 4;
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+  {
+    if (i < programSize)
+    {
+      const uint8_t* p = &binaryProgram[i * 4];
+      program[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    else
+      program[i] = 0;
+  }
+  return programSize;
+}
+
+bool HovalaagLoadInputText(const char* fileName, std::vector<uint16_t>* in1, std::vector<uint16_t>* in2)
+{
+  TextInput input;
+  if (!input.Open(fileName)) return false;
+
+  int16_t v1[InputBlockRows], v2[InputBlockRows];
+  for (;;)
+  {
+    int in2Len = 0;
+    int rows = input.Read(v1, in2 ? v2 : NULL, &in2Len, InputBlockRows);
+    for (int i = 0; i < rows; ++i)
+      in1->push_back(v1[i] & 0xfff);
+    for (int i = 0; i < in2Len; ++i)
+      in2->push_back(v2[i] & 0xfff);
+    if (rows < InputBlockRows) break;
+  }
+
+  input.ReportMalformed();
+  return true;
+}
+
+bool HovalaagLoadInputBin(const char* fileName, std::vector<uint16_t>* in1)
+{
+  FILE* inFile = fopen(fileName, "rb");
+  if (!inFile)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+
+  uint8_t buf[4096];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), inFile)) > 0)
+  {
+    for (size_t i = 0; i < len; ++i)
+      in1->push_back(buf[i]);
+  }
+
+  fclose(inFile);
+  return true;
+}
@@ -0,0 +1,403 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Software model of the Hovalaag CPU implemented in Hovalaag.v and HovalaagALU.v
+//
+// The model is cycle accurate: each cycle executes exactly one instruction,
+// just as one rising edge of clk does on the FPGA.
+//
+// The 256 entry program is predecoded into a dispatch table when it is loaded,
+// so the interpreter never has to pick apart the 32-bit instruction words
+// while it is running.
+//
+// All registers are held as 12-bit values in the low bits of a uint16_t.
+// The ALU works on 13-bit values, the extra top bit becomes the new F value.
+
+#ifndef HOVALAAG_H
+#define HOVALAAG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define HOVALAAG_PROGRAM_SIZE 256
+#define HOVALAAG_FIFO_SIZE 8192
+#define HOVALAAG_PROFILE_GAPS 64
+#define HOVALAAG_LOOP_VARS 7      // A, B, C, D, W, F and 1, see HovalaagLoop
+#define HOVALAAG_LOOP_POWERS 12   // A DECNZ loop runs at most 4096 passes
+
+// Unit operations, values are as encoded in the instruction word (see Hovalaag.v)
+enum
+{
+  A_HOLD = 0, A_FROM_M = 1, A_FROM_D = 2, A_FROM_IN = 3,
+  B_HOLD = 0, B_FROM_M = 1, B_FROM_A = 2, B_FROM_K = 3,
+  C_HOLD = 0, C_FROM_M = 1, C_DEC = 2, C_DECNZ = 3,
+  W_HOLD = 0, W_FROM_M = 1, W_FROM_A = 2, W_FROM_K = 3,
+  F_HOLD = 0, F_ZERO = 1, F_NEG = 2, F_POS = 3,
+  PC_STEP = 0, PC_JMP = 1, PC_JMPT = 2, PC_JMPF = 3,
+};
+
+// Predecoded instruction
+struct HovalaagOp
+{
+  uint8_t alu;
+  uint8_t aOp;
+  uint8_t bOp;
+  uint8_t cOp;
+  uint8_t dOp;
+  uint8_t wOp;
+  uint8_t fOp;
+  uint8_t pcOp;
+  uint8_t out;      // OUT_valid for the next cycle
+  uint8_t io;       // IO_select: 0 for IN1/OUT1, 1 for IN2/OUT2
+  uint8_t L;
+  uint16_t K;
+};
+
+// Dispatch table entry built from a HovalaagOp when the program is loaded.
+// The stage pointers are the interpreter's handlers for the instruction,
+// see HovalaagCpu::Run.
+struct HovalaagExec
+{
+  const void* stage1;
+  const void* stage2;
+  int32_t K;        // Sign extended
+  uint16_t stage1Index;
+  uint16_t stage2Index;
+  uint8_t L;
+  uint8_t dOp;
+  uint8_t out;
+  uint8_t io;
+  uint16_t loop;    // For a DECNZ closing a loop Run can skip, its index in loops + 1
+};
+
+// Architectural state, matching the registers in Hovalaag.v
+struct HovalaagState
+{
+  uint16_t A;
+  uint16_t B;
+  uint16_t C;
+  uint16_t D;
+  uint16_t W;
+  uint16_t OUT;     // The OUT register: always W from the previous cycle
+  uint8_t F;
+  uint8_t PC;
+  uint64_t cycles;
+};
+
+// Reasons for HovalaagCpu::Run to return
+enum HovalaagStop
+{
+  HOVALAAG_CYCLE_LIMIT,
+  HOVALAAG_INPUT_STALL,
+  HOVALAAG_HALTED,        // HovalaagIo::halt was set by Out
+};
+
+// The ports the CPU is wired to.
+class HovalaagIo
+{
+public:
+  HovalaagIo() : halt(false), cycle(0) {}
+  virtual ~HovalaagIo() {}
+
+  // Read the word waiting on IN1 (port 0) or IN2 (port 1) and advance.
+  // Return false if no input is available, the CPU then stalls before
+  // executing the instruction, as it does when in1_rdy is raised on the board.
+  virtual bool In(int port, uint16_t* value) = 0;
+
+  // A word has been written to OUT1 (port 0) or OUT2 (port 1).
+  virtual void Out(int port, uint16_t value) = 0;
+
+  // Set by Out to stop the CPU once the instruction writing the output
+  // has completed, for example when all the expected outputs have arrived.
+  bool halt;
+
+  // The cycle being executed, set by the CPU before each call to In or Out
+  // (HovalaagCpu::Run, Step and translated programs, but not HovalaagBatch).
+  uint64_t cycle;
+};
+
+// Sign extend a 12-bit register value to the 13 bits used by the ALU
+static inline uint32_t HovalaagExtend(uint32_t v)
+{
+  return v | ((v & 0x800) << 1);
+}
+
+// The ALU function from HovalaagALU.v.  Operands are 12-bit register values,
+// the result is 13 bits: {newF, M}.
+static inline uint32_t HovalaagAlu(uint32_t op, uint32_t A, uint32_t B, uint32_t C, uint32_t F,
+                                   uint32_t op14Source, uint32_t op15Source)
+{
+  uint32_t a = HovalaagExtend(A);
+  uint32_t b = HovalaagExtend(B);
+  uint32_t r;
+  switch (op)
+  {
+    default:
+    case 0:  r = 0; break;
+    case 1:  r = -a; break;
+    case 2:  r = b; break;
+    case 3:  r = HovalaagExtend(C); break;
+    case 4:  r = (a >> 1) | ((a & 1) << 12); break;
+    case 5:  r = a + b; break;
+    case 6:  r = b - a; break;
+    case 7:  r = a + b + F; break;
+    case 8:  r = b - a - F; break;
+    case 9:  r = a | b; break;
+    case 10: r = a & b; break;
+    case 11: r = a ^ b; break;
+    case 12: r = ~a; break;
+    case 13: r = a; break;
+    case 14: r = HovalaagExtend(op14Source); break;
+    case 15: r = HovalaagExtend(op15Source); break;
+  }
+  return r & 0x1fff;
+}
+
+// New value of F given the F unit operation and the 13-bit ALU result
+static inline uint32_t HovalaagFlag(uint32_t fOp, uint32_t F, uint32_t r)
+{
+  switch (fOp)
+  {
+    default:
+    case F_HOLD: return F;
+    case F_ZERO: return r == 0;
+    case F_NEG:  return r >> 12;
+    case F_POS:  return (r >> 12) == 0 && (r & 0xfff) != 0;
+  }
+}
+
+// Decode one 32-bit instruction word
+HovalaagOp HovalaagDecode(uint32_t instr);
+
+// A loop closed by a DECNZ jumping back to L, whose body from L to the DECNZ
+// has no other branches, doesn't read or write IN or OUT, and only changes C
+// with the DECNZ.  Every pass then does the same thing to the registers, and
+// the number of passes left is given by C.  When Run takes the DECNZ back it
+// can skip most of the remaining passes, finishing the loop on the
+// interpreter so F and OUT are right when it exits.
+//
+// If every register the body reads before writing is an affine function
+// (mod 4096) of the registers at the start of the pass, a pass is a matrix
+// on (A, B, C, D, W, F, 1) and k passes are its kth power.  Registers the body
+// writes before reading don't matter at the start of a pass, and are left as
+// they are.  The DECNZ counts as reading W, which OUT takes, and F if it has a
+// conditional jump for when the loop exits.  Otherwise, if the body doesn't
+// read C, a pass that leaves the registers as they were will do so every
+// time, which catches delay loops.
+struct HovalaagLoop
+{
+  uint8_t start;
+  uint8_t end;                // The DECNZ
+  uint16_t length;
+  bool affine;
+  bool powersReady;           // Powers are worked out the first time they are needed
+  uint16_t pass[HOVALAAG_LOOP_POWERS][HOVALAAG_LOOP_VARS][HOVALAAG_LOOP_VARS];  // pass[i] is 2^i passes
+
+  // For loops that aren't affine, the registers at the start of a pass to
+  // compare with the next
+  uint32_t lastRun;
+  uint64_t lastCycle;
+  int32_t last[5];            // A, B, D, W, F
+  uint32_t wait;              // Passes to go before the next comparison
+  uint32_t misses;
+};
+
+// Execution counts gathered by HovalaagCpu::Run while HovalaagCpu::profile is set.
+// They add up over runs until Reset.
+//
+// Reads and writes per instruction aren't counted separately: an instruction
+// reading IN1/IN2 or writing OUT1/OUT2 does so every time it is executed.
+struct HovalaagProfile
+{
+  uint64_t executed[HOVALAAG_PROGRAM_SIZE];
+  uint64_t taken[HOVALAAG_PROGRAM_SIZE];    // Jumps to L, by DECNZ or the J unit
+  uint64_t outputs;
+  uint64_t lastOutput;                      // Cycle the last output was written in
+  uint64_t gapMin;                          // Cycles between consecutive outputs
+  uint64_t gapMax;
+  uint64_t gapTotal;
+  uint64_t gaps[HOVALAAG_PROFILE_GAPS];     // Histogram of the gaps, the last entry
+                                            // counts every longer gap
+
+  HovalaagProfile() { Reset(); }
+  void Reset() { memset(this, 0, sizeof(*this)); }
+
+  // An output was written in the given cycle (counting from 0)
+  void Output(uint64_t cycle)
+  {
+    if (outputs++)
+    {
+      uint64_t gap = cycle - lastOutput;
+      if (gapMin == 0 || gap < gapMin) gapMin = gap;
+      if (gap > gapMax) gapMax = gap;
+      gapTotal += gap;
+      gaps[gap < HOVALAAG_PROFILE_GAPS ? gap : HOVALAAG_PROFILE_GAPS - 1]++;
+    }
+    lastOutput = cycle;
+  }
+};
+
+class HovalaagCpu
+{
+public:
+  HovalaagCpu();
+
+  // Predecode a program.  Words beyond numWords are NOPs, as left by Inject.
+  void Load(const uint32_t* program, int numWords);
+
+  // Equivalent to holding rst high for a cycle
+  void Reset();
+
+  // Execute exactly one instruction.  This is a plain decode and execute of
+  // the instruction, useful as a reference for the fast interpreter.
+  HovalaagStop Step(HovalaagIo& io);
+
+  // Execute up to maxCycles instructions using the fast interpreter.
+  // Passes of DECNZ loops are skipped where possible, see HovalaagLoop, with
+  // the cycle count and profile as if they had run.
+  // If profile is set the executions are counted in it, with a separate
+  // copy of the interpreter so runs without a profile don't pay for it.
+  HovalaagStop Run(HovalaagIo& io, uint64_t maxCycles);
+
+  HovalaagState state;
+  HovalaagProfile* profile;
+
+  // Values used for the results of ALU ops 14 and 15 (alu_op_14_source / alu_op_15_source)
+  uint16_t op14Source;
+  uint16_t op15Source;
+
+  uint32_t program[HOVALAAG_PROGRAM_SIZE];
+  HovalaagOp ops[HOVALAAG_PROGRAM_SIZE];
+  HovalaagExec exec[HOVALAAG_PROGRAM_SIZE];
+  std::vector<HovalaagLoop> loops;
+
+private:
+  template <bool profiled> HovalaagStop RunLoop(HovalaagIo& io, uint64_t maxCycles);
+  void FindLoops();
+  uint64_t SkipLoop(HovalaagLoop& loop, int32_t* regs, uint64_t cycle, uint64_t budget);
+
+  uint32_t runs;    // Run calls, so a loop's last pass isn't taken from an earlier one
+};
+
+// Model of Fifo.v: 8192 words, reads as zero when empty.
+// Writing to a full FIFO wraps and loses the contents, as in the hardware.
+struct HovalaagFifo
+{
+  uint16_t data[HOVALAAG_FIFO_SIZE];
+  uint16_t inAddr;
+  uint16_t outAddr;
+
+  void Reset() { inAddr = outAddr = 0; }
+  bool Empty() const { return inAddr == outAddr; }
+  size_t Count() const { return (inAddr - outAddr) & (HOVALAAG_FIFO_SIZE - 1); }
+  void Write(uint16_t v)
+  {
+    data[inAddr] = v;
+    inAddr = (inAddr + 1) & (HOVALAAG_FIFO_SIZE - 1);
+  }
+  uint16_t Read()
+  {
+    if (Empty()) return 0;
+    uint16_t v = data[outAddr];
+    outAddr = (outAddr + 1) & (HOVALAAG_FIFO_SIZE - 1);
+    return v;
+  }
+};
+
+// Ports wired up as on the Basys2 harness.
+//
+// IN1 and IN2 stream from arrays, reading past the end gives zero (the
+// terminator and fill that Inject writes) unless stopAtEnd is set, in which
+// case the CPU stalls as it does when InjectS has no more data to send.
+//
+// If loopback is set, IN2 is instead fed from OUT2 through a model of Fifo.v,
+// as in the default configuration of hovalaag_top.v.
+//
+// Outputs are collected in out[0] (OUT1) and out[1] (OUT2).  If haltAfter is
+// non-zero the CPU is halted once that many words have been output in total.
+class HovalaagStreamIo : public HovalaagIo
+{
+public:
+  HovalaagStreamIo();
+
+  void SetInput(int port, const uint16_t* data, size_t len);
+  void Reset();
+
+  virtual bool In(int port, uint16_t* value);
+  virtual void Out(int port, uint16_t value);
+
+  const uint16_t* in[2];
+  size_t inLen[2];
+  size_t inPos[2];
+  bool loopback;
+  bool stopAtEnd;
+  bool collect;
+  uint64_t haltAfter;
+  HovalaagFifo fifo;
+  std::vector<uint16_t> out[2];
+  uint64_t outCount[2];
+};
+
+// Defined here so HovalaagBatch can call them directly
+inline bool HovalaagStreamIo::In(int port, uint16_t* value)
+{
+  if (port == 1 && loopback)
+  {
+    *value = fifo.Read();
+    return true;
+  }
+
+  if (inPos[port] < inLen[port])
+  {
+    *value = in[port][inPos[port]++];
+    return true;
+  }
+
+  if (stopAtEnd) return false;
+  *value = 0;
+  return true;
+}
+
+inline void HovalaagStreamIo::Out(int port, uint16_t value)
+{
+  outCount[port]++;
+  if (collect) out[port].push_back(value);
+  if (port == 1 && loopback) fifo.Write(value);
+  if (haltAfter && outCount[0] + outCount[1] >= haltAfter) halt = true;
+}
+
+// Read an a.out image as written by the assembler.
+// Returns the number of instructions, or -1 if the file is not a valid program.
+int HovalaagLoadProgram(const char* fileName, uint32_t program[HOVALAAG_PROGRAM_SIZE]);
+
+// Read input.txt in the same format as Inject: columns of decimal values,
+// the first two columns are IN1 and IN2, any remaining columns are ignored.
+// The file is parsed by Inject's TextInput, so blank lines are skipped and
+// malformed ones reported and skipped, just as when it goes to the board.
+bool HovalaagLoadInputText(const char* fileName, std::vector<uint16_t>* in1, std::vector<uint16_t>* in2);
+
+// Read input.bin in the same format as InjectS: each byte is one word for IN1.
+bool HovalaagLoadInputBin(const char* fileName, std::vector<uint16_t>* in1);
+
+// A program translated to C++ by HovalaagTranslate and compiled into the binary.
+// run behaves as HovalaagCpu::Run, the CPU must have the same program loaded as
+// it is used to finish the last partial block when the cycle limit is reached.
+struct HovalaagTranslatedProgram
+{
+  const uint32_t* program;
+  int programSize;
+  HovalaagStop (*run)(HovalaagCpu& cpu, HovalaagIo& io, uint64_t maxCycles);
+};
+
+// Write C++ source for a program, defining a HovalaagTranslatedProgram named symbol.
+bool HovalaagTranslate(const uint32_t* program, int numWords, const char* symbol, FILE* out);
+
+// Sign extend a 12-bit value for printing
+static inline int HovalaagSigned(uint16_t v)
+{
+  return (int16_t)(v << 4) >> 4;
+}
+
+#endif
@@ -0,0 +1,458 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Lockstep execution of many Hovalaag CPUs, see HovalaagBatch.h
+
+#include <string.h>
+#include <algorithm>
+#include <typeinfo>
+
+#include "HovalaagBatch.h"
+
+// Steps each group runs for between repacks
+#define SliceSteps 1024
+
+typedef uint16_t HovalaagULanes __attribute__((vector_size(HOVALAAG_BATCH_LANES * sizeof(uint16_t))));
+
+static inline HovalaagLanes Broadcast(int v)
+{
+  HovalaagLanes r = {};
+  return r + (int16_t)v;
+}
+
+// Sign extend the low 12 bits of each lane
+static inline HovalaagLanes Extend(HovalaagLanes v)
+{
+  return (HovalaagLanes)((HovalaagULanes)v << 4) >> 4;
+}
+
+static inline bool Any(HovalaagLanes m)
+{
+  uint64_t w[sizeof(m) / sizeof(uint64_t)];
+  memcpy(w, &m, sizeof(m));
+  uint64_t x = 0;
+  for (size_t i = 0; i < sizeof(m) / sizeof(uint64_t); ++i) x |= w[i];
+  return x != 0;
+}
+
+// One bit per lane of a mask
+static inline uint64_t LaneBits(HovalaagLanes m)
+{
+  uint64_t bits = 0;
+  for (int l = 0; l < HOVALAAG_BATCH_LANES; ++l)
+    bits |= (uint64_t)(m[l] & 1) << l;
+  return bits;
+}
+
+static inline bool LaneIn(HovalaagBatch::Job& job, int port, uint16_t* value)
+{
+  if (job.stream) return job.stream->HovalaagStreamIo::In(port, value);
+  return job.io->In(port, value);
+}
+
+static inline void LaneOut(HovalaagBatch::Job& job, int port, uint16_t value)
+{
+  if (job.stream) job.stream->HovalaagStreamIo::Out(port, value);
+  else job.io->Out(port, value);
+}
+
+static inline HovalaagLanes Alu(int op, HovalaagLanes A, HovalaagLanes B, HovalaagLanes C, HovalaagLanes F,
+                                HovalaagLanes op14, HovalaagLanes op15)
+{
+  switch (op)
+  {
+    default:
+    case 0:  return Broadcast(0);
+    case 1:  return -A;
+    case 2:  return B;
+    case 3:  return C;
+    case 4:  return ((A >> 1) & 0xfff) - ((A & 1) << 12);
+    case 5:  return A + B;
+    case 6:  return B - A;
+    case 7:  return A + B + F;
+    case 8:  return B - A - F;
+    case 9:  return A | B;
+    case 10: return A & B;
+    case 11: return A ^ B;
+    case 12: return ~A;
+    case 13: return A;
+    case 14: return op14;
+    case 15: return op15;
+  }
+}
+
+// Registers of a group while it is running
+struct Regs
+{
+  HovalaagLanes A, B, C, D, W, OUT, F, PC;
+};
+
+template <bool MASKED>
+static inline void Set(HovalaagLanes& reg, HovalaagLanes m, HovalaagLanes v)
+{
+  reg = MASKED ? (m ? v : reg) : v;
+}
+
+// Execute the instruction for the lanes in m, or every lane if not MASKED.
+// PC is only updated if setPC, the caller follows the PC while the lanes agree.
+// Returns the lanes taking a conditional jump.
+template <bool MASKED>
+static inline __attribute__((always_inline))
+HovalaagLanes Execute(const HovalaagOp& op, int pc, HovalaagLanes m, HovalaagLanes in, Regs& s, bool setPC,
+                      HovalaagLanes src14, HovalaagLanes src15)
+{
+  const HovalaagLanes zero = Broadcast(0);
+  const HovalaagLanes one = Broadcast(1);
+
+  // Every unit reads the register values from the start of the cycle
+  HovalaagLanes r = Alu(op.alu, s.A, s.B, s.C, s.F, src14, src15);
+  HovalaagLanes M = Extend(r);
+  HovalaagLanes K = Broadcast(HovalaagSigned(op.K));
+  HovalaagLanes L = Broadcast(op.L);
+
+  HovalaagLanes newA = s.A;
+  switch (op.aOp)
+  {
+    case A_FROM_M: newA = M; break;
+    case A_FROM_D: newA = s.D; break;
+    case A_FROM_IN: newA = in; break;
+  }
+
+  HovalaagLanes newB = s.B;
+  switch (op.bOp)
+  {
+    case B_FROM_M: newB = M; break;
+    case B_FROM_A: newB = s.A; break;
+    case B_FROM_K: newB = K; break;
+  }
+
+  HovalaagLanes newW = s.W;
+  switch (op.wOp)
+  {
+    case W_FROM_M: newW = M; break;
+    case W_FROM_A: newW = s.A; break;
+    case W_FROM_K: newW = K; break;
+  }
+
+  HovalaagLanes newF = s.F;
+  switch (op.fOp)
+  {
+    case F_ZERO: newF = (r == zero) & one; break;
+    case F_NEG: newF = (r < zero) & one; break;
+    case F_POS: newF = (r > zero) & one; break;
+  }
+
+  HovalaagLanes newC = s.C;
+  switch (op.cOp)
+  {
+    case C_FROM_M: newC = M; break;
+    case C_DEC:
+    case C_DECNZ: newC = Extend(s.C - one); break;
+  }
+
+  HovalaagLanes taken = zero;
+  if (op.pcOp == PC_JMPT) taken = (s.F != zero);
+  else if (op.pcOp == PC_JMPF) taken = (s.F == zero);
+  if (op.cOp == C_DECNZ && op.pcOp != PC_JMP) taken |= (s.C != one);
+
+  if (setPC)
+  {
+    int next = (pc + 1) & 0xff;
+    Set<MASKED>(s.PC, m, (op.pcOp == PC_JMP) ? L : (taken ? L : Broadcast(next)));
+  }
+  Set<MASKED>(s.OUT, m, s.W);
+  if (op.dOp) Set<MASKED>(s.D, m, s.A);
+  Set<MASKED>(s.A, m, newA);
+  Set<MASKED>(s.B, m, newB);
+  Set<MASKED>(s.C, m, newC);
+  Set<MASKED>(s.W, m, newW);
+  Set<MASKED>(s.F, m, newF);
+  return taken;
+}
+
+// Steps until the first of the live lanes reaches its limit
+static int Budget(HovalaagLanes live, HovalaagLanes executed, HovalaagLanes limit)
+{
+  int budget = SliceSteps;
+  for (int l = 0; l < HOVALAAG_BATCH_LANES; ++l)
+    if (live[l] && limit[l] - executed[l] < budget) budget = limit[l] - executed[l];
+  return budget;
+}
+
+HovalaagBatch::HovalaagBatch()
+{
+  op14Source = 0;
+  op15Source = 0;
+  groupSteps = 0;
+  laneSteps = 0;
+  repacks = 0;
+  Load(NULL, 0);
+}
+
+void HovalaagBatch::Load(const uint32_t* program, int numWords)
+{
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+    ops[i] = HovalaagDecode((i < numWords) ? program[i] : 0);
+}
+
+int HovalaagBatch::Add(HovalaagIo* io)
+{
+  Job job;
+  memset(&job, 0, sizeof(job));
+  job.io = io;
+  job.stop = HOVALAAG_CYCLE_LIMIT;
+  jobs.push_back(job);
+  return jobs.size() - 1;
+}
+
+int HovalaagBatch::Add(HovalaagStreamIo* io)
+{
+  int i = Add(static_cast<HovalaagIo*>(io));
+  // A class derived from HovalaagStreamIo may override In and Out
+  if (typeid(*io) == typeid(HovalaagStreamIo)) jobs[i].stream = io;
+  return i;
+}
+
+void HovalaagBatch::Clear()
+{
+  jobs.clear();
+  groups.clear();
+}
+
+void HovalaagBatch::Run(uint64_t maxCycles)
+{
+  std::vector<uint64_t> target(jobs.size());
+  for (size_t i = 0; i < jobs.size(); ++i)
+  {
+    jobs[i].stop = HOVALAAG_CYCLE_LIMIT;
+    jobs[i].running = (maxCycles > 0);
+    target[i] = jobs[i].state.cycles + maxCycles;
+  }
+
+  for (;;)
+  {
+    // Pack the running jobs into groups, sorted by PC so lanes that are at
+    // the same point in the program share a group
+    std::vector<int> running;
+    for (size_t i = 0; i < jobs.size(); ++i)
+      if (jobs[i].running) running.push_back(i);
+    if (running.empty()) break;
+    std::stable_sort(running.begin(), running.end(),
+                     [this](int a, int b) { return jobs[a].state.PC < jobs[b].state.PC; });
+
+    groups.resize((running.size() + HOVALAAG_BATCH_LANES - 1) / HOVALAAG_BATCH_LANES);
+    for (size_t n = 0; n < groups.size(); ++n)
+    {
+      HovalaagBatchGroup& g = groups[n];
+      memset(&g, 0, sizeof(g));
+      for (int l = 0; l < HOVALAAG_BATCH_LANES; ++l)
+      {
+        size_t i = n * HOVALAAG_BATCH_LANES + l;
+        if (i >= running.size())
+        {
+          g.job[l] = -1;
+          continue;
+        }
+        int j = running[i];
+        const HovalaagState& s = jobs[j].state;
+        g.job[l] = j;
+        g.A[l] = HovalaagSigned(s.A);
+        g.B[l] = HovalaagSigned(s.B);
+        g.C[l] = HovalaagSigned(s.C);
+        g.D[l] = HovalaagSigned(s.D);
+        g.W[l] = HovalaagSigned(s.W);
+        g.OUT[l] = s.OUT;
+        g.F[l] = s.F;
+        g.PC[l] = s.PC;
+        g.live[l] = -1;
+        g.limit[l] = std::min<uint64_t>(target[j] - s.cycles, SliceSteps);
+      }
+      g.divergent = true;
+    }
+    ++repacks;
+
+    for (size_t n = 0; n < groups.size(); ++n)
+      RunGroup(groups[n]);
+
+    // Write the lanes back to their jobs
+    for (size_t n = 0; n < groups.size(); ++n)
+    {
+      const HovalaagBatchGroup& g = groups[n];
+      for (int l = 0; l < HOVALAAG_BATCH_LANES; ++l)
+      {
+        if (g.job[l] < 0) continue;
+        Job& job = jobs[g.job[l]];
+        job.state.A = g.A[l] & 0xfff;
+        job.state.B = g.B[l] & 0xfff;
+        job.state.C = g.C[l] & 0xfff;
+        job.state.D = g.D[l] & 0xfff;
+        job.state.W = g.W[l] & 0xfff;
+        job.state.OUT = g.OUT[l] & 0xfff;
+        job.state.F = g.F[l];
+        job.state.PC = g.PC[l];
+        job.state.cycles += g.executed[l];
+        laneSteps += g.executed[l];
+        if (job.stop != HOVALAAG_CYCLE_LIMIT || job.state.cycles == target[g.job[l]])
+          job.running = false;
+      }
+    }
+  }
+  groups.clear();
+}
+
+// Run a group for up to SliceSteps steps.
+//
+// While all the live lanes are at the same PC (!divergent) the PC is followed
+// as a scalar, and the count of steps is only added to each lane's executed
+// count when the lanes split up, a lane stalls or halts, or the first lane
+// reaches its limit (budget).  With every lane live the registers are written
+// without masking.
+void HovalaagBatch::RunGroup(HovalaagBatchGroup& g)
+{
+  Regs s = { g.A, g.B, g.C, g.D, g.W, g.OUT, g.F, g.PC };
+  HovalaagLanes live = g.live;
+  HovalaagLanes executed = g.executed;
+  const HovalaagLanes limit = g.limit;
+  const HovalaagLanes full = Broadcast(-1);
+  const HovalaagLanes src14 = Broadcast(HovalaagSigned(op14Source));
+  const HovalaagLanes src15 = Broadcast(HovalaagSigned(op15Source));
+  bool divergent = g.divergent;
+  bool allLive = false;
+  int pc = 0;
+  int pending = 0;
+  int budget = 0;
+
+  for (int step = 0; step < SliceSteps; ++step)
+  {
+    HovalaagLanes m;
+    if (divergent)
+    {
+      // Follow the lowest PC of the live lanes
+      int minPC = HOVALAAG_PROGRAM_SIZE;
+      int firstPC = -1;
+      divergent = false;
+      for (int l = 0; l < HOVALAAG_BATCH_LANES; ++l)
+      {
+        if (!live[l]) continue;
+        if (firstPC < 0) firstPC = s.PC[l];
+        else if (s.PC[l] != firstPC) divergent = true;
+        if (s.PC[l] < minPC) minPC = s.PC[l];
+      }
+      if (firstPC < 0) break;
+      pc = minPC;
+      if (divergent)
+        m = live & (s.PC == Broadcast(pc));
+      else
+      {
+        // Back together
+        m = live;
+        allLive = !Any(live ^ full);
+        budget = Budget(live, executed, limit);
+      }
+    }
+    else
+    {
+      if (!Any(live)) break;
+      m = live;
+    }
+
+    const HovalaagOp& op = ops[pc];
+    ++groupSteps;
+
+    HovalaagLanes in = {};
+    if (op.aOp == A_FROM_IN)
+    {
+      for (uint64_t bits = LaneBits(m); bits; bits &= bits - 1)
+      {
+        int l = __builtin_ctzll(bits);
+        uint16_t v;
+        Job& job = jobs[g.job[l]];
+        if (LaneIn(job, op.io, &v))
+          in[l] = HovalaagSigned(v);
+        else
+        {
+          // This lane stops here, as HovalaagCpu::Run does on a stall
+          if (!divergent)
+          {
+            executed += Broadcast(pending) & live;
+            s.PC = live ? Broadcast(pc) : s.PC;
+            pending = 0;
+          }
+          job.stop = HOVALAAG_INPUT_STALL;
+          m[l] = 0;
+          live[l] = 0;
+          allLive = false;
+        }
+      }
+      if (!Any(m)) continue;
+    }
+
+    // Lanes whose io asks to halt after this instruction
+    HovalaagLanes halting = {};
+    bool anyHalting = false;
+    if (op.out)
+    {
+      for (uint64_t bits = LaneBits(m); bits; bits &= bits - 1)
+      {
+        int l = __builtin_ctzll(bits);
+        Job& job = jobs[g.job[l]];
+        LaneOut(job, op.io, s.W[l] & 0xfff);
+        if (job.io->halt)
+        {
+          job.stop = HOVALAAG_HALTED;
+          halting[l] = -1;
+          anyHalting = true;
+        }
+      }
+    }
+
+    if (divergent)
+    {
+      Execute<true>(op, pc, m, in, s, true, src14, src15);
+      executed -= m;
+      live &= ~(executed == limit) & ~halting;
+      continue;
+    }
+
+    HovalaagLanes taken = allLive ? Execute<false>(op, pc, m, in, s, false, src14, src15)
+                                  : Execute<true>(op, pc, m, in, s, false, src14, src15);
+    ++pending;
+
+    int next = (pc + 1) & 0xff;
+    bool conditional = op.pcOp == PC_JMPT || op.pcOp == PC_JMPF || (op.cOp == C_DECNZ && op.pcOp != PC_JMP);
+    bool split = false;
+    if (op.pcOp == PC_JMP) pc = op.L;
+    else if (!conditional) pc = next;
+    else if (!Any(m & taken)) pc = next;
+    else if (!Any(m & ~taken)) pc = op.L;
+    else split = true;
+
+    if (split || anyHalting || --budget == 0)
+    {
+      executed += Broadcast(pending) & live;
+      pending = 0;
+      s.PC = live ? (split ? (taken ? Broadcast(op.L) : Broadcast(next)) : Broadcast(pc)) : s.PC;
+      live &= ~(executed == limit) & ~halting;
+      allLive = !Any(live ^ full);
+      budget = Budget(live, executed, limit);
+      divergent = split;
+    }
+  }
+
+  if (!divergent)
+  {
+    executed += Broadcast(pending) & live;
+    s.PC = live ? Broadcast(pc) : s.PC;
+  }
+
+  g.A = s.A;
+  g.B = s.B;
+  g.C = s.C;
+  g.D = s.D;
+  g.W = s.W;
+  g.OUT = s.OUT;
+  g.F = s.F;
+  g.PC = s.PC;
+  g.live = live;
+  g.executed = executed;
+  g.divergent = divergent;
+}
@@ -0,0 +1,96 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Run one Hovalaag program on many independent sets of inputs in lockstep.
+//
+// The CPUs are packed into groups of HOVALAAG_BATCH_LANES, with each register
+// of the group held in one vector (GCC vector extensions, so the same code
+// compiles to SSE2, AVX2 or AVX-512 depending on ARCHFLAGS in the Makefile).
+// Each step executes one instruction for every lane of a group whose PC
+// matches the group's current PC, the other lanes are masked off.  When lanes diverge the group
+// follows the lowest PC, so lanes leaving a loop early wait for the others at
+// the loop exit.
+//
+// Every SliceSteps steps all the CPUs are repacked, sorted by PC and with the
+// finished ones removed, so groups stay full of lanes that agree on the PC.
+
+#ifndef HOVALAAG_BATCH_H
+#define HOVALAAG_BATCH_H
+
+#include <vector>
+
+#include "Hovalaag.h"
+
+// One vector register of 16-bit lanes for the instruction set being compiled for.
+// Everything including this header must be built with the same flags.
+#ifndef HOVALAAG_BATCH_LANES
+#if defined(__AVX512BW__)
+#define HOVALAAG_BATCH_LANES 32
+#elif defined(__AVX2__)
+#define HOVALAAG_BATCH_LANES 16
+#else
+#define HOVALAAG_BATCH_LANES 8
+#endif
+#endif
+
+// Registers of one group, each lane holds a 12-bit value sign extended to 16 bits
+typedef int16_t HovalaagLanes __attribute__((vector_size(HOVALAAG_BATCH_LANES * sizeof(int16_t))));
+
+struct HovalaagBatchGroup
+{
+  HovalaagLanes A, B, C, D, W, OUT, F, PC;
+  HovalaagLanes live;       // -1 for lanes that are still running
+  HovalaagLanes executed;   // Instructions executed by each lane in this slice
+  HovalaagLanes limit;      // Instructions each lane may execute in this slice
+  int job[HOVALAAG_BATCH_LANES];
+  bool divergent;           // Live lanes don't all have the same PC
+};
+
+class HovalaagBatch
+{
+public:
+  HovalaagBatch();
+
+  void Load(const uint32_t* program, int numWords);
+
+  // Add a CPU, starting from reset, reading and writing through io.
+  // Returns the index of the job.
+  int Add(HovalaagIo* io);
+
+  // As above.  HovalaagStreamIo is called directly rather than through the
+  // virtual functions, which matters as every lane does its own IO.
+  int Add(HovalaagStreamIo* io);
+  void Clear();
+
+  // Run every job until it has executed maxCycles instructions in total,
+  // or stalled on input.  Each job ends in exactly the state HovalaagCpu::Run
+  // would leave it in.
+  void Run(uint64_t maxCycles);
+
+  struct Job
+  {
+    HovalaagIo* io;
+    HovalaagStreamIo* stream;   // io, if it is a HovalaagStreamIo
+    HovalaagState state;
+    HovalaagStop stop;
+    bool running;
+  };
+  std::vector<Job> jobs;
+
+  uint16_t op14Source;
+  uint16_t op15Source;
+
+  // Statistics: steps of a whole group, and instructions actually executed
+  // by lanes.  laneSteps / (groupSteps * HOVALAAG_BATCH_LANES) is the fraction
+  // of the vector width in use.
+  uint64_t groupSteps;
+  uint64_t laneSteps;
+  uint64_t repacks;
+
+private:
+  void RunGroup(HovalaagBatchGroup& g);
+
+  HovalaagOp ops[HOVALAAG_PROGRAM_SIZE];
+  std::vector<HovalaagBatchGroup> groups;
+};
+
+#endif
@@ -0,0 +1,275 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Checkpoints of a long run, see HovalaagCheckpoint.h
+//
+// The file is the header followed by records, each a tag byte and a struct
+// written as it is in memory, so it is read back on the same kind of host:
+//   'P'  a FIFO page, written before the first checkpoint using it
+//   'C'  a checkpoint, its pages given by number
+//   'E'  where the run ended
+// A file cut short while a run was being recorded can still be read up to
+// its last whole record.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "HovalaagCheckpoint.h"
+
+#define CheckpointMagic "HOVCKPT1"
+
+struct CheckpointRecord
+{
+  HovalaagState state;
+  uint64_t inPos[2];
+  uint64_t outCount[2];
+  uint16_t fifoIn;
+  uint16_t fifoOut;
+  uint32_t pages[HOVALAAG_CHECKPOINT_PAGES];    // Page number + 1, or 0 for none
+};
+
+struct EndRecord
+{
+  uint64_t cycles;
+  int32_t stop;
+};
+
+HovalaagCheckpoints::HovalaagCheckpoints()
+{
+  memset(&header, 0, sizeof(header));
+  pagesSaved = 0;
+  ended = false;
+  endCycles = 0;
+  endStop = HOVALAAG_CYCLE_LIMIT;
+  file = NULL;
+  writeFailed = false;
+}
+
+HovalaagCheckpoints::~HovalaagCheckpoints()
+{
+  if (file) fclose(file);
+}
+
+bool HovalaagCheckpoints::Write(const void* data, size_t size)
+{
+  if (file && fwrite(data, 1, size, file) != size) writeFailed = true;
+  return !writeFailed;
+}
+
+bool HovalaagCheckpoints::Begin(const HovalaagCpu& cpu, const HovalaagStreamIo& io, const char* inputFileName,
+                                uint64_t interval, const char* fileName)
+{
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CheckpointMagic, sizeof(header.magic));
+  memcpy(header.program, cpu.program, sizeof(header.program));
+  header.programSize = HOVALAAG_PROGRAM_SIZE;
+  header.op14Source = cpu.op14Source;
+  header.op15Source = cpu.op15Source;
+  header.loopback = io.loopback;
+  header.stopAtEnd = io.stopAtEnd;
+  header.haltAfter = io.haltAfter;
+  header.interval = interval ? interval : 1;
+  header.inLen[0] = io.inLen[0];
+  header.inLen[1] = io.inLen[1];
+  snprintf(header.inputFileName, sizeof(header.inputFileName), "%s", inputFileName);
+
+  checkpoints.clear();
+  pagesSaved = 0;
+  ended = false;
+  writeFailed = false;
+  if (fileName)
+  {
+    file = fopen(fileName, "wb");
+    if (!file)
+    {
+      printf("Failed to open %s\n", fileName);
+      return false;
+    }
+    Write(&header, sizeof(header));
+  }
+  Take(cpu, io);
+  return !writeFailed;
+}
+
+void HovalaagCheckpoints::Take(const HovalaagCpu& cpu, const HovalaagStreamIo& io)
+{
+  HovalaagCheckpoint c;
+  CheckpointRecord record;
+  memset(&record, 0, sizeof(record));
+  c.state = record.state = cpu.state;
+  for (int port = 0; port < 2; ++port)
+  {
+    c.inPos[port] = record.inPos[port] = io.inPos[port];
+    c.outCount[port] = record.outCount[port] = io.outCount[port];
+  }
+  c.fifoIn = record.fifoIn = io.fifo.inAddr;
+  c.fifoOut = record.fifoOut = io.fifo.outAddr;
+
+  // The pages holding the words in the FIFO
+  bool live[HOVALAAG_CHECKPOINT_PAGES] = { false };
+  size_t remaining = io.fifo.Count();
+  for (size_t addr = io.fifo.outAddr; remaining;)
+  {
+    size_t run = std::min<size_t>(remaining, HOVALAAG_CHECKPOINT_PAGE - addr % HOVALAAG_CHECKPOINT_PAGE);
+    live[addr / HOVALAAG_CHECKPOINT_PAGE] = true;
+    addr = (addr + run) & (HOVALAAG_FIFO_SIZE - 1);
+    remaining -= run;
+  }
+
+  const HovalaagCheckpoint* last = checkpoints.empty() ? NULL : &checkpoints.back();
+  for (int p = 0; p < HOVALAAG_CHECKPOINT_PAGES; ++p)
+  {
+    if (!live[p]) continue;
+    const uint16_t* data = io.fifo.data + p * HOVALAAG_CHECKPOINT_PAGE;
+    if (last && last->fifo[p] && !memcmp(last->fifo[p]->data, data, sizeof(last->fifo[p]->data)))
+    {
+      c.fifo[p] = last->fifo[p];
+    }
+    else
+    {
+      std::shared_ptr<HovalaagFifoPage> page(new HovalaagFifoPage);
+      page->id = pagesSaved++;
+      memcpy(page->data, data, sizeof(page->data));
+      Write("P", 1);
+      Write(page.get(), sizeof(*page));
+      c.fifo[p] = page;
+    }
+    record.pages[p] = c.fifo[p]->id + 1;
+  }
+
+  Write("C", 1);
+  Write(&record, sizeof(record));
+  if (file) fflush(file);
+  checkpoints.push_back(c);
+}
+
+bool HovalaagCheckpoints::End(const HovalaagCpu& cpu, HovalaagStop stop)
+{
+  ended = true;
+  endCycles = cpu.state.cycles;
+  endStop = stop;
+  if (!file) return true;
+
+  EndRecord record = { endCycles, (int32_t)stop };
+  Write("E", 1);
+  Write(&record, sizeof(record));
+  if (fclose(file) != 0) writeFailed = true;
+  file = NULL;
+  return !writeFailed;
+}
+
+bool HovalaagCheckpoints::Load(const char* fileName)
+{
+  FILE* f = fopen(fileName, "rb");
+  if (!f)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, CheckpointMagic, sizeof(header.magic)) ||
+      header.programSize < 0 || header.programSize > HOVALAAG_PROGRAM_SIZE || header.interval == 0)
+  {
+    printf("%s is not a checkpoint file\n", fileName);
+    fclose(f);
+    return false;
+  }
+  header.inputFileName[sizeof(header.inputFileName) - 1] = 0;
+
+  checkpoints.clear();
+  ended = false;
+  std::vector<std::shared_ptr<const HovalaagFifoPage>> pages;
+  bool ok = true;
+  int tag;
+  while (ok && !ended && (tag = fgetc(f)) != EOF)
+  {
+    if (tag == 'P')
+    {
+      std::shared_ptr<HovalaagFifoPage> page(new HovalaagFifoPage);
+      if (fread(page.get(), sizeof(*page), 1, f) != 1) break;
+      ok = page->id == pages.size();
+      pages.push_back(page);
+    }
+    else if (tag == 'C')
+    {
+      CheckpointRecord record;
+      if (fread(&record, sizeof(record), 1, f) != 1) break;
+      HovalaagCheckpoint c;
+      c.state = record.state;
+      for (int port = 0; port < 2; ++port)
+      {
+        c.inPos[port] = record.inPos[port];
+        c.outCount[port] = record.outCount[port];
+      }
+      c.fifoIn = record.fifoIn;
+      c.fifoOut = record.fifoOut;
+      for (int p = 0; p < HOVALAAG_CHECKPOINT_PAGES && ok; ++p)
+      {
+        if (record.pages[p] > pages.size()) ok = false;
+        else if (record.pages[p]) c.fifo[p] = pages[record.pages[p] - 1];
+      }
+      checkpoints.push_back(c);
+    }
+    else if (tag == 'E')
+    {
+      EndRecord record;
+      if (fread(&record, sizeof(record), 1, f) != 1) break;
+      ended = true;
+      endCycles = record.cycles;
+      endStop = (HovalaagStop)record.stop;
+    }
+    else
+      ok = false;
+  }
+  fclose(f);
+  pagesSaved = pages.size();
+
+  if (!ok || checkpoints.empty())
+  {
+    printf("%s is %s\n", fileName, ok ? "empty" : "corrupt");
+    return false;
+  }
+  return true;
+}
+
+const HovalaagCheckpoint& HovalaagCheckpoints::Find(uint64_t cycle) const
+{
+  size_t lo = 0, hi = checkpoints.size();
+  while (hi - lo > 1)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (checkpoints[mid].state.cycles <= cycle) lo = mid;
+    else hi = mid;
+  }
+  return checkpoints[lo];
+}
+
+void HovalaagCheckpoints::Setup(HovalaagCpu& cpu, HovalaagStreamIo& io) const
+{
+  cpu.Load(header.program, header.programSize);
+  cpu.op14Source = header.op14Source;
+  cpu.op15Source = header.op15Source;
+  io.loopback = header.loopback;
+  io.stopAtEnd = header.stopAtEnd;
+  io.haltAfter = header.haltAfter;
+}
+
+void HovalaagCheckpoints::Restore(const HovalaagCheckpoint& c, HovalaagCpu& cpu, HovalaagStreamIo& io)
+{
+  cpu.state = c.state;
+  for (int port = 0; port < 2; ++port)
+  {
+    io.inPos[port] = c.inPos[port];
+    io.outCount[port] = c.outCount[port];
+    io.out[port].clear();
+  }
+  io.fifo.inAddr = c.fifoIn;
+  io.fifo.outAddr = c.fifoOut;
+  for (int p = 0; p < HOVALAAG_CHECKPOINT_PAGES; ++p)
+  {
+    if (c.fifo[p])
+      memcpy(io.fifo.data + p * HOVALAAG_CHECKPOINT_PAGE, c.fifo[p]->data, sizeof(c.fifo[p]->data));
+  }
+  io.halt = false;
+}
@@ -0,0 +1,112 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Checkpoints of a long run of HovalaagCpu on HovalaagStreamIo, so the run
+// can be picked up again at any cycle without starting from reset.
+//
+// A checkpoint holds the registers, F, PC, OUT and cycle count, how far each
+// input has been read, how many words each output has had, and the words in
+// the loopback FIFO.  The FIFO is kept in pages of HOVALAAG_CHECKPOINT_PAGE
+// words that are shared between checkpoints: a checkpoint only keeps the
+// pages holding words that are in the FIFO, and reuses the previous
+// checkpoint's copy of a page that hasn't changed, so a checkpoint is a few
+// hundred bytes plus the pages written since the last one.
+//
+// Checkpoints are taken every interval cycles, starting at cycle 0, and can
+// be written to a file as they are taken, with the program and the way the
+// IO was set up.  HovalaagReplay reads the file back, restores the last
+// checkpoint before a cycle and runs forward to it.
+
+#ifndef HOVALAAG_CHECKPOINT_H
+#define HOVALAAG_CHECKPOINT_H
+
+#include <memory>
+#include <vector>
+
+#include "Hovalaag.h"
+
+#define HOVALAAG_CHECKPOINT_PAGE 256
+#define HOVALAAG_CHECKPOINT_PAGES (HOVALAAG_FIFO_SIZE / HOVALAAG_CHECKPOINT_PAGE)
+
+struct HovalaagFifoPage
+{
+  uint32_t id;      // Order the page was saved in, its number in the file
+  uint16_t data[HOVALAAG_CHECKPOINT_PAGE];
+};
+
+struct HovalaagCheckpoint
+{
+  HovalaagState state;
+  uint64_t inPos[2];
+  uint64_t outCount[2];
+  uint16_t fifoIn;
+  uint16_t fifoOut;
+  std::shared_ptr<const HovalaagFifoPage> fifo[HOVALAAG_CHECKPOINT_PAGES];  // NULL where nothing is in the FIFO
+};
+
+// How the recorded run was set up, the start of a checkpoint file
+struct HovalaagCheckpointHeader
+{
+  char magic[8];
+  uint32_t program[HOVALAAG_PROGRAM_SIZE];
+  int32_t programSize;
+  uint16_t op14Source;
+  uint16_t op15Source;
+  uint8_t loopback;
+  uint8_t stopAtEnd;
+  uint64_t haltAfter;
+  uint64_t interval;
+  uint64_t inLen[2];
+  char inputFileName[256];
+};
+
+class HovalaagCheckpoints
+{
+public:
+  HovalaagCheckpoints();
+  ~HovalaagCheckpoints();
+
+  // Start recording a run from the CPU's current state, taking the first
+  // checkpoint.  If fileName isn't NULL the checkpoints are written to it as
+  // they are taken.  Returns false if the file can't be written.
+  bool Begin(const HovalaagCpu& cpu, const HovalaagStreamIo& io, const char* inputFileName, uint64_t interval,
+             const char* fileName);
+
+  // Cycles the CPU can run before the next checkpoint is due
+  uint64_t CyclesToNext(const HovalaagCpu& cpu) const { return header.interval - cpu.state.cycles % header.interval; }
+
+  void Take(const HovalaagCpu& cpu, const HovalaagStreamIo& io);
+
+  // Note where the run ended and close the file
+  bool End(const HovalaagCpu& cpu, HovalaagStop stop);
+
+  // Read a checkpoint file.  Prints the problem and returns false if it can't.
+  bool Load(const char* fileName);
+
+  // The last checkpoint at or before cycle
+  const HovalaagCheckpoint& Find(uint64_t cycle) const;
+
+  // Load the program and set up the IO as for the recorded run, apart from
+  // the input data
+  void Setup(HovalaagCpu& cpu, HovalaagStreamIo& io) const;
+
+  // Put the CPU and IO back as they were at a checkpoint.  The CPU must have
+  // the program loaded and the IO the inputs of the recorded run.
+  static void Restore(const HovalaagCheckpoint& c, HovalaagCpu& cpu, HovalaagStreamIo& io);
+
+  HovalaagCheckpointHeader header;
+  std::vector<HovalaagCheckpoint> checkpoints;
+  uint64_t pagesSaved;
+
+  // Set by End, or by Load if the recording finished
+  bool ended;
+  uint64_t endCycles;
+  HovalaagStop endStop;
+
+private:
+  bool Write(const void* data, size_t size);
+
+  FILE* file;
+  bool writeFailed;
+};
+
+#endif
@@ -0,0 +1,752 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Run a Hovalaag program on the software model of the CPU.
+//
+// Reads the program from "a.out" and input data from "input.txt", in the
+// same formats as Inject.  If the input file name ends in ".bin" it is read
+// as binary data to stream into IN1, as InjectS does.
+//
+// Outputs are printed one per line, as "OUT1 <value>" or "OUT2 <value>".
+//
+// Given a list of input files after the options, the program is run on each
+// of them at once with HovalaagBatch, and the outputs are printed per file.
+//
+// HovalaagEmu -P <source file> profiles the run: it counts how often each
+// instruction is executed, its jumps and its reads and writes, and prints the
+// hottest loops and the source annotated with the counts.  The source is
+// assembled with the assembler library for its labels and line numbers.
+//
+// HovalaagEmu -N <topology file> runs a network of CPUs linked by FIFOs,
+// each on its own thread, see HovalaagNetwork.h.  The outputs of the network
+// are printed port by port once it has finished, followed by statistics for
+// each CPU and link.
+//
+// HovalaagEmu -k <file> takes a checkpoint of the run every -K cycles and
+// writes them to the file, see HovalaagCheckpoint.h.  HovalaagReplay reads
+// them back to go to any cycle of the run.
+//
+// HovalaagEmu -T <file> writes a binary trace of the run, every cycle's
+// changes to the registers and its reads and writes, see HovalaagTrace.h.
+// HovalaagTraceDiff finds the first cycle where two traces differ.  The run
+// is stepped a cycle at a time to record it, so it is much slower.
+//
+// HovalaagEmu -t writes the program out as C++.  Building HovalaagEmu with
+// HOVALAAG_AOT defined and that source linked in (make aot) gives a binary
+// that runs the translated program instead of the interpreter.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+#include "Hovalaag.h"
+#include "HovalaagBatch.h"
+#include "HovalaagCheckpoint.h"
+#include "HovalaagNetwork.h"
+#include "HovalaagTrace.h"
+#include "vls.h"
+
+#define BinFileName "a.out"
+#define InputFileName "input.txt"
+#define DefaultMaxCycles 100000000ULL
+#define BenchmarkCycles 1000000000ULL
+#define DiffChunkCycles 65536
+#define DefaultCheckpointInterval (1ULL << 24)
+
+#ifdef HOVALAAG_AOT
+extern const HovalaagTranslatedProgram HovalaagTranslated;
+#endif
+
+static void Usage()
+{
+  printf("Usage: HovalaagEmu [options] [input files to run as a batch]\n"
+         "  -p <file>  Program image (default " BinFileName ")\n"
+         "  -i <file>  Input data, .txt columns or .bin bytes (default " InputFileName ")\n"
+         "  -l         Loop OUT2 back to IN2 through the FIFO, as hovalaag_top.v\n"
+         "  -s         Stop when IN1 is read past the end of the input\n"
+         "  -c <n>     Maximum number of cycles (default %llu)\n"
+         "  -n <n>     Halt after n words have been output\n"
+         "  -q         Don't print outputs\n"
+         "  -r         Print the register state on exit\n"
+         "  -b         Benchmark: rerun from reset and report instructions per second\n"
+         "  -d         Check the outputs and state against the plain interpreter (Step)\n"
+         "  -t <file>  Translate the program to C++ and exit\n"
+         "  -P <file>  Profile the run and list this source of the program with the counts\n"
+         "  -N <file>  Run the network of CPUs in this topology file (-s, -c and -q apply)\n"
+         "  -k <file>  Write checkpoints of the run to this file, for HovalaagReplay\n"
+         "  -K <n>     Cycles between checkpoints (default %llu)\n"
+         "  -T <file>  Write a binary trace of every cycle to this file, for HovalaagTraceDiff\n",
+         DefaultMaxCycles, DefaultCheckpointInterval);
+}
+
+// Prints outputs as they are written, so OUT1 and OUT2 stay interleaved
+class PrintingIo : public HovalaagStreamIo
+{
+public:
+  virtual void Out(int port, uint16_t value)
+  {
+    printf("OUT%d %d\n", port + 1, HovalaagSigned(value));
+    HovalaagStreamIo::Out(port, value);
+  }
+};
+
+// Records every cycle when trace isn't NULL
+static HovalaagStop RunCpu(HovalaagCpu& cpu, HovalaagIo& io, uint64_t maxCycles, HovalaagTraceWriter* trace = NULL)
+{
+  if (trace) return trace->Run(cpu, io, maxCycles);
+#ifdef HOVALAAG_AOT
+  // The translated program isn't profiled
+  if (cpu.profile) return cpu.Run(io, maxCycles);
+  return HovalaagTranslated.run(cpu, io, maxCycles);
+#else
+  return cpu.Run(io, maxCycles);
+#endif
+}
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool EndsWith(const char* s, const char* suffix)
+{
+  size_t len = strlen(s);
+  size_t suffixLen = strlen(suffix);
+  return len >= suffixLen && !strcmp(s + len - suffixLen, suffix);
+}
+
+static bool ReadFile(const char* fileName, std::string* text)
+{
+  FILE* f = fopen(fileName, "rb");
+  if (!f)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    text->append(buf, n);
+  fclose(f);
+  return true;
+}
+
+static bool LoadInput(const char* fileName, std::vector<uint16_t>* in1, std::vector<uint16_t>* in2)
+{
+  if (EndsWith(fileName, ".bin"))
+    return HovalaagLoadInputBin(fileName, in1);
+  else
+    return HovalaagLoadInputText(fileName, in1, in2);
+}
+
+static const char* StopName(HovalaagStop stop)
+{
+  switch (stop)
+  {
+    case HOVALAAG_INPUT_STALL: return "Input stalled";
+    case HOVALAAG_HALTED: return "Halted";
+    default: return "Stopped";
+  }
+}
+
+static bool SameState(const HovalaagState& a, const HovalaagState& b)
+{
+  return a.A == b.A && a.B == b.B && a.C == b.C && a.D == b.D && a.W == b.W &&
+         a.OUT == b.OUT && a.F == b.F && a.PC == b.PC && a.cycles == b.cycles;
+}
+
+static void PrintState(const char* name, const HovalaagState& s)
+{
+  printf("%-6s PC=%02x A=%03x B=%03x C=%03x D=%03x W=%03x OUT=%03x F=%d cycles=%llu\n", name,
+         s.PC, s.A, s.B, s.C, s.D, s.W, s.OUT, s.F, (unsigned long long)s.cycles);
+}
+
+// Run the program on cpu and on a second CPU using the plain Step interpreter,
+// in chunks of DiffChunkCycles, checking that the OUT1 and OUT2 streams and
+// the state are identical after each chunk.
+static bool Differential(HovalaagCpu& cpu, HovalaagStreamIo& io, uint64_t maxCycles)
+{
+  HovalaagCpu ref;
+  ref.Load(cpu.program, HOVALAAG_PROGRAM_SIZE);
+  ref.op14Source = cpu.op14Source;
+  ref.op15Source = cpu.op15Source;
+
+  HovalaagStreamIo refIo;
+  for (int port = 0; port < 2; ++port)
+    refIo.SetInput(port, io.in[port], io.inLen[port]);
+  refIo.loopback = io.loopback;
+  refIo.stopAtEnd = io.stopAtEnd;
+  refIo.haltAfter = io.haltAfter;
+  io.collect = true;
+  refIo.collect = true;
+
+  uint64_t outBase[2] = { 0, 0 };
+  HovalaagStop stop = HOVALAAG_CYCLE_LIMIT;
+  while (cpu.state.cycles < maxCycles && stop == HOVALAAG_CYCLE_LIMIT)
+  {
+    uint64_t chunk = maxCycles - cpu.state.cycles;
+    if (chunk > DiffChunkCycles) chunk = DiffChunkCycles;
+
+    stop = RunCpu(cpu, io, chunk);
+    HovalaagStop refStop = HOVALAAG_CYCLE_LIMIT;
+    for (uint64_t i = 0; i < chunk && refStop == HOVALAAG_CYCLE_LIMIT; ++i)
+      refStop = ref.Step(refIo);
+
+    for (int port = 0; port < 2; ++port)
+    {
+      const std::vector<uint16_t>& got = io.out[port];
+      const std::vector<uint16_t>& expected = refIo.out[port];
+      for (size_t i = 0; i < got.size() || i < expected.size(); ++i)
+      {
+        if (i >= got.size() || i >= expected.size() || got[i] != expected[i])
+        {
+          printf("OUT%d differs at output %llu: ", port + 1, (unsigned long long)(outBase[port] + i));
+          if (i < got.size()) printf("got %d, ", HovalaagSigned(got[i]));
+          else printf("got nothing, ");
+          if (i < expected.size()) printf("expected %d\n", HovalaagSigned(expected[i]));
+          else printf("expected nothing\n");
+          PrintState("Run", cpu.state);
+          PrintState("Step", ref.state);
+          return false;
+        }
+      }
+      outBase[port] += got.size();
+      io.out[port].clear();
+      refIo.out[port].clear();
+    }
+
+    if (stop != refStop || !SameState(cpu.state, ref.state))
+    {
+      printf("State differs after %llu cycles%s\n", (unsigned long long)ref.state.cycles,
+             (stop != refStop) ? ", stopped for different reasons" : "");
+      PrintState("Run", cpu.state);
+      PrintState("Step", ref.state);
+      return false;
+    }
+  }
+
+  printf("Identical: %llu cycles, OUT1 %llu words, OUT2 %llu words\n", (unsigned long long)cpu.state.cycles,
+         (unsigned long long)outBase[0], (unsigned long long)outBase[1]);
+  return true;
+}
+
+// Assemble the source of the program being profiled, trying each of the
+// assembler's modes until one gives the same image, for its labels and lines.
+static bool AssembleProfiled(vls_assembler* as, const std::string& text, const uint32_t* program,
+                             vls_program* assembled)
+{
+  static const int modes[] = { 0, VLS_PACK, VLS_OPTIMIZE, VLS_PACK | VLS_OPTIMIZE };
+  vls_error error;
+  error.line = 0;
+  for (int flags : modes)
+  {
+    if (!vls_assemble_flags(as, text.data(), text.size(), flags, assembled, &error)) break;
+    bool same = true;
+    for (int i = 0; i < HOVALAAG_PROGRAM_SIZE && same; ++i)
+      same = program[i] == (i < assembled->num_instructions ? assembled->image[i] : 0);
+    if (same) return true;
+  }
+  if (error.line)
+    printf("ASM error, line %d: %s\n", error.line, error.message);
+  return false;
+}
+
+// Profile counts for an address range
+struct ProfileCounts
+{
+  uint64_t cycles;
+  uint64_t in[2];
+  uint64_t out[2];
+};
+
+static ProfileCounts CountRange(const HovalaagCpu& cpu, const HovalaagProfile& profile, int first, int last)
+{
+  ProfileCounts counts = { 0, { 0, 0 }, { 0, 0 } };
+  for (int pc = first; pc <= last; ++pc)
+  {
+    const HovalaagOp& op = cpu.ops[pc];
+    uint64_t n = profile.executed[pc];
+    counts.cycles += n;
+    if (op.aOp == A_FROM_IN) counts.in[op.io] += n;
+    if (op.out) counts.out[op.io] += n;
+  }
+  return counts;
+}
+
+static bool IsBranch(const HovalaagOp& op)
+{
+  return op.cOp == C_DECNZ || op.pcOp != PC_STEP;
+}
+
+// A loop seen while profiling: the addresses from a jump target to the last
+// jump back to it
+struct ProfileLoop
+{
+  int header;
+  int latch;
+  uint64_t cycles;
+};
+
+static void PrintLoopName(const vls_program& assembled, int pc)
+{
+  if (assembled.label[pc]) printf("%s", assembled.label[pc]);
+  else printf("line %d", assembled.line[pc]);
+}
+
+// Print the profile as a summary, the hottest loops and a listing of the
+// source annotated with the counts for each instruction
+static void PrintProfile(const HovalaagCpu& cpu, const HovalaagProfile& profile, const vls_program& assembled,
+                         const std::string& text)
+{
+  ProfileCounts total = CountRange(cpu, profile, 0, HOVALAAG_PROGRAM_SIZE - 1);
+  printf("\nProfile of %llu cycles\n", (unsigned long long)total.cycles);
+  printf("IN1 read %llu, IN2 read %llu, OUT1 written %llu, OUT2 written %llu\n",
+         (unsigned long long)total.in[0], (unsigned long long)total.in[1],
+         (unsigned long long)total.out[0], (unsigned long long)total.out[1]);
+  if (profile.outputs > 1)
+  {
+    uint64_t gaps = profile.outputs - 1;
+    printf("Cycles between outputs: min %llu, mean %.2f, max %llu\n", (unsigned long long)profile.gapMin,
+           (double)profile.gapTotal / gaps, (unsigned long long)profile.gapMax);
+
+    // The most common gaps, largest count first
+    bool shown[HOVALAAG_PROFILE_GAPS] = { false };
+    printf("  most common:");
+    for (int i = 0; i < 5; ++i)
+    {
+      int best = -1;
+      for (int gap = 1; gap < HOVALAAG_PROFILE_GAPS; ++gap)
+        if (!shown[gap] && profile.gaps[gap] && (best < 0 || profile.gaps[gap] > profile.gaps[best])) best = gap;
+      if (best < 0) break;
+      shown[best] = true;
+      printf(" %s%d (%.1f%%)", best == HOVALAAG_PROFILE_GAPS - 1 ? ">=" : "", best,
+             100.0 * profile.gaps[best] / gaps);
+    }
+    printf("\n");
+  }
+
+  // Every jump back to an earlier address closes a loop, as does running off
+  // the end of the program back to address 0.  Jumps back to the same address
+  // are one loop, ending at the last of them.
+  std::vector<ProfileLoop> loops;
+  for (int pc = 0; pc < HOVALAAG_PROGRAM_SIZE; ++pc)
+  {
+    const HovalaagOp& op = cpu.ops[pc];
+    int header = -1;
+    if (profile.taken[pc] && IsBranch(op) && op.L <= pc) header = op.L;
+    else if (pc == HOVALAAG_PROGRAM_SIZE - 1 && profile.executed[pc] > profile.taken[pc]) header = 0;
+    if (header < 0) continue;
+
+    size_t i = 0;
+    while (i < loops.size() && loops[i].header != header) ++i;
+    if (i == loops.size()) loops.push_back(ProfileLoop { header, pc, 0 });
+    else loops[i].latch = pc;
+  }
+  for (ProfileLoop& loop : loops)
+    loop.cycles = CountRange(cpu, profile, loop.header, loop.latch).cycles;
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const ProfileLoop& a, const ProfileLoop& b) { return a.cycles > b.cycles; });
+
+  if (!loops.empty())
+  {
+    printf("\nHot loops\n");
+    printf("     cycles       %%  iterations  cycles/iter  in/iter  out/iter  loop\n");
+    for (size_t i = 0; i < loops.size() && i < 10; ++i)
+    {
+      const ProfileLoop& loop = loops[i];
+      ProfileCounts counts = CountRange(cpu, profile, loop.header, loop.latch);
+      uint64_t iterations = profile.executed[loop.header];
+      if (iterations == 0) iterations = 1;
+      printf("%11llu  %5.1f%%  %10llu  %11.2f  %7.2f  %8.2f  ", (unsigned long long)loop.cycles,
+             total.cycles ? 100.0 * loop.cycles / total.cycles : 0.0, (unsigned long long)iterations,
+             (double)loop.cycles / iterations, (double)(counts.in[0] + counts.in[1]) / iterations,
+             (double)(counts.out[0] + counts.out[1]) / iterations);
+      PrintLoopName(assembled, loop.header);
+      if (loop.latch < assembled.num_instructions)
+        printf(" (lines %d-%d)\n", assembled.line[loop.header], assembled.line[loop.latch]);
+      else
+        printf(" (line %d to the end of the program)\n", assembled.line[loop.header]);
+    }
+  }
+
+  // Each instruction's counts go on the source line it came from
+  std::vector<int> pcOfLine;
+  for (int pc = 0; pc < assembled.num_instructions; ++pc)
+  {
+    int line = assembled.line[pc];
+    if (line >= (int)pcOfLine.size()) pcOfLine.resize(line + 1, -1);
+    pcOfLine[line] = pc;
+  }
+
+  printf("\n    executed       taken   not taken  ports\n");
+  size_t pos = 0;
+  for (int line = 1; pos < text.size(); ++line)
+  {
+    size_t end = text.find('\n', pos);
+    if (end == std::string::npos) end = text.size();
+    size_t len = end - pos;
+    if (len && text[pos + len - 1] == '\r') --len;
+
+    int pc = line < (int)pcOfLine.size() ? pcOfLine[line] : -1;
+    if (pc < 0)
+    {
+      printf("%*s", 48, "");
+    }
+    else
+    {
+      const HovalaagOp& op = cpu.ops[pc];
+      uint64_t n = profile.executed[pc];
+      printf("%12llu", (unsigned long long)n);
+      if (IsBranch(op))
+        printf("%12llu%12llu", (unsigned long long)profile.taken[pc], (unsigned long long)(n - profile.taken[pc]));
+      else
+        printf("%24s", "");
+      char ports[16] = "";
+      if (op.aOp == A_FROM_IN) snprintf(ports, sizeof(ports), "IN%d", op.io + 1);
+      if (op.out) snprintf(ports + strlen(ports), sizeof(ports) - strlen(ports), "%sOUT%d", ports[0] ? "," : "", op.io + 1);
+      printf("  %-10s", ports);
+    }
+    printf("%4d  %.*s\n", line, (int)len, text.data() + pos);
+    pos = end + 1;
+  }
+}
+
+struct BatchOptions
+{
+  bool loopback;
+  bool stopAtEnd;
+  bool quiet;
+  bool printRegs;
+  bool benchmark;
+  bool differential;
+  uint64_t haltAfter;
+};
+
+// Run the program on each input file with HovalaagBatch
+static int RunBatch(const uint32_t* program, int programSize, int numFiles, char* fileNames[],
+                    const BatchOptions& options, uint64_t maxCycles)
+{
+  std::vector<std::vector<uint16_t> > in1(numFiles), in2(numFiles);
+  std::vector<HovalaagStreamIo> ios(numFiles);
+  for (int i = 0; i < numFiles; ++i)
+  {
+    if (!LoadInput(fileNames[i], &in1[i], &in2[i])) return 4;
+    HovalaagStreamIo& io = ios[i];
+    io.SetInput(0, in1[i].data(), in1[i].size());
+    io.SetInput(1, in2[i].data(), in2[i].size());
+    io.loopback = options.loopback;
+    io.stopAtEnd = options.stopAtEnd;
+    io.haltAfter = options.haltAfter;
+  }
+
+  HovalaagBatch batch;
+  batch.Load(program, programSize);
+  for (int i = 0; i < numFiles; ++i)
+    batch.Add(&ios[i]);
+
+  double start = Now();
+  batch.Run(maxCycles);
+  double batchTime = Now() - start;
+
+  if (options.differential || options.benchmark)
+  {
+    // Run each input again, one after another on the interpreter
+    HovalaagCpu cpu;
+    cpu.Load(program, programSize);
+    HovalaagStreamIo io;
+    io.loopback = options.loopback;
+    io.stopAtEnd = options.stopAtEnd;
+    io.haltAfter = options.haltAfter;
+    double sequentialTime = 0;
+    int mismatches = 0;
+    for (int i = 0; i < numFiles; ++i)
+    {
+      cpu.Reset();
+      io.Reset();
+      io.SetInput(0, in1[i].data(), in1[i].size());
+      io.SetInput(1, in2[i].data(), in2[i].size());
+      start = Now();
+      HovalaagStop stop = RunCpu(cpu, io, maxCycles);
+      sequentialTime += Now() - start;
+
+      const HovalaagBatch::Job& job = batch.jobs[i];
+      if (options.differential &&
+          (stop != job.stop || !SameState(cpu.state, job.state) || io.out[0] != ios[i].out[0] || io.out[1] != ios[i].out[1]))
+      {
+        printf("%s differs\n", fileNames[i]);
+        PrintState("Run", cpu.state);
+        PrintState("Batch", job.state);
+        ++mismatches;
+      }
+    }
+
+    if (options.differential)
+      printf("%d of %d input sets identical\n", numFiles - mismatches, numFiles);
+    if (options.benchmark)
+    {
+      printf("%d input sets, %d lanes, %.1f%% lane use, %llu repacks\n", numFiles, HOVALAAG_BATCH_LANES,
+             100.0 * batch.laneSteps / ((double)batch.groupSteps * HOVALAAG_BATCH_LANES),
+             (unsigned long long)batch.repacks);
+      printf("Batch %.3f s: %.0f sets/s, %.1f MIPS\n", batchTime, numFiles / batchTime,
+             batch.laneSteps / batchTime * 1e-6);
+      printf("Sequential %.3f s: %.0f sets/s\n", sequentialTime, numFiles / sequentialTime);
+    }
+    return mismatches ? 5 : 0;
+  }
+
+  for (int i = 0; i < numFiles; ++i)
+  {
+    const HovalaagBatch::Job& job = batch.jobs[i];
+    printf("== %s\n", fileNames[i]);
+    if (!options.quiet)
+    {
+      // The ports are collected separately, so OUT1 is printed before OUT2
+      for (int port = 0; port < 2; ++port)
+        for (size_t n = 0; n < ios[i].out[port].size(); ++n)
+          printf("OUT%d %d\n", port + 1, HovalaagSigned(ios[i].out[port][n]));
+    }
+    if (options.printRegs)
+    {
+      const HovalaagState& s = job.state;
+      printf("%s after %llu cycles\n", StopName(job.stop), (unsigned long long)s.cycles);
+      printf("PC=%02x A=%03x B=%03x C=%03x D=%03x W=%03x F=%d\n", s.PC, s.A, s.B, s.C, s.D, s.W, s.F);
+    }
+  }
+  return 0;
+}
+
+static int RunNetwork(const char* fileName, bool stopAtEnd, bool quiet, uint64_t maxCycles)
+{
+  HovalaagNetwork network;
+  if (!network.Load(fileName)) return 2;
+  network.Run(maxCycles, stopAtEnd);
+  if (!quiet) network.PrintOutputs();
+  network.PrintStats();
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* binFileName = BinFileName;
+  const char* inputFileName = InputFileName;
+  bool loopback = false;
+  bool stopAtEnd = false;
+  bool quiet = false;
+  bool printRegs = false;
+  bool benchmark = false;
+  bool differential = false;
+  const char* translateFileName = NULL;
+  const char* programFileName = NULL;
+  const char* profileFileName = NULL;
+  const char* networkFileName = NULL;
+  const char* checkpointFileName = NULL;
+  const char* traceFileName = NULL;
+  uint64_t checkpointInterval = DefaultCheckpointInterval;
+  uint64_t maxCycles = 0;
+  uint64_t haltAfter = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:i:lsc:n:qrbdt:P:N:k:K:T:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'p': binFileName = programFileName = optarg; break;
+      case 'i': inputFileName = optarg; break;
+      case 'l': loopback = true; break;
+      case 's': stopAtEnd = true; break;
+      case 'c': maxCycles = strtoull(optarg, NULL, 0); break;
+      case 'n': haltAfter = strtoull(optarg, NULL, 0); break;
+      case 'q': quiet = true; break;
+      case 'r': printRegs = true; break;
+      case 'b': benchmark = true; break;
+      case 'd': differential = true; break;
+      case 't': translateFileName = optarg; break;
+      case 'P': profileFileName = optarg; break;
+      case 'N': networkFileName = optarg; break;
+      case 'k': checkpointFileName = optarg; break;
+      case 'K': checkpointInterval = strtoull(optarg, NULL, 0); break;
+      case 'T': traceFileName = optarg; break;
+      default: Usage(); return 1;
+    }
+  }
+  if (maxCycles == 0) maxCycles = benchmark ? BenchmarkCycles : DefaultMaxCycles;
+
+  // The network names its own programs and inputs
+  if (networkFileName)
+    return RunNetwork(networkFileName, stopAtEnd, quiet, maxCycles);
+
+  uint32_t program[HOVALAAG_PROGRAM_SIZE];
+#ifdef HOVALAAG_AOT
+  // The program is built in, a program file is only read to check it matches
+  int programSize = HovalaagTranslated.programSize;
+  memcpy(program, HovalaagTranslated.program, sizeof(program));
+  (void)binFileName;
+  if (programFileName)
+  {
+    uint32_t fileProgram[HOVALAAG_PROGRAM_SIZE];
+    if (HovalaagLoadProgram(programFileName, fileProgram) < 0) return 2;
+    if (memcmp(fileProgram, program, sizeof(program)))
+    {
+      printf("%s is not the program this binary was built with\n", programFileName);
+      return 2;
+    }
+  }
+#else
+  (void)programFileName;
+  int programSize = HovalaagLoadProgram(binFileName, program);
+  if (programSize < 0) return 2;
+#endif
+
+  if (translateFileName)
+  {
+    FILE* outFile = fopen(translateFileName, "w");
+    if (!outFile)
+    {
+      printf("Failed to open %s\n", translateFileName);
+      return 3;
+    }
+    bool ok = HovalaagTranslate(program, programSize, "HovalaagTranslated", outFile);
+    if (fclose(outFile) != 0) ok = false;
+    if (!ok)
+    {
+      printf("Failed to write %s\n", translateFileName);
+      return 3;
+    }
+    return 0;
+  }
+
+  if (optind < argc)
+  {
+    if (profileFileName || checkpointFileName || traceFileName)
+    {
+      printf("%s can't be used with a batch of input files\n",
+             profileFileName ? "-P" : checkpointFileName ? "-k" : "-T");
+      return 1;
+    }
+    BatchOptions options = { loopback, stopAtEnd, quiet, printRegs, benchmark, differential, haltAfter };
+    return RunBatch(program, programSize, argc - optind, argv + optind, options, maxCycles);
+  }
+
+  if (profileFileName && traceFileName)
+  {
+    printf("-P and -T can't be used together\n");
+    return 1;
+  }
+
+  std::vector<uint16_t> in1, in2;
+  if (!LoadInput(inputFileName, &in1, &in2)) return 4;
+
+  HovalaagCpu cpu;
+  cpu.Load(program, programSize);
+
+  // Assemble the source first, so a mismatch is reported before a long run
+  HovalaagProfile profile;
+  vls_assembler* as = NULL;
+  vls_program assembled;
+  std::string sourceText;
+  if (profileFileName)
+  {
+    if (!ReadFile(profileFileName, &sourceText)) return 4;
+    as = vls_create();
+    if (!as || !AssembleProfiled(as, sourceText, cpu.program, &assembled))
+    {
+      printf("%s doesn't assemble to the program being run\n", profileFileName);
+      if (as) vls_destroy(as);
+      return 4;
+    }
+    cpu.profile = &profile;
+  }
+
+  PrintingIo printingIo;
+  HovalaagStreamIo plainIo;
+  HovalaagStreamIo& io = (quiet || benchmark || differential) ? plainIo : printingIo;
+  io.SetInput(0, in1.data(), in1.size());
+  io.SetInput(1, in2.data(), in2.size());
+  io.loopback = loopback;
+  io.stopAtEnd = stopAtEnd;
+  io.haltAfter = haltAfter;
+  io.collect = false;
+
+  if (differential)
+    return Differential(cpu, io, maxCycles) ? 0 : 5;
+
+  if (benchmark)
+  {
+    uint64_t executed = 0;
+    int runs = 0;
+    double start = Now();
+    while (executed < maxCycles)
+    {
+      cpu.Reset();
+      io.Reset();
+      RunCpu(cpu, io, maxCycles - executed);
+      executed += cpu.state.cycles;
+      ++runs;
+      if (cpu.state.cycles == 0) break;
+    }
+    double elapsed = Now() - start;
+    printf("%llu instructions in %d runs, %.3f s: %.1f MIPS\n",
+           (unsigned long long)executed, runs, elapsed, executed / elapsed * 1e-6);
+    return 0;
+  }
+
+  HovalaagTraceWriter traceWriter;
+  HovalaagTraceWriter* trace = NULL;
+  if (traceFileName)
+  {
+    if (!traceWriter.Open(traceFileName, cpu)) return 3;
+    trace = &traceWriter;
+  }
+
+  HovalaagStop stop;
+  if (checkpointFileName)
+  {
+    // Run to each checkpoint in turn
+    HovalaagCheckpoints checkpoints;
+    if (!checkpoints.Begin(cpu, io, inputFileName, checkpointInterval, checkpointFileName)) return 3;
+    stop = HOVALAAG_CYCLE_LIMIT;
+    while (stop == HOVALAAG_CYCLE_LIMIT && cpu.state.cycles < maxCycles)
+    {
+      stop = RunCpu(cpu, io, std::min(checkpoints.CyclesToNext(cpu), maxCycles - cpu.state.cycles), trace);
+      if (stop == HOVALAAG_CYCLE_LIMIT && cpu.state.cycles < maxCycles &&
+          cpu.state.cycles % checkpoints.header.interval == 0)
+        checkpoints.Take(cpu, io);
+    }
+    if (!checkpoints.End(cpu, stop))
+    {
+      printf("Failed to write %s\n", checkpointFileName);
+      return 3;
+    }
+  }
+  else
+    stop = RunCpu(cpu, io, maxCycles, trace);
+
+  if (trace && !trace->Close(cpu, stop))
+  {
+    printf("Failed to write %s\n", traceFileName);
+    return 3;
+  }
+
+  if (printRegs)
+  {
+    const HovalaagState& s = cpu.state;
+    printf("%s after %llu cycles\n", StopName(stop), (unsigned long long)s.cycles);
+    printf("PC=%02x A=%03x B=%03x C=%03x D=%03x W=%03x F=%d\n", s.PC, s.A, s.B, s.C, s.D, s.W, s.F);
+    printf("IN1 read %llu, IN2 read %llu, OUT1 written %llu, OUT2 written %llu\n",
+           (unsigned long long)io.inPos[0], (unsigned long long)io.inPos[1],
+           (unsigned long long)io.outCount[0], (unsigned long long)io.outCount[1]);
+  }
+
+  if (profileFileName)
+  {
+    PrintProfile(cpu, profile, assembled, sourceText);
+    vls_destroy(as);
+  }
+
+  return 0;
+}
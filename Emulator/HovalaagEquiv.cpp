@@ -0,0 +1,370 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Check that two program images write the same outputs for every input.
+//
+// This is for per-sample kernels: programs that read a sample, write the
+// outputs for it and go back to read the next.  Each input in the domain is
+// given to both programs from reset, one word on IN1 (and one on IN2 with
+// -2), and each runs until it stalls reading past that input, which is the
+// kernel waiting for its next sample.  The OUT1 and OUT2 words written are
+// then compared.  The domain is every 12-bit value of IN1, or with -2 every
+// pair of values on IN1 and IN2, 4096 squared.
+//
+// A run is cut short after MaxOutputs words or the cycle limit, or, without
+// -2, when it reads IN2, which has nothing to give it.  If either program was
+// cut short the outputs are still compared as far as they go, but the input
+// isn't proven, and the check fails as unproven rather than equivalent.
+//
+// The inputs are numbered so that smaller values come first - 0, 1, -1, 2,
+// -2 and so on, and with -2 in square shells of pairs by the larger of the
+// two - and split into chunks handed out to the threads in order.  Once an
+// input differs no chunk after it is started, but the ones before it are
+// finished, so the counterexample reported is always the smallest one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Hovalaag.h"
+
+#define DefaultMaxCycles 4096
+#define MaxOutputs 64
+#define ChunkSize 4096
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// One word on each input port given, then stalls.  Reading a port that wasn't
+// given is noted.  Outputs are kept, and the CPU halted when there have been
+// MaxOutputs.
+class SampleIo : public HovalaagIo
+{
+public:
+  void Reset(uint16_t in1, uint16_t in2, bool hasIn2)
+  {
+    in[0] = in1;
+    in[1] = in2;
+    given[0] = available[0] = true;
+    given[1] = available[1] = hasIn2;
+    readMissing = false;
+    count[0] = count[1] = 0;
+    halt = false;
+  }
+
+  virtual bool In(int port, uint16_t* value)
+  {
+    if (!given[port]) readMissing = true;
+    if (!available[port]) return false;
+    available[port] = false;
+    *value = in[port];
+    return true;
+  }
+
+  virtual void Out(int port, uint16_t value)
+  {
+    out[port][count[port]++] = value;
+    if (count[0] + count[1] == MaxOutputs) halt = true;
+  }
+
+  uint16_t in[2];
+  bool given[2];
+  bool available[2];
+  bool readMissing;
+  uint16_t out[2][MaxOutputs];
+  int count[2];
+};
+
+// Run one program on one input
+struct Result
+{
+  bool complete;        // stalled for the next input, rather than being cut short
+  bool readIn2;         // stalled reading IN2 without -2
+  uint64_t cycles;
+};
+
+static Result RunSample(HovalaagCpu& cpu, SampleIo& io, uint16_t in1, uint16_t in2, bool hasIn2, uint64_t maxCycles)
+{
+  cpu.Reset();
+  io.Reset(in1, in2, hasIn2);
+  HovalaagStop stop = cpu.Run(io, maxCycles);
+  Result r = { stop == HOVALAAG_INPUT_STALL && !io.readMissing, io.readMissing, cpu.state.cycles };
+  return r;
+}
+
+enum Verdict { SAME, UNPROVEN, DIFFERENT };
+
+// Compare the outputs of the two programs, describing any difference
+static Verdict Compare(const SampleIo io[2], const Result r[2], std::string* why)
+{
+  char buf[256];
+  Verdict verdict = SAME;
+  for (int port = 0; port < 2; ++port)
+  {
+    int n0 = io[0].count[port], n1 = io[1].count[port];
+    for (int i = 0; i < n0 && i < n1; ++i)
+    {
+      if (io[0].out[port][i] != io[1].out[port][i])
+      {
+        snprintf(buf, sizeof(buf), "OUT%d word %d is %d from the first program and %d from the second", port + 1,
+                 i, HovalaagSigned(io[0].out[port][i]), HovalaagSigned(io[1].out[port][i]));
+        *why = buf;
+        return DIFFERENT;
+      }
+    }
+    if (n0 == n1) continue;
+
+    // The program that wrote fewer words may only have been cut short
+    int shorter = n0 < n1 ? 0 : 1;
+    if (r[shorter].complete)
+    {
+      snprintf(buf, sizeof(buf), "OUT%d gets %d words from the first program and %d from the second", port + 1, n0,
+               n1);
+      *why = buf;
+      return DIFFERENT;
+    }
+    verdict = UNPROVEN;
+  }
+  if (!r[0].complete || !r[1].complete) verdict = UNPROVEN;
+  return verdict;
+}
+
+// Input value for a position in the order 0, 1, -1, 2, -2, ... -2048
+static uint16_t Value(uint32_t rank)
+{
+  return (rank & 1) ? (rank + 1) / 2 : (-(int)(rank / 2)) & 0xfff;
+}
+
+// The input pair at a position in the domain.  Pairs go in square shells:
+// shell s is the 2s + 1 pairs whose larger rank is s.
+static void Input(uint64_t i, bool pairs, uint16_t* in1, uint16_t* in2)
+{
+  if (!pairs)
+  {
+    *in1 = Value(i);
+    *in2 = 0;
+    return;
+  }
+  uint32_t s = (uint32_t)sqrt((double)i);
+  while ((uint64_t)s * s > i) --s;
+  while ((uint64_t)(s + 1) * (s + 1) <= i) ++s;
+  uint32_t j = i - (uint64_t)s * s;
+  if (j < s)
+  {
+    *in1 = Value(s);
+    *in2 = Value(j);
+  }
+  else
+  {
+    *in1 = Value(j - s);
+    *in2 = Value(s);
+  }
+}
+
+struct Check
+{
+  const uint32_t* program[2];
+  int programSize[2];
+  bool pairs;
+  uint64_t maxCycles;
+  uint64_t domain;
+
+  std::atomic<uint64_t> nextChunk;
+  std::atomic<uint64_t> firstDifferent;   // domain if none yet
+
+  std::mutex lock;
+  std::string why;
+  uint64_t unproven;
+  uint64_t firstUnproven;
+  uint64_t cycles[2];
+  bool readIn2[2];
+};
+
+static void Worker(Check& check)
+{
+  HovalaagCpu cpu[2];
+  SampleIo io[2];
+  for (int p = 0; p < 2; ++p)
+    cpu[p].Load(check.program[p], check.programSize[p]);
+
+  uint64_t unproven = 0;
+  uint64_t firstUnproven = check.domain;
+  uint64_t cycles[2] = { 0, 0 };
+  bool readIn2[2] = { false, false };
+  for (;;)
+  {
+    uint64_t start = check.nextChunk++ * ChunkSize;
+    if (start >= check.domain || start >= check.firstDifferent) break;
+    uint64_t end = start + ChunkSize < check.domain ? start + ChunkSize : check.domain;
+    for (uint64_t i = start; i < end && i < check.firstDifferent; ++i)
+    {
+      uint16_t in1, in2;
+      Input(i, check.pairs, &in1, &in2);
+      Result r[2];
+      for (int p = 0; p < 2; ++p)
+      {
+        r[p] = RunSample(cpu[p], io[p], in1, in2, check.pairs, check.maxCycles);
+        cycles[p] += r[p].cycles;
+        if (r[p].readIn2) readIn2[p] = true;
+      }
+
+      std::string why;
+      Verdict verdict = Compare(io, r, &why);
+      if (verdict == UNPROVEN)
+      {
+        if (!unproven++) firstUnproven = i;
+      }
+      else if (verdict == DIFFERENT)
+      {
+        std::lock_guard<std::mutex> guard(check.lock);
+        if (i < check.firstDifferent)
+        {
+          check.firstDifferent = i;
+          check.why = why;
+        }
+        break;
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(check.lock);
+  check.unproven += unproven;
+  if (firstUnproven < check.firstUnproven) check.firstUnproven = firstUnproven;
+  check.cycles[0] += cycles[0];
+  check.cycles[1] += cycles[1];
+  for (int p = 0; p < 2; ++p)
+    if (readIn2[p]) check.readIn2[p] = true;
+}
+
+static void PrintInput(uint64_t i, bool pairs)
+{
+  uint16_t in1, in2;
+  Input(i, pairs, &in1, &in2);
+  if (pairs) printf("IN1=%d IN2=%d", HovalaagSigned(in1), HovalaagSigned(in2));
+  else printf("IN1=%d", HovalaagSigned(in1));
+}
+
+// Run both programs on one input again and print what they write
+static void PrintOutputs(const Check& check, uint64_t i)
+{
+  uint16_t in1, in2;
+  Input(i, check.pairs, &in1, &in2);
+  for (int p = 0; p < 2; ++p)
+  {
+    HovalaagCpu cpu;
+    SampleIo io;
+    cpu.Load(check.program[p], check.programSize[p]);
+    Result r = RunSample(cpu, io, in1, in2, check.pairs, check.maxCycles);
+    printf("  %s program, %llu cycles%s:", p ? "second" : "first", (unsigned long long)r.cycles,
+           r.readIn2 ? " (read IN2)" : r.complete ? "" : " (cut short)");
+    for (int port = 0; port < 2; ++port)
+    {
+      if (!io.count[port]) continue;
+      printf(" OUT%d", port + 1);
+      for (int n = 0; n < io.count[port]; ++n)
+        printf(" %d", HovalaagSigned(io.out[port][n]));
+    }
+    printf("\n");
+  }
+}
+
+static void Usage()
+{
+  printf("Usage: HovalaagEquiv [options] <program> <program>\n"
+         "  -2         Every pair of IN1 and IN2 values, rather than every IN1 value\n"
+         "  -j <n>     Number of threads (default: one per core)\n"
+         "  -c <n>     Maximum cycles for a program on one input (default %d)\n",
+         DefaultMaxCycles);
+}
+
+int main(int argc, char* argv[])
+{
+  bool pairs = false;
+  int numThreads = std::thread::hardware_concurrency();
+  uint64_t maxCycles = DefaultMaxCycles;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "2j:c:h")) != -1)
+  {
+    switch (opt)
+    {
+      case '2': pairs = true; break;
+      case 'j': numThreads = atoi(optarg); break;
+      case 'c': maxCycles = strtoull(optarg, NULL, 0); break;
+      default: Usage(); return 1;
+    }
+  }
+  if (optind != argc - 2)
+  {
+    Usage();
+    return 1;
+  }
+  if (numThreads < 1) numThreads = 1;
+
+  uint32_t program[2][HOVALAAG_PROGRAM_SIZE];
+  Check check;
+  for (int p = 0; p < 2; ++p)
+  {
+    check.programSize[p] = HovalaagLoadProgram(argv[optind + p], program[p]);
+    if (check.programSize[p] < 0) return 2;
+    check.program[p] = program[p];
+    check.cycles[p] = 0;
+    check.readIn2[p] = false;
+  }
+  check.pairs = pairs;
+  check.maxCycles = maxCycles;
+  check.domain = pairs ? 4096ULL * 4096 : 4096;
+  check.nextChunk = 0;
+  check.firstDifferent = check.domain;
+  check.unproven = 0;
+  check.firstUnproven = check.domain;
+
+  double start = Now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numThreads; ++i)
+    threads.push_back(std::thread(Worker, std::ref(check)));
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  double elapsed = Now() - start;
+
+  if (check.firstDifferent < check.domain)
+  {
+    printf("Different for ");
+    PrintInput(check.firstDifferent, pairs);
+    printf(": %s\n", check.why.c_str());
+    PrintOutputs(check, check.firstDifferent);
+    return 5;
+  }
+
+  printf("%llu inputs in %.2f s on %d threads, %.2f and %.2f cycles per input\n", (unsigned long long)check.domain,
+         elapsed, numThreads, (double)check.cycles[0] / check.domain, (double)check.cycles[1] / check.domain);
+  if (check.readIn2[0] || check.readIn2[1])
+  {
+    printf("Not proven: the %s program%s IN2, check with -2\n",
+           check.readIn2[0] && check.readIn2[1] ? "first and second" : check.readIn2[0] ? "first" : "second",
+           check.readIn2[0] && check.readIn2[1] ? "s read" : " reads");
+    return 6;
+  }
+  if (check.unproven)
+  {
+    printf("Not proven: %llu inputs were cut short, first ", (unsigned long long)check.unproven);
+    PrintInput(check.firstUnproven, pairs);
+    printf("\n");
+    PrintOutputs(check, check.firstUnproven);
+    return 6;
+  }
+  printf("Equivalent\n");
+  return 0;
+}
@@ -0,0 +1,466 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Several Hovalaag CPUs wired together through FIFOs, each running on its
+// own thread.  See HovalaagNetwork.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "HovalaagNetwork.h"
+
+// Cycles a CPU runs between publishing its progress when it isn't waiting
+#define Quantum 1024
+
+// Times a waiting thread checks before yielding the core
+#define SpinCount 64
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool EndsWith(const char* s, const char* suffix)
+{
+  size_t len = strlen(s);
+  size_t suffixLen = strlen(suffix);
+  return len >= suffixLen && !strcmp(s + len - suffixLen, suffix);
+}
+
+HovalaagLink::HovalaagLink(HovalaagNetworkNode* producer, int outPort, HovalaagNetworkNode* consumer, int inPort,
+                           uint64_t depth)
+  : producer(producer)
+  , consumer(consumer)
+  , outPort(outPort)
+  , inPort(inPort)
+  , depth(depth)
+  , head(0)
+  , flush(0)
+  , producerHead(0)
+  , producerFlush(0)
+  , cachedTail(0)
+  , consumerSeen(0)
+  , written(0)
+  , lost(0)
+  , lostResidency(0)
+  , tail(0)
+  , consumerTail(0)
+  , visibleEnd(0)
+  , producerSeen(0)
+  , read(0)
+  , emptyReads(0)
+  , maxOccupancy(0)
+  , readResidency(0)
+  , unread(0)
+  , unreadResidency(0)
+{
+  uint64_t size = 1;
+  while (size < depth + 1) size <<= 1;
+  ring.resize(size);
+  mask = size - 1;
+}
+
+bool HovalaagLink::Read(uint64_t t, uint16_t* value)
+{
+  if (producer != consumer && producerSeen < 2 * t)
+  {
+    consumer->Publish(2 * t);
+    producerSeen = consumer->WaitFor(producer, 2 * t);
+  }
+
+  // Any overflow was in an earlier cycle, and is visible now the producer
+  // has been seen to pass t
+  uint64_t f = flush.load(std::memory_order_acquire);
+  if (consumerTail < f) consumerTail = f;
+  if (visibleEnd < consumerTail) visibleEnd = consumerTail;
+  uint64_t h = head.load(std::memory_order_acquire);
+  while (visibleEnd < h && ring[visibleEnd & mask].cycle < t) ++visibleEnd;
+
+  uint64_t count = visibleEnd - consumerTail;
+  if (count > maxOccupancy) maxOccupancy = count;
+  if (count == 0)
+  {
+    ++emptyReads;
+    *value = 0;
+    return false;
+  }
+
+  const Entry& e = ring[consumerTail & mask];
+  readResidency += t - e.cycle;
+  *value = e.value;
+  ++read;
+  tail.store(++consumerTail, std::memory_order_release);
+  return true;
+}
+
+void HovalaagLink::Write(uint64_t t, uint16_t value)
+{
+  ++written;
+
+  // The tail seen last is never ahead of the real one, so the FIFO is only
+  // checked properly when it looks full.  The consumer's reads for cycle t
+  // have to be done before the check is exact.
+  uint64_t start = std::max(cachedTail, producerFlush);
+  if (producerHead - start >= depth - 1)
+  {
+    cachedTail = tail.load(std::memory_order_acquire);
+    start = std::max(cachedTail, producerFlush);
+    if (producerHead - start >= depth - 1 && producer != consumer && consumerSeen < 2 * t + 1)
+    {
+      producer->Publish(2 * t + 1);
+      consumerSeen = producer->WaitFor(consumer, 2 * t + 1);
+      cachedTail = tail.load(std::memory_order_acquire);
+      start = std::max(cachedTail, producerFlush);
+    }
+  }
+  bool full = producerHead - start == depth - 1;
+
+  Entry& e = ring[producerHead & mask];
+  e.cycle = t;
+  e.value = value;
+  ++producerHead;
+
+  if (full)
+  {
+    // The write pointer catches up with the read pointer, so Fifo.v reads as
+    // empty and everything in it is gone, this word included
+    for (uint64_t i = start; i < producerHead; ++i)
+      lostResidency += t - ring[i & mask].cycle;
+    lost += producerHead - start;
+    producerFlush = producerHead;
+    flush.store(producerFlush, std::memory_order_release);
+  }
+  head.store(producerHead, std::memory_order_release);
+}
+
+void HovalaagLink::Finish()
+{
+  uint64_t end = std::max(producer->cpu.state.cycles, consumer->cpu.state.cycles);
+  uint64_t start = std::max(consumerTail, producerFlush);
+  unread = producerHead - start;
+  unreadResidency = 0;
+  for (uint64_t i = start; i < producerHead; ++i)
+    unreadResidency += end - ring[i & mask].cycle;
+  if (unread > maxOccupancy) maxOccupancy = unread;
+  if (lost) maxOccupancy = depth - 1;
+}
+
+HovalaagNetworkNode::HovalaagNetworkNode()
+  : stopAtEnd(false)
+  , progress(0)
+  , stop(HOVALAAG_CYCLE_LIMIT)
+  , emptyReads(0)
+  , waits(0)
+  , waitTime(0)
+{
+  for (int port = 0; port < 2; ++port)
+  {
+    inLink[port] = NULL;
+    outLink[port] = NULL;
+    hasInput[port] = false;
+    inputPos[port] = 0;
+    collect[port] = false;
+    inCount[port] = 0;
+    outCount[port] = 0;
+  }
+}
+
+bool HovalaagNetworkNode::In(int port, uint16_t* value)
+{
+  if (inLink[port])
+  {
+    if (!inLink[port]->Read(cycle, value)) ++emptyReads;
+  }
+  else if (hasInput[port] && inputPos[port] < input[port].size())
+    *value = input[port][inputPos[port]++];
+  else if (hasInput[port] && stopAtEnd)
+    return false;
+  else
+    *value = 0;
+
+  ++inCount[port];
+  return true;
+}
+
+void HovalaagNetworkNode::Out(int port, uint16_t value)
+{
+  ++outCount[port];
+  if (collect[port]) output[port].push_back(value);
+  if (outLink[port]) outLink[port]->Write(cycle, value);
+}
+
+uint64_t HovalaagNetworkNode::WaitFor(const HovalaagNetworkNode* other, uint64_t halfCycles)
+{
+  uint64_t seen = other->progress.load(std::memory_order_acquire);
+  if (seen >= halfCycles) return seen;
+
+  ++waits;
+  double start = Now();
+  for (int spins = 0; (seen = other->progress.load(std::memory_order_acquire)) < halfCycles; ++spins)
+  {
+    if (spins >= SpinCount) std::this_thread::yield();
+  }
+  waitTime += Now() - start;
+  return seen;
+}
+
+HovalaagNetworkNode* HovalaagNetwork::FindNode(const std::string& name) const
+{
+  for (size_t i = 0; i < nodes.size(); ++i)
+    if (nodes[i]->name == name) return nodes[i].get();
+  return NULL;
+}
+
+static std::string Format(const char* format, const char* a, const char* b = "")
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), format, a, b);
+  return buf;
+}
+
+// Parse <cpu>.IN<n> or <cpu>.OUT<n>, kind being "IN" or "OUT"
+bool HovalaagNetwork::ParsePort(const char* text, const char* kind, HovalaagNetworkNode** node, int* port,
+                                std::string* error) const
+{
+  const char* dot = strrchr(text, '.');
+  *node = dot ? FindNode(std::string(text, dot - text)) : NULL;
+  if (!*node)
+  {
+    *error = dot ? Format("No cpu named %s", std::string(text, dot - text).c_str())
+                 : Format("Expected <cpu>.%s<n>, not %s", kind, text);
+    return false;
+  }
+  size_t kindLen = strlen(kind);
+  if (strncmp(dot + 1, kind, kindLen) || (dot[kindLen + 1] != '1' && dot[kindLen + 1] != '2') || dot[kindLen + 2])
+  {
+    *error = Format("Expected a port %s1 or %s2", kind, kind) + ", not " + (dot + 1);
+    return false;
+  }
+  *port = dot[kindLen + 1] - '1';
+  return true;
+}
+
+bool HovalaagNetwork::Load(const char* fileName)
+{
+  FILE* f = fopen(fileName, "r");
+  if (!f)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+
+  char buf[1024];
+  std::string error;
+  int lineNumber = 0;
+  while (error.empty() && fgets(buf, sizeof(buf), f))
+  {
+    ++lineNumber;
+    char* comment = strchr(buf, '#');
+    if (comment) *comment = 0;
+
+    char* words[5];
+    int numWords = 0;
+    for (char* word = strtok(buf, " \t\r\n"); word && numWords < 5; word = strtok(NULL, " \t\r\n"))
+      words[numWords++] = word;
+    if (numWords == 0) continue;
+
+    std::string item = words[0];
+    HovalaagNetworkNode* node;
+    HovalaagNetworkNode* other;
+    int port, otherPort;
+    if (item == "cpu" && numWords == 3)
+    {
+      uint32_t program[HOVALAAG_PROGRAM_SIZE];
+      int programSize;
+      if (FindNode(words[1]))
+        error = Format("There is already a cpu named %s", words[1]);
+      else if ((programSize = HovalaagLoadProgram(words[2], program)) < 0)
+        error = Format("Can't load the program for %s", words[1]);
+      else
+      {
+        nodes.push_back(std::unique_ptr<HovalaagNetworkNode>(new HovalaagNetworkNode));
+        nodes.back()->name = words[1];
+        nodes.back()->programFileName = words[2];
+        nodes.back()->cpu.Load(program, programSize);
+      }
+    }
+    else if (item == "link" && (numWords == 3 || numWords == 4))
+    {
+      uint64_t depth = (numWords == 4) ? strtoull(words[3], NULL, 0) : HOVALAAG_NETWORK_DEPTH;
+      if (!ParsePort(words[1], "OUT", &node, &port, &error) || !ParsePort(words[2], "IN", &other, &otherPort, &error))
+        ;
+      else if (depth < 2)
+        error = Format("The link from %s must be at least 2 deep", words[1]);
+      else if (node->outLink[port])
+        error = Format("%s is already linked", words[1]);
+      else if (other->inLink[otherPort] || other->hasInput[otherPort])
+        error = Format("%s is already connected", words[2]);
+      else
+      {
+        links.push_back(std::unique_ptr<HovalaagLink>(new HovalaagLink(node, port, other, otherPort, depth)));
+        node->outLink[port] = other->inLink[otherPort] = links.back().get();
+      }
+    }
+    else if (item == "input" && (numWords == 3 || numWords == 4))
+    {
+      int column = (numWords == 4) ? atoi(words[3]) : 1;
+      bool bin = EndsWith(words[2], ".bin");
+      std::vector<uint16_t> in1, in2;
+      if (!ParsePort(words[1], "IN", &node, &port, &error))
+        ;
+      else if (node->inLink[port] || node->hasInput[port])
+        error = Format("%s is already connected", words[1]);
+      else if (column != 1 && (column != 2 || bin))
+        error = Format("%s has no column %s", words[2], words[3]);
+      else if (bin ? !HovalaagLoadInputBin(words[2], &in1) : !HovalaagLoadInputText(words[2], &in1, &in2))
+        error = Format("Can't load the input for %s", words[1]);
+      else
+      {
+        node->input[port] = (column == 1) ? in1 : in2;
+        node->hasInput[port] = true;
+      }
+    }
+    else if (item == "output" && numWords == 2)
+    {
+      if (!ParsePort(words[1], "OUT", &node, &port, &error))
+        ;
+      else if (node->collect[port])
+        error = Format("%s is already an output", words[1]);
+      else
+      {
+        node->collect[port] = true;
+        outputs.push_back(std::make_pair(node, port));
+      }
+    }
+    else
+    {
+      error = "Expected cpu <name> <program>, link <cpu>.OUT<n> <cpu>.IN<n> [depth], "
+              "input <cpu>.IN<n> <file> [column] or output <cpu>.OUT<n>";
+    }
+  }
+  fclose(f);
+
+  if (!error.empty())
+  {
+    printf("%s:%d: %s\n", fileName, lineNumber, error.c_str());
+    return false;
+  }
+  if (nodes.empty())
+  {
+    printf("%s has no cpus\n", fileName);
+    return false;
+  }
+  return true;
+}
+
+static void RunNode(HovalaagNetworkNode* node, uint64_t maxCycles)
+{
+  HovalaagCpu& cpu = node->cpu;
+  while (cpu.state.cycles < maxCycles)
+  {
+    node->stop = cpu.Run(*node, std::min<uint64_t>(Quantum, maxCycles - cpu.state.cycles));
+    node->Publish(2 * cpu.state.cycles);
+    if (node->stop != HOVALAAG_CYCLE_LIMIT) break;
+  }
+
+  // Stopped for good, so no other CPU need wait for it
+  node->Publish(UINT64_MAX);
+}
+
+void HovalaagNetwork::Run(uint64_t maxCycles, bool stopAtEnd)
+{
+  for (size_t i = 0; i < nodes.size(); ++i)
+  {
+    nodes[i]->cpu.Reset();
+    nodes[i]->stopAtEnd = stopAtEnd;
+  }
+
+  double start = Now();
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < nodes.size(); ++i)
+    threads.push_back(std::thread(RunNode, nodes[i].get(), maxCycles));
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  elapsed = Now() - start;
+
+  for (size_t i = 0; i < links.size(); ++i)
+    links[i]->Finish();
+}
+
+void HovalaagNetwork::PrintOutputs() const
+{
+  for (size_t i = 0; i < outputs.size(); ++i)
+  {
+    const HovalaagNetworkNode* node = outputs[i].first;
+    int port = outputs[i].second;
+    for (size_t n = 0; n < node->output[port].size(); ++n)
+      printf("%s.OUT%d %d\n", node->name.c_str(), port + 1, HovalaagSigned(node->output[port][n]));
+  }
+}
+
+static const char* StopName(HovalaagStop stop)
+{
+  switch (stop)
+  {
+    case HOVALAAG_INPUT_STALL: return "input ended";
+    case HOVALAAG_HALTED: return "halted";
+    default: return "cycle limit";
+  }
+}
+
+void HovalaagNetwork::PrintStats() const
+{
+  uint64_t totalCycles = 0;
+  int nameWidth = 4;
+  for (size_t i = 0; i < nodes.size(); ++i)
+  {
+    totalCycles += nodes[i]->cpu.state.cycles;
+    nameWidth = std::max(nameWidth, (int)nodes[i]->name.size());
+  }
+  printf("%d cpus and %d links, %llu cycles in %.3f s: %.1f MIPS\n", (int)nodes.size(), (int)links.size(),
+         (unsigned long long)totalCycles, elapsed, elapsed > 0 ? totalCycles / elapsed * 1e-6 : 0.0);
+
+  printf("\n%-*s %12s %10s %10s %10s %10s %10s %8s %8s  %s\n", nameWidth, "CPU", "Cycles", "IN1", "IN2", "OUT1",
+         "OUT2", "Empty", "Waits", "Wait s", "Stopped");
+  for (size_t i = 0; i < nodes.size(); ++i)
+  {
+    const HovalaagNetworkNode* node = nodes[i].get();
+    printf("%-*s %12llu %10llu %10llu %10llu %10llu %10llu %8llu %8.3f  %s\n", nameWidth, node->name.c_str(),
+           (unsigned long long)node->cpu.state.cycles, (unsigned long long)node->inCount[0],
+           (unsigned long long)node->inCount[1], (unsigned long long)node->outCount[0],
+           (unsigned long long)node->outCount[1], (unsigned long long)node->emptyReads,
+           (unsigned long long)node->waits, node->waitTime, StopName(node->stop));
+  }
+  if (links.empty()) return;
+
+  // Mean occupancy is the words held at the end of a cycle, averaged over the run
+  std::vector<std::string> names;
+  int linkWidth = 4;
+  for (size_t i = 0; i < links.size(); ++i)
+  {
+    const HovalaagLink* link = links[i].get();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s.OUT%d -> %s.IN%d", link->producer->name.c_str(), link->outPort + 1,
+             link->consumer->name.c_str(), link->inPort + 1);
+    names.push_back(buf);
+    linkWidth = std::max(linkWidth, (int)names.back().size());
+  }
+  printf("\n%-*s %6s %10s %10s %10s %10s %6s %8s %6s\n", linkWidth, "Link", "Depth", "Written", "Read", "Empty", "Lost",
+         "Unread", "Mean", "Max");
+  for (size_t i = 0; i < links.size(); ++i)
+  {
+    const HovalaagLink* link = links[i].get();
+    uint64_t span = std::max(link->producer->cpu.state.cycles, link->consumer->cpu.state.cycles);
+    uint64_t residency = link->readResidency + link->lostResidency + link->unreadResidency;
+    printf("%-*s %6llu %10llu %10llu %10llu %10llu %6llu %8.2f %6llu\n", linkWidth, names[i].c_str(),
+           (unsigned long long)link->depth, (unsigned long long)link->written, (unsigned long long)link->read,
+           (unsigned long long)link->emptyReads, (unsigned long long)link->lost, (unsigned long long)link->unread,
+           span ? (double)residency / span : 0.0, (unsigned long long)link->maxOccupancy);
+  }
+}
@@ -0,0 +1,168 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Several Hovalaag CPUs wired together through FIFOs, each running on its
+// own thread.
+//
+// The network is read from a topology file, one item per line, with '#'
+// starting a comment:
+//
+//   cpu <name> <program image>
+//   link <cpu>.OUT<n> <cpu>.IN<n> [depth]
+//   input <cpu>.IN<n> <input file> [column]
+//   output <cpu>.OUT<n>
+//
+// A link behaves as Fifo.v, by default with its 8192 entries: it holds up to
+// depth - 1 words, reading it when empty gives zero rather than stalling, and
+// writing to it when full wraps the pointers round so everything in it is
+// lost, the new word included.  A link from a CPU's OUT2 to its own IN2 is
+// the loopback of hovalaag_top.v.  An input file is read as by HovalaagEmu -i,
+// column selecting the .txt column (default 1), and an input port with
+// nothing connected reads zero.  The words written to an output port are kept.
+//
+// Each link is a single producer, single consumer ring, entries stamped with
+// the cycle they were written in.  A consumer reading in cycle t only takes
+// entries written before t, and first waits until the producer has finished
+// every cycle before t, so what it reads doesn't depend on how the threads
+// are scheduled.  In the same way a producer finding the FIFO full waits
+// until the consumer has done its reads for the cycle before deciding it
+// overflows.  Every CPU publishes how far it has got, in half cycles, as it
+// runs.  A waiting CPU never waits for one that is behind it, so the network
+// can't deadlock, and the outputs are the same from run to run.
+
+#ifndef HOVALAAG_NETWORK_H
+#define HOVALAAG_NETWORK_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Hovalaag.h"
+
+// Depth of a link when the topology doesn't give one, the size of Fifo.v
+#define HOVALAAG_NETWORK_DEPTH 8192
+
+struct HovalaagNetworkNode;
+
+// One FIFO from an output port to an input port
+struct HovalaagLink
+{
+  struct Entry
+  {
+    uint64_t cycle;     // Cycle the word was written in
+    uint16_t value;
+  };
+
+  HovalaagLink(HovalaagNetworkNode* producer, int outPort, HovalaagNetworkNode* consumer, int inPort, uint64_t depth);
+
+  // Called on the consumer's thread for a read in cycle t.  Returns false,
+  // reading zero, if there is no word written before cycle t.
+  bool Read(uint64_t t, uint16_t* value);
+
+  // Called on the producer's thread for a write in cycle t
+  void Write(uint64_t t, uint16_t value);
+
+  // Account for the words left in the ring once the threads have finished
+  void Finish();
+
+  HovalaagNetworkNode* producer;
+  HovalaagNetworkNode* consumer;
+  int outPort;
+  int inPort;
+  uint64_t depth;
+  uint64_t mask;
+  std::vector<Entry> ring;    // Holds at least depth + 1 entries
+
+  // Producer side
+  alignas(64) std::atomic<uint64_t> head;
+  std::atomic<uint64_t> flush;    // Entries before this were lost when the FIFO overflowed
+  uint64_t producerHead;
+  uint64_t producerFlush;
+  uint64_t cachedTail;
+  uint64_t consumerSeen;          // Progress of the consumer last read
+  uint64_t written;
+  uint64_t lost;
+  uint64_t lostResidency;         // Cycles the lost words spent in the FIFO
+
+  // Consumer side
+  alignas(64) std::atomic<uint64_t> tail;
+  uint64_t consumerTail;
+  uint64_t visibleEnd;            // Entries before this were written before the current cycle
+  uint64_t producerSeen;          // Progress of the producer last read
+  uint64_t read;
+  uint64_t emptyReads;
+  uint64_t maxOccupancy;
+  uint64_t readResidency;         // Cycles the words read spent in the FIFO
+
+  // Set by Finish
+  uint64_t unread;
+  uint64_t unreadResidency;
+};
+
+// One CPU, and the IO for its ports
+struct HovalaagNetworkNode : public HovalaagIo
+{
+  HovalaagNetworkNode();
+
+  virtual bool In(int port, uint16_t* value);
+  virtual void Out(int port, uint16_t value);
+
+  // Progress is in half cycles: 2t once every cycle before t has finished,
+  // 2t + 1 once the reads for cycle t have been done as well.
+  void Publish(uint64_t halfCycles) { progress.store(halfCycles, std::memory_order_release); }
+
+  // Wait until another CPU's progress reaches halfCycles, returning its progress
+  uint64_t WaitFor(const HovalaagNetworkNode* other, uint64_t halfCycles);
+
+  std::string name;
+  std::string programFileName;
+  HovalaagCpu cpu;
+
+  // Each port connects to a link, an input file or nothing
+  HovalaagLink* inLink[2];
+  HovalaagLink* outLink[2];
+  std::vector<uint16_t> input[2];
+  bool hasInput[2];
+  size_t inputPos[2];
+  bool stopAtEnd;
+  bool collect[2];
+  std::vector<uint16_t> output[2];
+
+  alignas(64) std::atomic<uint64_t> progress;
+
+  // Statistics
+  HovalaagStop stop;
+  uint64_t inCount[2];
+  uint64_t outCount[2];
+  uint64_t emptyReads;    // Reads of an empty link, which gave zero
+  uint64_t waits;         // Times the thread had to wait for another CPU
+  double waitTime;        // Seconds spent waiting
+};
+
+class HovalaagNetwork
+{
+public:
+  // Read a topology file, loading the programs and input files it names.
+  // Prints the problem and returns false if it can't.
+  bool Load(const char* fileName);
+
+  // Run every CPU from reset on its own thread until it has executed
+  // maxCycles instructions, or stalled reading past the end of an input
+  // file when stopAtEnd is set.  A network is only run once.
+  void Run(uint64_t maxCycles, bool stopAtEnd);
+
+  // Print the words written to each output port, then the statistics
+  void PrintOutputs() const;
+  void PrintStats() const;
+
+  std::vector<std::unique_ptr<HovalaagNetworkNode>> nodes;
+  std::vector<std::unique_ptr<HovalaagLink>> links;
+  std::vector<std::pair<HovalaagNetworkNode*, int>> outputs;
+  double elapsed;
+
+private:
+  HovalaagNetworkNode* FindNode(const std::string& name) const;
+  bool ParsePort(const char* text, const char* kind, HovalaagNetworkNode** node, int* port, std::string* error) const;
+};
+
+#endif
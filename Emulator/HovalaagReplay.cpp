@@ -0,0 +1,187 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Go to any cycle of a run recorded by HovalaagEmu -k.
+//
+// The checkpoint file holds the program and how the IO was set up, and the
+// run is picked up at the last checkpoint before the cycle asked for and run
+// forward to it, so getting to a cycle near the end of a long run takes no
+// longer than running one checkpoint interval.  The input data is read from
+// the file the recording was made with, or the one given with -i, which must
+// be the same length.
+//
+// The state at the cycle is printed as HovalaagEmu -r prints it.  With -n the
+// following cycles are then stepped one at a time, printing the state before
+// each and the words read and written.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Hovalaag.h"
+#include "HovalaagCheckpoint.h"
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool EndsWith(const char* s, const char* suffix)
+{
+  size_t len = strlen(s);
+  size_t suffixLen = strlen(suffix);
+  return len >= suffixLen && !strcmp(s + len - suffixLen, suffix);
+}
+
+static const char* StopName(HovalaagStop stop)
+{
+  switch (stop)
+  {
+    case HOVALAAG_INPUT_STALL: return "Input stalled";
+    case HOVALAAG_HALTED: return "Halted";
+    default: return "Stopped";
+  }
+}
+
+// Prints each word read and written, with its position in the stream, when trace is set
+class TraceIo : public HovalaagStreamIo
+{
+public:
+  TraceIo() : trace(false) {}
+
+  virtual bool In(int port, uint16_t* value)
+  {
+    uint64_t pos = inPos[port];
+    if (!HovalaagStreamIo::In(port, value)) return false;
+    if (trace)
+    {
+      if (port == 1 && loopback) printf("  IN2 %d (FIFO)\n", HovalaagSigned(*value & 0xfff));
+      else if (pos < inLen[port]) printf("  IN%d %d (word %llu)\n", port + 1, HovalaagSigned(*value & 0xfff),
+                                         (unsigned long long)pos);
+      else printf("  IN%d 0 (past the end)\n", port + 1);
+    }
+    return true;
+  }
+
+  virtual void Out(int port, uint16_t value)
+  {
+    if (trace) printf("  OUT%d %d (word %llu)\n", port + 1, HovalaagSigned(value), (unsigned long long)outCount[port]);
+    HovalaagStreamIo::Out(port, value);
+  }
+
+  bool trace;
+};
+
+static void PrintState(HovalaagStop stop, const HovalaagCpu& cpu, const HovalaagStreamIo& io)
+{
+  const HovalaagState& s = cpu.state;
+  printf("%s after %llu cycles\n", StopName(stop), (unsigned long long)s.cycles);
+  printf("PC=%02x A=%03x B=%03x C=%03x D=%03x W=%03x OUT=%03x F=%d\n", s.PC, s.A, s.B, s.C, s.D, s.W, s.OUT, s.F);
+  printf("IN1 read %llu, IN2 read %llu, OUT1 written %llu, OUT2 written %llu\n",
+         (unsigned long long)io.inPos[0], (unsigned long long)io.inPos[1],
+         (unsigned long long)io.outCount[0], (unsigned long long)io.outCount[1]);
+  if (io.loopback) printf("FIFO holds %llu words\n", (unsigned long long)io.fifo.Count());
+}
+
+static void Usage()
+{
+  printf("Usage: HovalaagReplay [options] <checkpoint file> <cycle>\n"
+         "  -i <file>  Input data of the recorded run (default: the file it was recorded with)\n"
+         "  -n <n>     Then step n cycles, printing the state and the words read and written\n"
+         "  -l         List the checkpoints in the file\n");
+}
+
+int main(int argc, char* argv[])
+{
+  const char* inputFileName = NULL;
+  uint64_t traceCycles = 0;
+  bool list = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:n:lh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'i': inputFileName = optarg; break;
+      case 'n': traceCycles = strtoull(optarg, NULL, 0); break;
+      case 'l': list = true; break;
+      default: Usage(); return 1;
+    }
+  }
+  if (optind != argc - 2)
+  {
+    Usage();
+    return 1;
+  }
+  uint64_t cycle = strtoull(argv[optind + 1], NULL, 0);
+
+  HovalaagCheckpoints checkpoints;
+  if (!checkpoints.Load(argv[optind])) return 2;
+  const HovalaagCheckpointHeader& header = checkpoints.header;
+
+  if (list)
+  {
+    printf("%llu checkpoints every %llu cycles, %llu FIFO pages\n", (unsigned long long)checkpoints.checkpoints.size(),
+           (unsigned long long)header.interval, (unsigned long long)checkpoints.pagesSaved);
+    for (size_t i = 0; i < checkpoints.checkpoints.size(); ++i)
+    {
+      const HovalaagCheckpoint& c = checkpoints.checkpoints[i];
+      int pages = 0;
+      for (int p = 0; p < HOVALAAG_CHECKPOINT_PAGES; ++p)
+        if (c.fifo[p]) ++pages;
+      printf("%12llu  PC=%02x  IN1 %llu IN2 %llu OUT1 %llu OUT2 %llu  %d pages\n",
+             (unsigned long long)c.state.cycles, c.state.PC, (unsigned long long)c.inPos[0],
+             (unsigned long long)c.inPos[1], (unsigned long long)c.outCount[0], (unsigned long long)c.outCount[1],
+             pages);
+    }
+    if (checkpoints.ended)
+      printf("%s after %llu cycles\n", StopName(checkpoints.endStop), (unsigned long long)checkpoints.endCycles);
+  }
+
+  if (!inputFileName) inputFileName = header.inputFileName;
+  std::vector<uint16_t> in1, in2;
+  bool loaded = EndsWith(inputFileName, ".bin") ? HovalaagLoadInputBin(inputFileName, &in1)
+                                                : HovalaagLoadInputText(inputFileName, &in1, &in2);
+  if (!loaded) return 4;
+  if (in1.size() != header.inLen[0] || in2.size() != header.inLen[1])
+  {
+    printf("%s isn't the input the run was recorded with\n", inputFileName);
+    return 4;
+  }
+
+  HovalaagCpu cpu;
+  TraceIo io;
+  io.SetInput(0, in1.data(), in1.size());
+  io.SetInput(1, in2.data(), in2.size());
+  io.collect = false;
+  checkpoints.Setup(cpu, io);
+
+  const HovalaagCheckpoint& c = checkpoints.Find(cycle);
+  HovalaagCheckpoints::Restore(c, cpu, io);
+  double start = Now();
+  HovalaagStop stop = HOVALAAG_CYCLE_LIMIT;
+  if (cycle > c.state.cycles) stop = cpu.Run(io, cycle - c.state.cycles);
+  double elapsed = Now() - start;
+  printf("Restored cycle %llu, ran %llu cycles in %.3f s\n", (unsigned long long)c.state.cycles,
+         (unsigned long long)(cpu.state.cycles - c.state.cycles), elapsed);
+  PrintState(stop, cpu, io);
+  if (stop != HOVALAAG_CYCLE_LIMIT) return 0;
+
+  io.trace = true;
+  for (uint64_t i = 0; i < traceCycles; ++i)
+  {
+    const HovalaagState& s = cpu.state;
+    printf("%llu: PC=%02x A=%03x B=%03x C=%03x D=%03x W=%03x OUT=%03x F=%d\n", (unsigned long long)s.cycles, s.PC,
+           s.A, s.B, s.C, s.D, s.W, s.OUT, s.F);
+    stop = cpu.Step(io);
+    if (stop != HOVALAAG_CYCLE_LIMIT)
+    {
+      printf("%s\n", StopName(stop));
+      break;
+    }
+  }
+  return 0;
+}
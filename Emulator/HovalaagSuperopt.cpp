@@ -0,0 +1,773 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Search for a program that writes the same outputs as a reference program
+// in fewer cycles.
+//
+// The reference is assembled with the assembler library and run on random
+// input vectors, and the outputs it writes become the specification, OUT1
+// and OUT2 each a stream of its own as in HovalaagTest.  Each thread then
+// runs a stochastic search (Markov chain Monte Carlo, as STOKE does) over
+// vls_instruction encodings, starting from the reference: a random change is
+// made to the program - a unit op, the ALU operation, a constant or a jump
+// target, or an instruction replaced, copied, swapped, inserted or deleted -
+// and kept or undone by comparing costs.  The cost is the number of wrong
+// output bits, weighted by the reference's cycles per output, plus the cycles
+// taken.  A change that costs more is still kept with a probability falling
+// off exponentially with the increase, so the search can cross incorrect
+// programs to reach better ones.
+//
+// Candidates are first run on a few short vectors.  Only one that writes all
+// of their outputs correctly, in no more cycles than the best program so far,
+// is run on the full set of vectors, and if it passes and is faster (or as
+// fast and shorter) it becomes the best, which is shared by all the threads.
+// A thread that hasn't got close to the best for a while restarts from it.
+// One of the full vectors is long enough for a count in C to wrap.
+//
+// The best program has the unit ops it doesn't need cleared and is written
+// out as assembler source, which is assembled again and checked on the full
+// vectors.  Passing the vectors is evidence, not proof, that the program is
+// equivalent to the reference.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Hovalaag.h"
+#include "vls.h"
+
+#define DefaultSeconds 10
+#define DefaultVectors 64
+#define DefaultWords 256
+#define DefaultMaxCycles 65536ULL
+#define FastMaxCycles 4096      // the reference's cycles on a fast vector
+#define FastVectors 4
+#define FastWords 16
+#define LongWords 8192          // one full vector is long enough to wrap C,
+#define LongMaxCycles 16        // and has this many times the cycles
+#define RestartInterval 65536
+#define NumAluOps 13
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool EndsWith(const char* s, const char* suffix)
+{
+  size_t len = strlen(s);
+  size_t suffixLen = strlen(suffix);
+  return len >= suffixLen && !strcmp(s + len - suffixLen, suffix);
+}
+
+// xorshift64*, one per thread
+struct Random
+{
+  uint64_t s;
+
+  explicit Random(uint64_t seed) : s(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+  uint64_t Next()
+  {
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 0x2545f4914f6cdd1dULL;
+  }
+  int Below(int n) { return (int)(((Next() >> 32) * n) >> 32); }
+  double Unit() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+// One instruction of a candidate.  The constant and jump target are kept
+// apart, and only packed into v.value when the program is encoded.
+struct Instr
+{
+  vls_instruction v;
+  int constant;
+  int target;
+};
+
+struct Program
+{
+  int len;
+  Instr instr[VLS_MAX_INSTRUCTIONS];
+};
+
+static bool UsesAlu(const vls_instruction& v)
+{
+  return v.a == A_from_alu || v.b == B_from_alu || v.c == C_from_alu || v.w == W_from_alu || v.f != F_nop;
+}
+
+static bool UsesConstant(const vls_instruction& v)
+{
+  return v.b == B_from_const || v.w == W_from_const;
+}
+
+static bool UsesTarget(const vls_instruction& v)
+{
+  return v.c == DECNZ || v.j != J_step;
+}
+
+static bool UsesIo(const vls_instruction& v)
+{
+  return v.a == A_from_in1 || v.o != O_nop;
+}
+
+// Put an instruction in the form the assembler gives for its source, and
+// check it can be encoded.  Fields no unit uses are cleared, B=0 and W=0 use
+// the ALU's 0 when the ALU is free, and an instruction doing nothing jumps to
+// the next, as there is no way to write an empty instruction.
+static bool Normalize(Instr* in, int pc)
+{
+  vls_instruction& v = in->v;
+  if (v.a == A_nop && v.b == B_nop && v.c == C_nop && v.d == D_nop && v.w == W_nop && v.o == O_nop &&
+      v.f == F_nop && v.j == J_step)
+  {
+    v.j = J_jump;
+    in->target = pc + 1;
+  }
+  if (v.alu >= NumAluOps) return false;
+  if (!UsesAlu(v) || v.alu == 0)
+  {
+    if (v.b == B_from_const && in->constant == 0)
+    {
+      v.b = B_from_alu;
+      v.alu = 0;
+    }
+    if (v.w == W_from_const && in->constant == 0)
+    {
+      v.w = W_from_alu;
+      v.alu = 0;
+    }
+  }
+  if (!UsesAlu(v)) v.alu = 0;
+  if (!UsesIo(v)) v.io = 0;
+  if (!UsesConstant(v)) in->constant = 0;
+  if (!UsesTarget(v)) in->target = 0;
+
+  if (UsesConstant(v) && UsesTarget(v) && in->constant != in->target)
+  {
+    // K and L share the value field as two 6-bit constants
+    if (in->target > 63 || in->constant < -32 || in->constant > 31) return false;
+    v.value = (in->constant << 6) | in->target;
+    v.two_constants = 1;
+  }
+  else
+  {
+    v.value = UsesTarget(v) ? in->target : in->constant;
+    v.two_constants = 0;
+  }
+  return true;
+}
+
+static bool Encode(Program* p, uint32_t image[HOVALAAG_PROGRAM_SIZE])
+{
+  for (int pc = 0; pc < p->len; ++pc)
+  {
+    if (!Normalize(&p->instr[pc], pc)) return false;
+    image[pc] = vls_encode(p->instr[pc].v);
+  }
+  for (int pc = p->len; pc < HOVALAAG_PROGRAM_SIZE; ++pc)
+    image[pc] = 0;
+  return true;
+}
+
+static const char* const aluText[NumAluOps] =
+{
+  "0", "-A", "B", "C", "A>>1", "A+B", "B-A", "A+B+F", "B-A-F", "A|B", "A&B", "A^B", "~A",
+};
+
+static void AddOp(std::vector<std::string>* ops, const char* format, ...)
+{
+  char buf[64];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  ops->push_back(buf);
+}
+
+// Write a normalized program as assembler source, with a label "Ln" at
+// each address jumped to
+static std::string Disassemble(const Program& p)
+{
+  bool isTarget[VLS_MAX_INSTRUCTIONS + 1] = { false };
+  for (int pc = 0; pc < p.len; ++pc)
+    if (UsesTarget(p.instr[pc].v)) isTarget[p.instr[pc].target] = true;
+
+  std::string text;
+  char buf[64];
+  for (int pc = 0; pc <= p.len; ++pc)
+  {
+    if (isTarget[pc]) snprintf(buf, sizeof(buf), "L%d:", pc);
+    else buf[0] = 0;
+    text += buf;
+    if (pc == p.len)
+    {
+      text += "\n";
+      break;
+    }
+    text.append(8 - strlen(buf) % 8, ' ');
+
+    const Instr& in = p.instr[pc];
+    const vls_instruction& v = in.v;
+    const char* alu = aluText[v.alu];
+    std::vector<std::string> ops;
+    if (v.a == A_from_D) AddOp(&ops, "A=D");
+    else if (v.a == A_from_alu) AddOp(&ops, "A=%s", alu);
+    else if (v.a == A_from_in1) AddOp(&ops, "A=IN%d", v.io + 1);
+    if (v.b == B_from_A) AddOp(&ops, "B=A");
+    else if (v.b == B_from_alu) AddOp(&ops, "B=%s", alu);
+    else if (v.b == B_from_const) AddOp(&ops, "B=%d", in.constant);
+    if (v.c == C_from_alu) AddOp(&ops, "C=%s", alu);
+    else if (v.c == DEC) AddOp(&ops, "DEC");
+    else if (v.c == DECNZ) AddOp(&ops, "DECNZ L%d", in.target);
+    if (v.d) AddOp(&ops, "D=A");
+    if (v.w == W_from_A) AddOp(&ops, "W=A");
+    else if (v.w == W_from_alu) AddOp(&ops, "W=%s", alu);
+    else if (v.w == W_from_const) AddOp(&ops, "W=%d", in.constant);
+    if (v.o) AddOp(&ops, "OUT%d=W", v.io + 1);
+    if (v.f == F_zero) AddOp(&ops, "F=ZERO(%s)", alu);
+    else if (v.f == F_neg) AddOp(&ops, "F=NEG(%s)", alu);
+    else if (v.f == F_pos) AddOp(&ops, "F=POS(%s)", alu);
+    if (v.j == J_jump) AddOp(&ops, "JMP L%d", in.target);
+    else if (v.j == J_jump_true) AddOp(&ops, "JMPT L%d", in.target);
+    else if (v.j == J_jump_false) AddOp(&ops, "JMPF L%d", in.target);
+
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+      if (i) text += ", ";
+      text += ops[i];
+    }
+    text += "\n";
+  }
+  return text;
+}
+
+// Inputs for one run and the outputs the reference writes for them
+struct Vector
+{
+  std::vector<uint16_t> in[2];
+  std::vector<uint16_t> out[2];
+  uint64_t cycles;                // for the reference to write all its outputs
+};
+
+// Run a program on a vector until it has written as many words as the
+// reference, or has had twice as long.  Returns the number of wrong bits,
+// counting every missing or extra word as wrong in all 12.
+static uint64_t RunVector(HovalaagCpu& cpu, HovalaagStreamIo& io, const Vector& vec, uint64_t* cycles)
+{
+  cpu.Reset();
+  io.Reset();
+  io.SetInput(0, vec.in[0].data(), vec.in[0].size());
+  io.SetInput(1, vec.in[1].data(), vec.in[1].size());
+  io.haltAfter = vec.out[0].size() + vec.out[1].size();
+  cpu.Run(io, vec.cycles * 2 + HOVALAAG_PROGRAM_SIZE);
+  *cycles = cpu.state.cycles;
+
+  uint64_t wrong = 0;
+  for (int port = 0; port < 2; ++port)
+  {
+    const std::vector<uint16_t>& got = io.out[port];
+    const std::vector<uint16_t>& expected = vec.out[port];
+    size_t n = got.size() < expected.size() ? got.size() : expected.size();
+    for (size_t i = 0; i < n; ++i)
+      wrong += __builtin_popcount((got[i] ^ expected[i]) & 0xfff);
+    wrong += 12 * (got.size() > expected.size() ? got.size() - expected.size() : expected.size() - got.size());
+  }
+  return wrong;
+}
+
+struct Score
+{
+  uint64_t wrong;
+  uint64_t cycles;
+};
+
+static Score RunVectors(HovalaagCpu& cpu, HovalaagStreamIo& io, const std::vector<Vector>& vectors, bool stopIfWrong)
+{
+  Score score = { 0, 0 };
+  for (const Vector& vec : vectors)
+  {
+    uint64_t cycles;
+    score.wrong += RunVector(cpu, io, vec, &cycles);
+    score.cycles += cycles;
+    if (stopIfWrong && score.wrong) break;
+  }
+  return score;
+}
+
+// Run the reference on a vector's inputs to fill in its outputs.
+// Returns false if it writes nothing.
+static bool RunReference(const uint32_t* image, int len, Vector* vec, uint64_t maxCycles)
+{
+  HovalaagCpu cpu;
+  cpu.Load(image, len);
+  HovalaagStreamIo io;
+  io.SetInput(0, vec->in[0].data(), vec->in[0].size());
+  io.SetInput(1, vec->in[1].data(), vec->in[1].size());
+  io.stopAtEnd = true;
+  cpu.Run(io, maxCycles);
+  vec->out[0] = io.out[0];
+  vec->out[1] = io.out[1];
+  if (vec->out[0].empty() && vec->out[1].empty()) return false;
+
+  // The cycles up to the last output, rather than to running out of input
+  cpu.Reset();
+  io.Reset();
+  io.haltAfter = vec->out[0].size() + vec->out[1].size();
+  cpu.Run(io, maxCycles);
+  vec->cycles = cpu.state.cycles;
+  return true;
+}
+
+struct Search
+{
+  std::vector<Vector> fast;
+  std::vector<Vector> full;
+  std::vector<int> constants;     // constants used by the reference
+  int maxLen;
+  double errorWeight;             // cost of a wrong bit, in cycles
+  double temperature;
+  double endTime;
+  uint64_t seed;
+
+  // The best program so far, shared by all threads
+  std::mutex lock;
+  Program best;
+  uint64_t bestFullCycles;
+  std::atomic<uint64_t> bestFastCycles;
+  std::atomic<int> bestLen;
+  std::atomic<int> bestVersion;
+  double startTime;
+
+  std::atomic<uint64_t> iterations;
+  std::atomic<uint64_t> fullChecks;
+};
+
+static void RandomField(Search& search, Random& rnd, Instr* in, int len, int field)
+{
+  vls_instruction& v = in->v;
+  switch (field)
+  {
+    case 0: v.a = rnd.Below(4); break;
+    case 1: v.b = rnd.Below(4); break;
+    case 2: v.c = rnd.Below(4); break;
+    case 3: v.d = rnd.Below(2); break;
+    case 4: v.w = rnd.Below(4); break;
+    case 5: v.o = rnd.Below(2); break;
+    case 6: v.io = rnd.Below(2); break;
+    case 7: v.f = rnd.Below(4); break;
+    case 8: v.j = rnd.Below(4); break;
+    case 9: v.alu = rnd.Below(NumAluOps); break;
+    case 10:
+    {
+      // Mostly small steps and the reference's own constants
+      int r = rnd.Below(4);
+      if (r < 2) in->constant += rnd.Below(2) ? 1 + rnd.Below(4) : -1 - rnd.Below(4);
+      else if (r == 2 && !search.constants.empty()) in->constant = search.constants[rnd.Below(search.constants.size())];
+      else in->constant = rnd.Below(4096) - 2048;
+      if (in->constant < -2048 || in->constant > 2047) in->constant = 0;
+      break;
+    }
+    default: in->target = rnd.Below(len); break;
+  }
+}
+
+#define NumFields 12
+
+// Make one random change to a program
+static void Mutate(Search& search, Random& rnd, Program* p)
+{
+  int i = rnd.Below(p->len);
+  int move = rnd.Below(10);
+  if (move < 5)
+  {
+    RandomField(search, rnd, &p->instr[i], p->len, rnd.Below(NumFields));
+  }
+  else if (move == 5)
+  {
+    for (int field = 0; field < NumFields; ++field)
+      RandomField(search, rnd, &p->instr[i], p->len, field);
+  }
+  else if (move == 6)
+  {
+    p->instr[i] = p->instr[rnd.Below(p->len)];
+  }
+  else if (move == 7)
+  {
+    int j = rnd.Below(p->len);
+    Instr t = p->instr[i];
+    p->instr[i] = p->instr[j];
+    p->instr[j] = t;
+  }
+  else if (move == 8 && p->len > 1)
+  {
+    // Delete, jumps past it move back one
+    memmove(&p->instr[i], &p->instr[i + 1], (p->len - i - 1) * sizeof(Instr));
+    --p->len;
+    for (int pc = 0; pc < p->len; ++pc)
+      if (p->instr[pc].target > i) --p->instr[pc].target;
+  }
+  else if (move == 9 && p->len < search.maxLen)
+  {
+    // Insert a copy of an instruction, jumps past it move on one
+    Instr copy = p->instr[rnd.Below(p->len)];
+    memmove(&p->instr[i + 1], &p->instr[i], (p->len - i) * sizeof(Instr));
+    ++p->len;
+    p->instr[i] = copy;
+    for (int pc = 0; pc < p->len; ++pc)
+      if (pc != i && p->instr[pc].target > i) ++p->instr[pc].target;
+  }
+}
+
+static double Cost(const Search& search, const Score& score)
+{
+  return score.wrong * search.errorWeight + score.cycles;
+}
+
+static void Worker(int self, Search& search)
+{
+  Random rnd(search.seed + self);
+  HovalaagCpu cpu;
+  HovalaagStreamIo io;
+  io.stopAtEnd = true;
+  uint32_t image[HOVALAAG_PROGRAM_SIZE];
+
+  Program current, next;
+  int version;
+  {
+    std::lock_guard<std::mutex> guard(search.lock);
+    current = search.best;
+    version = search.bestVersion;
+  }
+  Encode(&current, image);
+  cpu.Load(image, current.len);
+  double currentCost = Cost(search, RunVectors(cpu, io, search.fast, false));
+  double bestCostSinceRestart = currentCost;
+
+  uint64_t n;
+  for (n = 1; Now() < search.endTime; ++n)
+  {
+    // Go back to the best program when the search has found nothing close
+    // to it since the last restart, or someone has found a better one
+    if (n % RestartInterval == 0 &&
+        (bestCostSinceRestart > search.bestFastCycles || search.bestVersion != version))
+    {
+      std::lock_guard<std::mutex> guard(search.lock);
+      current = search.best;
+      version = search.bestVersion;
+      Encode(&current, image);
+      cpu.Load(image, current.len);
+      currentCost = Cost(search, RunVectors(cpu, io, search.fast, false));
+      bestCostSinceRestart = currentCost;
+    }
+
+    next = current;
+    Mutate(search, rnd, &next);
+    if (!Encode(&next, image)) continue;
+    cpu.Load(image, next.len);
+    Score score = RunVectors(cpu, io, search.fast, false);
+    double cost = Cost(search, score);
+
+    if (cost > currentCost && rnd.Unit() >= exp((currentCost - cost) / search.temperature)) continue;
+    current = next;
+    currentCost = cost;
+    if (cost < bestCostSinceRestart) bestCostSinceRestart = cost;
+
+    // Only a candidate right on the fast vectors and no slower than the best
+    // is worth the full check
+    if (score.wrong || score.cycles > search.bestFastCycles ||
+        (score.cycles == search.bestFastCycles && current.len >= search.bestLen))
+      continue;
+    ++search.fullChecks;
+    Score full = RunVectors(cpu, io, search.full, true);
+    if (full.wrong) continue;
+
+    std::lock_guard<std::mutex> guard(search.lock);
+    if (full.cycles < search.bestFullCycles || (full.cycles == search.bestFullCycles && current.len < search.bestLen))
+    {
+      search.best = current;
+      search.bestFullCycles = full.cycles;
+      search.bestFastCycles = score.cycles;
+      search.bestLen = current.len;
+      version = ++search.bestVersion;
+      printf("%7.2f s: %llu cycles, %d instructions\n", Now() - search.startTime,
+             (unsigned long long)full.cycles, current.len);
+      fflush(stdout);
+    }
+  }
+  search.iterations += n - 1;
+}
+
+// Clear each unit op of the best program that it still passes the full
+// vectors without, no slower, so the source doesn't carry the dead ops the
+// search leaves behind
+static void Simplify(Search& search, Program* p)
+{
+  HovalaagCpu cpu;
+  HovalaagStreamIo io;
+  io.stopAtEnd = true;
+  uint32_t image[HOVALAAG_PROGRAM_SIZE];
+  Encode(p, image);
+  cpu.Load(image, p->len);
+  uint64_t cycles = RunVectors(cpu, io, search.full, true).cycles;
+
+  for (int pc = 0; pc < p->len; ++pc)
+  {
+    for (int field = 0; field < 8; ++field)
+    {
+      Program q = *p;
+      vls_instruction& v = q.instr[pc].v;
+      switch (field)
+      {
+        case 0: if (v.a == A_nop) continue; v.a = A_nop; break;
+        case 1: if (v.b == B_nop) continue; v.b = B_nop; break;
+        case 2: if (v.c == C_nop) continue; v.c = C_nop; break;
+        case 3: if (v.d == D_nop) continue; v.d = D_nop; break;
+        case 4: if (v.w == W_nop) continue; v.w = W_nop; break;
+        case 5: if (v.o == O_nop) continue; v.o = O_nop; break;
+        case 6: if (v.f == F_nop) continue; v.f = F_nop; break;
+        default: if (v.j == J_step) continue; v.j = J_step; break;
+      }
+      if (!Encode(&q, image)) continue;
+      cpu.Load(image, q.len);
+      Score score = RunVectors(cpu, io, search.full, true);
+      if (!score.wrong && score.cycles <= cycles) *p = q;
+    }
+  }
+}
+
+static bool ReadFile(const char* fileName, std::string* text)
+{
+  FILE* f = fopen(fileName, "rb");
+  if (!f)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    text->append(buf, n);
+  fclose(f);
+  return true;
+}
+
+static void RandomInputs(Random& rnd, Vector* vec, int words, int lo, int hi)
+{
+  for (int port = 0; port < 2; ++port)
+    for (int i = 0; i < words; ++i)
+      vec->in[port].push_back((lo + rnd.Below(hi - lo + 1)) & 0xfff);
+}
+
+static uint64_t Outputs(const std::vector<Vector>& vectors)
+{
+  uint64_t n = 0;
+  for (const Vector& vec : vectors)
+    n += vec.out[0].size() + vec.out[1].size();
+  return n;
+}
+
+static void Usage()
+{
+  printf("Usage: HovalaagSuperopt [options] <source file>\n"
+         "  -o <file>     Write the program found here (default: print it)\n"
+         "  -i <file>     Also check on this input, .txt columns or .bin bytes\n"
+         "  -j <n>        Number of threads (default: one per core)\n"
+         "  -t <s>        Seconds to search for (default %d)\n"
+         "  -n <n>        Number of random input vectors (default %d)\n"
+         "  -w <n>        Words per input in each vector (default %d)\n"
+         "  -m <lo>:<hi>  Range of the random inputs (default -2048:2047)\n"
+         "  -c <n>        Maximum cycles for the reference on a vector (default %llu)\n"
+         "  -L <n>        Maximum program length (default: the reference's, plus 4)\n"
+         "  -T <x>        Temperature, in cycles per output (default 1)\n"
+         "  -r <n>        Random seed (default 1)\n",
+         DefaultSeconds, DefaultVectors, DefaultWords, DefaultMaxCycles);
+}
+
+int main(int argc, char* argv[])
+{
+  const char* outFileName = NULL;
+  const char* inputFileName = NULL;
+  int numThreads = std::thread::hardware_concurrency();
+  double seconds = DefaultSeconds;
+  int numVectors = DefaultVectors;
+  int words = DefaultWords;
+  int lo = -2048, hi = 2047;
+  uint64_t maxCycles = DefaultMaxCycles;
+  int maxLen = 0;
+  double temperature = 1;
+  uint64_t seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:i:j:t:n:w:m:c:L:T:r:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'o': outFileName = optarg; break;
+      case 'i': inputFileName = optarg; break;
+      case 'j': numThreads = atoi(optarg); break;
+      case 't': seconds = atof(optarg); break;
+      case 'n': numVectors = atoi(optarg); break;
+      case 'w': words = atoi(optarg); break;
+      case 'm':
+        if (sscanf(optarg, "%d:%d", &lo, &hi) != 2 || lo > hi || lo < -2048 || hi > 4095)
+        {
+          Usage();
+          return 1;
+        }
+        break;
+      case 'c': maxCycles = strtoull(optarg, NULL, 0); break;
+      case 'L': maxLen = atoi(optarg); break;
+      case 'T': temperature = atof(optarg); break;
+      case 'r': seed = strtoull(optarg, NULL, 0); break;
+      default: Usage(); return 1;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    Usage();
+    return 1;
+  }
+  if (numThreads < 1) numThreads = 1;
+
+  std::string source;
+  if (!ReadFile(argv[optind], &source)) return 2;
+  vls_assembler* as = vls_create();
+  vls_program reference;
+  vls_error error;
+  if (!as || !vls_assemble(as, source.data(), source.size(), &reference, &error))
+  {
+    if (as) printf("ASM error, line %d: %s\n", error.line, error.message);
+    return 2;
+  }
+
+  Search search;
+  Program& start = search.best;
+  start.len = reference.num_instructions;
+  for (int pc = 0; pc < start.len; ++pc)
+  {
+    Instr& in = start.instr[pc];
+    in.v = reference.program[pc];
+    in.target = in.v.two_constants ? (in.v.value & 63) : (in.v.value & 255);
+    in.constant = in.v.two_constants ? (in.v.value >> 6) : in.v.value;
+    if (UsesConstant(in.v)) search.constants.push_back(in.constant);
+  }
+  uint32_t image[HOVALAAG_PROGRAM_SIZE];
+  if (start.len == 0 || !Encode(&start, image))
+  {
+    printf("%s has no program to start from\n", argv[optind]);
+    return 2;
+  }
+
+  // The vectors, with the reference's outputs for them
+  Random rnd(seed);
+  for (int i = 0; i <= FastVectors + numVectors; ++i)
+  {
+    Vector vec;
+    bool fast = i < FastVectors;
+    bool isLong = i == FastVectors + numVectors;
+    RandomInputs(rnd, &vec, fast ? FastWords : isLong ? LongWords : words, lo, hi);
+    uint64_t limit = fast ? FastMaxCycles : isLong ? maxCycles * LongMaxCycles : maxCycles;
+    if (!RunReference(image, start.len, &vec, limit)) continue;
+    (fast ? search.fast : search.full).push_back(vec);
+  }
+  if (inputFileName)
+  {
+    Vector vec;
+    bool ok = EndsWith(inputFileName, ".bin") ? HovalaagLoadInputBin(inputFileName, &vec.in[0])
+                                              : HovalaagLoadInputText(inputFileName, &vec.in[0], &vec.in[1]);
+    if (!ok) return 4;
+    if (RunReference(image, start.len, &vec, maxCycles)) search.full.push_back(vec);
+  }
+  if (search.fast.empty() || search.full.empty())
+  {
+    printf("The reference writes no outputs for the inputs\n");
+    return 3;
+  }
+
+  HovalaagCpu cpu;
+  HovalaagStreamIo io;
+  io.stopAtEnd = true;
+  cpu.Load(image, start.len);
+  Score fastScore = RunVectors(cpu, io, search.fast, false);
+  Score fullScore = RunVectors(cpu, io, search.full, false);
+  uint64_t fullOutputs = Outputs(search.full);
+  double perOutput = (double)fastScore.cycles / Outputs(search.fast);
+  printf("Reference: %d instructions, %llu cycles for %llu outputs, %.2f cycles per output\n", start.len,
+         (unsigned long long)fullScore.cycles, (unsigned long long)fullOutputs,
+         (double)fullScore.cycles / fullOutputs);
+
+  search.maxLen = maxLen > 0 ? maxLen : start.len + 4;
+  if (search.maxLen > VLS_MAX_INSTRUCTIONS - 1) search.maxLen = VLS_MAX_INSTRUCTIONS - 1;
+  search.errorWeight = perOutput;
+  search.temperature = temperature * perOutput;
+  search.seed = seed;
+  search.bestFullCycles = fullScore.cycles;
+  search.bestFastCycles = fastScore.cycles;
+  search.bestLen = start.len;
+  search.bestVersion = 0;
+  search.iterations = 0;
+  search.fullChecks = 0;
+  search.startTime = Now();
+  search.endTime = search.startTime + seconds;
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numThreads; ++i)
+    threads.push_back(std::thread(Worker, i, std::ref(search)));
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  double elapsed = Now() - search.startTime;
+
+  printf("%llu candidates in %.2f s on %d threads (%.0f per second), %llu fully checked\n",
+         (unsigned long long)search.iterations, elapsed, numThreads, search.iterations / elapsed,
+         (unsigned long long)search.fullChecks);
+  printf("Best: %d instructions, %llu cycles for %llu outputs, %.2f cycles per output\n", search.bestLen.load(),
+         (unsigned long long)search.bestFullCycles, (unsigned long long)fullOutputs,
+         (double)search.bestFullCycles / fullOutputs);
+
+  // Assemble the source written for the best program, and check it again
+  Program best = search.best;
+  Simplify(search, &best);
+  Encode(&best, image);
+  std::string text = Disassemble(best);
+  vls_program assembled;
+  if (!vls_assemble(as, text.data(), text.size(), &assembled, &error))
+  {
+    printf("The program found doesn't assemble: line %d: %s\n%s", error.line, error.message, text.c_str());
+    return 5;
+  }
+  cpu.Load(assembled.image, assembled.num_instructions);
+  if (assembled.num_instructions != best.len ||
+      memcmp(assembled.image, image, best.len * sizeof(uint32_t)) ||
+      RunVectors(cpu, io, search.full, true).wrong)
+  {
+    printf("The program found assembles to something different:\n%s", text.c_str());
+    return 5;
+  }
+  vls_destroy(as);
+
+  if (!outFileName)
+  {
+    printf("\n%s", text.c_str());
+    return 0;
+  }
+  FILE* f = fopen(outFileName, "w");
+  if (!f || fputs(text.c_str(), f) < 0 || fclose(f) != 0)
+  {
+    printf("Failed to write %s\n", outFileName);
+    return 6;
+  }
+  return 0;
+}
@@ -0,0 +1,593 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Run a directory of test cases on the software model of the CPU.
+//
+// Each subdirectory of the test directory is one case, containing:
+//   <name>.asm    The program source, assembled with the Hovalaag assembler
+//                 library (assembler/vls.h) or the assembler given by -a
+//                 (or an already assembled a.out)
+//   input.txt     Input data in the same format as Inject (optional)
+//   output1.txt   Expected OUT1 values in decimal, one per line
+//   output2.txt   Expected OUT2 values (optional)
+//   options       Extra options for the case (optional): -l, -s and -c <n>
+//                 as for HovalaagEmu
+//
+// A case runs until it has written as many words as expected on the ports it
+// has expected output for, and passes if they are the expected values.  A
+// port with no file isn't checked, whatever is written to it.
+//
+// Outputs are compared by a rolling hash, so neither the expected nor the
+// actual output is ever held in memory.  The hash is also recorded every
+// CheckpointWords words, which tells us which block of the output first
+// differs, and stops a case as soon as a block is wrong.
+//
+// Cases are spread across threads with a work stealing scheduler: each thread
+// takes cases from the back of its own queue, and when that is empty steals
+// from the front of the others.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Hovalaag.h"
+#include "vls.h"
+
+#define DefaultMaxCycles 100000000ULL
+#define CheckpointWords 4096
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool EndsWith(const char* s, const char* suffix)
+{
+  size_t len = strlen(s);
+  size_t suffixLen = strlen(suffix);
+  return len >= suffixLen && !strcmp(s + len - suffixLen, suffix);
+}
+
+static bool FileExists(const std::string& fileName)
+{
+  struct stat st;
+  return stat(fileName.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Rolling hash of a stream of output words
+struct HashStream
+{
+  uint64_t count;
+  uint64_t hash;
+  std::vector<uint64_t> checkpoints;   // hash after each CheckpointWords words
+
+  HashStream() : count(0), hash(0) {}
+
+  void Add(uint16_t value)
+  {
+    hash = hash * 0x100000001b3ULL + value + 1;
+    if (++count % CheckpointWords == 0) checkpoints.push_back(hash);
+  }
+};
+
+// Hash a file of expected output values, one decimal value per line
+static bool HashFile(const std::string& fileName, HashStream* h)
+{
+  FILE* f = fopen(fileName.c_str(), "rb");
+  if (!f) return false;
+
+  char buf[256];
+  while (fgets(buf, sizeof(buf), f))
+  {
+    char* end;
+    long v = strtol(buf, &end, 10);
+    if (end == buf) continue;
+    h->Add(v & 0xfff);
+  }
+  fclose(f);
+  return true;
+}
+
+// Hashes the outputs of the checked ports as they are written, and halts the
+// CPU when all the expected outputs have arrived or as soon as they are known
+// to be wrong.
+class CheckingIo : public HovalaagStreamIo
+{
+public:
+  CheckingIo(const HashStream* expected, const bool* checked) : expected(expected), checked(checked), wrong(false)
+  {
+    collect = false;
+  }
+
+  virtual void Out(int port, uint16_t value)
+  {
+    HovalaagStreamIo::Out(port, value);
+    if (!checked[port]) return;
+    HashStream& h = actual[port];
+    const HashStream& e = expected[port];
+    h.Add(value);
+    if (h.count > e.count ||
+        (h.count % CheckpointWords == 0 && h.checkpoints.back() != e.checkpoints[h.checkpoints.size() - 1]))
+    {
+      wrong = true;
+      halt = true;
+    }
+    else if ((!checked[0] || actual[0].count == expected[0].count) &&
+             (!checked[1] || actual[1].count == expected[1].count))
+      halt = true;
+  }
+
+  const HashStream* expected;
+  const bool* checked;
+  HashStream actual[2];
+  bool wrong;
+};
+
+struct Options
+{
+  const char* assembler;   // NULL to use the built in assembler
+  uint64_t maxCycles;
+  bool loopback;
+  bool stopAtEnd;
+};
+
+struct Case
+{
+  std::string name;
+  std::string dir;
+
+  bool passed;
+  std::string message;
+  uint64_t cycles;
+  double wallTime;
+};
+
+// The built in assembler, which can't be shared between threads
+struct BuiltinAssembler
+{
+  vls_assembler* as;
+
+  BuiltinAssembler() : as(vls_create()) {}
+  ~BuiltinAssembler() { vls_destroy(as); }
+};
+
+// Assemble source in memory with this thread's assembler
+static bool AssembleBuiltin(const std::string& source, uint32_t* program, int* programSize, std::string* error)
+{
+  static thread_local BuiltinAssembler builtin;
+  if (!builtin.as)
+  {
+    *error = "failed to create the assembler";
+    return false;
+  }
+
+  FILE* f = fopen(source.c_str(), "rb");
+  if (!f)
+  {
+    *error = "can't read " + source;
+    return false;
+  }
+  std::string text;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    text.append(buf, n);
+  fclose(f);
+
+  vls_program assembled;
+  vls_error asmError;
+  if (!vls_assemble(builtin.as, text.data(), text.size(), &assembled, &asmError))
+  {
+    char message[sizeof(asmError.message) + 64];
+    if (asmError.line)
+      snprintf(message, sizeof(message), "assembly failed: ASM error, line %d: %s", asmError.line, asmError.message);
+    else
+      snprintf(message, sizeof(message), "assembly failed: ASM error: %s", asmError.message);
+    *error = message;
+    return false;
+  }
+
+  memcpy(program, assembled.image, assembled.num_instructions * sizeof(uint32_t));
+  *programSize = assembled.num_instructions;
+  return true;
+}
+
+// Assemble source with the assembler in a temporary directory, as it always
+// writes to a.out in the current directory.
+static bool Assemble(const char* assembler, const std::string& source, uint32_t* program, int* programSize,
+                     std::string* error)
+{
+  char dir[] = "/tmp/hovalaagXXXXXX";
+  if (!mkdtemp(dir))
+  {
+    *error = "failed to create temporary directory";
+    return false;
+  }
+
+  // The child changes directory, so make the paths absolute first
+  char sourcePath[PATH_MAX];
+  char assemblerPath[PATH_MAX];
+  if (!realpath(source.c_str(), sourcePath))
+  {
+    *error = "can't find " + source;
+    rmdir(dir);
+    return false;
+  }
+  if (strchr(assembler, '/'))
+  {
+    if (!realpath(assembler, assemblerPath))
+    {
+      *error = std::string("can't find ") + assembler;
+      rmdir(dir);
+      return false;
+    }
+  }
+  else
+    snprintf(assemblerPath, sizeof(assemblerPath), "%s", assembler);
+
+  std::string logName = std::string(dir) + "/assembler.log";
+  std::string binName = std::string(dir) + "/a.out";
+  char* const args[] = { assemblerPath, sourcePath, NULL };
+
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    int fd = open(logName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || chdir(dir) != 0) _exit(126);
+    dup2(fd, 1);
+    dup2(fd, 2);
+    execvp(assemblerPath, args);
+    _exit(127);
+  }
+
+  int status = 0;
+  bool ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (!ok)
+  {
+    if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 127)
+      *error = std::string("failed to run ") + assemblerPath;
+    else
+    {
+      // The assembler reports the first error and exits
+      *error = "assembly failed";
+      FILE* log = fopen(logName.c_str(), "rb");
+      char buf[256];
+      if (log && fgets(buf, sizeof(buf), log))
+      {
+        buf[strcspn(buf, "\r\n")] = 0;
+        *error += std::string(": ") + buf;
+      }
+      if (log) fclose(log);
+    }
+  }
+  else
+  {
+    *programSize = HovalaagLoadProgram(binName.c_str(), program);
+    if (*programSize < 0)
+    {
+      *error = "assembler did not produce a valid a.out";
+      ok = false;
+    }
+  }
+
+  unlink(binName.c_str());
+  unlink(logName.c_str());
+  rmdir(dir);
+  return ok;
+}
+
+// Read the per case options file
+static bool ReadCaseOptions(const std::string& fileName, Options* options)
+{
+  FILE* f = fopen(fileName.c_str(), "rb");
+  if (!f) return true;
+
+  char buf[256];
+  bool ok = true;
+  while (fgets(buf, sizeof(buf), f))
+  {
+    char* save;
+    for (char* tok = strtok_r(buf, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save))
+    {
+      if (!strcmp(tok, "-l")) options->loopback = true;
+      else if (!strcmp(tok, "-s")) options->stopAtEnd = true;
+      else if (!strcmp(tok, "-c") && (tok = strtok_r(NULL, " \t\r\n", &save)))
+        options->maxCycles = strtoull(tok, NULL, 0);
+      else
+        ok = false;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+static std::string Describe(int port, const HashStream& actual, const HashStream& expected)
+{
+  char buf[128];
+
+  // The first checkpoint that differs gives the block with the first difference
+  size_t numCheckpoints = std::min(actual.checkpoints.size(), expected.checkpoints.size());
+  size_t block = numCheckpoints;
+  for (size_t i = 0; i < numCheckpoints; ++i)
+  {
+    if (actual.checkpoints[i] != expected.checkpoints[i])
+    {
+      block = i;
+      break;
+    }
+  }
+
+  if (block < numCheckpoints || (actual.count == expected.count && actual.hash != expected.hash))
+  {
+    uint64_t first = block * CheckpointWords;
+    uint64_t last = std::min<uint64_t>(first + CheckpointWords, expected.count) - 1;
+    snprintf(buf, sizeof(buf), "OUT%d differs in words %llu-%llu", port + 1, (unsigned long long)first,
+             (unsigned long long)last);
+  }
+  else
+    snprintf(buf, sizeof(buf), "OUT%d has %llu words, expected %llu", port + 1, (unsigned long long)actual.count,
+             (unsigned long long)expected.count);
+  return buf;
+}
+
+static void RunCase(Case& c, const Options& defaults)
+{
+  double start = Now();
+  c.passed = false;
+  c.cycles = 0;
+
+  Options options = defaults;
+  if (!ReadCaseOptions(c.dir + "/options", &options))
+  {
+    c.message = "bad options file";
+    c.wallTime = Now() - start;
+    return;
+  }
+
+  // Find the program
+  std::string source;
+  DIR* d = opendir(c.dir.c_str());
+  if (d)
+  {
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+      if (EndsWith(ent->d_name, ".asm") && (source.empty() || c.dir + "/" + ent->d_name < source))
+        source = c.dir + "/" + ent->d_name;
+    }
+    closedir(d);
+  }
+
+  uint32_t program[HOVALAAG_PROGRAM_SIZE];
+  int programSize = -1;
+  if (!source.empty())
+  {
+    bool assembled = options.assembler ? Assemble(options.assembler, source, program, &programSize, &c.message)
+                                       : AssembleBuiltin(source, program, &programSize, &c.message);
+    if (!assembled)
+    {
+      c.wallTime = Now() - start;
+      return;
+    }
+  }
+  else if (FileExists(c.dir + "/a.out"))
+    programSize = HovalaagLoadProgram((c.dir + "/a.out").c_str(), program);
+  if (programSize < 0)
+  {
+    c.message = "no program";
+    c.wallTime = Now() - start;
+    return;
+  }
+
+  std::vector<uint16_t> in1, in2;
+  if (FileExists(c.dir + "/input.txt") && !HovalaagLoadInputText((c.dir + "/input.txt").c_str(), &in1, &in2))
+  {
+    c.message = "can't read input.txt";
+    c.wallTime = Now() - start;
+    return;
+  }
+
+  HashStream expected[2];
+  bool haveOutput[2];
+  haveOutput[0] = HashFile(c.dir + "/output1.txt", &expected[0]);
+  haveOutput[1] = HashFile(c.dir + "/output2.txt", &expected[1]);
+  if (!haveOutput[0] && !haveOutput[1])
+  {
+    c.message = "no expected output";
+    c.wallTime = Now() - start;
+    return;
+  }
+
+  HovalaagCpu cpu;
+  cpu.Load(program, programSize);
+  CheckingIo io(expected, haveOutput);
+  io.SetInput(0, in1.data(), in1.size());
+  io.SetInput(1, in2.data(), in2.size());
+  io.loopback = options.loopback;
+  io.stopAtEnd = options.stopAtEnd;
+
+  // Nothing to wait for if no output is expected
+  HovalaagStop stop = HOVALAAG_HALTED;
+  if (expected[0].count || expected[1].count)
+    stop = cpu.Run(io, options.maxCycles);
+  c.cycles = cpu.state.cycles;
+
+  std::string problems;
+  for (int port = 0; port < 2; ++port)
+  {
+    if (!haveOutput[port]) continue;
+    const HashStream& a = io.actual[port];
+    const HashStream& e = expected[port];
+    if (a.count != e.count || a.hash != e.hash)
+    {
+      if (!problems.empty()) problems += ", ";
+      problems += Describe(port, a, e);
+    }
+  }
+
+  if (problems.empty())
+    c.passed = true;
+  else if (stop == HOVALAAG_CYCLE_LIMIT)
+    c.message = "cycle limit reached: " + problems;
+  else if (stop == HOVALAAG_INPUT_STALL)
+    c.message = "ran out of input: " + problems;
+  else
+    c.message = problems;
+  c.wallTime = Now() - start;
+}
+
+// Per thread queue of case indices
+struct WorkQueue
+{
+  std::mutex lock;
+  std::deque<int> cases;
+};
+
+static void Worker(int self, std::vector<WorkQueue>& queues, std::vector<Case>& cases, const Options& options)
+{
+  int numQueues = queues.size();
+  for (;;)
+  {
+    int next = -1;
+    {
+      std::lock_guard<std::mutex> guard(queues[self].lock);
+      if (!queues[self].cases.empty())
+      {
+        next = queues[self].cases.back();
+        queues[self].cases.pop_back();
+      }
+    }
+
+    // Nothing left of our own, steal the oldest case from another thread
+    for (int i = 1; next < 0 && i < numQueues; ++i)
+    {
+      WorkQueue& victim = queues[(self + i) % numQueues];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.cases.empty())
+      {
+        next = victim.cases.front();
+        victim.cases.pop_front();
+      }
+    }
+
+    // No case is ever added once the threads start, so all the queues being
+    // empty means we're done
+    if (next < 0) return;
+    RunCase(cases[next], options);
+  }
+}
+
+static void Usage()
+{
+  printf("Usage: HovalaagTest [options] <test directory>\n"
+         "  -a <file>  Run this assembler rather than the built in one\n"
+         "  -j <n>     Number of threads (default: one per core)\n"
+         "  -c <n>     Maximum number of cycles per case (default %llu)\n"
+         "  -l         Loop OUT2 back to IN2 through the FIFO for all cases\n"
+         "  -s         Stop when IN1 is read past the end of the input for all cases\n",
+         DefaultMaxCycles);
+}
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  options.assembler = NULL;
+  options.maxCycles = DefaultMaxCycles;
+  options.loopback = false;
+  options.stopAtEnd = false;
+  int numThreads = std::thread::hardware_concurrency();
+
+  int opt;
+  while ((opt = getopt(argc, argv, "a:j:c:lsh")) != -1)
+  {
+    switch (opt)
+    {
+      case 'a': options.assembler = optarg; break;
+      case 'j': numThreads = atoi(optarg); break;
+      case 'c': options.maxCycles = strtoull(optarg, NULL, 0); break;
+      case 'l': options.loopback = true; break;
+      case 's': options.stopAtEnd = true; break;
+      default: Usage(); return 1;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    Usage();
+    return 1;
+  }
+  if (numThreads < 1) numThreads = 1;
+
+  // Every subdirectory is a case
+  const char* testDir = argv[optind];
+  std::vector<Case> cases;
+  DIR* d = opendir(testDir);
+  if (!d)
+  {
+    printf("Failed to open %s\n", testDir);
+    return 2;
+  }
+  struct dirent* ent;
+  while ((ent = readdir(d)) != NULL)
+  {
+    if (ent->d_name[0] == '.') continue;
+    Case c;
+    c.name = ent->d_name;
+    c.dir = std::string(testDir) + "/" + ent->d_name;
+    struct stat st;
+    if (stat(c.dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) cases.push_back(c);
+  }
+  closedir(d);
+  std::sort(cases.begin(), cases.end(), [](const Case& a, const Case& b) { return a.name < b.name; });
+  if (cases.empty())
+  {
+    printf("No test cases in %s\n", testDir);
+    return 2;
+  }
+
+  if (numThreads > (int)cases.size()) numThreads = cases.size();
+  std::vector<WorkQueue> queues(numThreads);
+  for (size_t i = 0; i < cases.size(); ++i)
+    queues[i % numThreads].cases.push_back(i);
+
+  double start = Now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numThreads; ++i)
+    threads.push_back(std::thread(Worker, i, std::ref(queues), std::ref(cases), std::cref(options)));
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  double elapsed = Now() - start;
+
+  int failed = 0;
+  uint64_t totalCycles = 0;
+  for (size_t i = 0; i < cases.size(); ++i)
+  {
+    const Case& c = cases[i];
+    printf("%s %-32s %12llu cycles %9.2f ms\n", c.passed ? "PASS" : "FAIL", c.name.c_str(),
+           (unsigned long long)c.cycles, c.wallTime * 1e3);
+    if (!c.passed)
+    {
+      printf("     %s\n", c.message.c_str());
+      ++failed;
+    }
+    totalCycles += c.cycles;
+  }
+  printf("%d passed, %d failed, %llu cycles in %.2f s on %d threads\n", (int)cases.size() - failed, failed,
+         (unsigned long long)totalCycles, elapsed, numThreads);
+
+  return failed ? 1 : 0;
+}
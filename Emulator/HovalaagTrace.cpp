@@ -0,0 +1,428 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Binary traces of a run, see HovalaagTrace.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HovalaagTrace.h"
+
+#define TraceMagic "HOVTRC01"
+
+// Largest record: flags, five two byte changes, PC, IO flags and two words
+#define MaxRecordSize 17
+
+static uint8_t* Put16(uint8_t* p, uint16_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t* Put32(uint8_t* p, uint32_t v)
+{
+  for (int i = 0; i < 4; ++i)
+    p[i] = (v >> (8 * i)) & 0xff;
+  return p + 4;
+}
+
+static uint8_t* Put64(uint8_t* p, uint64_t v)
+{
+  for (int i = 0; i < 8; ++i)
+    p[i] = (v >> (8 * i)) & 0xff;
+  return p + 8;
+}
+
+static uint16_t Get16(const uint8_t* p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t Get32(const uint8_t* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t Get64(const uint8_t* p)
+{
+  return Get32(p) | ((uint64_t)Get32(p + 4) << 32);
+}
+
+// The change from one 12-bit value to another, zigzag encoded
+static uint8_t* PutChange(uint8_t* p, uint16_t from, uint16_t to)
+{
+  int32_t d = HovalaagSigned((to - from) & 0xfff);
+  uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+  if (z < 0x80)
+  {
+    *p++ = z;
+  }
+  else
+  {
+    *p++ = 0x80 | (z & 0x7f);
+    *p++ = z >> 7;
+  }
+  return p;
+}
+
+HovalaagTraceWriter::HovalaagTraceWriter()
+{
+  bytesWritten = 0;
+  file = NULL;
+  inner = NULL;
+  ioFlags = 0;
+  inValue = outValue = 0;
+  used[0] = used[1] = 0;
+  filling = 0;
+  blockCycles = 0;
+  pending[0] = pending[1] = false;
+  quit = false;
+  failed = false;
+}
+
+HovalaagTraceWriter::~HovalaagTraceWriter()
+{
+  if (thread.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      quit = true;
+    }
+    changed.notify_all();
+    thread.join();
+  }
+  if (file) fclose(file);
+}
+
+bool HovalaagTraceWriter::Open(const char* fileName, const HovalaagCpu& cpu)
+{
+  file = fopen(fileName, "wb");
+  if (!file)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+
+  uint8_t header[HOVALAAG_TRACE_HEADER_SIZE];
+  memcpy(header, TraceMagic, 8);
+  uint8_t* p = Put32(header + 8, HOVALAAG_TRACE_BLOCK);
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+    p = Put32(p, cpu.program[i]);
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) failed = true;
+  bytesWritten = sizeof(header);
+
+  for (int i = 0; i < 2; ++i)
+    block[i].resize(HOVALAAG_TRACE_BLOCK_HEADER_SIZE + (size_t)HOVALAAG_TRACE_BLOCK * MaxRecordSize);
+  thread = std::thread(&HovalaagTraceWriter::Writer, this);
+  StartBlock(cpu.state);
+  return true;
+}
+
+void HovalaagTraceWriter::StartBlock(const HovalaagState& s)
+{
+  // The lengths are filled in by EndBlock
+  uint8_t* p = block[filling].data() + 8;
+  p = Put64(p, s.cycles);
+  *p++ = s.PC;
+  *p++ = s.F;
+  p = Put16(p, s.A);
+  p = Put16(p, s.B);
+  p = Put16(p, s.C);
+  p = Put16(p, s.D);
+  p = Put16(p, s.W);
+  used[filling] = HOVALAAG_TRACE_BLOCK_HEADER_SIZE;
+  blockCycles = 0;
+}
+
+// Hand the block to the writer thread and wait for the other one to be free
+void HovalaagTraceWriter::EndBlock()
+{
+  uint8_t* p = block[filling].data();
+  p = Put32(p, used[filling] - HOVALAAG_TRACE_BLOCK_HEADER_SIZE);
+  Put32(p, blockCycles);
+  bytesWritten += used[filling];
+
+  std::unique_lock<std::mutex> guard(lock);
+  pending[filling] = true;
+  changed.notify_all();
+  filling ^= 1;
+  changed.wait(guard, [this] { return !pending[filling]; });
+}
+
+void HovalaagTraceWriter::Writer()
+{
+  int next = 0;
+  std::unique_lock<std::mutex> guard(lock);
+  for (;;)
+  {
+    changed.wait(guard, [&] { return pending[next] || quit; });
+    if (!pending[next]) break;
+
+    guard.unlock();
+    bool ok = fwrite(block[next].data(), 1, used[next], file) == used[next];
+    guard.lock();
+    if (!ok) failed = true;
+    pending[next] = false;
+    changed.notify_all();
+    next ^= 1;
+  }
+}
+
+bool HovalaagTraceWriter::In(int port, uint16_t* value)
+{
+  inner->cycle = cycle;
+  if (!inner->In(port, value)) return false;
+  ioFlags |= HOVALAAG_TRACE_IN | (port ? HOVALAAG_TRACE_IN2 : 0);
+  inValue = *value & 0xfff;
+  return true;
+}
+
+void HovalaagTraceWriter::Out(int port, uint16_t value)
+{
+  inner->cycle = cycle;
+  inner->Out(port, value);
+  halt = inner->halt;
+  ioFlags |= HOVALAAG_TRACE_OUT | (port ? HOVALAAG_TRACE_OUT2 : 0);
+  outValue = value;
+}
+
+HovalaagStop HovalaagTraceWriter::Run(HovalaagCpu& cpu, HovalaagIo& io, uint64_t maxCycles)
+{
+  inner = &io;
+  halt = io.halt;
+  HovalaagStop stop = HOVALAAG_CYCLE_LIMIT;
+  for (uint64_t n = 0; n < maxCycles; ++n)
+  {
+    HovalaagState before = cpu.state;
+    ioFlags = 0;
+    stop = cpu.Step(*this);
+    if (stop == HOVALAAG_INPUT_STALL) break;
+
+    const HovalaagState& s = cpu.state;
+    uint8_t* record = block[filling].data() + used[filling];
+    uint8_t* p = record + 1;
+    uint8_t flags = 0;
+    const uint16_t from[5] = { before.A, before.B, before.C, before.D, before.W };
+    const uint16_t to[5] = { s.A, s.B, s.C, s.D, s.W };
+    for (int r = 0; r < 5; ++r)
+    {
+      if (from[r] == to[r]) continue;
+      flags |= 1 << r;
+      p = PutChange(p, from[r], to[r]);
+    }
+    if (s.F != before.F) flags |= HOVALAAG_TRACE_F;
+    if (s.PC != (uint8_t)(before.PC + 1))
+    {
+      flags |= HOVALAAG_TRACE_PC;
+      *p++ = s.PC;
+    }
+    if (ioFlags)
+    {
+      flags |= HOVALAAG_TRACE_IO;
+      *p++ = ioFlags;
+      if (ioFlags & HOVALAAG_TRACE_IN) p = Put16(p, inValue);
+      if (ioFlags & HOVALAAG_TRACE_OUT) p = Put16(p, outValue);
+    }
+    *record = flags;
+    used[filling] = p - block[filling].data();
+
+    if (++blockCycles == HOVALAAG_TRACE_BLOCK)
+    {
+      EndBlock();
+      StartBlock(s);
+    }
+    if (stop != HOVALAAG_CYCLE_LIMIT) break;
+  }
+  return stop;
+}
+
+bool HovalaagTraceWriter::Close(const HovalaagCpu& cpu, HovalaagStop stop)
+{
+  if (blockCycles) EndBlock();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    quit = true;
+  }
+  changed.notify_all();
+  thread.join();
+
+  uint8_t end[16];
+  uint8_t* p = Put32(end, HOVALAAG_TRACE_END);
+  p = Put32(p, stop);
+  Put64(p, cpu.state.cycles);
+  if (fwrite(end, 1, sizeof(end), file) != sizeof(end)) failed = true;
+  bytesWritten += sizeof(end);
+  if (fclose(file) != 0) failed = true;
+  file = NULL;
+  return !failed;
+}
+
+HovalaagTraceReader::HovalaagTraceReader()
+{
+  fileName = NULL;
+  memset(program, 0, sizeof(program));
+  blockSize = 0;
+  blockCycles = 0;
+  blockStart = 0;
+  memset(&state, 0, sizeof(state));
+  ended = false;
+  corrupt = false;
+  endStop = HOVALAAG_CYCLE_LIMIT;
+  endCycles = 0;
+  file = NULL;
+  pos = 0;
+  decoded = 0;
+}
+
+HovalaagTraceReader::~HovalaagTraceReader()
+{
+  if (file) fclose(file);
+}
+
+bool HovalaagTraceReader::Open(const char* name)
+{
+  fileName = name;
+  file = fopen(fileName, "rb");
+  if (!file)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+  uint8_t header[HOVALAAG_TRACE_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TraceMagic, 8) ||
+      (blockSize = Get32(header + 8)) == 0)
+  {
+    printf("%s is not a trace file\n", fileName);
+    return false;
+  }
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+    program[i] = Get32(header + 12 + 4 * i);
+  return true;
+}
+
+bool HovalaagTraceReader::NextBlock()
+{
+  block.clear();
+  blockCycles = 0;
+  pos = decoded = 0;
+  if (ended || corrupt) return false;
+
+  uint8_t header[HOVALAAG_TRACE_BLOCK_HEADER_SIZE];
+  if (fread(header, 1, 16, file) != 16)
+  {
+    corrupt = true;
+    return false;
+  }
+  uint32_t length = Get32(header);
+  if (length == HOVALAAG_TRACE_END)
+  {
+    ended = true;
+    endStop = (HovalaagStop)Get32(header + 4);
+    endCycles = Get64(header + 8);
+    return false;
+  }
+  if (fread(header + 16, 1, sizeof(header) - 16, file) != sizeof(header) - 16 ||
+      length > (uint64_t)Get32(header + 4) * MaxRecordSize)
+  {
+    corrupt = true;
+    return false;
+  }
+
+  block.resize(sizeof(header) + length);
+  memcpy(block.data(), header, sizeof(header));
+  if (fread(block.data() + sizeof(header), 1, length, file) != length)
+  {
+    corrupt = true;
+    return false;
+  }
+
+  blockCycles = Get32(header + 4);
+  blockStart = Get64(header + 8);
+  state.cycle = blockStart;
+  state.PC = header[16];
+  state.F = header[17];
+  for (int r = 0; r < 5; ++r)
+    state.reg[r] = Get16(header + 18 + 2 * r);
+  state.io = 0;
+  state.in = state.out = 0;
+  pos = sizeof(header);
+  return true;
+}
+
+bool HovalaagTraceReader::Next(HovalaagTraceCycle* c)
+{
+  if (decoded == blockCycles)
+  {
+    if (pos != block.size()) corrupt = true;
+    return false;
+  }
+
+  const uint8_t* p = block.data() + pos;
+  const uint8_t* end = block.data() + block.size();
+  if (p == end)
+  {
+    corrupt = true;
+    return false;
+  }
+  uint8_t flags = *p++;
+  for (int r = 0; r < 5; ++r)
+  {
+    if (!(flags & (1 << r))) continue;
+    if (p == end || ((*p & 0x80) && p + 1 == end))
+    {
+      corrupt = true;
+      return false;
+    }
+    uint32_t z = *p & 0x7f;
+    if (*p++ & 0x80) z |= *p++ << 7;
+    int32_t d = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+    state.reg[r] = (state.reg[r] + d) & 0xfff;
+  }
+  if (flags & HOVALAAG_TRACE_F) state.F ^= 1;
+
+  state.PC = state.PC + 1;
+  if (flags & HOVALAAG_TRACE_PC)
+  {
+    if (p == end)
+    {
+      corrupt = true;
+      return false;
+    }
+    state.PC = *p++;
+  }
+
+  state.io = 0;
+  state.in = state.out = 0;
+  if (flags & HOVALAAG_TRACE_IO)
+  {
+    if (p == end)
+    {
+      corrupt = true;
+      return false;
+    }
+    state.io = *p++;
+    size_t need = ((state.io & HOVALAAG_TRACE_IN) ? 2 : 0) + ((state.io & HOVALAAG_TRACE_OUT) ? 2 : 0);
+    if ((size_t)(end - p) < need)
+    {
+      corrupt = true;
+      return false;
+    }
+    if (state.io & HOVALAAG_TRACE_IN)
+    {
+      state.in = Get16(p);
+      p += 2;
+    }
+    if (state.io & HOVALAAG_TRACE_OUT)
+    {
+      state.out = Get16(p);
+      p += 2;
+    }
+  }
+
+  ++state.cycle;
+  ++decoded;
+  pos = p - block.data();
+  *c = state;
+  return true;
+}
@@ -0,0 +1,175 @@
+// Copyright (C) 2020 Michael Bell
+//
+// A compact binary trace of a run, one record per cycle, and a reader that
+// streams it back a block at a time.
+//
+// The file starts with a header:
+//   8 bytes    "HOVTRC01"
+//   4 bytes    cycles per block
+//   1024 bytes the program, 256 little-endian instruction words
+//
+// then blocks, each holding the records for the next HOVALAAG_TRACE_BLOCK
+// cycles of the run, or fewer for the last one:
+//   4 bytes    length of the records in bytes
+//   4 bytes    number of cycles
+//   8 bytes    cycle the block starts at
+//   12 bytes   the state at the start of the block: PC, F, then A, B, C,
+//              D, W two bytes each
+//   records
+// and an end marker:
+//   4 bytes    0xffffffff
+//   4 bytes    the HovalaagStop the run ended with
+//   8 bytes    cycle the run ended at
+// Every field is little-endian, written a byte at a time, so a trace can
+// just as well be written by something other than the emulator, such as a
+// simulation of Hovalaag.v.
+//
+// A record is the change the cycle made, starting with a byte of flags:
+//   bits 0-4   A, B, C, D, W changed, each followed by its change
+//   bit 5      F changed
+//   bit 6      PC didn't go on to the next instruction, followed by a byte of the new PC
+//   bit 7      a word was read or written, followed by a byte of IO flags
+// A register's change is the difference from its old value as a signed
+// 12-bit number, zigzag encoded, in one byte if it is under 128 and two
+// otherwise, the first with its top bit set.  The IO flags are:
+//   bit 0      a word was read, from IN2 if bit 1 is set, else IN1
+//   bit 2      a word was written, to OUT2 if bit 3 is set, else OUT1
+// followed by the word read and then the word written, two bytes each.  A
+// cycle that only moves on to the next instruction is one byte.
+//
+// Blocks start on the same cycles in every trace of a run from reset, so two
+// traces can be compared a block at a time and only a block that differs
+// decoded.
+
+#ifndef HOVALAAG_TRACE_H
+#define HOVALAAG_TRACE_H
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Hovalaag.h"
+
+#define HOVALAAG_TRACE_BLOCK 65536
+#define HOVALAAG_TRACE_HEADER_SIZE (8 + 4 + 4 * HOVALAAG_PROGRAM_SIZE)
+#define HOVALAAG_TRACE_BLOCK_HEADER_SIZE 28
+#define HOVALAAG_TRACE_END 0xffffffffu
+
+// Record flags
+#define HOVALAAG_TRACE_F 0x20
+#define HOVALAAG_TRACE_PC 0x40
+#define HOVALAAG_TRACE_IO 0x80
+
+// IO flags
+#define HOVALAAG_TRACE_IN 0x01
+#define HOVALAAG_TRACE_IN2 0x02
+#define HOVALAAG_TRACE_OUT 0x04
+#define HOVALAAG_TRACE_OUT2 0x08
+
+// One cycle of a trace: the state after it and the words it read and wrote
+struct HovalaagTraceCycle
+{
+  uint64_t cycle;     // Cycle count after it, as HovalaagState::cycles
+  uint8_t PC;
+  uint16_t reg[5];    // A, B, C, D, W
+  uint8_t F;
+  uint8_t io;         // IO flags
+  uint16_t in;
+  uint16_t out;
+};
+
+// Records a run to a file.  The records for a block are built on the running
+// thread and written out by a thread of the writer's own, so the run only
+// waits for the disk if it gets two blocks ahead.
+class HovalaagTraceWriter : private HovalaagIo
+{
+public:
+  HovalaagTraceWriter();
+  ~HovalaagTraceWriter();
+
+  // Start a trace of cpu, which must be at reset.  Prints the problem and
+  // returns false if the file can't be opened.
+  bool Open(const char* fileName, const HovalaagCpu& cpu);
+
+  // Step cpu through up to maxCycles cycles on io, recording each.  Can be
+  // called again to carry on with the run.
+  HovalaagStop Run(HovalaagCpu& cpu, HovalaagIo& io, uint64_t maxCycles);
+
+  // Write the rest of the trace and the end marker.  Returns false if any of
+  // the trace couldn't be written.
+  bool Close(const HovalaagCpu& cpu, HovalaagStop stop);
+
+  uint64_t bytesWritten;
+
+private:
+  // Passes IO through to the run's IO, noting it for the record
+  virtual bool In(int port, uint16_t* value);
+  virtual void Out(int port, uint16_t value);
+
+  void StartBlock(const HovalaagState& s);
+  void EndBlock();
+  void Writer();
+
+  FILE* file;
+  HovalaagIo* inner;
+  uint8_t ioFlags;
+  uint16_t inValue;
+  uint16_t outValue;
+
+  // The block being filled, and the one being written
+  std::vector<uint8_t> block[2];
+  size_t used[2];
+  int filling;
+  uint32_t blockCycles;
+  std::thread thread;
+  std::mutex lock;
+  std::condition_variable changed;
+  bool pending[2];
+  bool quit;
+  bool failed;
+};
+
+// Reads a trace a block at a time
+class HovalaagTraceReader
+{
+public:
+  HovalaagTraceReader();
+  ~HovalaagTraceReader();
+
+  // Prints the problem and returns false if the file isn't a trace
+  bool Open(const char* fileName);
+
+  // Read the next block.  Returns false at the end of the trace, with ended
+  // set if it had an end marker, or if the block is cut short or corrupt.
+  bool NextBlock();
+
+  // Decode the next record of the block.  Returns false at the end of the block.
+  bool Next(HovalaagTraceCycle* c);
+
+  const char* fileName;
+  uint32_t program[HOVALAAG_PROGRAM_SIZE];
+  uint32_t blockSize;
+
+  // The block read last: its header and records as in the file
+  std::vector<uint8_t> block;
+  uint32_t blockCycles;
+  uint64_t blockStart;
+
+  // The state after the last record decoded
+  HovalaagTraceCycle state;
+
+  bool ended;
+  bool corrupt;
+  HovalaagStop endStop;
+  uint64_t endCycles;
+
+private:
+  FILE* file;
+  size_t pos;
+  uint32_t decoded;
+};
+
+#endif
@@ -0,0 +1,176 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Find the first cycle where two traces written by HovalaagEmu -T differ.
+//
+// The traces are read a block at a time, so they can be any size.  Blocks
+// that are the same byte for byte are passed over without being decoded,
+// which is most of them until the runs go different ways.  In the block
+// where they do the records are decoded side by side, and the first cycle
+// that leaves a different state or reads or writes a different word is
+// printed, with the state before it.  The cycle is numbered as HovalaagReplay
+// numbers them, so a run recorded with -k as well can be looked at around it.
+//
+// Exits with 0 if the traces are the same, 5 if they differ and 3 if either
+// can't be read to the end.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Hovalaag.h"
+#include "HovalaagTrace.h"
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char* StopName(HovalaagStop stop)
+{
+  switch (stop)
+  {
+    case HOVALAAG_INPUT_STALL: return "Input stalled";
+    case HOVALAAG_HALTED: return "Halted";
+    default: return "Stopped";
+  }
+}
+
+static bool SameCycle(const HovalaagTraceCycle& a, const HovalaagTraceCycle& b)
+{
+  return a.PC == b.PC && !memcmp(a.reg, b.reg, sizeof(a.reg)) && a.F == b.F && a.io == b.io && a.in == b.in &&
+         a.out == b.out;
+}
+
+static void PrintCycle(const char* name, const HovalaagTraceCycle& c)
+{
+  printf("  %-20s PC=%02x A=%03x B=%03x C=%03x D=%03x W=%03x F=%d", name, c.PC, c.reg[0], c.reg[1], c.reg[2],
+         c.reg[3], c.reg[4], c.F);
+  if (c.io & HOVALAAG_TRACE_IN)
+    printf("  IN%d %d", (c.io & HOVALAAG_TRACE_IN2) ? 2 : 1, HovalaagSigned(c.in));
+  if (c.io & HOVALAAG_TRACE_OUT)
+    printf("  OUT%d %d", (c.io & HOVALAAG_TRACE_OUT2) ? 2 : 1, HovalaagSigned(c.out));
+  printf("\n");
+}
+
+// Report a trace that couldn't be read to the end
+static bool CheckRead(const HovalaagTraceReader& t)
+{
+  if (!t.corrupt) return true;
+  printf("%s is cut short or corrupt in the block at cycle %llu\n", t.fileName, (unsigned long long)t.blockStart);
+  return false;
+}
+
+static void Usage()
+{
+  printf("Usage: HovalaagTraceDiff <trace> <trace>\n");
+}
+
+int main(int argc, char* argv[])
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "h")) != -1)
+  {
+    Usage();
+    return 1;
+  }
+  if (optind != argc - 2)
+  {
+    Usage();
+    return 1;
+  }
+
+  HovalaagTraceReader t[2];
+  for (int i = 0; i < 2; ++i)
+    if (!t[i].Open(argv[optind + i])) return 2;
+  if (t[0].blockSize != t[1].blockSize)
+  {
+    printf("The traces have different block sizes, %u and %u\n", t[0].blockSize, t[1].blockSize);
+    return 2;
+  }
+  if (memcmp(t[0].program, t[1].program, sizeof(t[0].program)))
+    printf("The traces are of different programs\n");
+
+  double start = Now();
+  uint64_t same = 0;          // Cycles known to be the same
+  uint64_t blocksSkipped = 0;
+  for (;;)
+  {
+    bool more[2];
+    for (int i = 0; i < 2; ++i)
+      more[i] = t[i].NextBlock();
+    if (!CheckRead(t[0]) || !CheckRead(t[1])) return 3;
+    if (!more[0] || !more[1]) break;
+
+    if (t[0].block == t[1].block)
+    {
+      same = t[0].blockStart + t[0].blockCycles;
+      ++blocksSkipped;
+      continue;
+    }
+
+    HovalaagTraceCycle before = t[0].state;
+    if (!SameCycle(t[0].state, t[1].state))
+    {
+      printf("Different at the start of the block at cycle %llu\n", (unsigned long long)t[0].blockStart);
+      PrintCycle(t[0].fileName, t[0].state);
+      PrintCycle(t[1].fileName, t[1].state);
+      return 5;
+    }
+    for (;;)
+    {
+      HovalaagTraceCycle c[2];
+      for (int i = 0; i < 2; ++i)
+        more[i] = t[i].Next(&c[i]);
+      if (!CheckRead(t[0]) || !CheckRead(t[1])) return 3;
+      if (!more[0] || !more[1]) break;
+      if (!SameCycle(c[0], c[1]))
+      {
+        // The words read and written before aren't part of the state
+        before.io = 0;
+        printf("First difference at cycle %llu\n", (unsigned long long)before.cycle);
+        PrintCycle("before", before);
+        PrintCycle(t[0].fileName, c[0]);
+        PrintCycle(t[1].fileName, c[1]);
+        return 5;
+      }
+      before = c[0];
+      same = c[0].cycle;
+    }
+    if (more[0] || more[1]) break;
+  }
+  double elapsed = Now() - start;
+
+  // Read on to the end markers
+  for (int i = 0; i < 2; ++i)
+  {
+    while (t[i].NextBlock())
+      ;
+    if (!CheckRead(t[i])) return 3;
+  }
+
+  printf("%llu cycles the same, %llu blocks of them not decoded, in %.2f s\n", (unsigned long long)same,
+         (unsigned long long)blocksSkipped, elapsed);
+  if (t[0].endCycles == same && t[1].endCycles == same)
+  {
+    if (t[0].endStop == t[1].endStop)
+    {
+      printf("The traces are the same, %s after %llu cycles\n", StopName(t[0].endStop), (unsigned long long)same);
+      return 0;
+    }
+    for (int i = 0; i < 2; ++i)
+      printf("%s: %s after %llu cycles\n", t[i].fileName, StopName(t[i].endStop), (unsigned long long)same);
+    return 5;
+  }
+  for (int i = 0; i < 2; ++i)
+  {
+    if (t[i].endCycles == same)
+      printf("%s ends there, %s\n", t[i].fileName, StopName(t[i].endStop));
+    else
+      printf("%s goes on to cycle %llu\n", t[i].fileName, (unsigned long long)t[i].endCycles);
+  }
+  return 5;
+}
@@ -0,0 +1,232 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Translate a Hovalaag program to C++, see HovalaagTranslate in Hovalaag.h
+//
+// The generated function keeps the registers in locals, sign extended as in
+// HovalaagCpu::Run, and has one label per instruction.  Each instruction is
+// straight line code with its unit operations and ALU op inlined, and
+// DECNZ/JMP/JMPT/JMPF become plain gotos, so the host compiler sees the
+// whole program as an ordinary control flow graph.
+//
+// The cycle limit is checked once per basic block.  A block that would run
+// past the limit is instead finished one instruction at a time with
+// HovalaagCpu::Step, so the generated function stops on exactly the same
+// cycle as the interpreter.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Hovalaag.h"
+
+// ALU expressions on sign extended registers, as Alu<> in Hovalaag.cpp
+static const char* const aluExpr[16] =
+{
+  "0",
+  "-A",
+  "B",
+  "C",
+  "((A >> 1) & 0xfff) - ((A & 1) << 12)",
+  "A + B",
+  "B - A",
+  "A + B + F",
+  "B - A - F",
+  "A | B",
+  "A & B",
+  "A ^ B",
+  "~A",
+  "A",
+  "src14",
+  "src15",
+};
+
+// ALU ops whose result can leave the 12-bit range and so need extending to give M
+static bool AluNeedsExtend(int alu)
+{
+  return alu == 1 || alu == 4 || (alu >= 5 && alu <= 8);
+}
+
+static bool IsBranch(const HovalaagOp& op)
+{
+  return op.pcOp != PC_STEP || op.cOp == C_DECNZ;
+}
+
+static bool UsesM(const HovalaagOp& op)
+{
+  return op.aOp == A_FROM_M || op.bOp == B_FROM_M || op.cOp == C_FROM_M || op.wOp == W_FROM_M;
+}
+
+static void TranslateInstruction(FILE* out, int i, uint32_t word, const HovalaagOp& op)
+{
+  int next = (i + 1) & 0xff;
+
+  fprintf(out, "I%d: // %02x: %08x\n", i, i, word);
+  fprintf(out, "  {\n");
+
+  if (op.aOp == A_FROM_IN)
+  {
+    fprintf(out, "    uint16_t in;\n");
+    fprintf(out, "    io.cycle = cpu.state.cycles + n;\n");
+    fprintf(out, "    if (!io.In(%d, &in)) { PC = %d; goto stall; }\n", op.io, i);
+  }
+
+  bool needM = UsesM(op);
+  if (needM || op.fOp != F_HOLD)
+    fprintf(out, "    const int32_t r = %s;\n", aluExpr[op.alu]);
+  if (needM)
+    fprintf(out, "    const int32_t M = %s;\n", AluNeedsExtend(op.alu) ? "Extend(r)" : "r");
+
+  // New register values are computed from the old ones before any are written
+  static const char* const aSrc[4] = { NULL, "M", "D", "Extend(in)" };
+  static const char* const bSrc[4] = { NULL, "M", "A", NULL };
+  static const char* const wSrc[4] = { NULL, "M", "A", NULL };
+  static const char* const cSrc[4] = { NULL, "M", "Extend(C - 1)", "Extend(C - 1)" };
+  static const char* const fSrc[4] = { NULL, "r == 0", "r < 0", "r > 0" };
+  int K = HovalaagSigned(op.K);
+
+  if (op.aOp != A_HOLD) fprintf(out, "    const int32_t nA = %s;\n", aSrc[op.aOp]);
+  if (op.bOp == B_FROM_K) fprintf(out, "    const int32_t nB = %d;\n", K);
+  else if (op.bOp != B_HOLD) fprintf(out, "    const int32_t nB = %s;\n", bSrc[op.bOp]);
+  if (op.cOp != C_HOLD) fprintf(out, "    const int32_t nC = %s;\n", cSrc[op.cOp]);
+  if (op.wOp == W_FROM_K) fprintf(out, "    const int32_t nW = %d;\n", K);
+  else if (op.wOp != W_HOLD) fprintf(out, "    const int32_t nW = %s;\n", wSrc[op.wOp]);
+  if (op.fOp != F_HOLD) fprintf(out, "    const int32_t nF = %s;\n", fSrc[op.fOp]);
+  if (op.cOp == C_DECNZ) fprintf(out, "    const bool decnz = (C != 1);\n");
+  if (op.pcOp == PC_JMPT) fprintf(out, "    const bool jump = F;\n");
+  if (op.pcOp == PC_JMPF) fprintf(out, "    const bool jump = !F;\n");
+
+  fprintf(out, "    OUT = W;\n");
+  if (op.out)
+  {
+    fprintf(out, "    io.cycle = cpu.state.cycles + n;\n");
+    fprintf(out, "    io.Out(%d, W & 0xfff);\n", op.io);
+  }
+  if (op.dOp) fprintf(out, "    D = A;\n");
+  if (op.aOp != A_HOLD) fprintf(out, "    A = nA;\n");
+  if (op.bOp != B_HOLD) fprintf(out, "    B = nB;\n");
+  if (op.cOp != C_HOLD) fprintf(out, "    C = nC;\n");
+  if (op.wOp != W_HOLD) fprintf(out, "    W = nW;\n");
+  if (op.fOp != F_HOLD) fprintf(out, "    F = nF;\n");
+  fprintf(out, "    ++n;\n");
+
+  if (op.out)
+  {
+    char newPC[64];
+    if (op.pcOp == PC_JMP) snprintf(newPC, sizeof(newPC), "%d", op.L);
+    else if (op.pcOp != PC_STEP) snprintf(newPC, sizeof(newPC), "jump ? %d : %d", op.L, next);
+    else snprintf(newPC, sizeof(newPC), "%d", next);
+    if (op.cOp == C_DECNZ) fprintf(out, "    if (io.halt) { PC = decnz ? %d : %s; goto halted; }\n", op.L, newPC);
+    else fprintf(out, "    if (io.halt) { PC = %s; goto halted; }\n", newPC);
+  }
+
+  if (op.cOp == C_DECNZ) fprintf(out, "    if (decnz) goto B%d;\n", op.L);
+  if (op.pcOp == PC_JMP) fprintf(out, "    goto B%d;\n", op.L);
+  else
+  {
+    if (op.pcOp != PC_STEP) fprintf(out, "    if (jump) goto B%d;\n", op.L);
+    // Every other instruction falls through to the next label
+    if (next == 0) fprintf(out, "    goto B0;\n");
+  }
+  fprintf(out, "  }\n");
+}
+
+bool HovalaagTranslate(const uint32_t* prog, int numWords, const char* symbol, FILE* out)
+{
+  uint32_t program[HOVALAAG_PROGRAM_SIZE];
+  HovalaagOp ops[HOVALAAG_PROGRAM_SIZE];
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+  {
+    program[i] = (i < numWords) ? prog[i] : 0;
+    ops[i] = HovalaagDecode(program[i]);
+  }
+
+  // Find the basic blocks.  Any instruction can be the entry point, as Run can
+  // be called with any state, so the entry switch also checks the cycle limit
+  // against the rest of the block it enters.
+  bool leader[HOVALAAG_PROGRAM_SIZE];
+  memset(leader, 0, sizeof(leader));
+  leader[0] = true;
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+  {
+    if (IsBranch(ops[i]))
+    {
+      leader[ops[i].L] = true;
+      leader[(i + 1) & 0xff] = true;
+    }
+  }
+
+  int rest[HOVALAAG_PROGRAM_SIZE];
+  rest[HOVALAAG_PROGRAM_SIZE - 1] = 1;
+  for (int i = HOVALAAG_PROGRAM_SIZE - 2; i >= 0; --i)
+    rest[i] = (IsBranch(ops[i]) || leader[i + 1]) ? 1 : rest[i + 1] + 1;
+
+  fprintf(out, "// Generated by HovalaagEmu -t, do not edit.\n\n");
+  fprintf(out, "#include \"Hovalaag.h\"\n\n");
+  fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-label\"\n\n");
+  fprintf(out, "static inline int32_t Extend(int32_t v)\n{\n  return (int32_t)((uint32_t)v << 20) >> 20;\n}\n\n");
+
+  fprintf(out, "static const uint32_t program[%d] =\n{\n", HOVALAAG_PROGRAM_SIZE);
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; i += 8)
+  {
+    fprintf(out, " ");
+    for (int j = i; j < i + 8; ++j) fprintf(out, " 0x%08x,", program[j]);
+    fprintf(out, "\n");
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "static HovalaagStop Run(HovalaagCpu& cpu, HovalaagIo& io, uint64_t maxCycles)\n{\n");
+  fprintf(out, "  int32_t A = Extend(cpu.state.A);\n");
+  fprintf(out, "  int32_t B = Extend(cpu.state.B);\n");
+  fprintf(out, "  int32_t C = Extend(cpu.state.C);\n");
+  fprintf(out, "  int32_t D = Extend(cpu.state.D);\n");
+  fprintf(out, "  int32_t W = Extend(cpu.state.W);\n");
+  fprintf(out, "  int32_t OUT = cpu.state.OUT;\n");
+  fprintf(out, "  int32_t F = cpu.state.F;\n");
+  fprintf(out, "  uint32_t PC = cpu.state.PC;\n");
+  fprintf(out, "  const int32_t src14 = Extend(cpu.op14Source);\n");
+  fprintf(out, "  const int32_t src15 = Extend(cpu.op15Source);\n");
+  fprintf(out, "  (void)src14;\n");
+  fprintf(out, "  (void)src15;\n");
+  fprintf(out, "  uint64_t n = 0;\n");
+  fprintf(out, "  HovalaagStop stop = HOVALAAG_CYCLE_LIMIT;\n\n");
+
+  fprintf(out, "  switch (PC)\n  {\n");
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+    fprintf(out, "    case %d: if (maxCycles < %d) goto done; goto I%d;\n", i, rest[i], i);
+  fprintf(out, "  }\n\n");
+
+  for (int i = 0; i < HOVALAAG_PROGRAM_SIZE; ++i)
+  {
+    if (leader[i])
+    {
+      fprintf(out, "B%d:\n", i);
+      fprintf(out, "  if (maxCycles - n < %d) { PC = %d; goto done; }\n", rest[i], i);
+    }
+    TranslateInstruction(out, i, program[i], ops[i]);
+  }
+
+  fprintf(out, "\nhalted:\n");
+  fprintf(out, "  stop = HOVALAAG_HALTED;\n");
+  fprintf(out, "  goto done;\n");
+  fprintf(out, "stall:\n");
+  fprintf(out, "  stop = HOVALAAG_INPUT_STALL;\n");
+  fprintf(out, "done:\n");
+  fprintf(out, "  cpu.state.A = A & 0xfff;\n");
+  fprintf(out, "  cpu.state.B = B & 0xfff;\n");
+  fprintf(out, "  cpu.state.C = C & 0xfff;\n");
+  fprintf(out, "  cpu.state.D = D & 0xfff;\n");
+  fprintf(out, "  cpu.state.W = W & 0xfff;\n");
+  fprintf(out, "  cpu.state.OUT = OUT & 0xfff;\n");
+  fprintf(out, "  cpu.state.F = F;\n");
+  fprintf(out, "  cpu.state.PC = PC;\n");
+  fprintf(out, "  cpu.state.cycles += n;\n\n");
+  fprintf(out, "  // Finish a partial block on the interpreter\n");
+  fprintf(out, "  if (stop == HOVALAAG_CYCLE_LIMIT)\n  {\n");
+  fprintf(out, "    for (; n < maxCycles && stop == HOVALAAG_CYCLE_LIMIT; ++n)\n");
+  fprintf(out, "      stop = cpu.Step(io);\n");
+  fprintf(out, "  }\n");
+  fprintf(out, "  return stop;\n}\n\n");
+
+  fprintf(out, "extern const HovalaagTranslatedProgram %s = { program, %d, Run };\n", symbol, numWords);
+
+  return !ferror(out);
+}
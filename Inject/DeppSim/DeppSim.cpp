@@ -0,0 +1,619 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Software stand-in for libdepp/libdmgr, so Inject and InjectS can be run,
+// tested and benchmarked without a board.
+//
+// Each opened device is a model of the Basys2 build in hovalaag_top.v:
+// the DpimIf.v register map, Program.v, Input1.v, and the CPU from the
+// Emulator with IN2 looped back from OUT2 through the FIFO, or with
+// HOVALAAG_SIM_IN2=stream the build with IN2 streamed through a second
+// Input1.v.
+//
+// Register writes behave as on the FPGA:
+//   reg 0 (ctrl) 0x01-0x03 selects program, input 1 or input 2.
+//     While (ctrl & 0x8F) is 0x81-0x83 the data registers are committed to
+//     the selected memory at the current address after every register write.
+//     Setting bit 6 as well fills from the current address to the end of
+//     the memory (address 0xFF for the program, 0x7FF for the inputs), then
+//     bit 6 clears.
+//     Bit 4 holds the CPU, the FIFO and the input read address in reset
+//     while set, the memories can still be written.
+//   reg 1 address bits 7:0, reg 6 address bits 10:8
+//   regs 2-5 data bits 31:24 down to 7:0.  Inputs are taken from bits 27:16.
+//   reg 7 reads {in2 upper half drained, in2 lower half drained,
+//     in1 upper half drained, in1 lower half drained, in2_rdy, in1_rdy}.
+//     Unless IN2 is streamed there's no input 2 memory, so the input 2 bits
+//     are always 0 and writes to input 2 are dropped.
+//   regs 8-11 read the 50MHz clocks spent stalled for input, bits 31:24
+//     down to 7:0, latched by reading reg 8.
+//
+// The CPU is held until the first input upload has finished (ctrl written
+// back to 0 after an input commit), which stands in for pressing BTN0
+// before running Inject, or until the hold bit is released.  From then on
+// it runs at HOVALAAG_SIM_HZ in wall clock time, caught up on every DEPP
+// call.  Unlike the board, instructions that don't read the input keep
+// running while in1_rdy or in2_rdy is raised, which only affects timing.
+// The number of times the CPU stalled waiting for a half of an input array
+// to be refilled, and the cycles lost, are counted.
+//
+// Environment:
+//   HOVALAAG_SIM_HZ      CPU clock rate, default 12500000
+//   HOVALAAG_SIM_IN2     "stream" for the build streaming both inputs
+//   HOVALAAG_SIM_CYCLES  cycles to run at DmgrClose, so Inject's results
+//                        can be checked, default 0
+//   HOVALAAG_SIM_OUT     file to write the outputs to as "OUT1 n" lines,
+//                        any %s is replaced by the device name
+//   HOVALAAG_SIM_PROGRAM file holding the program memory, loaded at DmgrOpen
+//                        and saved at DmgrClose, so it persists between runs
+//                        as it does on the board (which Inject's program
+//                        cache relies on).  Default $HOME/.deppsim_<name>.img,
+//                        set it empty to start from a cleared memory.
+//
+// Transaction, register and byte counts are printed to stderr at DmgrClose.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mutex>
+
+#include "dpcdecl.h"
+#include "depp.h"
+#include "dmgr.h"
+
+#include "Hovalaag.h"
+
+#define DefaultCpuHz 12500000.0
+#define BoardClockHz 50000000.0
+#define InputSize 2048
+#define HalfSize 1024
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+class SimDevice : public HovalaagIo
+{
+public:
+  SimDevice(const char* name);
+
+  void WriteReg(uint8_t addr, uint8_t data);
+  uint8_t ReadReg(uint8_t addr);
+
+  // Run the CPU for the time since the last call
+  void CatchUp();
+  void RunCpu(uint64_t cycles);
+  void Hold();
+  void Close();
+
+  virtual bool In(int port, uint16_t* value);
+  virtual void Out(int port, uint16_t value);
+
+  char name[64];
+  bool enabled;
+
+  // DpimIf.v
+  uint8_t ctrlReg;
+  uint16_t programAddr;
+  uint32_t programData;
+  uint32_t stallCount;
+
+  // Program.v and Input1.v, twice if IN2 is streamed
+  uint32_t program[HOVALAAG_PROGRAM_SIZE];
+  bool programDirty;
+  uint16_t input[2][InputSize];
+  uint16_t addr[2];
+  bool drained[2][2];
+  bool streamIn2;
+
+  HovalaagCpu cpu;
+  HovalaagFifo fifo;
+  bool inputWritten;
+  bool running;
+  bool held;
+  uint64_t heldCycles;
+  double cpuHz;
+  double lastTime;
+  double pendingCycles;
+  uint64_t closeCycles;
+  FILE* outFile;
+  char programFile[1024];
+
+  // Statistics
+  double openTime;
+  double callTime;
+  uint64_t transactions;
+  uint64_t regWrites;
+  uint64_t regReads;
+  uint64_t bytes;
+  uint64_t programWrites;
+  uint64_t inputWrites;
+  uint64_t outCount[2];
+  uint64_t stalls;
+  uint64_t stallCycles;
+  bool stalled;
+
+private:
+  void Commit();
+};
+
+SimDevice::SimDevice(const char* devName)
+  : enabled(false)
+  , ctrlReg(0)
+  , programAddr(0)
+  , programData(0)
+  , stallCount(0)
+  , programDirty(true)
+  , streamIn2(false)
+  , inputWritten(false)
+  , running(false)
+  , held(false)
+  , heldCycles(0)
+  , pendingCycles(0)
+  , outFile(NULL)
+  , callTime(0)
+  , transactions(0)
+  , regWrites(0)
+  , regReads(0)
+  , bytes(0)
+  , programWrites(0)
+  , inputWrites(0)
+  , stalls(0)
+  , stallCycles(0)
+  , stalled(false)
+{
+  snprintf(name, sizeof(name), "%s", devName);
+  memset(program, 0, sizeof(program));
+  memset(input, 0, sizeof(input));
+  memset(addr, 0, sizeof(addr));
+  memset(drained, 0, sizeof(drained));
+  outCount[0] = outCount[1] = 0;
+  fifo.Reset();
+  cpu.Reset();
+
+  const char* s = getenv("HOVALAAG_SIM_HZ");
+  cpuHz = s ? atof(s) : DefaultCpuHz;
+  s = getenv("HOVALAAG_SIM_IN2");
+  streamIn2 = s && !strcmp(s, "stream");
+  s = getenv("HOVALAAG_SIM_CYCLES");
+  closeCycles = s ? strtoull(s, NULL, 0) : 0;
+  s = getenv("HOVALAAG_SIM_OUT");
+  if (s && *s)
+  {
+    char outName[1024];
+    const char* n = strstr(s, "%s");
+    if (n)
+      snprintf(outName, sizeof(outName), "%.*s%s%s", (int)(n - s), s, name, n + 2);
+    else
+      snprintf(outName, sizeof(outName), "%s", s);
+    outFile = fopen(outName, "w");
+    if (!outFile) printf("DeppSim: Failed to open %s\n", outName);
+  }
+
+  s = getenv("HOVALAAG_SIM_PROGRAM");
+  if (s)
+    snprintf(programFile, sizeof(programFile), "%s", s);
+  else
+    snprintf(programFile, sizeof(programFile), "%s/.deppsim_%s.img", getenv("HOME") ? getenv("HOME") : ".", name);
+  if (*programFile)
+  {
+    FILE* f = fopen(programFile, "rb");
+    if (f)
+    {
+      if (fread(program, sizeof(uint32_t), HOVALAAG_PROGRAM_SIZE, f) != HOVALAAG_PROGRAM_SIZE)
+        printf("DeppSim: Failed to read %s\n", programFile);
+      fclose(f);
+    }
+  }
+
+  openTime = lastTime = Now();
+}
+
+// Program_set / input1_set are levels, so the memory is written on every
+// fast clock while ctrl selects a commit.
+void SimDevice::Commit()
+{
+  switch (ctrlReg & 0x8F)
+  {
+    case 0x81:
+      program[programAddr & 0xFF] = programData;
+      programDirty = true;
+      ++programWrites;
+      break;
+
+    case 0x83:
+      if (!streamIn2) break;
+      // fall through
+    case 0x82:
+    {
+      int n = (ctrlReg & 3) - 2;
+      input[n][programAddr] = (programData >> 16) & 0xFFF;
+      if ((programAddr & (HalfSize - 1)) == HalfSize - 1) drained[n][programAddr / HalfSize] = false;
+      inputWritten = true;
+      ++inputWrites;
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void SimDevice::WriteReg(uint8_t addr, uint8_t data)
+{
+  ++regWrites;
+  switch (addr)
+  {
+    case 0:
+      ctrlReg = data;
+      if (data & 0x10)
+      {
+        Hold();
+      }
+      else if ((held || (data == 0 && inputWritten)) && !running)
+      {
+        held = false;
+        running = true;
+        lastTime = Now();
+        pendingCycles = 0;
+      }
+      break;
+    case 1: programAddr = (programAddr & 0x700) | data; break;
+    case 2: programData = (programData & 0x00FFFFFF) | (data << 24); break;
+    case 3: programData = (programData & 0xFF00FFFF) | (data << 16); break;
+    case 4: programData = (programData & 0xFFFF00FF) | (data << 8); break;
+    case 5: programData = (programData & 0xFFFFFF00) | data; break;
+    case 6: programAddr = (programAddr & 0xFF) | ((data & 7) << 8); break;
+    default: break;
+  }
+
+  Commit();
+
+  // The fill holds the EPP wait until it is done
+  while (ctrlReg & 0x40)
+  {
+    if (((ctrlReg & 3) == 1 && (programAddr & 0xFF) == 0xFF) || programAddr == InputSize - 1)
+      ctrlReg &= ~0x40;
+    else
+    {
+      programAddr = (programAddr + 1) & (InputSize - 1);
+      Commit();
+    }
+  }
+}
+
+uint8_t SimDevice::ReadReg(uint8_t addr)
+{
+  ++regReads;
+  switch (addr)
+  {
+    case 0: return ctrlReg;
+    case 1: return programAddr & 0xFF;
+    case 2: return programData >> 24;
+    case 3: return programData >> 16;
+    case 4: return programData >> 8;
+    case 5: return programData;
+    case 6: return programAddr >> 8;
+    case 7:
+      return (drained[0][this->addr[0] / HalfSize] ? 0x01 : 0) | (drained[1][this->addr[1] / HalfSize] ? 0x02 : 0) |
+             (drained[0][0] ? 0x04 : 0) | (drained[0][1] ? 0x08 : 0) |
+             (drained[1][0] ? 0x10 : 0) | (drained[1][1] ? 0x20 : 0);
+    case 8:
+      stallCount = (uint32_t)(uint64_t)(stallCycles * (BoardClockHz / cpuHz));
+      return stallCount >> 24;
+    case 9: return stallCount >> 16;
+    case 10: return stallCount >> 8;
+    case 11: return stallCount;
+    default: return 0;
+  }
+}
+
+// Reset everything the hold bit resets.  The cycles already run are kept
+// for the statistics.
+void SimDevice::Hold()
+{
+  if (held) return;
+  held = true;
+  running = false;
+  stalled = false;
+  heldCycles += cpu.state.cycles;
+  cpu.Reset();
+  fifo.Reset();
+  memset(addr, 0, sizeof(addr));
+  memset(drained, 0, sizeof(drained));
+}
+
+void SimDevice::CatchUp()
+{
+  if (!running) return;
+
+  double t = Now();
+  pendingCycles += (t - lastTime) * cpuHz;
+  lastTime = t;
+
+  uint64_t cycles = (uint64_t)pendingCycles;
+  pendingCycles -= cycles;
+  RunCpu(cycles);
+}
+
+void SimDevice::RunCpu(uint64_t cycles)
+{
+  if (!running || cycles == 0) return;
+
+  if (programDirty)
+  {
+    cpu.Load(program, HOVALAAG_PROGRAM_SIZE);
+    programDirty = false;
+  }
+
+  // The CPU's clock is stopped while in1_rdy or in2_rdy is raised, so time spent
+  // stalled is lost rather than saved up.
+  uint64_t startCycles = cpu.state.cycles;
+  if (cpu.Run(*this, cycles) == HOVALAAG_INPUT_STALL)
+  {
+    if (!stalled) ++stalls;
+    stalled = true;
+    stallCycles += cycles - (cpu.state.cycles - startCycles);
+  }
+  else
+  {
+    stalled = false;
+  }
+}
+
+bool SimDevice::In(int port, uint16_t* value)
+{
+  if (port == 0 || streamIn2)
+  {
+    uint16_t& a = addr[port];
+    if (drained[port][a / HalfSize]) return false;
+    *value = input[port][a];
+    if ((a & (HalfSize - 1)) == HalfSize - 1) drained[port][a / HalfSize] = true;
+    a = (a + 1) & (InputSize - 1);
+  }
+  else
+  {
+    *value = fifo.Read();
+  }
+  return true;
+}
+
+void SimDevice::Out(int port, uint16_t value)
+{
+  ++outCount[port];
+  if (outFile) fprintf(outFile, "OUT%d %d\n", port + 1, HovalaagSigned(value));
+  if (port == 1) fifo.Write(value);
+}
+
+void SimDevice::Close()
+{
+  CatchUp();
+
+  // Stalls once the input has run out aren't interesting
+  uint64_t streamStalls = stalls;
+  uint64_t streamStallCycles = stallCycles;
+  RunCpu(closeCycles);
+
+  double t = Now() - openTime;
+  fprintf(stderr, "DeppSim %s: %llu transactions, %llu register writes, %llu reads, %llu bytes\n",
+          name, (unsigned long long)transactions, (unsigned long long)regWrites,
+          (unsigned long long)regReads, (unsigned long long)bytes);
+  fprintf(stderr, "DeppSim %s: %llu program writes, %llu input writes\n",
+          name, (unsigned long long)programWrites, (unsigned long long)inputWrites);
+  fprintf(stderr, "DeppSim %s: %.3fs open, %.3fs in DEPP calls\n", name, t, callTime);
+  fprintf(stderr, "DeppSim %s: CPU ran %llu cycles, output %llu OUT1 and %llu OUT2 words\n",
+          name, (unsigned long long)(heldCycles + cpu.state.cycles),
+          (unsigned long long)outCount[0], (unsigned long long)outCount[1]);
+  fprintf(stderr, "DeppSim %s: CPU stalled for input %llu times, %llu cycles\n",
+          name, (unsigned long long)streamStalls, (unsigned long long)streamStallCycles);
+
+  if (outFile) fclose(outFile);
+  outFile = NULL;
+
+  if (*programFile)
+  {
+    FILE* f = fopen(programFile, "wb");
+    if (!f || fwrite(program, sizeof(uint32_t), HOVALAAG_PROGRAM_SIZE, f) != HOVALAAG_PROGRAM_SIZE)
+      printf("DeppSim: Failed to write %s\n", programFile);
+    if (f) fclose(f);
+  }
+}
+
+// HIFs are indexes into devices, offset by one so hifInvalid is never used.
+// Each device may be used from a different thread, the mutex guards the
+// table itself: opening, closing and looking up a HIF.
+#define MaxDevices 64
+static SimDevice* devices[MaxDevices];
+static std::mutex devicesMutex;
+static thread_local ERC lastError = ercNoErc;
+
+static SimDevice* GetDevice(HIF hif, bool needEnabled)
+{
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  if (hif == hifInvalid || hif > MaxDevices || !devices[hif - 1])
+  {
+    lastError = ercInvalidHif;
+    return NULL;
+  }
+  SimDevice* dev = devices[hif - 1];
+  if (needEnabled && !dev->enabled)
+  {
+    lastError = ercNotEnabled;
+    return NULL;
+  }
+  return dev;
+}
+
+// Times a DEPP call and brings the CPU up to date before it
+class SimCall
+{
+public:
+  SimCall(SimDevice* dev, uint64_t bytes) : dev(dev), start(Now())
+  {
+    ++dev->transactions;
+    dev->bytes += bytes;
+    dev->CatchUp();
+  }
+  ~SimCall() { dev->callTime += Now() - start; }
+
+private:
+  SimDevice* dev;
+  double start;
+};
+
+BOOL DmgrOpen(HIF* phif, const char* szSel)
+{
+  if (!phif || !szSel)
+  {
+    lastError = ercConnReject;
+    return fFalse;
+  }
+
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  for (int i = 0; i < MaxDevices; ++i)
+  {
+    if (!devices[i])
+    {
+      devices[i] = new SimDevice(szSel);
+      *phif = i + 1;
+      lastError = ercNoErc;
+      return fTrue;
+    }
+  }
+  lastError = ercConnReject;
+  return fFalse;
+}
+
+BOOL DmgrClose(HIF hif)
+{
+  SimDevice* dev = GetDevice(hif, false);
+  if (!dev) return fFalse;
+  dev->Close();
+
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  devices[hif - 1] = NULL;
+  delete dev;
+  return fTrue;
+}
+
+static int NumSimDevices()
+{
+  const char* s = getenv("HOVALAAG_SIM_DEVICES");
+  int n = s ? atoi(s) : 1;
+  if (n < 0) n = 0;
+  if (n > MaxDevices) n = MaxDevices;
+  return n;
+}
+
+BOOL DmgrEnumDevices(int* pcdvc)
+{
+  *pcdvc = NumSimDevices();
+  return fTrue;
+}
+
+BOOL DmgrGetDvc(int idvc, DVC* pdvc)
+{
+  if (idvc < 0 || idvc >= NumSimDevices())
+  {
+    lastError = ercConnReject;
+    return fFalse;
+  }
+  memset(pdvc, 0, sizeof(DVC));
+  snprintf(pdvc->szName, sizeof(pdvc->szName), "Basys2-%d", idvc);
+  snprintf(pdvc->szConn, sizeof(pdvc->szConn), "DeppSim");
+  return fTrue;
+}
+
+BOOL DmgrFreeDvcEnum()
+{
+  return fTrue;
+}
+
+ERC DmgrGetLastError()
+{
+  return lastError;
+}
+
+BOOL DeppEnable(HIF hif)
+{
+  SimDevice* dev = GetDevice(hif, false);
+  if (!dev) return fFalse;
+  dev->enabled = true;
+  return fTrue;
+}
+
+BOOL DeppDisable(HIF hif)
+{
+  SimDevice* dev = GetDevice(hif, false);
+  if (!dev) return fFalse;
+  dev->enabled = false;
+  return fTrue;
+}
+
+BOOL DeppPutReg(HIF hif, BYTE bAddr, BYTE bData, BOOL fOverlap)
+{
+  (void)fOverlap;
+  SimDevice* dev = GetDevice(hif, true);
+  if (!dev) return fFalse;
+  SimCall call(dev, 2);
+  dev->WriteReg(bAddr, bData);
+  return fTrue;
+}
+
+BOOL DeppGetReg(HIF hif, BYTE bAddr, BYTE* pbData, BOOL fOverlap)
+{
+  (void)fOverlap;
+  SimDevice* dev = GetDevice(hif, true);
+  if (!dev) return fFalse;
+  SimCall call(dev, 2);
+  *pbData = dev->ReadReg(bAddr);
+  return fTrue;
+}
+
+BOOL DeppPutRegSet(HIF hif, BYTE* pbAddrData, DWORD nAddrDataPairs, BOOL fOverlap)
+{
+  (void)fOverlap;
+  SimDevice* dev = GetDevice(hif, true);
+  if (!dev) return fFalse;
+  SimCall call(dev, 2 * (uint64_t)nAddrDataPairs);
+  for (DWORD i = 0; i < nAddrDataPairs; ++i)
+    dev->WriteReg(pbAddrData[2 * i], pbAddrData[2 * i + 1]);
+  return fTrue;
+}
+
+BOOL DeppGetRegSet(HIF hif, BYTE* pbAddr, BYTE* pbData, DWORD cbData, BOOL fOverlap)
+{
+  (void)fOverlap;
+  SimDevice* dev = GetDevice(hif, true);
+  if (!dev) return fFalse;
+  SimCall call(dev, 2 * (uint64_t)cbData);
+  for (DWORD i = 0; i < cbData; ++i)
+    pbData[i] = dev->ReadReg(pbAddr[i]);
+  return fTrue;
+}
+
+BOOL DeppPutRegRepeat(HIF hif, BYTE bAddr, BYTE* pbData, DWORD cbData, BOOL fOverlap)
+{
+  (void)fOverlap;
+  SimDevice* dev = GetDevice(hif, true);
+  if (!dev) return fFalse;
+  SimCall call(dev, 1 + (uint64_t)cbData);
+  for (DWORD i = 0; i < cbData; ++i)
+    dev->WriteReg(bAddr, pbData[i]);
+  return fTrue;
+}
+
+BOOL DeppGetRegRepeat(HIF hif, BYTE bAddr, BYTE* pbData, DWORD cbData, BOOL fOverlap)
+{
+  (void)fOverlap;
+  SimDevice* dev = GetDevice(hif, true);
+  if (!dev) return fFalse;
+  SimCall call(dev, 1 + (uint64_t)cbData);
+  for (DWORD i = 0; i < cbData; ++i)
+    pbData[i] = dev->ReadReg(bAddr);
+  return fTrue;
+}
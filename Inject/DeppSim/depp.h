@@ -0,0 +1,26 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Stand-in for the Digilent Adept SDK depp.h, implemented by DeppSim.cpp
+//
+// The registers are those of DpimIf.v.  fOverlap is accepted but ignored,
+// every call completes before it returns.
+
+#ifndef DEPP_H
+#define DEPP_H
+
+#include "dpcdecl.h"
+
+BOOL DeppEnable(HIF hif);
+BOOL DeppDisable(HIF hif);
+
+BOOL DeppPutReg(HIF hif, BYTE bAddr, BYTE bData, BOOL fOverlap);
+BOOL DeppGetReg(HIF hif, BYTE bAddr, BYTE* pbData, BOOL fOverlap);
+
+// pbAddrData holds nAddrDataPairs address, data byte pairs
+BOOL DeppPutRegSet(HIF hif, BYTE* pbAddrData, DWORD nAddrDataPairs, BOOL fOverlap);
+BOOL DeppGetRegSet(HIF hif, BYTE* pbAddr, BYTE* pbData, DWORD cbData, BOOL fOverlap);
+
+BOOL DeppPutRegRepeat(HIF hif, BYTE bAddr, BYTE* pbData, DWORD cbData, BOOL fOverlap);
+BOOL DeppGetRegRepeat(HIF hif, BYTE bAddr, BYTE* pbData, DWORD cbData, BOOL fOverlap);
+
+#endif
@@ -0,0 +1,21 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Stand-in for the Digilent Adept SDK dmgr.h, implemented by DeppSim.cpp
+
+#ifndef DMGR_H
+#define DMGR_H
+
+#include "dpcdecl.h"
+
+// Open the named device, any name gives a new simulated board
+BOOL DmgrOpen(HIF* phif, const char* szSel);
+BOOL DmgrClose(HIF hif);
+ERC DmgrGetLastError();
+
+// The simulated boards are named Basys2-0 to Basys2-<n-1>, with n from
+// HOVALAAG_SIM_DEVICES (default 1).
+BOOL DmgrEnumDevices(int* pcdvc);
+BOOL DmgrGetDvc(int idvc, DVC* pdvc);
+BOOL DmgrFreeDvcEnum();
+
+#endif
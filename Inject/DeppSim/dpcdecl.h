@@ -0,0 +1,39 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Stand-in for the Digilent Adept SDK dpcdecl.h, for building Inject and
+// InjectS against DeppSim instead of the real libdepp/libdmgr.
+// Only the types used by the Inject programs are declared.
+
+#ifndef DPCDECL_H
+#define DPCDECL_H
+
+#include <stdint.h>
+
+typedef uint8_t BYTE;
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef DWORD HIF;
+typedef int ERC;
+typedef DWORD DTP;
+
+#define cchDvcNameMax 64
+#define MAX_PATH 260
+
+// Device enumerated by DmgrGetDvc
+typedef struct tagDVC
+{
+  char szName[cchDvcNameMax];
+  char szConn[MAX_PATH + 1];
+  DTP dtp;
+} DVC;
+
+#define hifInvalid 0
+#define fFalse 0
+#define fTrue 1
+
+#define ercNoErc 0
+#define ercConnReject 3001
+#define ercInvalidHif 3005
+#define ercNotEnabled 3012
+
+#endif
@@ -11,7 +11,20 @@
 // 63      9     72     54
 // 91     13    104     78
 // The first two columns are set as the IN1 and IN2 input data,
-// any remaining columns are ignored.
+// any remaining columns are ignored.  --columns a[,b] takes IN1 and IN2
+// from other columns (counting from 1), or only IN1 if b is left out.
+// Malformed lines are reported and skipped (see TextInput.h).
+// --packed reads IN1 and IN2 from input.hvi instead (see PackedInput.h).
+//
+// Each input array holds 2048 words, the rows that don't fit (leaving room
+// for the terminating zero) are reported and dropped, use InjectS to
+// stream longer inputs.
+//
+// Only the instructions that differ from the program last loaded are sent,
+// --force loads the whole program (see ProgramLoad.h).
+//
+// --stats file writes the transfer timings and counts as JSON (see
+// TransferStats.h).
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,16 +34,58 @@
 #include "depp.h"
 #include "dmgr.h"
 
+#include "ProgramLoad.h"
+#include "TransferStats.h"
+#include "TextInput.h"
+#include "PackedInput.h"
+
 #define DeviceName "Basys2"
 #define BinFileName "a.out"
 #define InputFileName "input.txt"
+#define PackedFileName "input.hvi"
+#define InputArrayWords 2048
 
-uint8_t* BuildBinRegSet(size_t* regSetLen);
-uint8_t* BuildInputRegSet(size_t* regSetLen);
+int ReadPackedInput(int16_t* in1, int16_t* in2, int* in2Len);
+int ReadTextInput(int in1Column, int in2Column, int16_t* in1, int16_t* in2, int* in2Len);
+uint8_t* BuildInputRegSet(bool packed, int in1Column, int in2Column, size_t* regSetLen, int* numWords);
 
 int main(int argc, char* argv[])
 {
   HIF hif;
+  bool force = false;
+  bool packed = false;
+  const char* statsFileName = NULL;
+  uint32_t programImage[ProgramWords];
+  TransferStats stats;
+  int in1Column = 0;
+  int in2Column = 1;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--force")) force = true;
+    else if (!strcmp(argv[i], "--packed")) packed = true;
+    else if (!strcmp(argv[i], "--stats") && i + 1 < argc) statsFileName = argv[++i];
+    else if (!strcmp(argv[i], "--columns") && i + 1 < argc &&
+             sscanf(argv[++i], "%d,%d", &in1Column, &in2Column) >= 1)
+    {
+      // Given counting from 1, and only leaving b out means no IN2
+      bool hasIn2 = strchr(argv[i], ',') != NULL;
+      if (in1Column < 1 || (hasIn2 && (sscanf(argv[i], "%*d,%d", &in2Column) != 1 || in2Column < 1)))
+      {
+        printf("Columns count from 1\n");
+        return 1;
+      }
+      in1Column--;
+      in2Column = hasIn2 ? in2Column - 1 : -1;
+    }
+    else
+    {
+      printf("Usage: Inject [--force] [--stats file.json] [--columns in1[,in2] | --packed]\n");
+      return 1;
+    }
+  }
+  transferStatsEnabled = statsFileName != NULL;
+  InitTransferStats(&stats);
 
   if (!DmgrOpen(&hif, DeviceName))
   {
@@ -46,125 +101,141 @@ int main(int argc, char* argv[])
 
   int rv = 0;
   size_t regSetLen;
-  uint8_t* regSetPairs = BuildBinRegSet(&regSetLen);
-  if (!regSetPairs)
+  uint8_t* regSetPairs = NULL;
+  int numWords;
+  bool ok;
+
+  {
+    TransferTimer timer(&stats, OpReadFile);
+    ok = ReadProgramImage(BinFileName, programImage);
+  }
+  if (!ok)
   {
     rv = 2;
     goto EXIT;
   }
+
+  {
+    TransferTimer timer(&stats, OpBuildRegSet);
+    regSetPairs = BuildCachedRegSet(DeviceName, programImage, force, &regSetLen);
+  }
   
-  if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
+  ClearProgramCache(DeviceName);
+  if (regSetLen != 0)
   {
-    printf("RegSet failed.\n");
-    rv = 3;
-    goto EXIT;
+    TransferTimer timer(&stats, OpPutRegSet);
+    if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
+    {
+      printf("RegSet failed.\n");
+      rv = 3;
+      goto EXIT;
+    }
+    CountPutRegSet(&stats, regSetLen);
   }
+  SaveProgramCache(DeviceName, programImage);
   free(regSetPairs);
 
-  regSetPairs = BuildInputRegSet(&regSetLen);
+  // The input file is read as the pairs are built, so this is timed as building
+  {
+    TransferTimer timer(&stats, OpBuildRegSet);
+    regSetPairs = BuildInputRegSet(packed, in1Column, in2Column, &regSetLen, &numWords);
+  }
   if (!regSetPairs)
   {
     rv = 4;
     goto EXIT;
   }
   
-  if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
   {
-    printf("RegSet failed.\n");
-    rv = 3;
-    goto EXIT;
+    TransferTimer timer(&stats, OpPutRegSet);
+    if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
+    {
+      printf("RegSet failed.\n");
+      rv = 3;
+      goto EXIT;
+    }
+    CountPutRegSet(&stats, regSetLen);
+    CountInputWords(&stats, numWords);
   }
 
 EXIT:
   free(regSetPairs);
   DeppDisable(hif);
   DmgrClose(hif);
-  return rv;
-}
-
-// Build the address/data pairs for programming the Hovalaag from the a.out binary
-// Allocates the buffer, which should be freed by the caller.
-uint8_t* BuildBinRegSet(size_t* regSetLen)
-{
-  FILE* binFile = fopen(BinFileName, "rb");
-  if (!binFile)
-  {
-    printf("Failed to open " BinFileName "\n");
-    return NULL;
-  }
 
-  // Determine file size
-  fseek(binFile, 0, SEEK_END);
-  size_t fileSize = ftell(binFile);
-  fseek(binFile, 0, SEEK_SET);
-  if ((fileSize % 4) != 0 || fileSize > 1024)
+  if (statsFileName)
   {
-    printf("Invalid program\n");
-    fclose(binFile);
-    return NULL;
+    const char* name = DeviceName;
+    const TransferStats* boardStats = &stats;
+    stats.endTime = Now();
+    WriteTransferStats(statsFileName, NULL, &name, &boardStats, 1);
   }
+  return rv;
+}
 
-  // Read file
-  uint8_t binaryProgram[1028];
-  memset(binaryProgram + fileSize, 0, 1028 - fileSize);
-  fread(binaryProgram, 1, fileSize, binFile);
-  size_t programSize = fileSize / 4;
-  
-  // Produce address/data pairs for programming
-  uint8_t* regSetPairs = (uint8_t*)malloc((programSize + 1) * 7 * 2 + 2);
-  for (size_t i = 0; i <= programSize; ++i)
-  {
-    uint8_t* instr = &regSetPairs[i * 7 * 2];
-    for (int j = 0; j < 6; ++j)
-      instr[j*2] = j;
-    instr[1] = 1;
-    instr[3] = i;
-    for (int j = 0; j < 4; ++j)
-      instr[5 + j * 2] = binaryProgram[i * 4 + 3 - j];
-    instr[12] = 0;
-    instr[13] = (i == programSize) ? 0xc1 : 0x81;
-  }
-
-  regSetPairs[programSize * 7 * 2] = 0;
-  regSetPairs[programSize * 7 * 2 + 1] = 0;
-
-  fclose(binFile);
+// Read the first InputArrayWords - 1 rows of input.hvi, returns the IN1 length
+// or -1 on failure
+int ReadPackedInput(int16_t* in1, int16_t* in2, int* in2Len)
+{
+  PackedInput packed;
+  if (!packed.Open(PackedFileName)) return -1;
 
-  *regSetLen = (programSize + 1) * 7 + 2;
-  return regSetPairs;
+  int in1Len = packed.Read(0, 0, in1, InputArrayWords - 1);
+  *in2Len = packed.Read(1, 0, in2, InputArrayWords - 1);
+  long long dropped = packed.Samples(0) - in1Len;
+  if (packed.Samples(1) - *in2Len > dropped) dropped = packed.Samples(1) - *in2Len;
+  if (dropped)
+    printf(PackedFileName ": only the first %d words fit in the input arrays, %lld dropped\n",
+           InputArrayWords - 1, dropped);
+  return in1Len;
 }
 
-uint8_t* BuildInputRegSet(size_t* regSetLen)
+// Read the first InputArrayWords - 1 rows of input.txt, returns the IN1 length
+// or -1 on failure
+int ReadTextInput(int in1Column, int in2Column, int16_t* in1, int16_t* in2, int* in2Len)
 {
-  FILE* inFile = fopen(InputFileName, "rb");
-  if (!inFile)
+  TextInput text;
+  if (!text.Open(InputFileName)) return -1;
+  text.SetColumns(in1Column, in2Column);
+
+  int in1Len = text.Read(in1, in2, in2Len, InputArrayWords - 1);
+  if (!text.AtEnd())
   {
-    printf("Failed to open " InputFileName "\n");
-    return NULL;
+    // Count what's left so the user knows how much was dropped
+    long long dropped = 0;
+    int16_t rest1[1024];
+    int16_t rest2[1024];
+    int rest2Len;
+    int n;
+    do
+    {
+      rest2Len = 0;
+      n = text.Read(rest1, rest2, &rest2Len, 1024);
+      dropped += n;
+    } while (n == 1024);
+    if (dropped)
+      printf(InputFileName ": only the first %d rows fit in the input array, %lld dropped\n",
+             InputArrayWords - 1, dropped);
   }
+  text.ReportMalformed();
+  return in1Len;
+}
 
-  short int in1[8192];
-  short int in2[8192];
-  int in1Len = 0;
+uint8_t* BuildInputRegSet(bool packed, int in1Column, int in2Column, size_t* regSetLen, int* numWords)
+{
+  int16_t in1[InputArrayWords];
+  int16_t in2[InputArrayWords];
   int in2Len = 0;
-
-  for (int i = 0; i < 8192 && !feof(inFile); ++i)
-  {
-    char buf[256];
-    if (!fgets(buf, sizeof(buf), inFile)) break;
-
-    int numRead = sscanf(buf, "%hd %hd", &in1[i], &in2[i]);
-    if (numRead == 0) break;
-    in1Len++;
-    if (numRead == 2) in2Len++;
-  }
+  int in1Len = packed ? ReadPackedInput(in1, in2, &in2Len)
+                      : ReadTextInput(in1Column, in2Column, in1, in2, &in2Len);
+  if (in1Len < 0) return NULL;
 
   in1[in1Len] = 0;
   in2[in2Len] = 0;
 
   // Produce address/data pairs for programming
   uint8_t* regSetPairs = (uint8_t*)malloc((in1Len + in2Len + 2) * 6 * 2 + 2);
-  for (size_t i = 0; i <= in1Len; ++i)
+  for (int i = 0; i <= in1Len; ++i)
   {
     uint8_t* instr = &regSetPairs[i * 6 * 2];
     for (int j = 0; j < 4; ++j)
@@ -178,7 +249,7 @@ uint8_t* BuildInputRegSet(size_t* regSetLen)
     instr[10] = 0;
     instr[11] = (i == in1Len) ? 0xc2 : 0x82;
   }
-  for (size_t i = 0; i <= in2Len; ++i)
+  for (int i = 0; i <= in2Len; ++i)
   {
     uint8_t* instr = &regSetPairs[(i + in1Len + 1) * 6 * 2];
     for (int j = 0; j < 4; ++j)
@@ -190,14 +261,13 @@ uint8_t* BuildInputRegSet(size_t* regSetLen)
     instr[8] = 6;
     instr[9] = i >> 8;
     instr[10] = 0;
-    instr[11] = (i == in1Len) ? 0xc3 : 0x83;
+    instr[11] = (i == in2Len) ? 0xc3 : 0x83;
   }
 
   regSetPairs[(in1Len + in2Len + 2) * 6 * 2] = 0;
   regSetPairs[(in1Len + in2Len + 2) * 6 * 2 + 1] = 0;
 
-  fclose(inFile);
-
   *regSetLen = (in1Len + in2Len + 2) * 6 * 1 + 1;
+  *numWords = in1Len + in2Len;
   return regSetPairs;
 }
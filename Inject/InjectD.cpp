@@ -0,0 +1,732 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Daemon that keeps the Basys2 board open and runs a queue of jobs on it,
+// each job being a program image and an input stream for IN1.
+//
+//   InjectD [-d device] [-s socket] [-f]   run the daemon
+//   InjectD -j [-t|-p] [-n] [-s socket]    queue a.out with input.bin (or
+//                                          input.txt with -t, IN1 of
+//                                          input.hvi with -p) and wait for
+//                                          it to finish, unless -n
+//   InjectD -i [-s socket]                 print the queue depth and job latencies
+//   InjectD -x [-s socket]                 stop the daemon once its queue is empty
+//
+// Jobs are passed over a Unix domain socket, /tmp/hovalaag_<device>.sock by
+// default.  Each request is a line of text, followed by binary data for RUN:
+//   RUN <input words>   then the 256 program words as in a.out, then the input
+//                       words as 16-bit little endian.  Replies
+//                       "QUEUED <id> <jobs waiting>", then
+//                       "DONE <id> <ms waiting> <ms running> <stalls>" or
+//                       "FAILED <id>" once the job has finished.  The client
+//                       can hang up after QUEUED if it doesn't want to wait.
+//   STATS               replies with "name value" lines
+//   QUIT                replies "OK" and stops once the queue is empty
+//
+// Each job starts with the CPU held in reset by bit 4 of the control register
+// while the instructions that differ from the last program loaded and the
+// first two chunks of input are sent, so no state is carried from one job to
+// the next.  This needs a bitstream with the hold bit in DpimIf.v.  A job has
+// finished once the CPU has read all of its input, including the zeros the
+// last chunk is padded with.
+//
+// Jobs are pipelined: when the CPU moves on to a job's last chunk, the other
+// half of the input array is filled with the next job's chunk for that half,
+// apart from its last word so the half stays drained and the CPU stalls at
+// the end of the job instead of running on into it.  Only the hold, the
+// program changes, that last word and the other half are left to send when
+// the next job starts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dpcdecl.h"
+#include "depp.h"
+#include "dmgr.h"
+
+#include "ProgramLoad.h"
+#include "InputLoad.h"
+
+#define DeviceName "Basys2"
+#define BinFileName "a.out"
+#define InputBinFileName "input.bin"
+#define InputTxtFileName "input.txt"
+#define PackedFileName "input.hvi"
+#define SocketFormat "/tmp/hovalaag_%s.sock"
+
+#define MaxInputWords (64 * 1024 * 1024)
+#define MaxLine 64
+
+struct Job
+{
+  int id;
+  int fd;
+  uint32_t image[ProgramWords];
+  int16_t* input;
+  int inputLen;
+  int stalls;
+  double queuedTime;
+  double startTime;
+  Job* next;
+};
+
+// Queue and statistics, protected by queueMutex
+struct Queue
+{
+  Job* head;
+  Job* tail;
+  int depth;
+  int nextId;
+  int runningId;
+  bool quitting;
+
+  int jobsDone;
+  int jobsFailed;
+  int programUploads;
+  int programSkipped;
+  long long inputWords;
+  double totalWait;
+  double totalRun;
+  double maxLatency;
+  double lastLatency;
+};
+
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond = PTHREAD_COND_INITIALIZER;
+static Queue queue;
+
+static HIF hif;
+static const char* deviceName = DeviceName;
+static uint32_t loadedImage[ProgramWords];
+static bool haveLoadedImage = false;
+static volatile sig_atomic_t stopRequested = 0;
+
+int RunDaemon(const char* socketPath, bool force);
+int SubmitJob(const char* socketPath, InputFormat format, bool wait);
+int Request(const char* socketPath, const char* request);
+
+int main(int argc, char* argv[])
+{
+  char socketPath[sizeof(((sockaddr_un*)0)->sun_path)] = "";
+  bool force = false;
+  InputFormat format = InputBinary;
+  bool wait = true;
+  char mode = 0;
+
+  static const struct option longOptions[] = {
+    { "force", no_argument, NULL, 'f' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "d:s:fjtpnix", longOptions, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'd': deviceName = optarg; break;
+      case 's': snprintf(socketPath, sizeof(socketPath), "%s", optarg); break;
+      case 'f': force = true; break;
+      case 't': format = InputText; break;
+      case 'p': format = InputPacked; break;
+      case 'n': wait = false; break;
+      case 'j':
+      case 'i':
+      case 'x': mode = opt; break;
+      default:
+        printf("Usage: InjectD [-d device] [-s socket] [-f]   run the daemon\n"
+               "       InjectD -j [-t|-p] [-n] [-s socket]    queue a.out with input.bin\n"
+               "       InjectD -i [-s socket]                 print queue depth and latencies\n"
+               "       InjectD -x [-s socket]                 stop the daemon\n"
+               "  -d  board to use, default " DeviceName "\n"
+               "  -s  socket, default " SocketFormat "\n"
+               "  -f  load the whole program for the first job (also --force)\n"
+               "  -t  read input.txt instead of input.bin\n"
+               "  -p  read IN1 of input.hvi instead of input.bin\n"
+               "  -n  don't wait for the job to finish\n", "<device>");
+        return 1;
+    }
+  }
+  if (!*socketPath)
+    snprintf(socketPath, sizeof(socketPath), SocketFormat, deviceName);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  switch (mode)
+  {
+    case 'j': return SubmitJob(socketPath, format, wait);
+    case 'i': return Request(socketPath, "STATS\n");
+    case 'x': return Request(socketPath, "QUIT\n");
+    default: return RunDaemon(socketPath, force);
+  }
+}
+
+static bool WriteAll(int fd, const void* buf, size_t len)
+{
+  const uint8_t* p = (const uint8_t*)buf;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool ReadAll(int fd, void* buf, size_t len)
+{
+  uint8_t* p = (uint8_t*)buf;
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Read a line without its newline, false at end of file or if it's too long
+static bool ReadLine(int fd, char* line, size_t size)
+{
+  for (size_t len = 0; len < size - 1; ++len)
+  {
+    if (read(fd, &line[len], 1) != 1) return false;
+    if (line[len] == '\n')
+    {
+      line[len] = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void Reply(int fd, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void Reply(int fd, const char* format, ...)
+{
+  char buf[1024];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len > (int)sizeof(buf) - 1) len = sizeof(buf) - 1;
+  WriteAll(fd, buf, len);
+}
+
+static void FreeJob(Job* job)
+{
+  if (job->fd >= 0) close(job->fd);
+  free(job->input);
+  free(job);
+}
+
+// Take the job at the head of the queue, waiting for one if wait is set.
+// Returns NULL if there is none, or once the daemon is stopping.
+static Job* PopJob(bool wait)
+{
+  pthread_mutex_lock(&queueMutex);
+  while (wait && !queue.head && !queue.quitting)
+    pthread_cond_wait(&queueCond, &queueMutex);
+
+  Job* job = queue.head;
+  if (job)
+  {
+    queue.head = job->next;
+    if (!queue.head) queue.tail = NULL;
+    queue.depth--;
+  }
+  pthread_mutex_unlock(&queueMutex);
+  return job;
+}
+
+static void FinishJob(Job* job, bool ok)
+{
+  double now = Now();
+  double wait = job->startTime - job->queuedTime;
+  double run = now - job->startTime;
+
+  pthread_mutex_lock(&queueMutex);
+  if (ok)
+  {
+    queue.jobsDone++;
+    queue.inputWords += job->inputLen;
+    queue.totalWait += wait;
+    queue.totalRun += run;
+    queue.lastLatency = wait + run;
+    if (wait + run > queue.maxLatency) queue.maxLatency = wait + run;
+  }
+  else
+  {
+    queue.jobsFailed++;
+  }
+  if (queue.runningId == job->id) queue.runningId = -1;
+  pthread_mutex_unlock(&queueMutex);
+
+  if (ok)
+  {
+    printf("Job %d: %d words, waited %.1fms, ran %.1fms, CPU waited for %d refills\n",
+           job->id, job->inputLen, wait * 1e3, run * 1e3, job->stalls);
+    if (job->fd >= 0)
+      Reply(job->fd, "DONE %d %.3f %.3f %d\n", job->id, wait * 1e3, run * 1e3, job->stalls);
+  }
+  else
+  {
+    printf("Job %d failed\n", job->id);
+    if (job->fd >= 0) Reply(job->fd, "FAILED %d\n", job->id);
+  }
+  FreeJob(job);
+}
+
+// Send and free a set of address/data pairs
+static bool SendRegSet(uint8_t* regSetPairs, size_t regSetLen)
+{
+  bool ok = regSetLen == 0 || DeppPutRegSet(hif, regSetPairs, regSetLen, false);
+  if (!ok) printf("RegSet failed.\n");
+  free(regSetPairs);
+  return ok;
+}
+
+static bool PutCtrl(uint8_t ctrl)
+{
+  uint8_t pair[2] = { 0, ctrl };
+  if (DeppPutRegSet(hif, pair, 1, false)) return true;
+  printf("RegSet failed.\n");
+  return false;
+}
+
+// Hold the CPU, load the job's program and its first two chunks of input,
+// and let it go.  prefilled is the half already holding all but the last
+// word of its chunk, or -1.
+static bool StartJob(Job* job, int prefilled)
+{
+  size_t regSetLen;
+
+  pthread_mutex_lock(&queueMutex);
+  queue.runningId = job->id;
+  pthread_mutex_unlock(&queueMutex);
+  job->startTime = Now();
+
+  if (!PutCtrl(CtrlHold)) return false;
+
+  uint8_t* regSetPairs = BuildProgramRegSet(job->image, haveLoadedImage ? loadedImage : NULL,
+                                            &regSetLen, CtrlHold);
+  pthread_mutex_lock(&queueMutex);
+  if (regSetLen == 0)
+    queue.programSkipped++;
+  else
+    queue.programUploads++;
+  pthread_mutex_unlock(&queueMutex);
+
+  if (regSetLen != 0)
+  {
+    haveLoadedImage = false;
+    ClearProgramCache(deviceName);
+    if (!SendRegSet(regSetPairs, regSetLen)) return false;
+    memcpy(loadedImage, job->image, sizeof(loadedImage));
+    haveLoadedImage = true;
+    SaveProgramCache(deviceName, loadedImage);
+  }
+  else
+  {
+    free(regSetPairs);
+  }
+
+  for (int chunk = 0; chunk < 2; ++chunk)
+  {
+    int first = (chunk == prefilled) ? HalfWords - 1 : 0;
+    regSetPairs = BuildInputRegSet(job->input, job->inputLen, chunk, first, HalfWords, CtrlHold, &regSetLen);
+    if (!SendRegSet(regSetPairs, regSetLen)) return false;
+  }
+
+  return PutCtrl(0);
+}
+
+// Run jobs from the queue until the daemon is stopped
+static void* RunJobs(void*)
+{
+  Job* job = PopJob(true);
+  int prefilled = -1;
+  while (job)
+  {
+    bool ok = StartJob(job, prefilled);
+    prefilled = -1;
+
+    int numChunks = InputChunks(job->inputLen);
+    DrainTimer drain = { 0, 0 };
+    bool stalled;
+    size_t regSetLen;
+    uint8_t* regSetPairs;
+
+    for (int chunk = 2; ok && chunk < numChunks; ++chunk)
+    {
+      ok = WaitForHalf(hif, chunk & 1, &drain, &stalled);
+      if (!ok) break;
+      if (stalled) job->stalls++;
+      regSetPairs = BuildInputRegSet(job->input, job->inputLen, chunk, 0, HalfWords, 0, &regSetLen);
+      ok = SendRegSet(regSetPairs, regSetLen);
+    }
+
+    // Once the CPU is on the last chunk, start the next job's input in the
+    // other half.
+    int lastHalf = (numChunks - 1) & 1;
+    Job* next = NULL;
+    if (ok) ok = WaitForHalf(hif, lastHalf ^ 1, &drain, &stalled);
+    if (ok)
+    {
+      next = PopJob(false);
+      if (next)
+      {
+        regSetPairs = BuildInputRegSet(next->input, next->inputLen, lastHalf ^ 1, 0, HalfWords - 1, 0, &regSetLen);
+        ok = SendRegSet(regSetPairs, regSetLen);
+        if (ok) prefilled = lastHalf ^ 1;
+      }
+    }
+    if (ok) ok = WaitForHalf(hif, lastHalf, &drain, &stalled);
+    if (!ok) prefilled = -1;
+
+    FinishJob(job, ok);
+    job = next ? next : PopJob(true);
+  }
+  return NULL;
+}
+
+static void HandleRun(int fd, int inputLen)
+{
+  if (inputLen < 0 || inputLen > MaxInputWords)
+  {
+    Reply(fd, "ERROR bad input length\n");
+    close(fd);
+    return;
+  }
+
+  Job* job = (Job*)malloc(sizeof(Job));
+  job->fd = fd;
+  job->input = (int16_t*)malloc((inputLen + 1) * sizeof(int16_t));
+  job->inputLen = inputLen;
+  job->stalls = 0;
+  job->next = NULL;
+
+  uint8_t imageBytes[ProgramWords * 4];
+  if (!ReadAll(fd, imageBytes, sizeof(imageBytes)) ||
+      !ReadAll(fd, job->input, inputLen * sizeof(int16_t)))
+  {
+    FreeJob(job);
+    return;
+  }
+  for (int i = 0; i < ProgramWords; ++i)
+  {
+    uint8_t* b = &imageBytes[i * 4];
+    job->image[i] = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  }
+  for (int i = 0; i < inputLen; ++i)
+  {
+    uint8_t* b = (uint8_t*)&job->input[i];
+    job->input[i] = (int16_t)(b[0] | (b[1] << 8));
+  }
+
+  pthread_mutex_lock(&queueMutex);
+  if (queue.quitting)
+  {
+    pthread_mutex_unlock(&queueMutex);
+    Reply(fd, "ERROR stopping\n");
+    FreeJob(job);
+    return;
+  }
+  job->id = queue.nextId++;
+  job->queuedTime = Now();
+  if (queue.tail)
+    queue.tail->next = job;
+  else
+    queue.head = job;
+  queue.tail = job;
+  int depth = ++queue.depth;
+  pthread_cond_signal(&queueCond);
+
+  // Reply while holding the lock so QUEUED is always sent before DONE
+  Reply(fd, "QUEUED %d %d\n", job->id, depth);
+  pthread_mutex_unlock(&queueMutex);
+}
+
+static void HandleStats(int fd)
+{
+  pthread_mutex_lock(&queueMutex);
+  Queue q = queue;
+  pthread_mutex_unlock(&queueMutex);
+
+  int n = q.jobsDone > 0 ? q.jobsDone : 1;
+  Reply(fd, "queued %d\n", q.depth);
+  Reply(fd, "running %d\n", q.runningId);
+  Reply(fd, "done %d\n", q.jobsDone);
+  Reply(fd, "failed %d\n", q.jobsFailed);
+  Reply(fd, "program_uploads %d\n", q.programUploads);
+  Reply(fd, "program_skipped %d\n", q.programSkipped);
+  Reply(fd, "input_words %lld\n", q.inputWords);
+  Reply(fd, "wait_ms_mean %.3f\n", q.totalWait * 1e3 / n);
+  Reply(fd, "run_ms_mean %.3f\n", q.totalRun * 1e3 / n);
+  Reply(fd, "latency_ms_mean %.3f\n", (q.totalWait + q.totalRun) * 1e3 / n);
+  Reply(fd, "latency_ms_max %.3f\n", q.maxLatency * 1e3);
+  Reply(fd, "latency_ms_last %.3f\n", q.lastLatency * 1e3);
+  close(fd);
+}
+
+static void StopQueue()
+{
+  pthread_mutex_lock(&queueMutex);
+  queue.quitting = true;
+  pthread_cond_broadcast(&queueCond);
+  pthread_mutex_unlock(&queueMutex);
+}
+
+static void* HandleConnection(void* arg)
+{
+  int fd = (int)(intptr_t)arg;
+  char line[MaxLine];
+  int inputLen;
+
+  if (!ReadLine(fd, line, sizeof(line)))
+    close(fd);
+  else if (sscanf(line, "RUN %d", &inputLen) == 1)
+    HandleRun(fd, inputLen);
+  else if (strcmp(line, "STATS") == 0)
+    HandleStats(fd);
+  else if (strcmp(line, "QUIT") == 0)
+  {
+    StopQueue();
+    Reply(fd, "OK\n");
+    close(fd);
+  }
+  else
+  {
+    Reply(fd, "ERROR unknown request\n");
+    close(fd);
+  }
+  return NULL;
+}
+
+static void OnSignal(int)
+{
+  stopRequested = 1;
+}
+
+static int Listen(const char* socketPath)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+
+  // A socket left behind by a daemon that died is replaced, one that
+  // something is still listening on isn't.
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0)
+  {
+    printf("InjectD is already running on %s\n", socketPath);
+    close(fd);
+    return -1;
+  }
+  unlink(socketPath);
+
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+  {
+    printf("Failed to listen on %s\n", socketPath);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int RunDaemon(const char* socketPath, bool force)
+{
+  int listenFd = Listen(socketPath);
+  if (listenFd < 0) return 1;
+
+  if (!DmgrOpen(&hif, deviceName))
+  {
+    printf("Failed to open device\n");
+    close(listenFd);
+    unlink(socketPath);
+    return 1;
+  }
+
+  int rv = 0;
+  pthread_t worker;
+  if (!DeppEnable(hif))
+  {
+    printf("Failed to enable DEPP transfer\n");
+    rv = 1;
+    goto CLOSE;
+  }
+
+  haveLoadedImage = !force && LoadProgramCache(deviceName, loadedImage);
+  queue.runningId = -1;
+
+  if (pthread_create(&worker, NULL, RunJobs, NULL) != 0)
+  {
+    printf("Failed to start worker thread\n");
+    rv = 6;
+    goto EXIT;
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+  printf("InjectD running on %s, listening on %s\n", deviceName, socketPath);
+  fflush(stdout);
+
+  while (true)
+  {
+    pthread_mutex_lock(&queueMutex);
+    bool quitting = queue.quitting;
+    pthread_mutex_unlock(&queueMutex);
+    if (quitting) break;
+    if (stopRequested) StopQueue();
+
+    pollfd pfd = { listenFd, POLLIN, 0 };
+    if (poll(&pfd, 1, 200) <= 0) continue;
+
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) continue;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, HandleConnection, (void*)(intptr_t)fd) != 0)
+      close(fd);
+    else
+      pthread_detach(thread);
+  }
+
+  // Jobs already queued are still run
+  pthread_join(worker, NULL);
+
+  {
+    pthread_mutex_lock(&queueMutex);
+    Queue q = queue;
+    pthread_mutex_unlock(&queueMutex);
+    printf("Ran %d jobs, %d failed, program loaded %d times and unchanged %d times\n",
+           q.jobsDone, q.jobsFailed, q.programUploads, q.programSkipped);
+  }
+
+EXIT:
+  DeppDisable(hif);
+CLOSE:
+  DmgrClose(hif);
+  close(listenFd);
+  unlink(socketPath);
+  return rv;
+}
+
+static int Connect(const char* socketPath)
+{
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+  {
+    printf("Failed to connect to InjectD on %s\n", socketPath);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int SubmitJob(const char* socketPath, InputFormat format, bool wait)
+{
+  uint32_t image[ProgramWords];
+  if (!ReadProgramImage(BinFileName, image)) return 2;
+
+  int inputLen;
+  const char* fileName = format == InputText ? InputTxtFileName :
+                         format == InputPacked ? PackedFileName : InputBinFileName;
+  int16_t* input = ReadAllInput(fileName, format, 0, &inputLen);
+  if (!input) return 4;
+
+  int fd = Connect(socketPath);
+  if (fd < 0)
+  {
+    free(input);
+    return 1;
+  }
+
+  char header[MaxLine];
+  int headerLen = snprintf(header, sizeof(header), "RUN %d\n", inputLen);
+
+  uint8_t imageBytes[ProgramWords * 4];
+  for (int i = 0; i < ProgramWords; ++i)
+  {
+    for (int j = 0; j < 4; ++j)
+      imageBytes[i * 4 + j] = (image[i] >> (j * 8)) & 0xff;
+  }
+  uint8_t* inputBytes = (uint8_t*)input;
+  for (int i = 0; i < inputLen; ++i)
+  {
+    uint16_t v = input[i];
+    inputBytes[i * 2] = v & 0xff;
+    inputBytes[i * 2 + 1] = v >> 8;
+  }
+
+  bool ok = WriteAll(fd, header, headerLen) && WriteAll(fd, imageBytes, sizeof(imageBytes)) &&
+            WriteAll(fd, inputBytes, inputLen * sizeof(int16_t));
+  free(input);
+
+  char line[MaxLine];
+  int id, depth;
+  if (!ok || !ReadLine(fd, line, sizeof(line)) || sscanf(line, "QUEUED %d %d", &id, &depth) != 2)
+  {
+    printf("Job not queued%s%s\n", ok ? ": " : "", ok ? line : "");
+    close(fd);
+    return 3;
+  }
+  printf("Queued job %d, %d jobs waiting\n", id, depth);
+
+  int rv = 0;
+  if (wait)
+  {
+    double waitMs, runMs;
+    int stalls;
+    if (ReadLine(fd, line, sizeof(line)) &&
+        sscanf(line, "DONE %d %lf %lf %d", &id, &waitMs, &runMs, &stalls) == 4)
+    {
+      printf("Job %d done, waited %.1fms, ran %.1fms, CPU waited for %d refills\n",
+             id, waitMs, runMs, stalls);
+    }
+    else
+    {
+      printf("Job %d failed\n", id);
+      rv = 5;
+    }
+  }
+  close(fd);
+  return rv;
+}
+
+// Send a request and print the reply
+int Request(const char* socketPath, const char* request)
+{
+  int fd = Connect(socketPath);
+  if (fd < 0) return 1;
+
+  if (!WriteAll(fd, request, strlen(request)))
+  {
+    close(fd);
+    return 1;
+  }
+
+  char buf[1024];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    fwrite(buf, 1, n, stdout);
+  close(fd);
+  return 0;
+}
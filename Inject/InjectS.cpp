@@ -4,234 +4,628 @@
 // Hovalaag CPU testing.
 //
 // Reads program from "a.out" and input data from "input.bin"
-// input.bin contains binary data to stream into IN1
+// input.bin contains binary data to stream into IN1, or with -t
+// input.txt is read as a column of decimal values, the first column unless
+// --column n is given (counting from 1).  input.txt is streamed, it is
+// scanned once to count the rows and split them between the boards, then
+// each board parses its own share as it sends it (see TextInput.h).
+// With -p IN1 of the packed input.hvi is sent instead, or the channel
+// given by --column, which is mapped and read straight from each board's
+// share (see PackedInput.h).  --start n skips the first n words of any of
+// them, to resume a run partway through.
+//
+// With -2 IN2 is streamed as well, from input2.bin, the second --column of
+// input.txt (default 2) or IN2 of input.hvi.  This needs the bitstream
+// streaming both inputs (see hovalaag_top.v).  Each input is refilled as
+// the CPU drains it, so programs reading both run at full speed.  The CPU
+// is held while the first chunks of both are loaded, so it doesn't start
+// on whatever IN2 held.  Each input is split between the boards on its own.
+//
+// The 2048 word input array is double buffered: Input1 flags each 1024 word
+// half in register 7 once the CPU has read past it, and that half is
+// refilled while the CPU reads the other one.  The CPU only stalls if it
+// catches up with a half that hasn't been refilled yet.
+//
+// Only the instructions that differ from the program last loaded are sent,
+// --force loads the whole program (see ProgramLoad.h).
+//
+// Several boards can be driven at once, each from its own thread, with
+// -d name (repeated, or a comma separated list) or -a for every board
+// attached.  All boards get the same program and the input is split into
+// one contiguous share per board.  -c n keeps the splits on multiples of
+// n words, for inputs made of fixed size independent records.
+//
+// --stats file writes the transfer timings and counts as JSON at exit, and
+// --live adds the link rate, the rate the CPUs are reading input and the
+// time they spent stalled to the progress line (see TransferStats.h).
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 
-#include "dpcdecl.h" 
+#include "dpcdecl.h"
 #include "depp.h"
 #include "dmgr.h"
 
+#include "ProgramLoad.h"
+#include "InputLoad.h"
+#include "TransferStats.h"
+#include "TextInput.h"
+#include "PackedInput.h"
+
 #define DeviceName "Basys2"
 #define BinFileName "a.out"
 #define InputBinFileName "input.bin"
+#define Input2BinFileName "input2.bin"
 #define InputTxtFileName "input.txt"
+#define PackedFileName "input.hvi"
 
-uint8_t* BuildBinRegSet(size_t* regSetLen);
-uint8_t* BuildInputRegSet(FILE* inFile, size_t* regSetLen, bool* moreData);
+#define MaxBoards 16
 
-bool isTextFile = false;
+// A board's share of one input, from input, text or packed from sample
+// first of channel
+struct InputShare
+{
+  const int16_t* input;
+  TextInput* text;
+  const PackedInput* packed;
+  int channel;
+  long long first;
+  int inputLen;
+
+  int wordsSent;
+  int halvesSent;
+};
+
+struct Board
+{
+  char name[64];
+  pthread_t thread;
+
+  InputShare in[NumInputs];
+  int numInputs;
+  int inputLen;
+
+  // Progress over all inputs, written by the board's thread
+  int wordsSent;
+  int halvesSent;
+  int stalls;
+  bool done;
+  int rv;
+
+  DrainTimer drain[NumInputs];
+  TransferStats stats;
+};
+
+int AddDeviceList(char* list, Board* boards, int numBoards);
+TextInputMark* ScanText(const char* fileName, int column, int* inputLen);
+bool OpenTextShare(TextInput* text, const char* fileName, int column, const TextInputMark* marks, int start);
+int EnumerateBoards(Board* boards);
+bool SendChunk(Board* b, HIF hif, int n, uint8_t ctrlFlags);
+void* StreamToBoard(void* arg);
+
+InputFormat format = InputBinary;
+bool force = false;
 
 int main(int argc, char* argv[])
 {
-  HIF hif;
-
-  if (argc == 2 && !strcmp(argv[1], "-t")) isTextFile = true;
-
-  if (!DmgrOpen(&hif, DeviceName))
+  Board boards[MaxBoards];
+  int numBoards = 0;
+  bool allBoards = false;
+  int chunkWords = 1;
+  const char* statsFileName = NULL;
+  bool live = false;
+  int columns[NumInputs] = { 1, 2 };
+  int numInputs = 1;
+  long long startWord = 0;
+  TransferStats hostStats;
+
+  static const struct option longOptions[] = {
+    { "force", no_argument, NULL, 'f' },
+    { "stats", required_argument, NULL, 'S' },
+    { "live", no_argument, NULL, 'L' },
+    { "column", required_argument, NULL, 'k' },
+    { "start", required_argument, NULL, 'R' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "tpfd:ac:2", longOptions, NULL)) != -1)
   {
-    printf("Failed to open device\n");
-    return 1;
+    switch (opt)
+    {
+      case 't': format = InputText; break;
+      case 'p': format = InputPacked; break;
+      case 'f': force = true; break;
+      case 'd': numBoards = AddDeviceList(optarg, boards, numBoards); break;
+      case 'a': allBoards = true; break;
+      case 'c': chunkWords = atoi(optarg); break;
+      case 'S': statsFileName = optarg; break;
+      case 'L': live = true; break;
+      case 'k': sscanf(optarg, "%d,%d", &columns[0], &columns[1]); break;
+      case '2': numInputs = 2; break;
+      case 'R': startWord = atoll(optarg); break;
+      default:
+        printf("Usage: InjectS [-t|-p] [-2] [-f] [-d device[,device...]] [-a] [-c chunk words] [--stats file] [--live]\n"
+               "               [--column n[,m]] [--start n]\n"
+               "  -t  read input.txt instead of input.bin\n"
+               "  -p  read input.hvi instead of input.bin\n"
+               "  -2  stream IN2 as well, from input2.bin, input.txt or input.hvi\n"
+               "  -f  load the whole program, not just the changes (also --force)\n"
+               "  -d  boards to use, default " DeviceName "\n"
+               "  -a  use every board attached\n"
+               "  -c  only split the input between boards on multiples of this many words\n"
+               "  --stats  write transfer timings and counts to a JSON file\n"
+               "  --live   add link and CPU rates to the progress line\n"
+               "  --column columns of input.txt, or channels of input.hvi, for IN1 and IN2, default 1,2\n"
+               "  --start  skip this many words of the input\n");
+        return 1;
+    }
   }
-
-  if (!DeppEnable(hif))
+  if (numBoards < 0) return 1;
+  if (chunkWords < 1) chunkWords = 1;
+  if (columns[0] < 1 || columns[1] < 1)
   {
-    printf("Failed to enable DEPP transfer\n");
-    DmgrClose(hif);
+    printf("Columns count from 1\n");
     return 1;
   }
+  if (startWord < 0) startWord = 0;
 
-  FILE* inFile = fopen(isTextFile ? InputTxtFileName : InputBinFileName, "rb");
-  if (!inFile)
+  if (allBoards)
   {
-    printf("Failed to open input file\n");
-    return NULL;
+    numBoards = EnumerateBoards(boards);
+    if (numBoards == 0)
+    {
+      printf("No boards found\n");
+      return 1;
+    }
+  }
+  if (numBoards == 0)
+  {
+    char defaultName[] = DeviceName;
+    numBoards = AddDeviceList(defaultName, boards, 0);
   }
 
-  int rv = 0;
-  size_t regSetLen;
-  uint8_t* regSetPairs = BuildBinRegSet(&regSetLen);
-  if (!regSetPairs)
+  transferStatsEnabled = statsFileName || live;
+  InitTransferStats(&hostStats);
+
+  int inputLen[NumInputs] = { 0, 0 };
+  int16_t* input[NumInputs] = { NULL, NULL };
+  TextInputMark* marks[NumInputs] = { NULL, NULL };
+  TextInput texts[MaxBoards][NumInputs];
+  PackedInput packed;
+  if (format == InputPacked && !packed.Open(PackedFileName)) return 1;
+  for (int n = 0; n < numInputs; ++n)
   {
-    rv = 2;
-    goto EXIT;
+    int column = columns[n];
+    {
+      TransferTimer timer(&hostStats, OpReadFile);
+      if (format == InputText)
+        marks[n] = ScanText(InputTxtFileName, column - 1, &inputLen[n]);
+      else if (format == InputBinary)
+        input[n] = ReadAllInput(n ? Input2BinFileName : InputBinFileName, InputBinary, 0, &inputLen[n]);
+      else
+        inputLen[n] = (packed.Samples(column - 1) < 0x7fffffff) ? packed.Samples(column - 1) : 0x7fffffff;
+    }
+    if (format == InputPacked && column > packed.Channels())
+    {
+      printf(PackedFileName " has no IN%d\n", column);
+      return 1;
+    }
+    if (!input[n] && !marks[n] && format != InputPacked) return 1;
+    inputLen[n] -= (startWord < inputLen[n]) ? startWord : inputLen[n];
   }
-  
-  if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
+  if (inputLen[0] == 0)
   {
-    printf("RegSet failed.\n");
-    rv = 3;
-    goto EXIT;
+    printf("No input data\n");
+    for (int n = 0; n < NumInputs; ++n)
+    {
+      free(input[n]);
+      free(marks[n]);
+    }
+    return 4;
   }
-  free(regSetPairs);
 
-  while (true)
+  // Split each input into one share per board, on chunk boundaries
+  for (int n = 0; n < numInputs; ++n)
   {
-    bool moreData = false;
-    regSetPairs = BuildInputRegSet(inFile, &regSetLen, &moreData);
-    if (!regSetPairs)
+    int numChunks = (inputLen[n] + chunkWords - 1) / chunkWords;
+    int chunksPerBoard = (numChunks + numBoards - 1) / numBoards;
+    for (int i = 0; i < numBoards; ++i)
     {
-      rv = 4;
-      goto EXIT;
+      Board* b = &boards[i];
+      InputShare* in = &b->in[n];
+      long long start = (long long)i * chunksPerBoard * chunkWords;
+      long long end = start + (long long)chunksPerBoard * chunkWords;
+      if (start > inputLen[n]) start = inputLen[n];
+      if (end > inputLen[n]) end = inputLen[n];
+      in->inputLen = end - start;
+      b->inputLen += in->inputLen;
+      b->numInputs = numInputs;
+      start += startWord;
+      if (format == InputBinary)
+      {
+        in->input = input[n] + start;
+      }
+      else if (format == InputPacked)
+      {
+        in->packed = &packed;
+        in->channel = columns[n] - 1;
+        in->first = start;
+      }
+      else if (OpenTextShare(&texts[i][n], InputTxtFileName, columns[n] - 1, marks[n], start))
+      {
+        in->text = &texts[i][n];
+      }
+      else
+      {
+        return 1;
+      }
     }
-  
-    if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
+    free(marks[n]);
+  }
+
+  double startTime = Now();
+  for (int i = 0; i < numBoards; ++i)
+  {
+    if (pthread_create(&boards[i].thread, NULL, StreamToBoard, &boards[i]) != 0)
     {
-      printf("RegSet failed.\n");
-      rv = 3;
-      goto EXIT;
+      printf("Failed to start thread for %s\n", boards[i].name);
+      boards[i].rv = 6;
+      boards[i].done = true;
+      boards[i].thread = 0;
     }
+  }
 
-    if (!moreData) break;
+  // Report progress once a second until every board has finished
+  int lastTotal = 0;
+  uint64_t lastBytes = 0;
+  uint64_t lastDrained = 0;
+  uint64_t lastStall = 0;
+  double lastTime = startTime;
+  while (true)
+  {
+    int numDone = 0;
+    for (int i = 0; i < numBoards; ++i)
+      if (__atomic_load_n(&boards[i].done, __ATOMIC_ACQUIRE)) numDone++;
+    if (numDone == numBoards) break;
 
-    free(regSetPairs);
-    regSetPairs = NULL;
+    usleep(100000);
+    double now = Now();
+    if (now - lastTime < 1.0) continue;
 
-    while (true)
+    int total = 0;
+    for (int i = 0; i < numBoards; ++i)
     {
-      uint8_t data;
-      if (!DeppGetReg(hif, 7, &data, 0))
+      int sent = __atomic_load_n(&boards[i].wordsSent, __ATOMIC_RELAXED);
+      total += sent;
+      printf("%s %d/%d  ", boards[i].name, sent, boards[i].inputLen);
+    }
+    printf("%.0f words/s", (total - lastTotal) / (now - lastTime));
+
+    if (live)
+    {
+      uint64_t bytes = 0, drained = 0, stall = 0;
+      for (int i = 0; i < numBoards; ++i)
       {
-        printf("RegGet failed.\n");
-        rv = 5;
-        goto EXIT;
+        bytes += LiveCount(&boards[i].stats.bytesSent);
+        drained += LiveCount(&boards[i].stats.wordsDrained);
+        stall += LiveCount(&boards[i].stats.stallClocks);
       }
-      if (data == 1) break;
-      usleep(10000);
+      double t = now - lastTime;
+      printf(", link %.1f kB/s, CPU read %.0f words/s, stalled %.0f%%",
+             (bytes - lastBytes) / t * 1e-3, (drained - lastDrained) / t,
+             (stall - lastStall) / BoardClockHz / t / numBoards * 100);
+      lastBytes = bytes;
+      lastDrained = drained;
+      lastStall = stall;
     }
+    printf("\n");
+    lastTotal = total;
+    lastTime = now;
   }
 
-EXIT:
-  fclose(inFile);
-  free(regSetPairs);
-  DeppDisable(hif);
-  DmgrClose(hif);
+  int rv = 0;
+  int total = 0;
+  for (int i = 0; i < numBoards; ++i)
+  {
+    Board* b = &boards[i];
+    if (b->thread) pthread_join(b->thread, NULL);
+    if (b->rv != 0 && rv == 0) rv = b->rv;
+    total += b->wordsSent;
+    printf("%s: sent %d input words, CPU was waiting for %d of %d refills\n",
+           b->name, b->wordsSent, b->stalls, b->halvesSent > 2 * b->numInputs ? b->halvesSent - 2 * b->numInputs : 0);
+  }
+  double elapsed = Now() - startTime;
+  printf("Sent %d words to %d boards in %.2fs, %.0f words/s\n",
+         total, numBoards, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+
+  if (statsFileName)
+  {
+    const char* names[MaxBoards];
+    const TransferStats* stats[MaxBoards];
+    for (int i = 0; i < numBoards; ++i)
+    {
+      names[i] = boards[i].name;
+      stats[i] = &boards[i].stats;
+    }
+    hostStats.endTime = Now();
+    if (!WriteTransferStats(statsFileName, &hostStats, names, stats, numBoards) && rv == 0) rv = 7;
+  }
+
+  for (int n = 0; n < NumInputs; ++n)
+    free(input[n]);
   return rv;
 }
 
-// Build the address/data pairs for programming the Hovalaag from the a.out binary
-// Allocates the buffer, which should be freed by the caller.
-uint8_t* BuildBinRegSet(size_t* regSetLen)
+// Add the boards in a comma separated list, returns the new number of boards
+// or -1 if there are too many.
+int AddDeviceList(char* list, Board* boards, int numBoards)
 {
-  FILE* binFile = fopen(BinFileName, "rb");
-  if (!binFile)
-  {
-    printf("Failed to open " BinFileName "\n");
-    return NULL;
-  }
+  if (numBoards < 0) return numBoards;
 
-  // Determine file size
-  fseek(binFile, 0, SEEK_END);
-  size_t fileSize = ftell(binFile);
-  fseek(binFile, 0, SEEK_SET);
-  if ((fileSize % 4) != 0 || fileSize > 1024)
+  char* save;
+  for (char* name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save))
   {
-    printf("Invalid program\n");
-    fclose(binFile);
-    return NULL;
+    if (numBoards == MaxBoards)
+    {
+      printf("Too many boards, at most %d are supported\n", MaxBoards);
+      return -1;
+    }
+    Board* b = &boards[numBoards++];
+    memset(b, 0, sizeof(Board));
+    snprintf(b->name, sizeof(b->name), "%s", name);
   }
+  return numBoards;
+}
+
+// Add every board the Adept runtime can see
+int EnumerateBoards(Board* boards)
+{
+  int numDevices = 0;
+  if (!DmgrEnumDevices(&numDevices)) return 0;
 
-  // Read file
-  uint8_t binaryProgram[1028];
-  memset(binaryProgram + fileSize, 0, 1028 - fileSize);
-  fread(binaryProgram, 1, fileSize, binFile);
-  size_t programSize = fileSize / 4;
-  
-  // Produce address/data pairs for programming
-  uint8_t* regSetPairs = (uint8_t*)malloc((programSize + 1) * 7 * 2 + 2);
-  for (size_t i = 0; i <= programSize; ++i)
+  int numBoards = 0;
+  for (int i = 0; i < numDevices && numBoards < MaxBoards; ++i)
   {
-    uint8_t* instr = &regSetPairs[i * 7 * 2];
-    for (int j = 0; j < 6; ++j)
-      instr[j*2] = j;
-    instr[1] = 1;
-    instr[3] = i;
-    for (int j = 0; j < 4; ++j)
-      instr[5 + j * 2] = binaryProgram[i * 4 + 3 - j];
-    instr[12] = 0;
-    instr[13] = (i == programSize) ? 0xc1 : 0x81;
+    DVC dvc;
+    if (!DmgrGetDvc(i, &dvc)) continue;
+    Board* b = &boards[numBoards++];
+    memset(b, 0, sizeof(Board));
+    snprintf(b->name, sizeof(b->name), "%s", dvc.szName);
   }
+  DmgrFreeDvcEnum();
+  return numBoards;
+}
 
-  regSetPairs[programSize * 7 * 2] = 0;
-  regSetPairs[programSize * 7 * 2 + 1] = 0;
+// Count the rows of a text input, noting where each block of HalfWords
+// rows starts so the boards can seek to their shares.  Malformed lines are
+// reported here.  Allocates the marks, which should be freed by the caller.
+TextInputMark* ScanText(const char* fileName, int column, int* inputLen)
+{
+  TextInput text;
+  if (!text.Open(fileName)) return NULL;
+  text.SetColumns(column, -1);
+
+  int numMarks = 0;
+  int size = 1024;
+  TextInputMark* marks = (TextInputMark*)malloc(size * sizeof(TextInputMark));
+  int16_t rows[HalfWords];
+  int len = 0;
+  while (true)
+  {
+    if (numMarks == size)
+    {
+      size *= 2;
+      marks = (TextInputMark*)realloc(marks, size * sizeof(TextInputMark));
+    }
+    marks[numMarks++] = text.Tell();
 
-  fclose(binFile);
+    int n = text.Read(rows, NULL, NULL, HalfWords);
+    len += n;
+    if (n < HalfWords) break;
+  }
+  text.ReportMalformed();
 
-  *regSetLen = (programSize + 1) * 7 + 1;
-  return regSetPairs;
+  *inputLen = len;
+  return marks;
 }
 
-#define NUM_DATA_WORDS 2048
+// Open the text input for a board, positioned at row start
+bool OpenTextShare(TextInput* text, const char* fileName, int column, const TextInputMark* marks, int start)
+{
+  if (!text->Open(fileName)) return false;
+  text->SetColumns(column, -1);
+  text->SetQuiet(true);
+  text->Seek(marks[start / HalfWords]);
+
+  int16_t rows[HalfWords];
+  int skip = start % HalfWords;
+  return text->Read(rows, NULL, NULL, skip) == skip;
+}
 
-uint8_t* BuildInputRegSet(FILE* inFile, size_t* regSetLen, bool* moreData)
+// Send the next chunk of input n to the half of its array it belongs in
+bool SendChunk(Board* b, HIF hif, int n, uint8_t ctrlFlags)
 {
-  int16_t in1[NUM_DATA_WORDS];
-  uint8_t in1bin[NUM_DATA_WORDS];
-  int in1Len = 0;
+  InputShare* in = &b->in[n];
+  int half = in->halvesSent & 1;
+  int16_t words[HalfWords];
+  int numWords = in->inputLen - in->wordsSent;
+  if (numWords < 0) numWords = 0;
+  if (numWords > HalfWords) numWords = HalfWords;
+  if (in->text)
+  {
+    TransferTimer timer(&b->stats, OpReadFile);
+    in->text->Read(words, NULL, NULL, numWords);
+  }
+  else if (in->packed)
+  {
+    TransferTimer timer(&b->stats, OpReadFile);
+    in->packed->Read(in->channel, in->first + in->wordsSent, words, numWords);
+  }
+  else
+  {
+    memcpy(words, in->input + in->wordsSent, numWords * sizeof(int16_t));
+  }
+  memset(words + numWords, 0, (HalfWords - numWords) * sizeof(int16_t));
 
-  if (isTextFile)
+  size_t regSetLen;
+  uint8_t* regSetPairs;
+  {
+    TransferTimer timer(&b->stats, OpBuildRegSet);
+    regSetPairs = BuildHalfRegSet(words, n, half, 0, HalfWords, ctrlFlags, &regSetLen);
+  }
   {
-    for (int i = 0; i < NUM_DATA_WORDS && !feof(inFile); ++i)
+    TransferTimer timer(&b->stats, OpPutRegSet);
+    if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
     {
-      char buf[256];
-      if (!fgets(buf, sizeof(buf), inFile)) break;
-
-      int numRead = sscanf(buf, "%hd", &in1[i]);
-      if (numRead == 0) break;
-      in1Len++;
+      printf("%s: RegSet failed.\n", b->name);
+      b->rv = 3;
+      free(regSetPairs);
+      return false;
     }
   }
-  else 
+  CountPutRegSet(&b->stats, regSetLen);
+  free(regSetPairs);
+
+  CountInputWords(&b->stats, numWords);
+  in->wordsSent += numWords;
+  in->halvesSent++;
+  __atomic_store_n(&b->wordsSent, b->wordsSent + numWords, __ATOMIC_RELAXED);
+  b->halvesSent++;
+  return true;
+}
+
+// Load the program on one board and stream its share of the input
+void* StreamToBoard(void* arg)
+{
+  Board* b = (Board*)arg;
+  HIF hif;
+  uint32_t programImage[ProgramWords];
+  uint8_t primeFlags = b->numInputs > 1 ? CtrlHold : 0;
+  size_t regSetLen;
+  uint8_t* regSetPairs = NULL;
+  bool ok;
+
+  InitTransferStats(&b->stats);
+  if (b->inputLen == 0)
   {
-    in1Len = fread(in1bin, 1, NUM_DATA_WORDS, inFile);
-    printf("Read %d bytes binary input\n", in1Len);
-    for (int i = 0; i < in1Len; ++i)
-      in1[i] = in1bin[i];
+    printf("%s: no input left for this board\n", b->name);
+    __atomic_store_n(&b->done, true, __ATOMIC_RELEASE);
+    return NULL;
   }
 
-  if (in1Len == 0) return NULL;
+  if (!DmgrOpen(&hif, b->name))
+  {
+    printf("%s: Failed to open device\n", b->name);
+    b->rv = 1;
+    __atomic_store_n(&b->done, true, __ATOMIC_RELEASE);
+    return NULL;
+  }
 
-  *regSetLen = in1Len * 6 * 2 + 2;
-  if (in1Len < NUM_DATA_WORDS)
+  if (!DeppEnable(hif))
   {
-    in1[in1Len] = 0;
-    *regSetLen += 6 * 2;
-    *moreData = false;
+    printf("%s: Failed to enable DEPP transfer\n", b->name);
+    b->rv = 1;
+    goto CLOSE;
   }
-  else
+
+  {
+    TransferTimer timer(&b->stats, OpReadFile);
+    ok = ReadProgramImage(BinFileName, programImage);
+  }
+  if (!ok)
+  {
+    b->rv = 2;
+    goto EXIT;
+  }
+
+  {
+    TransferTimer timer(&b->stats, OpBuildRegSet);
+    regSetPairs = BuildCachedRegSet(b->name, programImage, force, &regSetLen);
+  }
+
+  ClearProgramCache(b->name);
+  if (regSetLen != 0)
+  {
+    TransferTimer timer(&b->stats, OpPutRegSet);
+    if (!DeppPutRegSet(hif, regSetPairs, regSetLen, false))
+    {
+      printf("%s: RegSet failed.\n", b->name);
+      b->rv = 3;
+      goto EXIT;
+    }
+    CountPutRegSet(&b->stats, regSetLen);
+  }
+  SaveProgramCache(b->name, programImage);
+  free(regSetPairs);
+  regSetPairs = NULL;
+
+  if (!ReadStallCount(hif, &b->stats))
   {
-    *moreData = true;
+    printf("%s: RegGet failed.\n", b->name);
+    b->rv = 5;
+    goto EXIT;
   }
 
-  // Produce address/data pairs for programming
-  uint8_t* regSetPairs = (uint8_t*)malloc(*regSetLen);
-  for (size_t i = 0; i < NUM_DATA_WORDS; ++i)
+  // Both halves of each input array start out filled, after that each half
+  // is refilled as soon as the CPU has moved on from it.  With both inputs
+  // the CPU is held until they have both been filled.
+  for (int half = 0; half < 2; ++half)
+    for (int n = 0; n < b->numInputs; ++n)
+      if (!SendChunk(b, hif, n, primeFlags)) goto EXIT;
+  if (primeFlags)
   {
-    uint8_t* instr = &regSetPairs[i * 6 * 2];
-    for (int j = 0; j < 4; ++j)
-      instr[j*2] = j;
-    instr[1] = 2;
-    instr[3] = i & 0xff;
-    instr[5] = in1[i] >> 8;
-    instr[7] = in1[i] & 0xff;
-    instr[8] = 6;
-    instr[9] = i >> 8;
-    instr[10] = 0;
-    instr[11] = 0x82;
-    if (i == in1Len)
+    if (!DeppPutReg(hif, 0, 0, false))
     {
-      instr[11] = 0xc2;
-      break;
+      printf("%s: RegSet failed.\n", b->name);
+      b->rv = 3;
+      goto EXIT;
     }
+    CountPutRegSet(&b->stats, 1);
   }
 
-  regSetPairs[*regSetLen - 2] = 0;
-  regSetPairs[*regSetLen - 1] = 0;
+  while (true)
+  {
+    int halves[NumInputs] = { -1, -1 };
+    bool waiting = false;
+    for (int n = 0; n < b->numInputs; ++n)
+    {
+      InputShare* in = &b->in[n];
+      if (in->halvesSent >= InputChunks(in->inputLen)) continue;
+      halves[n] = in->halvesSent & 1;
+      waiting = true;
+    }
+    if (!waiting) break;
+
+    bool drained[NumInputs];
+    bool stalled[NumInputs];
+    if (!WaitForInputs(hif, halves, b->drain, drained, stalled, &b->stats) || !ReadStallCount(hif, &b->stats))
+    {
+      printf("%s: RegGet failed.\n", b->name);
+      b->rv = 5;
+      goto EXIT;
+    }
+    for (int n = 0; n < b->numInputs; ++n)
+    {
+      if (!drained[n]) continue;
+      if (stalled[n]) b->stalls++;
+      if (!SendChunk(b, hif, n, 0)) goto EXIT;
+    }
+  }
 
-  *regSetLen /= 2;
+  ReadStallCount(hif, &b->stats);
 
-  return regSetPairs;
+EXIT:
+  free(regSetPairs);
+  DeppDisable(hif);
+CLOSE:
+  DmgrClose(hif);
+  b->stats.endTime = Now();
+  __atomic_store_n(&b->done, true, __ATOMIC_RELEASE);
+  return NULL;
 }
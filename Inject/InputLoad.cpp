@@ -0,0 +1,245 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Streaming input into Input1.v through the DpimIf registers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dpcdecl.h"
+#include "depp.h"
+
+#include "InputLoad.h"
+#include "TextInput.h"
+#include "PackedInput.h"
+
+// Polling for a drained half, see WaitForHalf
+#define SpinPolls 32
+#define MinSleepUs 50
+#define MaxSleepUs 10000
+
+int16_t* ReadAllInput(const char* fileName, InputFormat format, int column, int* inputLen)
+{
+  if (format == InputPacked)
+  {
+    PackedInput packed;
+    if (!packed.Open(fileName)) return NULL;
+    if (column >= packed.Channels())
+    {
+      printf("%s has no IN%d\n", fileName, column + 1);
+      return NULL;
+    }
+
+    long long len = packed.Samples(column);
+    if (len > 0x7fffffff - HalfWords)
+    {
+      printf("%s is too long\n", fileName);
+      return NULL;
+    }
+    int16_t* input = (int16_t*)malloc((len ? len : 1) * sizeof(int16_t));
+    packed.Read(column, 0, input, len);
+    *inputLen = len;
+    return input;
+  }
+
+  if (format == InputText)
+  {
+    TextInput text;
+    if (!text.Open(fileName)) return NULL;
+    text.SetColumns(column, -1);
+
+    int len = 0;
+    int size = 65536;
+    int16_t* input = (int16_t*)malloc(size * sizeof(int16_t));
+    int rows;
+    while ((rows = text.Read(input + len, NULL, NULL, size - len)) > 0)
+    {
+      len += rows;
+      if (len < size) break;
+      size *= 2;
+      input = (int16_t*)realloc(input, size * sizeof(int16_t));
+    }
+    text.ReportMalformed();
+    *inputLen = len;
+    return input;
+  }
+
+  FILE* inFile = fopen(fileName, "rb");
+  if (!inFile)
+  {
+    printf("Failed to open input file\n");
+    return NULL;
+  }
+
+  int len = 0;
+  int size = 65536;
+  int16_t* input = (int16_t*)malloc(size * sizeof(int16_t));
+
+  uint8_t inBin[65536];
+  size_t n;
+  while ((n = fread(inBin, 1, sizeof(inBin), inFile)) > 0)
+  {
+    if (len + (int)n > size)
+    {
+      size *= 2;
+      input = (int16_t*)realloc(input, size * sizeof(int16_t));
+    }
+    for (size_t i = 0; i < n; ++i)
+      input[len++] = inBin[i];
+  }
+
+  fclose(inFile);
+  *inputLen = len;
+  return input;
+}
+
+int InputChunks(int inputLen)
+{
+  int chunks = inputLen / HalfWords + 1;
+  return chunks < 2 ? 2 : chunks;
+}
+
+static void PutReg(uint8_t* regSetPairs, size_t* len, int* regs, int addr, int data)
+{
+  if (regs[addr] == data) return;
+  regSetPairs[*len * 2] = addr;
+  regSetPairs[*len * 2 + 1] = data;
+  (*len)++;
+  regs[addr] = data;
+}
+
+// While ctrl is 0x82 moving the address or changing a data byte writes the
+// word, so most words only need the low address and the data bytes that
+// changed.  Commit mode is left while the high address changes and for the
+// last word of the half, as any write to the last word marks the half filled.
+uint8_t* BuildHalfRegSet(const int16_t* in1, int input, int half, int first, int end,
+                         uint8_t ctrlFlags, size_t* regSetLen)
+{
+  uint8_t* regSetPairs = (uint8_t*)malloc((HalfWords * 6 + 1) * 2);
+  size_t len = 0;
+  int regs[7] = { -1, -1, -1, -1, -1, -1, -1 };
+  int select = (2 + input) | ctrlFlags;
+  int commit = 0x80 | select;
+
+  for (int i = first; i < end; ++i)
+  {
+    int addr = half * HalfWords + i;
+    if (regs[0] != commit || regs[6] != (addr >> 8) || i == HalfWords - 1)
+    {
+      PutReg(regSetPairs, &len, regs, 0, select);
+      PutReg(regSetPairs, &len, regs, 6, addr >> 8);
+      PutReg(regSetPairs, &len, regs, 1, addr & 0xff);
+      PutReg(regSetPairs, &len, regs, 2, (in1[i] >> 8) & 0xff);
+      PutReg(regSetPairs, &len, regs, 3, in1[i] & 0xff);
+      PutReg(regSetPairs, &len, regs, 0, commit);
+    }
+    else
+    {
+      PutReg(regSetPairs, &len, regs, 1, addr & 0xff);
+      PutReg(regSetPairs, &len, regs, 2, (in1[i] >> 8) & 0xff);
+      PutReg(regSetPairs, &len, regs, 3, in1[i] & 0xff);
+    }
+  }
+  PutReg(regSetPairs, &len, regs, 0, ctrlFlags);
+
+  *regSetLen = len;
+  return regSetPairs;
+}
+
+uint8_t* BuildInputRegSet(const int16_t* input, int inputLen, int chunk, int first, int end,
+                          uint8_t ctrlFlags, size_t* regSetLen)
+{
+  int16_t in1[HalfWords];
+  int start = chunk * HalfWords;
+  int in1Len = inputLen - start;
+  if (in1Len < 0) in1Len = 0;
+  if (in1Len > HalfWords) in1Len = HalfWords;
+
+  memcpy(in1, input + start, in1Len * sizeof(int16_t));
+  memset(in1 + in1Len, 0, (HalfWords - in1Len) * sizeof(int16_t));
+  return BuildHalfRegSet(in1, 0, chunk & 1, first, end, ctrlFlags, regSetLen);
+}
+
+bool WaitForHalf(HIF hif, int half, DrainTimer* timer, bool* stalled, TransferStats* stats)
+{
+  int halves[NumInputs] = { half, -1 };
+  bool drained[NumInputs];
+  bool inputStalled[NumInputs];
+  if (!WaitForInputs(hif, halves, timer, drained, inputStalled, stats)) return false;
+  *stalled = inputStalled[0];
+  return true;
+}
+
+// The halves normally drain at a steady rate, so this sleeps until shortly
+// before the next one is due, then polls back to back for SpinPolls reads,
+// then sleeps between polls starting at MinSleepUs and doubling up to
+// MaxSleepUs in case the CPU has been paused.
+bool WaitForInputs(HIF hif, const int* halves, DrainTimer* timers, bool* drained, bool* stalled,
+                   TransferStats* stats)
+{
+  TransferTimer waitTimer(stats, OpWaitHalf);
+  if (!transferStatsEnabled) stats = NULL;
+
+  double now = Now();
+  double wake = 0;
+  for (int i = 0; i < NumInputs; ++i)
+  {
+    if (halves[i] < 0) continue;
+    double due = timers[i].lastDrained + timers[i].drainPeriod * 0.75;
+    if (wake == 0 || due < wake) wake = due;
+  }
+  if (wake > now) usleep((useconds_t)((wake - now) * 1e6));
+
+  int sleepUs = MinSleepUs;
+  for (int polls = 0; ; ++polls)
+  {
+    uint8_t data;
+    {
+      TransferTimer timer(stats, OpGetReg);
+      if (!DeppGetReg(hif, 7, &data, 0)) return false;
+    }
+    if (stats)
+    {
+      stats->polls++;
+      CountGetReg(stats, 1);
+    }
+
+    bool any = false;
+    now = Now();
+    for (int i = 0; i < NumInputs; ++i)
+    {
+      drained[i] = halves[i] >= 0 && (data & InHalfDrained(i, halves[i]));
+      stalled[i] = false;
+      if (!drained[i]) continue;
+      any = true;
+
+      // The CPU has already finished the other half too if it is stalled
+      stalled[i] = (data & InRdy(i)) != 0;
+      if (stats)
+      {
+        stats->halvesDrained++;
+        if (stalled[i]) stats->refillStalls++;
+        __atomic_fetch_add(&stats->wordsDrained, HalfWords, __ATOMIC_RELAXED);
+      }
+
+      // A stall means the CPU was waiting on us, so the time since the
+      // last half isn't its drain rate: back off the estimate instead.
+      DrainTimer* timer = &timers[i];
+      if (stalled[i])
+        timer->drainPeriod *= 0.5;
+      else if (timer->lastDrained != 0)
+        timer->drainPeriod = now - timer->lastDrained;
+      if (timer->drainPeriod > MaxSleepUs * 1e-6) timer->drainPeriod = MaxSleepUs * 1e-6;
+      timer->lastDrained = now;
+    }
+    if (any) return true;
+
+    if (polls >= SpinPolls)
+    {
+      usleep(sleepUs);
+      sleepUs *= 2;
+      if (sleepUs > MaxSleepUs) sleepUs = MaxSleepUs;
+    }
+  }
+}
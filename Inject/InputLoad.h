@@ -0,0 +1,81 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Streaming input into the double buffered Input1.v array through the
+// DpimIf registers, shared by InjectS and InjectD.  Builds streaming both
+// inputs have a second array for IN2, which works the same way.
+//
+// The input is sent in chunks of HalfWords words, chunk n going to half
+// (n & 1) of the array.  The CPU reads from address 0 after a reset, and
+// once it has read the last word of a half that half is flagged as drained
+// in register 7 and can be refilled.
+
+#ifndef INPUT_LOAD_H
+#define INPUT_LOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dpcdecl.h"
+#include "TransferStats.h"
+
+#define HalfWords 1024
+#define NumInputs 2
+
+// Register 0 bit holding the CPU in reset
+#define CtrlHold 0x10
+
+// Register 7 bits, input is 0 for IN1 and 1 for IN2
+#define InRdy(input) (0x01 << (input))
+#define InHalfDrained(input, half) (0x04 << ((input) * 2 + (half)))
+#define In1Rdy InRdy(0)
+#define In1HalfDrained(half) InHalfDrained(0, half)
+
+enum InputFormat
+{
+  InputBinary,   // one byte per word
+  InputText,     // a column of decimal values, see TextInput.h
+  InputPacked    // a channel of a .hvi file, see PackedInput.h
+};
+
+// Read a whole input file, column being the text column or packed channel
+// to take, counting from 0.  Allocates the buffer, which should be freed by
+// the caller.
+int16_t* ReadAllInput(const char* fileName, InputFormat format, int column, int* inputLen);
+
+// Number of chunks to send for inputLen words.  The input is always followed
+// by at least one zero, and both halves are always written so the CPU never
+// reads whatever was left in the array.
+int InputChunks(int inputLen);
+
+// Build the address/data pairs writing words first to end - 1 of a half of
+// an input array from words, which holds the whole HalfWords.  ctrlFlags
+// are ORed into every ctrl write.  Allocates the buffer, which should be
+// freed by the caller.
+uint8_t* BuildHalfRegSet(const int16_t* words, int input, int half, int first, int end,
+                         uint8_t ctrlFlags, size_t* regSetLen);
+
+// As BuildHalfRegSet for a chunk of IN1, padded with zeros past inputLen.
+uint8_t* BuildInputRegSet(const int16_t* input, int inputLen, int chunk, int first, int end,
+                          uint8_t ctrlFlags, size_t* regSetLen);
+
+// Estimate of how long the CPU takes to read half the input array, see
+// WaitForHalf.  Zero it before the first wait.
+struct DrainTimer
+{
+  double lastDrained;
+  double drainPeriod;
+};
+
+// Wait until the CPU has moved on from the given half of the IN1 array.
+// stalled is set if the CPU was already waiting for it.  The polling is
+// counted in stats, which may be NULL.
+bool WaitForHalf(HIF hif, int half, DrainTimer* timer, bool* stalled, TransferStats* stats = NULL);
+
+// As WaitForHalf for whichever of the inputs drains first, halves[i] being
+// the half of input i to wait for, or -1 to ignore it.  Each input has its
+// own timer.  drained[i] is set for each of the halves that have drained,
+// and stalled[i] if the CPU was already waiting for input i.
+bool WaitForInputs(HIF hif, const int* halves, DrainTimer* timers, bool* drained, bool* stalled,
+                   TransferStats* stats = NULL);
+
+#endif
@@ -0,0 +1,131 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Convert input.txt, or input.bin with -b, to a packed input file for
+// Inject, InjectS and InjectD (see PackedInput.h).
+//
+//   MakeHvi [-b] [--columns in1[,in2]] [-n block samples] [input [output]]
+//
+// The input defaults to input.txt (or input.bin) and the output to
+// input.hvi.  The first two columns of input.txt become IN1 and IN2, or
+// the columns given counting from 1; input.bin is all IN1, one byte to a
+// sample as InjectS has always sent it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "PackedInput.h"
+#include "TextInput.h"
+
+#define InputBinFileName "input.bin"
+#define InputTxtFileName "input.txt"
+#define PackedFileName "input.hvi"
+
+#define RowsPerRead 65536
+
+int main(int argc, char* argv[])
+{
+  bool isBinFile = false;
+  int in1Column = 0;
+  int in2Column = 1;
+  int blockSamples = PackedDefaultBlockSamples;
+
+  static const struct option longOptions[] = {
+    { "columns", required_argument, NULL, 'k' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "bn:", longOptions, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': isBinFile = true; break;
+      case 'n': blockSamples = atoi(optarg); break;
+      case 'k':
+        if (sscanf(optarg, "%d,%d", &in1Column, &in2Column) < 1) in1Column = 0;
+        if (!strchr(optarg, ',')) in2Column = 0;
+        in1Column--;
+        in2Column--;
+        break;
+      default:
+        printf("Usage: MakeHvi [-b] [--columns in1[,in2]] [-n block samples] [input [output]]\n"
+               "  -b  convert input.bin, one byte per IN1 sample\n"
+               "  -n  samples per block, default %d\n"
+               "  --columns columns of input.txt for IN1 and IN2, default 1,2\n",
+               PackedDefaultBlockSamples);
+        return 1;
+    }
+  }
+  if (in1Column < 0 || in2Column < -1)
+  {
+    printf("Columns count from 1\n");
+    return 1;
+  }
+  if (blockSamples < 2)
+  {
+    printf("Blocks must hold at least 2 samples\n");
+    return 1;
+  }
+
+  const char* inName = optind < argc ? argv[optind] : (isBinFile ? InputBinFileName : InputTxtFileName);
+  const char* outName = optind + 1 < argc ? argv[optind + 1] : PackedFileName;
+
+  PackedInputWriter writer;
+  if (!writer.Open(outName, blockSamples)) return 2;
+
+  int16_t* in1 = (int16_t*)malloc(RowsPerRead * sizeof(int16_t));
+  int16_t* in2 = (int16_t*)malloc(RowsPerRead * sizeof(int16_t));
+  int rv = 0;
+
+  if (isBinFile)
+  {
+    FILE* inFile = fopen(inName, "rb");
+    if (!inFile)
+    {
+      printf("Failed to open %s\n", inName);
+      rv = 3;
+      goto EXIT;
+    }
+
+    uint8_t bytes[RowsPerRead];
+    size_t n;
+    while ((n = fread(bytes, 1, sizeof(bytes), inFile)) > 0)
+    {
+      for (size_t i = 0; i < n; ++i)
+        in1[i] = bytes[i];
+      writer.Write(0, in1, n);
+    }
+    fclose(inFile);
+  }
+  else
+  {
+    TextInput text;
+    if (!text.Open(inName))
+    {
+      rv = 3;
+      goto EXIT;
+    }
+    text.SetColumns(in1Column, in2Column);
+
+    int rows;
+    do
+    {
+      int in2Len = 0;
+      rows = text.Read(in1, in2Column >= 0 ? in2 : NULL, &in2Len, RowsPerRead);
+      writer.Write(0, in1, rows);
+      writer.Write(1, in2, in2Len);
+    } while (rows == RowsPerRead);
+    text.ReportMalformed();
+  }
+
+  if (writer.OutOfRange())
+    printf("%lld values outside -2048 to 4095, only their low 12 bits were kept\n", writer.OutOfRange());
+
+EXIT:
+  if (!writer.Close() && rv == 0) rv = 4;
+  free(in1);
+  free(in2);
+  return rv;
+}
@@ -0,0 +1,304 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Packed binary input files, see PackedInput.h
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PackedInput.h"
+
+#define PackedVersion 1
+
+static uint64_t GetLE(const uint8_t* p, int bytes)
+{
+  uint64_t v = 0;
+  for (int i = bytes - 1; i >= 0; --i)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+static void PutLE(uint8_t* p, uint64_t v, int bytes)
+{
+  for (int i = 0; i < bytes; ++i)
+  {
+    p[i] = v & 0xff;
+    v >>= 8;
+  }
+}
+
+static int16_t SignExtend12(int v)
+{
+  return (int16_t)((v ^ 0x800) - 0x800);
+}
+
+PackedInput::PackedInput()
+  : data(NULL)
+  , size(0)
+  , numChannels(0)
+  , blockSamples(0)
+{
+  for (int i = 0; i < PackedMaxChannels; ++i)
+  {
+    samples[i] = 0;
+    index[i] = NULL;
+  }
+}
+
+PackedInput::~PackedInput()
+{
+  Close();
+}
+
+bool PackedInput::Open(const char* fileName)
+{
+  Close();
+
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < PackedHeaderBytes)
+  {
+    printf("%s is not a packed input file\n", fileName);
+    close(fd);
+    return false;
+  }
+
+  size = st.st_size;
+  void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    printf("Failed to map %s\n", fileName);
+    size = 0;
+    return false;
+  }
+  data = (const uint8_t*)p;
+
+  // Check the header and that every block in the index is in the file, so
+  // Read doesn't have to
+  uint64_t indexOffset = GetLE(data + 32, 8);
+  numChannels = GetLE(data + 6, 2);
+  blockSamples = GetLE(data + 8, 4);
+  const char* error = NULL;
+  if (memcmp(data, "HVI1", 4) != 0) error = "is not a packed input file";
+  else if (GetLE(data + 4, 2) != PackedVersion) error = "is an unsupported version";
+  else if (numChannels < 1 || numChannels > PackedMaxChannels) error = "has a bad channel count";
+  else if (blockSamples == 0 || (blockSamples & 1)) error = "has a bad block size";
+
+  for (int i = 0; i < numChannels && !error; ++i)
+  {
+    samples[i] = GetLE(data + 16 + 8 * i, 8);
+    uint64_t blocks = (samples[i] + blockSamples - 1) / blockSamples;
+    if (indexOffset > size || blocks > (size - indexOffset) / 8)
+    {
+      error = "is truncated";
+      break;
+    }
+    index[i] = data + indexOffset;
+    indexOffset += blocks * 8;
+
+    for (uint64_t b = 0; b < blocks; ++b)
+    {
+      uint64_t offset = GetLE(index[i] + b * 8, 8);
+      uint64_t n = samples[i] - b * blockSamples;
+      if (n > blockSamples) n = blockSamples;
+      if (offset > size || PackedBytes(n) > size - offset)
+      {
+        error = "is truncated";
+        break;
+      }
+    }
+  }
+  if (error)
+  {
+    printf("%s %s\n", fileName, error);
+    Close();
+    return false;
+  }
+
+  madvise(p, size, MADV_SEQUENTIAL);
+  return true;
+}
+
+void PackedInput::Close()
+{
+  if (data) munmap((void*)data, size);
+  data = NULL;
+  size = 0;
+  numChannels = 0;
+  for (int i = 0; i < PackedMaxChannels; ++i)
+  {
+    samples[i] = 0;
+    index[i] = NULL;
+  }
+}
+
+int PackedInput::Read(int channel, long long first, int16_t* out, int count) const
+{
+  if (channel >= numChannels || first >= samples[channel]) return 0;
+  if (count > samples[channel] - first) count = samples[channel] - first;
+
+  int n = 0;
+  while (n < count)
+  {
+    long long s = first + n;
+    uint64_t b = s / blockSamples;
+    uint32_t i = s % blockSamples;
+    const uint8_t* p = data + GetLE(index[channel] + b * 8, 8) + i / 2 * 3;
+
+    int blockLeft = blockSamples - i;
+    if (blockLeft > count - n) blockLeft = count - n;
+    int end = n + blockLeft;
+
+    if (i & 1)
+    {
+      out[n++] = SignExtend12((p[1] >> 4) | (p[2] << 4));
+      p += 3;
+    }
+    for (; n + 1 < end; n += 2, p += 3)
+    {
+      out[n] = SignExtend12(p[0] | ((p[1] & 0xf) << 8));
+      out[n + 1] = SignExtend12((p[1] >> 4) | (p[2] << 4));
+    }
+    if (n < end)
+      out[n++] = SignExtend12(p[0] | ((p[1] & 0xf) << 8));
+  }
+  return n;
+}
+
+PackedInputWriter::PackedInputWriter()
+  : file(NULL)
+  , blockSamples(0)
+  , offset(0)
+  , outOfRange(0)
+  , failed(false)
+{
+  fileName[0] = 0;
+  for (int i = 0; i < PackedMaxChannels; ++i)
+  {
+    block[i] = NULL;
+    blockLen[i] = 0;
+    samples[i] = 0;
+    blockOffsets[i] = NULL;
+    numBlocks[i] = 0;
+    offsetsSize[i] = 0;
+  }
+}
+
+PackedInputWriter::~PackedInputWriter()
+{
+  if (file) fclose(file);
+  for (int i = 0; i < PackedMaxChannels; ++i)
+  {
+    free(block[i]);
+    free(blockOffsets[i]);
+  }
+}
+
+bool PackedInputWriter::Open(const char* name, int samplesPerBlock)
+{
+  snprintf(fileName, sizeof(fileName), "%s", name);
+  file = fopen(name, "wb");
+  if (!file)
+  {
+    printf("Failed to open %s\n", name);
+    return false;
+  }
+
+  blockSamples = (samplesPerBlock + 1) & ~1;
+  for (int i = 0; i < PackedMaxChannels; ++i)
+    block[i] = (int16_t*)malloc(blockSamples * sizeof(int16_t));
+
+  // The header is written last, once the lengths are known
+  uint8_t header[PackedHeaderBytes];
+  memset(header, 0, sizeof(header));
+  failed = fwrite(header, 1, sizeof(header), file) != sizeof(header);
+  offset = PackedHeaderBytes;
+  return !failed;
+}
+
+void PackedInputWriter::Write(int channel, const int16_t* values, int count)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    if (values[i] < -2048 || values[i] > 4095) outOfRange++;
+    block[channel][blockLen[channel]++] = values[i];
+    if (blockLen[channel] == blockSamples) WriteBlock(channel);
+  }
+  samples[channel] += count;
+}
+
+void PackedInputWriter::WriteBlock(int channel)
+{
+  int n = blockLen[channel];
+  if (n == 0) return;
+
+  const int16_t* in = block[channel];
+  uint8_t packed[PackedBytes(PackedDefaultBlockSamples)];
+  uint8_t* out = (size_t)PackedBytes(n) <= sizeof(packed) ? packed : (uint8_t*)malloc(PackedBytes(n));
+  for (int i = 0; i < n; i += 2)
+  {
+    int a = in[i] & 0xfff;
+    int b = (i + 1 < n) ? in[i + 1] & 0xfff : 0;
+    out[i / 2 * 3] = a & 0xff;
+    out[i / 2 * 3 + 1] = (a >> 8) | ((b & 0xf) << 4);
+    out[i / 2 * 3 + 2] = b >> 4;
+  }
+  if (fwrite(out, 1, PackedBytes(n), file) != (size_t)PackedBytes(n)) failed = true;
+  if (out != packed) free(out);
+
+  if (numBlocks[channel] == offsetsSize[channel])
+  {
+    offsetsSize[channel] = offsetsSize[channel] ? offsetsSize[channel] * 2 : 1024;
+    blockOffsets[channel] = (uint64_t*)realloc(blockOffsets[channel], offsetsSize[channel] * sizeof(uint64_t));
+  }
+  blockOffsets[channel][numBlocks[channel]++] = offset;
+  offset += PackedBytes(n);
+  blockLen[channel] = 0;
+}
+
+bool PackedInputWriter::Close()
+{
+  if (!file) return false;
+
+  for (int i = 0; i < PackedMaxChannels; ++i)
+    WriteBlock(i);
+  int numChannels = samples[1] ? 2 : 1;
+
+  uint64_t indexOffset = offset;
+  for (int i = 0; i < numChannels; ++i)
+  {
+    for (int b = 0; b < numBlocks[i]; ++b)
+    {
+      uint8_t entry[8];
+      PutLE(entry, blockOffsets[i][b], 8);
+      if (fwrite(entry, 1, 8, file) != 8) failed = true;
+    }
+  }
+
+  uint8_t header[PackedHeaderBytes];
+  memset(header, 0, sizeof(header));
+  memcpy(header, "HVI1", 4);
+  PutLE(header + 4, PackedVersion, 2);
+  PutLE(header + 6, numChannels, 2);
+  PutLE(header + 8, blockSamples, 4);
+  PutLE(header + 16, samples[0], 8);
+  PutLE(header + 24, samples[1], 8);
+  PutLE(header + 32, indexOffset, 8);
+  if (fseek(file, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    failed = true;
+
+  if (fclose(file) != 0) failed = true;
+  file = NULL;
+  if (failed) printf("Failed to write %s\n", fileName);
+  return !failed;
+}
@@ -0,0 +1,106 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Packed binary input files (.hvi), holding the IN1 and IN2 streams as
+// 12-bit samples, two to every 3 bytes, so they take less than a third of
+// the space of input.txt and need no parsing.  Made from input.txt or
+// input.bin by MakeHvi.
+//
+// All values are little endian.  The file starts with a 48 byte header:
+//    0  "HVI1"
+//    4  uint16 version, 1
+//    6  uint16 number of channels, 1 (IN1) or 2 (IN1 and IN2)
+//    8  uint32 samples per block, even
+//   12  uint32 reserved, 0
+//   16  uint64 samples in IN1
+//   24  uint64 samples in IN2
+//   32  uint64 offset of the block index
+//   40  uint64 reserved, 0
+// followed by the blocks of both channels in the order they were written.
+// A block holds samples per block samples, apart from the last block of a
+// channel, packed in pairs a, b as the bytes
+//   a[7:0], b[3:0] a[11:8], b[11:4]
+// with an odd last sample padded with 0.  The block index is the offset of
+// each block of IN1 in turn, then each block of IN2, as uint64s, so any
+// sample can be found without reading the blocks before it.
+//
+// Samples are stored as the low 12 bits, as the board keeps them, and read
+// back sign extended.
+
+#ifndef PACKED_INPUT_H
+#define PACKED_INPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define PackedMaxChannels 2
+#define PackedHeaderBytes 48
+#define PackedDefaultBlockSamples 1024
+
+// Bytes taken by n samples
+#define PackedBytes(n) (((n) + 1) / 2 * 3)
+
+// Reads a mapped .hvi file.  Read doesn't change the object, so one
+// PackedInput can be shared between threads.
+class PackedInput
+{
+public:
+  PackedInput();
+  ~PackedInput();
+
+  bool Open(const char* fileName);
+  void Close();
+
+  int Channels() const { return numChannels; }
+  long long Samples(int channel) const { return channel < numChannels ? samples[channel] : 0; }
+
+  // Unpack up to count samples of a channel starting at sample first.
+  // Returns the number unpacked, less than count only at the end.
+  int Read(int channel, long long first, int16_t* out, int count) const;
+
+private:
+  const uint8_t* data;
+  size_t size;
+  int numChannels;
+  uint32_t blockSamples;
+  long long samples[PackedMaxChannels];
+  const uint8_t* index[PackedMaxChannels];
+};
+
+// Writes a .hvi file.  Samples outside -2048 to 4095 are stored as their low
+// 12 bits and counted.
+class PackedInputWriter
+{
+public:
+  PackedInputWriter();
+  ~PackedInputWriter();
+
+  bool Open(const char* fileName, int blockSamples = PackedDefaultBlockSamples);
+
+  void Write(int channel, const int16_t* values, int count);
+
+  // Write the last blocks, the index and the header.  The file has two
+  // channels if anything was written to IN2.
+  bool Close();
+
+  long long OutOfRange() const { return outOfRange; }
+
+private:
+  void WriteBlock(int channel);
+
+  FILE* file;
+  char fileName[1024];
+  int blockSamples;
+  uint64_t offset;
+  long long outOfRange;
+  bool failed;
+
+  int16_t* block[PackedMaxChannels];
+  int blockLen[PackedMaxChannels];
+  long long samples[PackedMaxChannels];
+  uint64_t* blockOffsets[PackedMaxChannels];
+  int numBlocks[PackedMaxChannels];
+  int offsetsSize[PackedMaxChannels];
+};
+
+#endif
@@ -0,0 +1,232 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Loading a.out into Program.v through the DpimIf registers.
+//
+// While ctrl is 0x81 the data registers are written to the program at the
+// current address on every clock, so in that state moving the address or
+// changing a data byte is itself a write.  A word is loaded by moving the
+// address (which briefly copies the old data there) and then changing only
+// the data bytes that differ.  0xC1 fills from the address to the end of
+// the program, which is used for the run of words at the end, the words
+// in the run that differ are then written individually.  Every fill start
+// is tried and the shortest set of pairs is used.
+//
+// Any ctrl flags passed in (such as the CPU hold bit) are kept set on every
+// ctrl write, including the final one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ProgramLoad.h"
+
+#define CacheFileFormat "%s/.hovalaag_%s.img"
+#define MaxPairs ((ProgramWords + 2) * 7 + 1)
+
+bool ReadProgramImage(const char* binFileName, uint32_t* image)
+{
+  FILE* binFile = fopen(binFileName, "rb");
+  if (!binFile)
+  {
+    printf("Failed to open %s\n", binFileName);
+    return false;
+  }
+
+  // Determine file size
+  fseek(binFile, 0, SEEK_END);
+  size_t fileSize = ftell(binFile);
+  fseek(binFile, 0, SEEK_SET);
+  if ((fileSize % 4) != 0 || fileSize > ProgramWords * 4)
+  {
+    printf("Invalid program\n");
+    fclose(binFile);
+    return false;
+  }
+
+  uint8_t binaryProgram[ProgramWords * 4];
+  memset(binaryProgram, 0, sizeof(binaryProgram));
+  size_t bytesRead = fread(binaryProgram, 1, fileSize, binFile);
+  fclose(binFile);
+  if (bytesRead != fileSize)
+  {
+    printf("Failed to read %s\n", binFileName);
+    return false;
+  }
+
+  for (int i = 0; i < ProgramWords; ++i)
+  {
+    uint8_t* b = &binaryProgram[i * 4];
+    image[i] = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  }
+  return true;
+}
+
+// Address/data pairs being built, with the register values they leave
+// behind (-1 where not yet known).
+struct RegSetBuilder
+{
+  uint8_t pairs[MaxPairs * 2];
+  size_t len;
+  int regs[6];
+  int ctrlFlags;
+};
+
+static void InitBuilder(RegSetBuilder* b, int ctrlFlags)
+{
+  b->len = 0;
+  b->ctrlFlags = ctrlFlags;
+  for (int i = 0; i < 6; ++i)
+    b->regs[i] = -1;
+}
+
+static void PutReg(RegSetBuilder* b, int addr, int data)
+{
+  if (b->regs[addr] == data) return;
+  b->pairs[b->len * 2] = addr;
+  b->pairs[b->len * 2 + 1] = data;
+  b->len++;
+  b->regs[addr] = data;
+}
+
+static void PutCtrl(RegSetBuilder* b, int ctrl)
+{
+  PutReg(b, 0, ctrl | b->ctrlFlags);
+}
+
+// Set the address and data, with the data ending up written to the address
+// if ctrl is (or then becomes) 0x81.
+static void SetAddrData(RegSetBuilder* b, int addr, uint32_t data)
+{
+  // Outside commit mode the registers have to be set before ctrl, as the
+  // first commit writes whatever they hold.
+  if (b->regs[0] != (0x81 | b->ctrlFlags)) PutCtrl(b, 1);
+
+  PutReg(b, 1, addr);
+  for (int j = 0; j < 4; ++j)
+    PutReg(b, 2 + j, (data >> (24 - j * 8)) & 0xff);
+}
+
+static void WriteWord(RegSetBuilder* b, int addr, uint32_t data)
+{
+  SetAddrData(b, addr, data);
+  PutCtrl(b, 0x81);
+}
+
+static void FillFrom(RegSetBuilder* b, int addr, uint32_t data)
+{
+  SetAddrData(b, addr, data);
+
+  // Always written, the fill happens on the write.  The fill leaves the
+  // address at the end and ctrl back at 0x81.
+  b->regs[0] = -1;
+  PutCtrl(b, 0xc1);
+  b->regs[0] = 0x81 | b->ctrlFlags;
+  b->regs[1] = ProgramWords - 1;
+}
+
+static void BuildPlan(RegSetBuilder* b, const uint32_t* image, const bool* changed, int fillStart,
+                      int ctrlFlags)
+{
+  InitBuilder(b, ctrlFlags);
+
+  uint32_t fillValue = image[ProgramWords - 1];
+  if (fillStart < ProgramWords)
+    FillFrom(b, fillStart, fillValue);
+
+  for (int i = 0; i < ProgramWords; ++i)
+  {
+    bool write = (i < fillStart) ? changed[i] : (image[i] != fillValue);
+    if (write) WriteWord(b, i, image[i]);
+  }
+
+  if (b->len != 0) PutCtrl(b, 0);
+}
+
+uint8_t* BuildProgramRegSet(const uint32_t* image, const uint32_t* oldImage, size_t* regSetLen,
+                            uint8_t ctrlFlags)
+{
+  bool changed[ProgramWords];
+  int lastChanged = -1;
+  for (int i = 0; i < ProgramWords; ++i)
+  {
+    changed[i] = !oldImage || oldImage[i] != image[i];
+    if (changed[i]) lastChanged = i;
+  }
+
+  RegSetBuilder* best = (RegSetBuilder*)malloc(sizeof(RegSetBuilder));
+  RegSetBuilder* plan = (RegSetBuilder*)malloc(sizeof(RegSetBuilder));
+
+  // No fill, then every fill start that covers a changed word
+  BuildPlan(best, image, changed, ProgramWords, ctrlFlags);
+  for (int fillStart = lastChanged; fillStart >= 0; --fillStart)
+  {
+    BuildPlan(plan, image, changed, fillStart, ctrlFlags);
+    if (plan->len < best->len)
+    {
+      RegSetBuilder* t = best;
+      best = plan;
+      plan = t;
+    }
+  }
+  free(plan);
+
+  *regSetLen = best->len;
+  uint8_t* regSetPairs = (uint8_t*)malloc(best->len * 2 + 2);
+  memcpy(regSetPairs, best->pairs, best->len * 2);
+  free(best);
+  return regSetPairs;
+}
+
+uint8_t* BuildCachedRegSet(const char* deviceName, const uint32_t* image, bool force, size_t* regSetLen)
+{
+  uint32_t oldImage[ProgramWords];
+  bool haveOld = !force && LoadProgramCache(deviceName, oldImage);
+
+  uint8_t* regSetPairs = BuildProgramRegSet(image, haveOld ? oldImage : NULL, regSetLen);
+  if (*regSetLen == 0)
+    printf("Program unchanged\n");
+  return regSetPairs;
+}
+
+static void CacheFileName(const char* deviceName, char* fileName, size_t len)
+{
+  const char* home = getenv("HOME");
+  snprintf(fileName, len, CacheFileFormat, home ? home : ".", deviceName);
+}
+
+bool LoadProgramCache(const char* deviceName, uint32_t* image)
+{
+  char fileName[1024];
+  CacheFileName(deviceName, fileName, sizeof(fileName));
+
+  FILE* cacheFile = fopen(fileName, "rb");
+  if (!cacheFile) return false;
+
+  bool ok = fread(image, sizeof(uint32_t), ProgramWords, cacheFile) == ProgramWords;
+  fclose(cacheFile);
+  return ok;
+}
+
+void SaveProgramCache(const char* deviceName, const uint32_t* image)
+{
+  char fileName[1024];
+  CacheFileName(deviceName, fileName, sizeof(fileName));
+
+  FILE* cacheFile = fopen(fileName, "wb");
+  if (!cacheFile) return;
+
+  if (fwrite(image, sizeof(uint32_t), ProgramWords, cacheFile) != ProgramWords)
+  {
+    fclose(cacheFile);
+    remove(fileName);
+    return;
+  }
+  fclose(cacheFile);
+}
+
+void ClearProgramCache(const char* deviceName)
+{
+  char fileName[1024];
+  CacheFileName(deviceName, fileName, sizeof(fileName));
+  remove(fileName);
+}
@@ -0,0 +1,39 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Loading a.out into Program.v through the DpimIf registers, shared by
+// Inject, InjectS and InjectD.
+//
+// The image last loaded on each device is kept in a cache file, so that
+// reloading only sends the instructions that changed.  The cache is removed
+// before an upload and rewritten once it succeeds, so a failed upload
+// falls back to a full load next time.  If the board is reconfigured or the
+// program memory is written some other way, use --force.
+
+#ifndef PROGRAM_LOAD_H
+#define PROGRAM_LOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ProgramWords 256
+
+// Read a.out into image, padded with zeros (NOPs) to ProgramWords.
+bool ReadProgramImage(const char* binFileName, uint32_t* image);
+
+// Build the address/data pairs that change the program memory from oldImage
+// to image, or load all of image if oldImage is NULL.  *regSetLen may be 0
+// if nothing changed.  ctrlFlags are ORed into every ctrl write.
+// Allocates the buffer, which should be freed by the caller.
+uint8_t* BuildProgramRegSet(const uint32_t* image, const uint32_t* oldImage, size_t* regSetLen,
+                            uint8_t ctrlFlags = 0);
+
+// Build the pairs to load image on the device, against the cached image
+// unless force is set.
+uint8_t* BuildCachedRegSet(const char* deviceName, const uint32_t* image, bool force, size_t* regSetLen);
+
+// Cache of the image last loaded on each device
+bool LoadProgramCache(const char* deviceName, uint32_t* image);
+void SaveProgramCache(const char* deviceName, const uint32_t* image);
+void ClearProgramCache(const char* deviceName);
+
+#endif
@@ -0,0 +1,226 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Streaming parser for input.txt style files, see TextInput.h
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <charconv>
+
+#include "TextInput.h"
+
+// Malformed lines printed before only counting them
+#define MaxReported 10
+
+// Parsed pages are given back in blocks of this many bytes
+#define ReleaseBytes (4 * 1024 * 1024)
+
+TextInput::TextInput()
+  : data(NULL)
+  , size(0)
+  , pos(0)
+  , released(0)
+  , lineNumber(0)
+  , malformed(0)
+  , in1Column(0)
+  , in2Column(1)
+  , quiet(false)
+{
+  fileName[0] = 0;
+}
+
+TextInput::~TextInput()
+{
+  Close();
+}
+
+bool TextInput::Open(const char* name)
+{
+  Close();
+  snprintf(fileName, sizeof(fileName), "%s", name);
+
+  int fd = open(name, O_RDONLY);
+  if (fd < 0)
+  {
+    printf("Failed to open %s\n", name);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    printf("Failed to read %s\n", name);
+    close(fd);
+    return false;
+  }
+
+  size = st.st_size;
+  if (size != 0)
+  {
+    void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+      printf("Failed to map %s\n", name);
+      close(fd);
+      size = 0;
+      return false;
+    }
+    data = (const char*)p;
+    madvise(p, size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  return true;
+}
+
+void TextInput::Close()
+{
+  if (data) munmap((void*)data, size);
+  data = NULL;
+  size = pos = released = 0;
+  lineNumber = malformed = 0;
+}
+
+void TextInput::SetColumns(int in1, int in2)
+{
+  in1Column = in1;
+  in2Column = in2;
+}
+
+TextInputMark TextInput::Tell() const
+{
+  TextInputMark mark = { pos, lineNumber };
+  return mark;
+}
+
+void TextInput::Seek(const TextInputMark& mark)
+{
+  pos = mark.pos;
+  lineNumber = mark.lineNumber;
+  released = pos & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+}
+
+static inline bool IsSeparator(char c)
+{
+  return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+// Parse a whole token as a 16-bit value.  Values up to 65535 are allowed as
+// well as negative ones, the input is only 12 bits wide on the board anyway.
+static bool ParseValue(const char* p, const char* end, int16_t* value)
+{
+  if (p < end && *p == '+') ++p;
+
+  int v;
+  std::from_chars_result r = std::from_chars(p, end, v);
+  if (r.ec != std::errc() || r.ptr != end || v < -32768 || v > 65535) return false;
+  *value = (int16_t)v;
+  return true;
+}
+
+void TextInput::Malformed(const char* line, const char* end, const char* reason)
+{
+  if (!quiet && malformed < MaxReported)
+  {
+    int len = end - line;
+    if (len > 40) len = 40;
+    printf("%s:%lld: %s, skipped: %.*s\n", fileName, lineNumber, reason, len, line);
+  }
+  malformed++;
+}
+
+void TextInput::ReportMalformed() const
+{
+  if (quiet || malformed == 0) return;
+  if (malformed > MaxReported)
+    printf("%s: %lld more malformed lines skipped\n", fileName, malformed - MaxReported);
+}
+
+// Returns false for blank and malformed lines
+bool TextInput::ParseLine(const char* line, const char* end, int16_t* in1, int16_t* in2, bool* haveIn2)
+{
+  bool haveIn1 = false;
+  *haveIn2 = false;
+  int lastColumn = in1Column > in2Column ? in1Column : in2Column;
+
+  const char* p = line;
+  for (int column = 0; column <= lastColumn; ++column)
+  {
+    while (p < end && IsSeparator(*p)) ++p;
+    if (p == end) break;
+
+    const char* tokenEnd = p;
+    while (tokenEnd < end && !IsSeparator(*tokenEnd)) ++tokenEnd;
+
+    if (column == in1Column)
+    {
+      if (!ParseValue(p, tokenEnd, in1))
+      {
+        Malformed(line, end, "not an integer");
+        return false;
+      }
+      haveIn1 = true;
+    }
+    else if (column == in2Column)
+    {
+      if (!ParseValue(p, tokenEnd, in2))
+      {
+        Malformed(line, end, "not an integer");
+        return false;
+      }
+      *haveIn2 = true;
+    }
+    p = tokenEnd;
+  }
+
+  if (!haveIn1)
+  {
+    // Blank lines are fine
+    for (p = line; p < end && IsSeparator(*p); ++p) {}
+    if (p != end) Malformed(line, end, "missing column");
+    return false;
+  }
+  return true;
+}
+
+int TextInput::Read(int16_t* in1, int16_t* in2, int* in2Len, int maxRows)
+{
+  int rows = 0;
+  while (rows < maxRows && pos < size)
+  {
+    const char* line = data + pos;
+    const char* end = (const char*)memchr(line, '\n', size - pos);
+    if (!end) end = data + size;
+    pos = (end - data) + 1;
+    lineNumber++;
+
+    int16_t v1, v2;
+    bool haveIn2;
+    if (!ParseLine(line, end, &v1, &v2, &haveIn2)) continue;
+
+    in1[rows++] = v1;
+    if (haveIn2 && in2) in2[(*in2Len)++] = v2;
+  }
+  if (pos > size) pos = size;
+
+  ReleaseParsed();
+  return rows;
+}
+
+// Give back the pages already parsed, so a long stream doesn't keep the
+// whole file resident.
+void TextInput::ReleaseParsed()
+{
+  if (pos - released < ReleaseBytes && pos < size) return;
+
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t end = pos & ~(pageSize - 1);
+  if (end > released)
+  {
+    madvise((void*)(data + released), end - released, MADV_DONTNEED);
+    released = end;
+  }
+}
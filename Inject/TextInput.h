@@ -0,0 +1,73 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Streaming parser for input.txt style files: rows of whitespace or comma
+// separated decimal values, two columns of which are taken as IN1 and IN2.
+//
+// The file is mapped rather than read, and rows are parsed on demand in
+// whatever sized blocks the caller asks for, with the pages already parsed
+// given back as it goes, so arbitrarily large files can be streamed.
+// Blank lines are skipped.  Lines where the selected columns are missing or
+// aren't integers are reported with their line number and skipped, rather
+// than ending the input.
+
+#ifndef TEXT_INPUT_H
+#define TEXT_INPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Position in the file, from Tell, for Seek
+struct TextInputMark
+{
+  size_t pos;
+  long long lineNumber;
+};
+
+class TextInput
+{
+public:
+  TextInput();
+  ~TextInput();
+
+  bool Open(const char* fileName);
+  void Close();
+
+  // Columns to take IN1 and IN2 from, counting from 0.  in2Column may be
+  // -1 if IN2 isn't wanted.  Defaults to 0 and 1.
+  void SetColumns(int in1Column, int in2Column);
+
+  // Don't print malformed lines, they are still counted
+  void SetQuiet(bool quiet) { this->quiet = quiet; }
+
+  // Parse up to maxRows rows.  IN1 values go to in1, IN2 values to in2 for
+  // the rows that have one, counted in *in2Len (in2 may be NULL).  Returns
+  // the number of rows, less than maxRows only at the end of the file.
+  int Read(int16_t* in1, int16_t* in2, int* in2Len, int maxRows);
+
+  TextInputMark Tell() const;
+  void Seek(const TextInputMark& mark);
+
+  bool AtEnd() const { return pos >= size; }
+  long long MalformedLines() const { return malformed; }
+
+  // Print the number of malformed lines not already printed, if any
+  void ReportMalformed() const;
+
+private:
+  bool ParseLine(const char* line, const char* end, int16_t* in1, int16_t* in2, bool* haveIn2);
+  void Malformed(const char* line, const char* end, const char* reason);
+  void ReleaseParsed();
+
+  char fileName[1024];
+  const char* data;
+  size_t size;
+  size_t pos;
+  size_t released;
+  long long lineNumber;
+  long long malformed;
+  int in1Column;
+  int in2Column;
+  bool quiet;
+};
+
+#endif
@@ -0,0 +1,246 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Instrumentation of the DEPP transfers, see TransferStats.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dpcdecl.h"
+#include "depp.h"
+
+#include "TransferStats.h"
+
+bool transferStatsEnabled = false;
+
+double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char* opNames[NumTransferOps] = {
+  "read_file", "build_regset", "put_regset", "get_reg", "wait_half"
+};
+
+void InitTransferStats(TransferStats* stats)
+{
+  memset(stats, 0, sizeof(TransferStats));
+  stats->startTime = Now();
+}
+
+void AddLatency(TransferStats* stats, TransferOp op, double seconds)
+{
+  LatencyHistogram* h = &stats->latency[op];
+  if (h->count == 0 || seconds < h->min) h->min = seconds;
+  if (seconds > h->max) h->max = seconds;
+  h->count++;
+  h->total += seconds;
+
+  int bucket = 0;
+  for (double us = seconds * 1e6; us >= 1.0 && bucket < HistogramBuckets - 1; us *= 0.5)
+    bucket++;
+  h->buckets[bucket]++;
+}
+
+TransferTimer::TransferTimer(TransferStats* stats, TransferOp op)
+  : stats(transferStatsEnabled ? stats : NULL)
+  , op(op)
+  , start(0)
+{
+  if (this->stats) start = Now();
+}
+
+TransferTimer::~TransferTimer()
+{
+  if (stats) AddLatency(stats, op, Now() - start);
+}
+
+void CountPutRegSet(TransferStats* stats, size_t pairs)
+{
+  if (!transferStatsEnabled || !stats) return;
+  __atomic_fetch_add(&stats->pairsSent, pairs, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->bytesSent, pairs * 2, __ATOMIC_RELAXED);
+}
+
+void CountGetReg(TransferStats* stats, size_t regs)
+{
+  if (!transferStatsEnabled || !stats) return;
+  __atomic_fetch_add(&stats->bytesSent, regs * 2, __ATOMIC_RELAXED);
+}
+
+void CountInputWords(TransferStats* stats, int words)
+{
+  if (!transferStatsEnabled || !stats) return;
+  __atomic_fetch_add(&stats->inputWords, words, __ATOMIC_RELAXED);
+}
+
+bool ReadStallCount(HIF hif, TransferStats* stats)
+{
+  if (!transferStatsEnabled || !stats) return true;
+
+  uint8_t addrs[4] = { 8, 9, 10, 11 };
+  uint8_t data[4];
+  {
+    TransferTimer timer(stats, OpGetReg);
+    if (!DeppGetRegSet(hif, addrs, data, 4, false)) return false;
+  }
+  CountGetReg(stats, 4);
+
+  uint32_t count = ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+  if (stats->haveStallCount)
+    __atomic_fetch_add(&stats->stallClocks, (uint32_t)(count - stats->lastStallCount), __ATOMIC_RELAXED);
+  stats->lastStallCount = count;
+  stats->haveStallCount = true;
+  return true;
+}
+
+uint64_t LiveCount(const uint64_t* counter)
+{
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void MergeTransferStats(TransferStats* a, const TransferStats* b)
+{
+  for (int op = 0; op < NumTransferOps; ++op)
+  {
+    LatencyHistogram* ha = &a->latency[op];
+    const LatencyHistogram* hb = &b->latency[op];
+    if (hb->count == 0) continue;
+    if (ha->count == 0 || hb->min < ha->min) ha->min = hb->min;
+    if (hb->max > ha->max) ha->max = hb->max;
+    ha->count += hb->count;
+    ha->total += hb->total;
+    for (int i = 0; i < HistogramBuckets; ++i)
+      ha->buckets[i] += hb->buckets[i];
+  }
+  a->pairsSent += b->pairsSent;
+  a->bytesSent += b->bytesSent;
+  a->inputWords += b->inputWords;
+  a->wordsDrained += b->wordsDrained;
+  a->stallClocks += b->stallClocks;
+  a->polls += b->polls;
+  a->halvesDrained += b->halvesDrained;
+  a->refillStalls += b->refillStalls;
+  if (b->startTime < a->startTime) a->startTime = b->startTime;
+  if (b->endTime > a->endTime) a->endTime = b->endTime;
+}
+
+// Upper bound of the bucket holding the given fraction of the samples, in us,
+// or the largest sample if that is less
+static double Percentile(const LatencyHistogram* h, double fraction)
+{
+  uint64_t target = (uint64_t)(h->count * fraction);
+  uint64_t seen = 0;
+  double max = h->max * 1e6;
+  for (int i = 0; i < HistogramBuckets; ++i)
+  {
+    seen += h->buckets[i];
+    if (seen > target) return (double)(1ull << i) < max ? (double)(1ull << i) : max;
+  }
+  return max;
+}
+
+// Write s as a JSON string, escaping quotes, backslashes and control characters
+static void WriteString(FILE* f, const char* s)
+{
+  fputc('"', f);
+  for (; *s; ++s)
+  {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+    else if (c == '\n') fputs("\\n", f);
+    else if (c == '\r') fputs("\\r", f);
+    else if (c == '\t') fputs("\\t", f);
+    else if (c < 0x20 || c == 0x7f) fprintf(f, "\\u%04x", c);
+    else fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+static void WriteStats(FILE* f, const char* name, const TransferStats* s, const char* indent)
+{
+  double elapsed = s->endTime - s->startTime;
+  double stallTime = s->stallClocks / BoardClockHz;
+
+  fprintf(f, "%s\"name\": ", indent);
+  WriteString(f, name);
+  fprintf(f, ",\n");
+  fprintf(f, "%s\"elapsed_s\": %.6f,\n", indent, elapsed);
+  fprintf(f, "%s\"input_words\": %llu,\n", indent, (unsigned long long)s->inputWords);
+  fprintf(f, "%s\"input_words_per_s\": %.1f,\n", indent, elapsed > 0 ? s->inputWords / elapsed : 0.0);
+  fprintf(f, "%s\"pairs_sent\": %llu,\n", indent, (unsigned long long)s->pairsSent);
+  fprintf(f, "%s\"bytes_sent\": %llu,\n", indent, (unsigned long long)s->bytesSent);
+  fprintf(f, "%s\"bytes_per_s\": %.1f,\n", indent, elapsed > 0 ? s->bytesSent / elapsed : 0.0);
+  fprintf(f, "%s\"polls\": %llu,\n", indent, (unsigned long long)s->polls);
+  fprintf(f, "%s\"halves_drained\": %llu,\n", indent, (unsigned long long)s->halvesDrained);
+  fprintf(f, "%s\"refill_stalls\": %llu,\n", indent, (unsigned long long)s->refillStalls);
+  fprintf(f, "%s\"cpu_stall_s\": %.6f,\n", indent, stallTime);
+  fprintf(f, "%s\"cpu_stall_fraction\": %.4f,\n", indent, elapsed > 0 ? stallTime / elapsed : 0.0);
+  fprintf(f, "%s\"latency\": {\n", indent);
+  for (int op = 0; op < NumTransferOps; ++op)
+  {
+    const LatencyHistogram* h = &s->latency[op];
+    fprintf(f, "%s  ", indent);
+    WriteString(f, opNames[op]);
+    fprintf(f, ": { \"count\": %llu, \"total_s\": %.6f, \"min_us\": %.1f, \"mean_us\": %.1f, "
+            "\"max_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"buckets_us_pow2\": [",
+            (unsigned long long)h->count, h->total, h->min * 1e6,
+            h->count ? h->total * 1e6 / h->count : 0.0, h->max * 1e6,
+            h->count ? Percentile(h, 0.5) : 0.0, h->count ? Percentile(h, 0.99) : 0.0);
+
+    // Trailing empty buckets are left out
+    int last = HistogramBuckets - 1;
+    while (last > 0 && h->buckets[last] == 0) last--;
+    for (int i = 0; i <= last; ++i)
+      fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)h->buckets[i]);
+    fprintf(f, "] }%s\n", op < NumTransferOps - 1 ? "," : "");
+  }
+  fprintf(f, "%s}\n", indent);
+}
+
+bool WriteTransferStats(const char* fileName, const TransferStats* host, const char* const* names,
+                        const TransferStats* const* stats, int numBoards)
+{
+  FILE* f = fopen(fileName, "w");
+  if (!f)
+  {
+    printf("Failed to open %s\n", fileName);
+    return false;
+  }
+
+  TransferStats total;
+  memset(&total, 0, sizeof(total));
+  const TransferStats* first = host ? host : (numBoards > 0 ? stats[0] : NULL);
+  if (first)
+  {
+    total.startTime = first->startTime;
+    total.endTime = first->endTime;
+  }
+
+  fprintf(f, "{\n");
+  if (host)
+  {
+    fprintf(f, "  \"host\": {\n");
+    WriteStats(f, "host", host, "    ");
+    fprintf(f, "  },\n");
+    MergeTransferStats(&total, host);
+  }
+  fprintf(f, "  \"boards\": [\n");
+  for (int i = 0; i < numBoards; ++i)
+  {
+    fprintf(f, "    {\n");
+    WriteStats(f, names[i], stats[i], "      ");
+    fprintf(f, "    }%s\n", i < numBoards - 1 ? "," : "");
+    MergeTransferStats(&total, stats[i]);
+  }
+  fprintf(f, "  ],\n  \"total\": {\n");
+  WriteStats(f, "total", &total, "    ");
+  fprintf(f, "  }\n}\n");
+
+  bool ok = !ferror(f);
+  fclose(f);
+  return ok;
+}
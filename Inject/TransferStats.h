@@ -0,0 +1,106 @@
+// Copyright (C) 2020 Michael Bell
+//
+// Instrumentation of the DEPP transfers in Inject and InjectS.
+//
+// When transferStatsEnabled is false the timers and counters cost a test of
+// that flag and nothing else, so they are left in the transfer paths.
+// When enabled, each board's thread updates its own TransferStats, the
+// counters other threads read while it runs use relaxed atomics.
+//
+// CPU stall time comes from the counter of clocks the CPU has been blocked
+// reading a drained half of IN1 or IN2, in DpimIf registers 8-11.
+// Bitstreams without it read as 0.
+
+#ifndef TRANSFER_STATS_H
+#define TRANSFER_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "dpcdecl.h"
+
+#define HistogramBuckets 32
+#define BoardClockHz 50000000.0
+
+enum TransferOp
+{
+  OpReadFile,
+  OpBuildRegSet,
+  OpPutRegSet,
+  OpGetReg,
+  OpWaitHalf,
+  NumTransferOps
+};
+
+// Latencies in power of two buckets: bucket 0 is under 1us, bucket n is
+// 2^(n-1) to 2^n us.
+struct LatencyHistogram
+{
+  uint64_t count;
+  double total;
+  double min;
+  double max;
+  uint64_t buckets[HistogramBuckets];
+};
+
+struct TransferStats
+{
+  LatencyHistogram latency[NumTransferOps];
+
+  // Read live by other threads
+  uint64_t pairsSent;
+  uint64_t bytesSent;
+  uint64_t inputWords;
+  uint64_t wordsDrained;
+  uint64_t stallClocks;
+
+  uint64_t polls;
+  uint64_t halvesDrained;
+  uint64_t refillStalls;
+  uint32_t lastStallCount;
+  bool haveStallCount;
+  double startTime;
+  double endTime;
+};
+
+extern bool transferStatsEnabled;
+
+void InitTransferStats(TransferStats* stats);
+void AddLatency(TransferStats* stats, TransferOp op, double seconds);
+
+// Time the enclosing scope as op, if stats are enabled and stats isn't NULL
+class TransferTimer
+{
+public:
+  TransferTimer(TransferStats* stats, TransferOp op);
+  ~TransferTimer();
+
+private:
+  TransferStats* stats;
+  TransferOp op;
+  double start;
+};
+
+// Count a register set sent, or register reads
+void CountPutRegSet(TransferStats* stats, size_t pairs);
+void CountGetReg(TransferStats* stats, size_t regs);
+void CountInputWords(TransferStats* stats, int words);
+
+// Read the CPU stall counter and add the clocks since the last read
+bool ReadStallCount(HIF hif, TransferStats* stats);
+
+// Add b's counts into a, for totals across boards
+void MergeTransferStats(TransferStats* a, const TransferStats* b);
+
+// Write the stats for the main thread (host, may be NULL) and each board,
+// and their total, as JSON
+bool WriteTransferStats(const char* fileName, const TransferStats* host, const char* const* names,
+                        const TransferStats* const* stats, int numBoards);
+
+// Relaxed atomic read of a live counter
+uint64_t LiveCount(const uint64_t* counter);
+
+// Monotonic time in seconds
+double Now();
+
+#endif
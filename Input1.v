@@ -2,6 +2,18 @@
 // Copyright (C) 2020 Michael Bell
 
 // Definition of input data.
+//
+// The array is used as two halves of 1024 words so it can be refilled while
+// the CPU runs.  When the CPU reads the last word of a half that half is
+// marked as drained (in1_half_rdy), and writing the last word of a half marks
+// it as filled again.  in1_rdy stalls the CPU while the half it is reading
+// from is drained.
+//
+// Writes still happen while in reset, so the array can be loaded while the
+// CPU is held.
+//
+// Also used for input 2 when both inputs are streamed (see hovalaag_top.v),
+// the ports keep their input 1 names.
 module Input1(
     input clk,
 	 input rst,
@@ -9,36 +21,38 @@ module Input1(
     output reg [11:0] data1,
 	 
 	 output in1_rdy,
+	 output [1:0] in1_half_rdy,
 	 input in1_write,
 	 input [10:0] addr_in,
 	 input [11:0] data_in
     );
 
-   reg in1_reqd = 1'b0;
-	assign in1_rdy = in1_reqd;
+	reg [1:0] in1_drained = 2'b00;
 	reg [10:0] addr1 = 0;
+	assign in1_rdy = in1_drained[addr1[10]];
+	assign in1_half_rdy = in1_drained;
 	reg [11:0] input1_array [0:2047];
 	
 	always @(posedge clk) begin
+		if (in1_write) begin
+			input1_array[addr_in] <= data_in;
+		end
+
 		if (rst) begin
 			addr1 <= 0;
-			in1_reqd <= 1'b0;
+			in1_drained <= 2'b00;
 		end
 		else begin
 			data1 <= input1_array[addr1];
 
-			if (in1_write && addr_in == 11'h7ff && addr1 == 0)
-				in1_reqd <= 1'b0;
-			else if (adv1 && addr1 == 11'h7ff) 
-			   in1_reqd <= 1'b1;
+			if (in1_write && addr_in[9:0] == 10'h3ff)
+				in1_drained[addr_in[10]] <= 1'b0;
+			if (adv1 && addr1[9:0] == 10'h3ff)
+			   in1_drained[addr1[10]] <= 1'b1;
 
 			if (adv1) begin
 			   addr1 <= addr1 + 1'b1;
 			end
-
-			if (in1_write) begin
-				input1_array[addr_in] <= data_in;
-			end
 		end
 	end
 endmodule
@@ -1,502 +1,325 @@
-#define STB_DEFINE
-#include "stb.h"  // http://github.com/nothings/stb
+// Command line Hovalaag assembler, from Sean Barrett's assembler.c which he
+// has released into the public domain.  The assembler itself is in vls.c.
 
-//#define MACHINE_CODE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vls.h"
 
 #define VERSION "1.08"
 #define DATE "2020-10-03"
 
-FILE *html;
-void fatal(char *s, ...)
+#define BENCHMARK_SECONDS  2.0
+
+static char *read_file(const char *filename, size_t *len)
 {
-   va_list a;
-   va_start(a,s);
-   vfprintf(stderr, s, a);
-   va_end(a);
-   if (html) {
-      fprintf(html, "</table></body></html>\n");
-      fclose(html);
+   char *buf;
+   long n;
+   FILE *f = fopen(filename, "rb");
+   if (f == NULL)
+      return NULL;
+   fseek(f, 0, SEEK_END);
+   n = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   buf = n >= 0 ? (char *) malloc(n+1) : NULL;
+   if (buf == NULL || fread(buf, 1, n, f) != (size_t) n) {
+      free(buf);
+      fclose(f);
+      return NULL;
    }
-   exit(1);
+   fclose(f);
+   buf[n] = 0;
+   *len = n;
+   return buf;
 }
 
-typedef int Bool;
-#define False 0
-#define True  1
-
-typedef struct
+// Assemble the source repeatedly and report the rate
+static void benchmark(int flags, vls_assembler *as, const char *source, size_t len, vls_program *program, vls_error *err)
 {
-   uint8 w:2;
-   uint8 a:2;
-   uint8 b:2;
-   uint8 c:2;
-
-   uint8 alu:4;
-   uint8 f:2;
-   uint8 j:2;
-
-   uint16 d:1;
-   uint16 o:1;
-   uint16 io:1;
-   uint16 two_constants:1;
-   int16  value:12;
-} vls_instruction; // 32 bits
-
-#define I(symbolic, string)          P(symbolic, string, P_none)
-
-#define A_UNIT               \
-   I(A_from_D  , "A=D")      \
-   P(A_from_alu, "A=",P_alu) \
-   I(A_from_in1, "A=IN1")    \
-   I(A_from_in2, "A=IN2")    \
-
-char *a_op[] = { "     " , "A=D, " , "A=M, " , "A=I1," , "A=I2," };
-char *b_op[] = { "    "  , "B=A,"  , "B=M,"  , "B=K,"            };
-char *c_op[] = { "      ", "C=M,  ", "DEC,  ", "DECNZ,",         };
-char *d_op[] = { "    "  , "D=A,"                                };
-char *w_op[] = { "    "  , "W=A,"  , "W=M,"  , "W=K,"            };
-char *o_op[] = { "     " , "O1=W," , "O2=W,"                     };
-char *f_op[] = { "       ", "F=Z(M),", "F=N(M),", "F=P(M),"      };
-char *j_op[] = { "     " , "JMP, " , "JMPT," , "JMPF,"           };
-char *m_op[] = { "M:0,    ", "M:-A,   ", "M:B,    ", "M:C,    ", "M:A>>1, ", "M:A+B,  ", "M:B-A,  ", "M:A+B+F,", "M:B-A-F,", "M:A|B,  ", "M:A&B,  ", "M:A^B,  ", "M:~A,   "};
-
-#define B_UNIT                 \
-   I(B_from_A,     "B=A")      \
-   P(B_from_alu  , "B=",P_alu) \
-   P(B_from_const, "B=",P_lit) \
-
-#define C_UNIT                 \
-   P(C_from_alu  , "C=",P_alu) \
-   I(DEC         , "DEC")      \
-   P(DECNZ       , "DECNZ ",P_label) \
-
-#define D_UNIT             \
-   I(D_from_A    , "D=A")
-
-#define W_UNIT                 \
-   I(W_from_A    , "W=A")      \
-   P(W_from_alu  , "W=",P_alu) \
-   P(W_from_const, "W=",P_lit) \
-
-#define O_UNIT               \
-   I(O_out1      , "OUT1=W") \
-   I(O_out2      , "OUT2=W") \
-
-#define F_UNIT                 \
-   I(F_zero      , "F=ZERO()") \
-   I(F_neg       , "F=NEG()")  \
-   I(F_pos       , "F=POS()")  \
-
-#define F_UNIT_2                    \
-   P(F_zero      , "F=ZERO(",P_alu) \
-   P(F_neg       , "F=NEG(" ,P_alu) \
-   P(F_pos       , "F=POS(" ,P_alu) \
-
-#define J_UNIT                       \
-   P(J_jump      , "JMP " , P_label) \
-   P(J_jump_true , "JMPT ", P_label) \
-   P(J_jump_false, "JMPF ", P_label) \
-
-#define P(a,b,c)  a,
-enum a_unit { A_nop, A_UNIT };
-enum b_unit { B_nop, B_UNIT };
-enum c_unit { C_nop, C_UNIT };
-enum d_unit { D_nop, D_UNIT };
-enum w_unit { W_nop, W_UNIT };
-enum o_unit { O_nop, O_UNIT };
-enum f_unit { F_nop, F_UNIT };
-enum j_unit { J_step,J_UNIT };
-#undef P
-
-typedef struct
-{
-   int instr;
-   char *text;
-   int param;
-} vls_unit_opcode;
-
-enum {
-   P_none,
-   P_lit,
-   P_alu,
-   P_label,
-};
-
-
-#define NUM_OPCODE_CLASSES   8
-#define MAX_OPCODE_VARIANTS  6
+   int lines = 1, runs = 0;
+   double elapsed;
+   size_t i;
+   clock_t start = clock();
+   for (i=0; i < len; ++i)
+      if (source[i] == '\n')
+         ++lines;
+   do {
+      int j;
+      for (j=0; j < 1000; ++j)
+         vls_assemble_flags(as, source, len, flags, program, err);
+      runs += 1000;
+      elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+   } while (elapsed < BENCHMARK_SECONDS);
+   printf("%d lines x %d runs in %.3f s: %.0f lines/s, %.0f programs/s\n",
+          lines, runs, elapsed, lines * (double) runs / elapsed, runs / elapsed);
+}
 
-#define P(a,b,c) { a,b,c },
-vls_unit_opcode opcode[NUM_OPCODE_CLASSES][MAX_OPCODE_VARIANTS] = // F unit matches 6 strings
+// List the optimizer's rewrites, and the cycles they save in each iteration
+// of each loop
+static void report_rewrites(const vls_program *program)
 {
-   { A_UNIT },
-   { B_UNIT },
-   { C_UNIT },
-   { D_UNIT },
-   { W_UNIT },
-   { O_UNIT },
-   { F_UNIT F_UNIT_2 },
-   { J_UNIT },
-};
+   int i, j;
+   for (i=0; i < program->num_rewrites; ++i) {
+      const vls_rewrite *r = &program->rewrites[i];
+      printf("line %d: %s", r->line, r->what);
+      if (r->cycles)
+         printf(", saves %d cycle%s", r->cycles, r->cycles == 1 ? "" : "s");
+      printf("\n");
+   }
+   for (i=0; i < program->num_rewrites; ++i) {
+      int loop_line = program->rewrites[i].loop_line, cycles = 0;
+      for (j=0; j < i; ++j)
+         if (program->rewrites[j].loop_line == loop_line)
+            break;
+      if (loop_line == 0 || j < i)
+         continue;
+      for (j=i; j < program->num_rewrites; ++j)
+         if (program->rewrites[j].loop_line == loop_line)
+            cycles += program->rewrites[j].cycles;
+      if (cycles)
+         printf("loop at line %d: up to %d cycle%s saved per iteration\n", loop_line, cycles, cycles == 1 ? "" : "s");
+   }
+}
 
-#define NUM_ALU  13
-char *alu[NUM_ALU] =
+// Start of each source line, for the listing
+static char **source_lines(char *source, size_t len, int *count)
 {
-   "0",
-   "-A",
-   "B",
-   "C",
-   "A>>1",
-   "A+B",
-   "B-A",
-   "A+B+F",
-   "B-A-F",
-   "A|B",
-   "A&B",
-   "A^B",
-   "~A",
-};
+   char **lines = (char **) malloc(sizeof(lines[0]) * (len+2));
+   size_t i;
+   int n = 0;
+   lines[n++] = source;
+   for (i=0; i < len; ++i) {
+      if (source[i] == '\r' || source[i] == '\n') {
+         if (source[i] == '\r' && i+1 < len && source[i+1] == '\n')
+            source[i++] = 0;
+         source[i] = 0;
+         lines[n++] = source + i+1;
+      }
+   }
+   *count = n;
+   return lines;
+}
 
-char *f_alu[NUM_ALU] =
+static void html_text(FILE *f, const char *s)
 {
-   "0)",
-   "-A)",
-   "B)",
-   "C)",
-   "A>>1)",
-   "A+B)",
-   "B-A)",
-   "A+B+F)",
-   "B-A-F)",
-   "A|B)",
-   "A&B)",
-   "A^B)",
-   "~A)",
-};
+   for (; *s; ++s) {
+      if (*s == '<')      fprintf(f, "&lt;");
+      else if (*s == '>') fprintf(f, "&gt;");
+      else if (*s == '&') fprintf(f, "&amp;");
+      else if (*s == '\t') fprintf(f, "   ");
+      else                fputc(*s, f);
+   }
+}
 
-char *unit_names[9] = 
+static void print_per_word(FILE *f, int cycles, int words, const char *none)
 {
-   "A unit", "B unit", "C unit", "D unit", "W unit", "O unit", "F unit", "J unit", "ALU"
-};
-
-stb_sdict *labels;
+   if (words)
+      fprintf(f, "%.2f", (double) cycles / words);
+   else
+      fprintf(f, "%s", none);
+}
 
-vls_instruction vls_assemble_instruction(char **unit_ops, int num_ops, int line_number)
+// The listing, with the blocks and loops vls_analyze found and their costs
+static void write_html(FILE *f, const vls_program *program, const vls_analysis *a, char **lines, int num_lines)
 {
-   int start,offset;
-
-   // if we fail to parse because we make a wrong ALU vs. const assignment, we need to
-   // try again but start at a different place. if it is viable, one of the instructions
-   // we start on will be the alu instruction. this requires alu cases in opcode[][] to
-   // be before other cases so we force correctly
-
-   for (start=0; start < num_ops; ++start) {
-      int units[11] = { 0 }; // 8 = ALU, 9 = literal, 10 = loop target
-      int io_slot = -1;
-      Bool needs_alu=False;
-      Bool has_alu=False;
-      Bool has_constant=False;
-      Bool has_io=False;
-      Bool has_label=False;
-      units[10] = -1;
-      for (offset=0; offset < num_ops; ++offset) {
-         int tok = (start + offset) % num_ops;
-         int a,b,i;
-         char *s = unit_ops[tok];
-         for (a=0; a < NUM_OPCODE_CLASSES; ++a) {
-            Bool alu_failed=0;
-            Bool lit_failed=0;
-            Bool alu_inconsistent=False;
-            for (b=0; b < MAX_OPCODE_VARIANTS; ++b) {
-               if (opcode[a][b].text != NULL) {
-                  Bool success = False;
-                  if (opcode[a][b].param != P_none) {
-                     if (stb_prefix(s, opcode[a][b].text)) {
-                        char *t = s + strlen(opcode[a][b].text);
-                        t = stb_skipwhite(t);
-                        switch (opcode[a][b].param) {
-                           case P_alu: {
-                              char **alu_strings = (a == 6 ? f_alu : alu);
-                              for (i=0; i < NUM_ALU; ++i)
-                                 if (0==strcmp(t, alu_strings[i]))
-                                    break;
-                              if (i == NUM_ALU)
-                                 alu_failed = True;
-                              else {
-                                 if (has_alu && units[8] != i)
-                                    alu_inconsistent = True;
-                                 else {
-                                    success = True;
-                                    has_alu = True;
-                                    units[8] = i;
-                                 }
-                              }
-                              break;
-                           }
-                           case P_lit: {
-                              char *post=0;
-                              int v;
-                              int neg = t[0] == '-' ? -1 : 1;
-                              if (neg < 0) ++t;
-                              if (*t == '$') {
-                                 v = strtol(t+1, &post, 16) * neg;
-                                 if (neg < 0) {
-                                    if ((v << 20) >> 20 != v)
-                                       fatal("ASM error, line %d: Constant %X would be truncated to %X.", line_number, v, ((v<<20)>>20) & 0xfff);
-                                 } else {
-                                    if ((v & 0xfff) != v)
-                                       fatal("ASM error, line %d: Constant %X would be truncated to %X.", line_number, v, v & 0xfff);
-                                 }
-                                 success = True;
-                              } else if (isdigit(*t)) {
-                                 v = strtol(t, &post, 10) * neg;
-                                 if ((v << 20) >> 20 != v)
-                                    fatal("ASM error, line %d: Constant %d would be truncated to %d.", line_number, v, (v<<20)>>20);
-                                 success = True;
-                              } else {
-                                 lit_failed = True; // can just throw the error here probably
-                              }
-                              if (success) {
-                                 post = stb_skipwhite(post);
-                                 if (*post != ';' && *post != 0)
-                                    fatal("ASM error, line %d: Extra characters after constant %d.", line_number, v);
-                                 if (has_constant && units[9] != v)
-                                    goto inconsistent;
-                                 if (units[10] >= 0 && units[10] != v && (units[10] >= 64 || v < -32 || v > 31))
-                                    goto inconsistent;
-                                 has_constant = True;
-                                 units[9] = v;
-                              }
-                              break;
-                           }
-                           case P_label: {
-                              int *address = stb_sdict_get(labels, t);
-                              if (address == NULL)
-                                 fatal("ASM error, line %d: Unknown label '%s' in %s.", line_number, t, unit_names[a]);
-                              if (has_label && units[10] != *address)
-                                 fatal("ASM error, line %d: Cannot branch to two different addresses in the same instruction.", line_number);
-                              if (has_constant && units[9] != *address && (*address >= 64 || units[9] < -32 || units[9] > 31))
-                                 goto inconsistent;
-                              units[10] = *address;
-                              has_label = True;
-                              success = True;
-                           }
-                        }
-                     }
-                  } else {
-                     if (!strcmp(s, opcode[a][b].text)) {
-                        success = True;
-                        if (a == 6) // F unit
-                           needs_alu = True; // implicit ALU requires ALU exist
-                     }
-                  }
-
-                  if (success) {
-                     if (units[a] != 0)
-                        fatal("ASM error, line %d: tried to use %s more than once.", line_number, unit_names[a]);
-                     units[a] = opcode[a][b].instr;
-                     goto parsed;
-                  }
-               }
-            }
-            if (alu_inconsistent)
-               goto inconsistent;
-            if (alu_failed && lit_failed)
-               fatal("ASM error, line %d: unrecognized ALU operation or integer constant in %s.", line_number, unit_names[a]); 
-            if (alu_failed)
-               fatal("ASM error, line %d: unrecognized ALU operation in %s.", line_number, unit_names[a]);
-            if (lit_failed)
-               fatal("ASM error, line %d: unrecognized integer constant operation in %s.", line_number, unit_names[a]);
-         }
-         fatal("ASM error, line %d: unrecognized opcode after %d commas.", line_number, tok);
-        parsed:
-         ;
+   int i, k;
+   fprintf(f, "<html><head><title>Hovalaag listing</title>\n"
+              "<style>td { padding: 0 8px; font-family: monospace; white-space: pre; } tr.block td { border-top: 1px solid #888; }</style>\n"
+              "</head><body>\n");
+   if (a->steady >= 0) {
+      const vls_loop *l = &a->loop[a->steady];
+      fprintf(f, "<p>Steady state: the loop at line %d, ", program->line[l->header]);
+      if (l->min.cycles == 0)
+         fprintf(f, "which has no path round.");
+      else {
+         fprintf(f, "%d to %d cycles an iteration%s.  ", l->min.cycles, l->max.cycles, l->estimated ? " (estimated)" : "");
+         fprintf(f, "Cycles per IN word ");
+         print_per_word(f, l->min.cycles, l->min.in, "-");
+         fprintf(f, " to ");
+         print_per_word(f, l->max.cycles, l->max.in, "-");
+         fprintf(f, ", per OUT word ");
+         print_per_word(f, l->min.cycles, l->min.out, "-");
+         fprintf(f, " to ");
+         print_per_word(f, l->max.cycles, l->max.out, "-");
+         fprintf(f, ".");
       }
-
-      if (needs_alu && !has_alu)
-         fatal("ASM error, line %d: F was assigned with implicit ALU, but no ALU operation was specified elsewhere.", line_number);
-
-      {
-         vls_instruction ins;
-         int a_io_slot = -1, o_io_slot = -1;
-         if (units[0] == A_from_in1 || units[0] == A_from_in2)
-            a_io_slot = units[0] - A_from_in1;
-         if (units[5] == O_out1 || units[5] == O_out2)
-            o_io_slot = units[5] - O_out1;
-         if (a_io_slot >= 0 && o_io_slot >= 0 && a_io_slot != o_io_slot)
-            fatal("ASM error, line %d: Attempted to use IN and OUT in same instruction with different port numbers.", line_number);
-
-         if (units[0] > A_from_in1) units[0] = A_from_in1;
-         if (units[5] > O_out1)     units[5] = O_out1;
-         ins.a = units[0];
-         ins.b = units[1];
-         ins.c = units[2];
-         ins.d = units[3];
-         ins.w = units[4];
-         ins.o = units[5];
-         ins.f = units[6];
-         ins.j = units[7];
-         ins.alu = units[8];
-         if (units[10] >= 0 && has_constant && units[10] != units[9]) {
-            if (units[10] >= 63 || units[9] < -32 || units[9] > 31)
-               fatal("ASM error, line %d: internal error detecting constant mismatch");
-            ins.value = (units[9] << 6) | units[10];
-            ins.two_constants = 1;
-         } else {
-            ins.value = units[10] >= 0 ? units[10] : units[9];
-            ins.two_constants = 0;
-         }
-         if (a_io_slot >= 0)
-            ins.io = a_io_slot;
-         else if (o_io_slot >= 0)
-            ins.io = o_io_slot;
-         else
-            ins.io = 0;
-         return ins;
-      }
-     inconsistent: 
-      // if we tried to use the ALU two different ways, or use two different constants, try a different
-      // ordering so the ALU gets assigned differently
-      ; 
+      fprintf(f, "</p>\n");
    }
-   fatal("ASM error, line %d: couldn't find a consistent assignment of ALU and/or constants\n", line_number);
 
-   // dummy NOTREACHED for compiler warning
-   {
-      vls_instruction x = { 0 };
-      return x;
+   fprintf(f, "<table>\n<tr><th>loop</th><th>lines</th><th>in</th><th>trips</th><th>cycles</th><th>IN</th><th>OUT</th></tr>\n");
+   for (k=0; k < a->num_loops; ++k) {
+      const vls_loop *l = &a->loop[k];
+      fprintf(f, "<tr><td>%d</td><td>%d-%d</td><td>", k, program->line[l->header], program->line[l->latch]);
+      if (l->parent >= 0)
+         fprintf(f, "%d", l->parent);
+      fprintf(f, "</td><td>");
+      if (l->trip_count)
+         fprintf(f, "%d", l->trip_count);
+      fprintf(f, "</td><td>%d-%d%s</td><td>%d-%d</td><td>%d-%d</td></tr>\n", l->min.cycles, l->max.cycles, l->estimated ? "?" : "",
+              l->min.in, l->max.in, l->min.out, l->max.out);
    }
+   fprintf(f, "</table><br>\n");
+
+   fprintf(f, "<table>\n<tr><th>addr</th><th>code</th><th>block</th><th>loop</th><th>line</th><th>source</th></tr>\n");
+   for (i=0; i < program->num_instructions; ++i) {
+      const vls_block *b = &a->block[a->block_of[i]];
+      int line = program->line[i];
+      if (b->start == i)
+         fprintf(f, "<tr class=\"block\"><td>%02X</td><td>%08X</td><td>%d: %d cycle%s</td><td>", i, program->image[i], a->block_of[i], b->cycles, b->cycles == 1 ? "" : "s");
+      else
+         fprintf(f, "<tr><td>%02X</td><td>%08X</td><td></td><td>", i, program->image[i]);
+      if (b->loop >= 0)
+         fprintf(f, "%d", b->loop);
+      fprintf(f, "</td><td>%d</td><td>", line);
+      if (line >= 1 && line <= num_lines)
+         html_text(f, lines[line-1]);
+      fprintf(f, "</td></tr>\n");
+   }
+   fprintf(f, "</table></body></html>\n");
 }
 
-vls_instruction program[65536];
-char *label[65536];
-int num_instructions=0;
+static void json_cost(FILE *f, const vls_cost *c)
+{
+   fprintf(f, "{ \"cycles\": %d, \"in\": %d, \"out\": %d, \"cycles_per_in\": ", c->cycles, c->in, c->out);
+   print_per_word(f, c->cycles, c->in, "null");
+   fprintf(f, ", \"cycles_per_out\": ");
+   print_per_word(f, c->cycles, c->out, "null");
+   fprintf(f, " }");
+}
 
-static uint remap2(uint n, uint a, uint b)
+static void write_json(FILE *f, const vls_program *program, const vls_analysis *a)
 {
-   if (n == a) return b;
-   if (n == b) return a;
-   return n;
+   int i, k;
+   fprintf(f, "{\n  \"instructions\": %d,\n  \"blocks\": [\n", program->num_instructions);
+   for (k=0; k < a->num_blocks; ++k) {
+      const vls_block *b = &a->block[k];
+      fprintf(f, "    { \"start\": %d, \"end\": %d, \"line\": %d, \"cycles\": %d, \"successors\": [", b->start, b->end, program->line[b->start], b->cycles);
+      for (i=0; i < b->num_succ; ++i)
+         fprintf(f, i ? ", %d" : "%d", b->succ[i]);
+      fprintf(f, "], \"loop\": %d }%s\n", b->loop, k+1 < a->num_blocks ? "," : "");
+   }
+   fprintf(f, "  ],\n  \"loops\": [\n");
+   for (k=0; k < a->num_loops; ++k) {
+      const vls_loop *l = &a->loop[k];
+      fprintf(f, "    { \"header\": %d, \"latch\": %d, \"line\": %d, \"parent\": %d, \"trip_count\": ", l->header, l->latch, program->line[l->header], l->parent);
+      if (l->trip_count)
+         fprintf(f, "%d", l->trip_count);
+      else
+         fprintf(f, "null");
+      fprintf(f, ", \"exits\": %s, \"estimated\": %s,\n      \"min\": ", l->exits ? "true" : "false", l->estimated ? "true" : "false");
+      json_cost(f, &l->min);
+      fprintf(f, ",\n      \"max\": ");
+      json_cost(f, &l->max);
+      fprintf(f, " }%s\n", k+1 < a->num_loops ? "," : "");
+   }
+   fprintf(f, "  ],\n  \"steady_state\": ");
+   if (a->steady >= 0)
+      fprintf(f, "%d\n}\n", a->steady);
+   else
+      fprintf(f, "null\n}\n");
 }
 
-void vls_assemble(char *filename)
+// Write a.html and a.json
+static int write_listing(const vls_program *program, char *source, size_t len)
 {
-   int i,j,len,pc;
-   char **lines = stb_stringfile(filename, &len);
-   if (lines == NULL)
-      fatal("Couldn't open '%s'.", filename);
-   labels = stb_sdict_new(1);
-   for (i=0; i < len; ++i) {
-      char *s;
-      // strip comments
-      s = strchr(lines[i], ';');
-      if (s) *s = 0;
-      // trim trailing spaces
-      stb_trimwhite(lines[i]);
-      // force to upper-case
-      for (s=lines[i]; *s; ++s)
-         *s = toupper(*s);
+   vls_analysis *a = (vls_analysis *) malloc(sizeof(*a));
+   int num_lines;
+   char **lines = source_lines(source, len, &num_lines);
+   FILE *f;
+   int ok = 1;
+   vls_analyze(program, a);
+   f = fopen("a.html", "w");
+   if (f == NULL)
+      ok = 0;
+   else {
+      write_html(f, program, a, lines, num_lines);
+      fclose(f);
+   }
+   f = fopen("a.json", "w");
+   if (f == NULL)
+      ok = 0;
+   else {
+      write_json(f, program, a);
+      fclose(f);
    }
+   free(lines);
+   free(a);
+   return ok;
+}
 
-   // assign addresses to labels
-   pc = 0;
-   for (i=0; i < len; ++i) {
-      if (lines[i][0] != 0 && !isspace(lines[i][0])) {
-         // if first row isn't empty, it should be a label
-         int *n;
-         char *s = strchr(lines[i], ':');
-         if (s == 0)
-            fatal("ASM error, line %d: Labels must be terminated by ':'.", i+1);
-         *s = 0;
-         n = malloc(sizeof(*n));
-         *n = pc;
-         if (stb_sdict_get(labels, lines[i]))
-            fatal("ASM error, line %d: Label defined more than once.", i+1);
-         stb_sdict_add(labels, lines[i], n);
-         label[pc] = strdup(lines[i]);
-         if (strlen(label[pc]) > 6)
-            label[pc][6] = 0;
-         lines[i] = s+1;
-      }
-      lines[i] = stb_trimwhite(lines[i]);
-      if (lines[i][0] != 0) {
-         if (pc >= 255) fatal("ASM error, line %d: Program can be at most 255 instructions long.", i+1);
-         ++pc;
-      }
+int main(int argc, char **argv)
+{
+   vls_assembler *as;
+   vls_program program;
+   vls_error err;
+   char *source;
+   size_t len;
+   FILE *ff;
+   int i, bench = 0, listing = 0, flags = 0;
+
+   for (i=1; i < argc-1; ++i) {
+      if (!strcmp(argv[i], "-b"))
+         bench = 1;
+      else if (!strcmp(argv[i], "-p"))
+         flags |= VLS_PACK;
+      else if (!strcmp(argv[i], "-O"))
+         flags |= VLS_OPTIMIZE;
+      else if (!strcmp(argv[i], "-l"))
+         listing = 1;
+      else
+         break;
+   }
+   if (argc < 2 || i != argc-1) {
+      fprintf(stderr, "Usage: assembler [-b] [-p] [-O] [-l] <source file>\n"
+                      "Writes the program to a.out, or with -b benchmarks the assembler\n"
+                      "  -p  the source is one micro-op to a line, pack them into instructions\n"
+                      "  -O  optimize the branches and report the cycles saved\n"
+                      "  -l  write a listing with the cycle costs to a.html, and the costs to a.json\n");
+      return 1;
    }
 
-   // assemble
-   num_instructions = 0;
-   for (i=0; i < len; ++i) {
-      char *s = lines[i];
-      if (s[0] != 0) {
-         int num_ins;
-         int reallocable=0;
-         char **tokens = stb_tokens_stripwhite(s, ",", &num_ins);
-         char **old_tokens = tokens;
-         for (j=0; j < num_ins;) {
-            if (tokens[j][1] == '=' && tokens[j][3] == '=') {
-               char *s,*t;
-               // multi-assignment needs to be split
-               ++num_ins;
-               if (reallocable)
-                  tokens = realloc(tokens, sizeof(tokens[0]) * num_ins);
-               else {
-                  tokens = malloc(sizeof(tokens[0]) * num_ins);
-                  memcpy(tokens, old_tokens, sizeof(tokens[0]) * (num_ins-1));
-                  reallocable = 1;
-               }
-                  
-               s = malloc(strlen(tokens[j])+1); // this is never freed!
-               t = strrchr(tokens[j], '=');
-               // the new token is the first LHS and the final RHS
-               sprintf(s, "%c%s", tokens[j][0], t);
-               tokens[num_ins-1] = s;
-               // the old token loses the first LHS
-               tokens[j] += 2;
-               // now try again, in case there's more than two assignments in tokens[j]
-            } else
-               ++j;
-         }
-         program[num_instructions++] = vls_assemble_instruction(tokens, num_ins, i+1);
-         free(old_tokens);
-      }
+   source = read_file(argv[argc-1], &len);
+   if (source == NULL) {
+      fprintf(stderr, "Couldn't open '%s'.\n", argv[argc-1]);
+      return 1;
    }
 
-   if (num_instructions == 0)
-      fatal("ASM error: program was empty\n");
+   as = vls_create();
+   if (as == NULL || !vls_assemble_flags(as, source, len, flags, &program, &err)) {
+      if (as == NULL)
+         fprintf(stderr, "ASM error: out of memory\n");
+      else if (err.line)
+         fprintf(stderr, "ASM error, line %d: %s\n", err.line, err.message);
+      else
+         fprintf(stderr, "ASM error: %s\n", err.message);
+      return 1;
+   }
 
-#ifdef MACHINE_CODE
-   #if 1
-   {
-      FILE *ff = fopen("a.out", "wb");
-      int i;
-      for (i=0; i < num_instructions; ++i) {
-         uint32 ins;
-         uint a,b,c,d,w,f,j,o,io,x,k,l,alu;
-         vls_instruction v = program[i];
-         alu = v.alu;
-         a = remap2(v.a, 1,2);
-         b = remap2(v.b, 1,2);
-         c = v.c;
-         d = v.d;
-         w = remap2(v.w, 1,2);
-         f = v.f;
-         j = v.j;
-         o = v.o;
-         io = v.io;
-         x = !v.two_constants;
-         k = (v.value >> 6) & 63;
-         l = v.value & 63;
+   if (bench) {
+      benchmark(flags, as, source, len, &program, &err);
+      vls_destroy(as);
+      free(source);
+      return 0;
+   }
 
-         ins = (alu << 28) | (a<<26) | (b<<24) | (c<<22) | (d<<21) | (w<<19) | (f<<17) | (j<<15) | (o<<14) | (io<<13) | (x<<12) | (k<<6) | l;
-         fwrite(&ins, 4, 1, ff);
-      }
-      fclose(ff);
+   ff = fopen("a.out", "wb");
+   if (ff == NULL || fwrite(program.image, 4, program.num_instructions, ff) != (size_t) program.num_instructions) {
+      fprintf(stderr, "Couldn't write a.out.\n");
+      return 1;
+   }
+   fclose(ff);
+   if (flags & VLS_PACK)
+      printf("%d micro-ops packed into %d instructions\n", program.num_micro_ops, program.num_instructions);
+   if (flags & VLS_OPTIMIZE)
+      report_rewrites(&program);
+   if (listing && !write_listing(&program, source, len)) {
+      fprintf(stderr, "Couldn't write the listing.\n");
+      return 1;
    }
-   #else
-   stb_filewrite("a.out", program, sizeof(program[0]) * num_instructions);
-   #endif
-   exit(0);
-#endif
+
+   vls_destroy(as);
+   free(source);
+   return 0;
 }
@@ -0,0 +1,253 @@
+; Benchmark program for assembler -b: 250 lines of the usual unit
+; combinations, including B=0/W=0 ahead of an ALU operation, multiple
+; assignments, labels and two constants in one instruction.
+L0:    W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 0
+L1:    C=A+B, F=ZERO(), JMPT L16   ; line 1
+L2:    C=A+B, F=ZERO(), JMPT L31   ; line 2
+L3:    W=A^B, A=D, OUT1=W, JMPF L30   ; line 3
+L4:    B=$7F, C=A>>1, F=POS()   ; line 4
+L5:    B=-5, W=-5, A=B-A, JMP L6   ; line 5
+L6:    W=A^B, A=D, OUT1=W, JMPF L1   ; line 6
+L7:    B=$7F, C=A>>1, F=POS()   ; line 7
+L8:    DEC, W=~A, OUT2=W   ; line 8
+L9:    A=IN1, B=A, W=A, OUT1=W   ; line 9
+L10:   W=A^B, A=D, OUT1=W, JMPF L17   ; line 10
+L11:   B=-5, W=-5, A=B-A, JMP L37   ; line 11
+L12:   C=A+B, F=ZERO(), JMPT L57   ; line 12
+L13:   W=B-A-F, DECNZ L1, A=IN2   ; line 13
+L14:   A=IN1, B=A, W=A, OUT1=W   ; line 14
+L15:   B=3, JMP L0   ; line 15
+L16:   B=$7F, C=A>>1, F=POS()   ; line 16
+L17:   B=-5, W=-5, A=B-A, JMP L27   ; line 17
+L18:   A=IN1, B=A, W=A, OUT1=W   ; line 18
+L19:   B=-5, W=-5, A=B-A, JMP L48   ; line 19
+L20:   W=A^B, A=D, OUT1=W, JMPF L31   ; line 20
+L21:   B=3, JMP L14   ; line 21
+L22:   W=B-A-F, DECNZ L14, A=IN2   ; line 22
+L23:   B=-5, W=-5, A=B-A, JMP L48   ; line 23
+L24:   W=A^B, A=D, OUT1=W, JMPF L18   ; line 24
+L25:   A=IN1, B=A, W=A, OUT1=W   ; line 25
+L26:   B=3, JMP L59   ; line 26
+L27:   C=A+B, F=ZERO(), JMPT L11   ; line 27
+L28:   A=B=W=A|B, OUT2=W, D=A   ; line 28
+L29:   W=B-A-F, DECNZ L57, A=IN2   ; line 29
+L30:   B=3, JMP L59   ; line 30
+L31:   B=$7F, C=A>>1, F=POS()   ; line 31
+L32:   B=-5, W=-5, A=B-A, JMP L19   ; line 32
+L33:   A=B=W=A|B, OUT2=W, D=A   ; line 33
+L34:   W=A^B, A=D, OUT1=W, JMPF L54   ; line 34
+L35:   B=3, JMP L25   ; line 35
+L36:   DEC, W=~A, OUT2=W   ; line 36
+L37:   A=IN1, B=A, W=A, OUT1=W   ; line 37
+L38:   B=-5, W=-5, A=B-A, JMP L47   ; line 38
+L39:   B=$7F, C=A>>1, F=POS()   ; line 39
+L40:   W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 40
+L41:   B=3, JMP L56   ; line 41
+L42:   W=B-A-F, DECNZ L5, A=IN2   ; line 42
+L43:   W=A^B, A=D, OUT1=W, JMPF L42   ; line 43
+L44:   B=3, JMP L6   ; line 44
+L45:   W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 45
+L46:   B=$7F, C=A>>1, F=POS()   ; line 46
+L47:   W=A^B, A=D, OUT1=W, JMPF L46   ; line 47
+L48:   A=IN1, B=A, W=A, OUT1=W   ; line 48
+L49:   A=IN1, B=A, W=A, OUT1=W   ; line 49
+L50:   DEC, W=~A, OUT2=W   ; line 50
+L51:   DEC, W=~A, OUT2=W   ; line 51
+L52:   W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 52
+L53:   B=3, JMP L14   ; line 53
+L54:   A=IN1, B=A, W=A, OUT1=W   ; line 54
+L55:   B=-5, W=-5, A=B-A, JMP L34   ; line 55
+L56:   B=3, JMP L14   ; line 56
+L57:   B=$7F, C=A>>1, F=POS()   ; line 57
+L58:   W=B-A-F, DECNZ L54, A=IN2   ; line 58
+L59:   DEC, W=~A, OUT2=W   ; line 59
+       W=A^B, A=D, OUT1=W, JMPF L58   ; line 60
+       A=B=W=A|B, OUT2=W, D=A   ; line 61
+       B=3, JMP L38   ; line 62
+       A=IN1, B=A, W=A, OUT1=W   ; line 63
+       B=3, JMP L51   ; line 64
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 65
+       B=3, JMP L13   ; line 66
+       B=$7F, C=A>>1, F=POS()   ; line 67
+       W=A^B, A=D, OUT1=W, JMPF L55   ; line 68
+       W=B-A-F, DECNZ L36, A=IN2   ; line 69
+       B=3, JMP L12   ; line 70
+       B=3, JMP L26   ; line 71
+       W=A^B, A=D, OUT1=W, JMPF L52   ; line 72
+       W=B-A-F, DECNZ L26, A=IN2   ; line 73
+       W=B-A-F, DECNZ L0, A=IN2   ; line 74
+       B=3, JMP L34   ; line 75
+       DEC, W=~A, OUT2=W   ; line 76
+       DEC, W=~A, OUT2=W   ; line 77
+       W=A^B, A=D, OUT1=W, JMPF L38   ; line 78
+       A=IN1, B=A, W=A, OUT1=W   ; line 79
+       B=-5, W=-5, A=B-A, JMP L40   ; line 80
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 81
+       DEC, W=~A, OUT2=W   ; line 82
+       C=A+B, F=ZERO(), JMPT L51   ; line 83
+       B=3, JMP L51   ; line 84
+       A=B=W=A|B, OUT2=W, D=A   ; line 85
+       C=A+B, F=ZERO(), JMPT L5   ; line 86
+       A=IN1, B=A, W=A, OUT1=W   ; line 87
+       A=IN1, B=A, W=A, OUT1=W   ; line 88
+       A=B=W=A|B, OUT2=W, D=A   ; line 89
+       A=B=W=A|B, OUT2=W, D=A   ; line 90
+       DEC, W=~A, OUT2=W   ; line 91
+       W=B-A-F, DECNZ L18, A=IN2   ; line 92
+       C=A+B, F=ZERO(), JMPT L10   ; line 93
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 94
+       B=3, JMP L10   ; line 95
+       A=B=W=A|B, OUT2=W, D=A   ; line 96
+       A=B=W=A|B, OUT2=W, D=A   ; line 97
+       W=B-A-F, DECNZ L31, A=IN2   ; line 98
+       W=A^B, A=D, OUT1=W, JMPF L7   ; line 99
+       A=IN1, B=A, W=A, OUT1=W   ; line 100
+       B=$7F, C=A>>1, F=POS()   ; line 101
+       B=$7F, C=A>>1, F=POS()   ; line 102
+       B=-5, W=-5, A=B-A, JMP L16   ; line 103
+       C=A+B, F=ZERO(), JMPT L16   ; line 104
+       B=3, JMP L13   ; line 105
+       DEC, W=~A, OUT2=W   ; line 106
+       A=IN1, B=A, W=A, OUT1=W   ; line 107
+       A=IN1, B=A, W=A, OUT1=W   ; line 108
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 109
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 110
+       B=3, JMP L43   ; line 111
+       B=$7F, C=A>>1, F=POS()   ; line 112
+       B=-5, W=-5, A=B-A, JMP L40   ; line 113
+       B=3, JMP L28   ; line 114
+       B=-5, W=-5, A=B-A, JMP L33   ; line 115
+       A=IN1, B=A, W=A, OUT1=W   ; line 116
+       DEC, W=~A, OUT2=W   ; line 117
+       W=B-A-F, DECNZ L42, A=IN2   ; line 118
+       B=$7F, C=A>>1, F=POS()   ; line 119
+       A=B=W=A|B, OUT2=W, D=A   ; line 120
+       B=-5, W=-5, A=B-A, JMP L56   ; line 121
+       A=IN1, B=A, W=A, OUT1=W   ; line 122
+       C=A+B, F=ZERO(), JMPT L54   ; line 123
+       C=A+B, F=ZERO(), JMPT L19   ; line 124
+       A=B=W=A|B, OUT2=W, D=A   ; line 125
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 126
+       DEC, W=~A, OUT2=W   ; line 127
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 128
+       B=3, JMP L56   ; line 129
+       A=IN1, B=A, W=A, OUT1=W   ; line 130
+       B=-5, W=-5, A=B-A, JMP L57   ; line 131
+       DEC, W=~A, OUT2=W   ; line 132
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 133
+       DEC, W=~A, OUT2=W   ; line 134
+       A=IN1, B=A, W=A, OUT1=W   ; line 135
+       B=-5, W=-5, A=B-A, JMP L22   ; line 136
+       C=A+B, F=ZERO(), JMPT L13   ; line 137
+       DEC, W=~A, OUT2=W   ; line 138
+       B=$7F, C=A>>1, F=POS()   ; line 139
+       B=-5, W=-5, A=B-A, JMP L31   ; line 140
+       C=A+B, F=ZERO(), JMPT L42   ; line 141
+       B=$7F, C=A>>1, F=POS()   ; line 142
+       B=3, JMP L31   ; line 143
+       A=IN1, B=A, W=A, OUT1=W   ; line 144
+       DEC, W=~A, OUT2=W   ; line 145
+       B=$7F, C=A>>1, F=POS()   ; line 146
+       A=B=W=A|B, OUT2=W, D=A   ; line 147
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 148
+       W=B-A-F, DECNZ L51, A=IN2   ; line 149
+       DEC, W=~A, OUT2=W   ; line 150
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 151
+       B=$7F, C=A>>1, F=POS()   ; line 152
+       A=B=W=A|B, OUT2=W, D=A   ; line 153
+       C=A+B, F=ZERO(), JMPT L53   ; line 154
+       B=$7F, C=A>>1, F=POS()   ; line 155
+       B=3, JMP L22   ; line 156
+       B=3, JMP L31   ; line 157
+       B=3, JMP L15   ; line 158
+       C=A+B, F=ZERO(), JMPT L46   ; line 159
+       A=IN1, B=A, W=A, OUT1=W   ; line 160
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 161
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 162
+       B=3, JMP L13   ; line 163
+       A=B=W=A|B, OUT2=W, D=A   ; line 164
+       W=B-A-F, DECNZ L38, A=IN2   ; line 165
+       B=3, JMP L53   ; line 166
+       A=B=W=A|B, OUT2=W, D=A   ; line 167
+       W=B-A-F, DECNZ L21, A=IN2   ; line 168
+       C=A+B, F=ZERO(), JMPT L18   ; line 169
+       B=-5, W=-5, A=B-A, JMP L55   ; line 170
+       DEC, W=~A, OUT2=W   ; line 171
+       W=A^B, A=D, OUT1=W, JMPF L8   ; line 172
+       DEC, W=~A, OUT2=W   ; line 173
+       C=A+B, F=ZERO(), JMPT L20   ; line 174
+       A=IN1, B=A, W=A, OUT1=W   ; line 175
+       C=A+B, F=ZERO(), JMPT L24   ; line 176
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 177
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 178
+       C=A+B, F=ZERO(), JMPT L39   ; line 179
+       DEC, W=~A, OUT2=W   ; line 180
+       B=$7F, C=A>>1, F=POS()   ; line 181
+       DEC, W=~A, OUT2=W   ; line 182
+       B=-5, W=-5, A=B-A, JMP L36   ; line 183
+       C=A+B, F=ZERO(), JMPT L17   ; line 184
+       W=B-A-F, DECNZ L57, A=IN2   ; line 185
+       A=B=W=A|B, OUT2=W, D=A   ; line 186
+       B=3, JMP L59   ; line 187
+       C=A+B, F=ZERO(), JMPT L29   ; line 188
+       A=B=W=A|B, OUT2=W, D=A   ; line 189
+       A=IN1, B=A, W=A, OUT1=W   ; line 190
+       A=B=W=A|B, OUT2=W, D=A   ; line 191
+       DEC, W=~A, OUT2=W   ; line 192
+       A=IN1, B=A, W=A, OUT1=W   ; line 193
+       B=$7F, C=A>>1, F=POS()   ; line 194
+       A=IN1, B=A, W=A, OUT1=W   ; line 195
+       B=-5, W=-5, A=B-A, JMP L50   ; line 196
+       DEC, W=~A, OUT2=W   ; line 197
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 198
+       W=A^B, A=D, OUT1=W, JMPF L10   ; line 199
+       B=-5, W=-5, A=B-A, JMP L10   ; line 200
+       C=A+B, F=ZERO(), JMPT L27   ; line 201
+       B=$7F, C=A>>1, F=POS()   ; line 202
+       B=3, JMP L58   ; line 203
+       A=B=W=A|B, OUT2=W, D=A   ; line 204
+       A=B=W=A|B, OUT2=W, D=A   ; line 205
+       W=A^B, A=D, OUT1=W, JMPF L20   ; line 206
+       C=A+B, F=ZERO(), JMPT L13   ; line 207
+       W=B-A-F, DECNZ L2, A=IN2   ; line 208
+       A=IN1, B=A, W=A, OUT1=W   ; line 209
+       A=B=W=A|B, OUT2=W, D=A   ; line 210
+       DEC, W=~A, OUT2=W   ; line 211
+       W=A^B, A=D, OUT1=W, JMPF L25   ; line 212
+       W=B-A-F, DECNZ L25, A=IN2   ; line 213
+       C=A+B, F=ZERO(), JMPT L4   ; line 214
+       W=B-A-F, DECNZ L38, A=IN2   ; line 215
+       W=A^B, A=D, OUT1=W, JMPF L7   ; line 216
+       A=B=W=A|B, OUT2=W, D=A   ; line 217
+       DEC, W=~A, OUT2=W   ; line 218
+       B=3, JMP L55   ; line 219
+       W=A^B, A=D, OUT1=W, JMPF L42   ; line 220
+       W=B-A-F, DECNZ L16, A=IN2   ; line 221
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 222
+       B=-5, W=-5, A=B-A, JMP L19   ; line 223
+       B=-5, W=-5, A=B-A, JMP L15   ; line 224
+       W=B-A-F, DECNZ L5, A=IN2   ; line 225
+       A=B=W=A|B, OUT2=W, D=A   ; line 226
+       W=A^B, A=D, OUT1=W, JMPF L5   ; line 227
+       DEC, W=~A, OUT2=W   ; line 228
+       W=B-A-F, DECNZ L14, A=IN2   ; line 229
+       B=$7F, C=A>>1, F=POS()   ; line 230
+       A=IN1, B=A, W=A, OUT1=W   ; line 231
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 232
+       DEC, W=~A, OUT2=W   ; line 233
+       A=B=W=A|B, OUT2=W, D=A   ; line 234
+       W=B-A-F, DECNZ L6, A=IN2   ; line 235
+       B=3, JMP L39   ; line 236
+       DEC, W=~A, OUT2=W   ; line 237
+       DEC, W=~A, OUT2=W   ; line 238
+       B=-5, W=-5, A=B-A, JMP L14   ; line 239
+       A=IN1, B=A, W=A, OUT1=W   ; line 240
+       B=-5, W=-5, A=B-A, JMP L25   ; line 241
+       C=A+B, F=ZERO(), JMPT L17   ; line 242
+       B=3, JMP L55   ; line 243
+       C=A+B, F=ZERO(), JMPT L46   ; line 244
+       C=A+B, F=ZERO(), JMPT L1   ; line 245
+       A=IN1, B=A, W=A, OUT1=W   ; line 246
+       W=B-A-F, DECNZ L31, A=IN2   ; line 247
+       W=A^B, A=D, OUT1=W, JMPF L55   ; line 248
+       W=0, B=0, OUT1=W, F=NEG(A+B), C=A+B   ; line 249
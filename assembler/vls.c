@@ -0,0 +1,1829 @@
+// Hovalaag assembler core, see vls.h.  From Sean Barrett's assembler.c,
+// which he has released into the public domain.
+
+#include <assert.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vls.h"
+
+typedef int Bool;
+#define False 0
+#define True  1
+
+#define ARENA_CHUNK_SIZE  (64*1024)
+#define LABEL_HASH_SIZE   512      // power of two, comfortably more than the 255 labels possible
+
+#define NUM_OPCODE_CLASSES   8
+#define MAX_OPCODE_VARIANTS  6
+#define NUM_ALU             13
+
+#define TRIE_CHARS   48    // distinct characters in the opcodes and ALU operations, plus one
+#define TRIE_NODES   256
+enum { TRIE_OPCODES = 1, TRIE_ALU, TRIE_NUM_ROOTS };   // roots, node 0 is unused
+
+typedef struct
+{
+   uint8_t next[TRIE_CHARS];     // child for each character, 0 for none
+   int8_t op_class;              // opcode class of the texts ending here, or -1
+   uint8_t variants;             // bit for each of its variants ending here
+   int8_t alu;                   // ALU operation ending here, or -1
+} vls_trie_node;
+
+typedef struct vls_arena_chunk
+{
+   struct vls_arena_chunk *next;
+   size_t size;
+   size_t used;
+} vls_arena_chunk;
+
+#define CHUNK_DATA(c)  ((char *) (c) + sizeof(vls_arena_chunk))
+
+typedef struct
+{
+   const char *name;
+   int address;
+   unsigned int generation;      // the slot is empty unless this is the assembler's
+} vls_label;
+
+struct vls_assembler
+{
+   vls_arena_chunk *arena;       // chunk being allocated from, older chunks follow
+   jmp_buf fail;
+   vls_error *err;
+   vls_label labels[LABEL_HASH_SIZE];
+   unsigned int generation;      // of the current call, so the labels needn't be cleared
+   vls_trie_node trie[TRIE_NODES];
+   uint8_t trie_char[256];       // character to trie child index, 0 if not in any opcode
+   char upper[256];              // toupper, without the call per character
+   int trie_num_chars;
+   int trie_num_nodes;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//   arena
+//
+
+static void build_tables(vls_assembler *as);
+
+static vls_arena_chunk *arena_new_chunk(size_t size)
+{
+   vls_arena_chunk *c = (vls_arena_chunk *) malloc(sizeof(*c) + size);
+   if (c == NULL)
+      return NULL;
+   c->next = NULL;
+   c->size = size;
+   c->used = 0;
+   return c;
+}
+
+// Give back everything allocated.  If the last call needed more than one
+// chunk they're replaced by one big enough for all of it, so a steady
+// stream of similar calls doesn't call malloc at all.
+static void arena_reset(vls_assembler *as)
+{
+   vls_arena_chunk *c = as->arena;
+   if (c->next != NULL) {
+      size_t total = 0;
+      while (c != NULL) {
+         vls_arena_chunk *next = c->next;
+         total += c->size;
+         free(c);
+         c = next;
+      }
+      as->arena = arena_new_chunk(total);
+   }
+   as->arena->used = 0;
+}
+
+static void vls_fail(vls_assembler *as, int line, const char *s, ...);
+
+static void *arena_alloc(vls_assembler *as, size_t n)
+{
+   vls_arena_chunk *c = as->arena;
+   n = (n + 7) & ~(size_t) 7;
+   if (c->size - c->used < n) {
+      c = arena_new_chunk(n > ARENA_CHUNK_SIZE ? n : ARENA_CHUNK_SIZE);
+      if (c == NULL)
+         vls_fail(as, 0, "Out of memory.");
+      c->next = as->arena;
+      as->arena = c;
+   }
+   c->used += n;
+   return CHUNK_DATA(c) + c->used - n;
+}
+
+static char *arena_strndup(vls_assembler *as, const char *s, size_t n)
+{
+   char *t = (char *) arena_alloc(as, n+1);
+   memcpy(t, s, n);
+   t[n] = 0;
+   return t;
+}
+
+size_t vls_arena_size(const vls_assembler *as)
+{
+   size_t total = 0;
+   const vls_arena_chunk *c;
+   for (c = as->arena; c != NULL; c = c->next)
+      total += c->size;
+   return total;
+}
+
+vls_assembler *vls_create(void)
+{
+   vls_assembler *as = (vls_assembler *) calloc(1, sizeof(*as));
+   if (as == NULL)
+      return NULL;
+   as->arena = arena_new_chunk(ARENA_CHUNK_SIZE);
+   if (as->arena == NULL) {
+      free(as);
+      return NULL;
+   }
+   build_tables(as);
+   return as;
+}
+
+void vls_destroy(vls_assembler *as)
+{
+   vls_arena_chunk *c;
+   if (as == NULL)
+      return;
+   c = as->arena;
+   while (c != NULL) {
+      vls_arena_chunk *next = c->next;
+      free(c);
+      c = next;
+   }
+   free(as);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//   errors, strings and labels
+//
+
+// Record the error and unwind to vls_assemble.  Nothing needs freeing as
+// everything is in the arena.
+static void vls_fail(vls_assembler *as, int line, const char *s, ...)
+{
+   va_list a;
+   size_t n;
+   va_start(a,s);
+   vsnprintf(as->err->message, sizeof(as->err->message), s, a);
+   va_end(a);
+   n = strlen(as->err->message);
+   while (n > 0 && as->err->message[n-1] == '\n')
+      as->err->message[--n] = 0;
+   as->err->line = line;
+   longjmp(as->fail, 1);
+}
+
+static char *skipwhite(char *s)
+{
+   while (isspace((unsigned char) *s))
+      ++s;
+   return s;
+}
+
+static char *trimwhite(char *s)
+{
+   size_t n;
+   s = skipwhite(s);
+   n = strlen(s);
+   while (n > 0 && isspace((unsigned char) s[n-1]))
+      s[--n] = 0;
+   return s;
+}
+
+static unsigned int label_hash(const char *s)
+{
+   unsigned int h = 2166136261u;
+   while (*s)
+      h = (h ^ (unsigned char) *s++) * 16777619u;
+   return h;
+}
+
+static vls_label *find_label(vls_assembler *as, const char *name)
+{
+   unsigned int i = label_hash(name);
+   for (;;) {
+      vls_label *l = &as->labels[i & (LABEL_HASH_SIZE-1)];
+      if (l->generation != as->generation) {
+         l->name = NULL;
+         return l;
+      }
+      if (!strcmp(l->name, name))
+         return l;
+      ++i;
+   }
+}
+
+static int *get_label(vls_assembler *as, const char *name)
+{
+   vls_label *l = find_label(as, name);
+   return l->name ? &l->address : NULL;
+}
+
+// Split s on commas, stripping white space from each token
+static char **split_tokens(vls_assembler *as, char *s, int *count)
+{
+   int n = 1, i;
+   char *t, **tokens;
+   for (t = s; *t; ++t)
+      if (*t == ',')
+         ++n;
+   tokens = (char **) arena_alloc(as, sizeof(tokens[0]) * n);
+   for (i=0; i < n; ++i) {
+      char *e = strchr(s, ',');
+      if (e)
+         *e = 0;
+      tokens[i] = trimwhite(s);
+      if (e)
+         s = e+1;
+   }
+   *count = n;
+   return tokens;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//   instructions
+//
+
+#define I(symbolic, string)          P(symbolic, string, P_none)
+
+typedef struct
+{
+   int instr;
+   const char *text;
+   int param;
+} vls_unit_opcode;
+
+enum {
+   P_none,
+   P_lit,
+   P_alu,
+   P_label,
+};
+
+#define P(a,b,c) { a,b,c },
+static const vls_unit_opcode opcode[NUM_OPCODE_CLASSES][MAX_OPCODE_VARIANTS] = // F unit matches 6 strings
+{
+   { A_UNIT },
+   { B_UNIT },
+   { C_UNIT },
+   { D_UNIT },
+   { W_UNIT },
+   { O_UNIT },
+   { F_UNIT F_UNIT_2 },
+   { J_UNIT },
+};
+#undef P
+
+// Opcode classes, the rows of opcode[]
+enum { A_CLASS, B_CLASS, C_CLASS, D_CLASS, W_CLASS, O_CLASS, F_CLASS, J_CLASS };
+
+// The F unit's ALU forms take the operation followed by ")"
+static const char *alu[NUM_ALU] =
+{
+   "0",
+   "-A",
+   "B",
+   "C",
+   "A>>1",
+   "A+B",
+   "B-A",
+   "A+B+F",
+   "B-A-F",
+   "A|B",
+   "A&B",
+   "A^B",
+   "~A",
+};
+
+// "0" is both an ALU operation and a constant, so B=0 and W=0 are either
+#define ALU_ZERO  0
+
+static const char *unit_names[9] =
+{
+   "A unit", "B unit", "C unit", "D unit", "W unit", "O unit", "F unit", "J unit", "ALU"
+};
+
+static int trie_insert(vls_assembler *as, int node, const char *s)
+{
+   for (; *s; ++s) {
+      int c = as->trie_char[(unsigned char) *s];
+      if (c == 0) {
+         c = ++as->trie_num_chars;
+         assert(c < TRIE_CHARS);
+         as->trie_char[(unsigned char) *s] = c;
+      }
+      if (as->trie[node].next[c] == 0) {
+         assert(as->trie_num_nodes < TRIE_NODES);
+         as->trie[node].next[c] = as->trie_num_nodes++;
+      }
+      node = as->trie[node].next[c];
+   }
+   return node;
+}
+
+// Build the tries of opcode texts (for the parameterised forms, the text
+// before the parameter) and ALU operations, and the upper-case table.
+// Node 0 is never a child, so 0 also means no match.
+static void build_tables(vls_assembler *as)
+{
+   int a,b,i;
+   as->trie_num_nodes = TRIE_NUM_ROOTS;
+   for (i=0; i < TRIE_NODES; ++i) {
+      as->trie[i].op_class = -1;
+      as->trie[i].alu = -1;
+   }
+   for (a=0; a < NUM_OPCODE_CLASSES; ++a) {
+      for (b=0; b < MAX_OPCODE_VARIANTS; ++b) {
+         if (opcode[a][b].text != NULL) {
+            vls_trie_node *n = &as->trie[trie_insert(as, TRIE_OPCODES, opcode[a][b].text)];
+            assert(n->op_class < 0 || n->op_class == a);
+            n->op_class = a;
+            n->variants |= 1 << b;
+         }
+      }
+   }
+   for (i=0; i < NUM_ALU; ++i)
+      as->trie[trie_insert(as, TRIE_ALU, alu[i])].alu = i;
+   for (i=0; i < 256; ++i)
+      as->upper[i] = (char) toupper(i);
+}
+
+// Find which variants of which opcode class s could be, recording where each
+// one's parameter starts (or for those without one, where the text ends).
+// All the texts s starts with are on one path through the trie, and they're
+// all in the same class.
+static int match_opcode(vls_assembler *as, const char *s, int *end)
+{
+   int a = -1, b, i, node = TRIE_OPCODES;
+   for (b=0; b < MAX_OPCODE_VARIANTS; ++b)
+      end[b] = -1;
+   for (i=0; ; ++i) {
+      const vls_trie_node *n = &as->trie[node];
+      if (n->op_class >= 0) {
+         unsigned int v = n->variants;
+         a = n->op_class;
+         for (b=0; v != 0; ++b, v >>= 1)
+            if (v & 1)
+               end[b] = i;
+      }
+      if (s[i] == 0)
+         break;
+      node = n->next[as->trie_char[(unsigned char) s[i]]];
+      if (node == 0)
+         break;
+   }
+   return a;
+}
+
+// ALU operation s names, or -1.  For the F unit it's followed by ")".
+static int match_alu(vls_assembler *as, const char *s, int f_unit)
+{
+   int node = TRIE_ALU;
+   for (;;) {
+      const vls_trie_node *n = &as->trie[node];
+      if (f_unit && n->alu >= 0 && s[0] == ')' && s[1] == 0)
+         return n->alu;
+      if (*s == 0)
+         return f_unit ? -1 : n->alu;
+      node = n->next[as->trie_char[(unsigned char) *s++]];
+      if (node == 0)
+         return -1;
+   }
+}
+
+// What one unit op (one token) needs from the instruction
+typedef struct
+{
+   int unit;            // opcode class
+   int instr;
+   int alu;             // ALU operation, or -1
+   int zero_instr;      // if alu is ALU_ZERO, the unit's constant form, or 0
+   Bool has_constant;
+   int constant;
+   int label;           // branch address, or -1
+   Bool needs_alu;      // F unit taking the ALU result implicitly
+} vls_unit_op;
+
+// Match one token, failing if it isn't a unit op
+static void match_unit_op(vls_assembler *as, char *s, int tok, int line_number, vls_unit_op *op)
+{
+   int a,b;
+   int end[MAX_OPCODE_VARIANTS];
+   Bool alu_failed=False;
+   Bool lit_failed=False;
+   memset(op, 0, sizeof(*op));
+   op->alu = -1;
+   op->label = -1;
+   a = match_opcode(as, s, end);
+   if (a < 0)
+      vls_fail(as, line_number, "unrecognized opcode after %d commas.", tok);
+   op->unit = a;
+   for (b=0; b < MAX_OPCODE_VARIANTS; ++b) {
+      char *t;
+      if (end[b] < 0)
+         continue;
+      t = skipwhite(s + end[b]);
+      switch (opcode[a][b].param) {
+         case P_none:
+            if (s[end[b]] == 0) {
+               if (a == F_CLASS)
+                  op->needs_alu = True; // implicit ALU requires ALU exist
+               goto parsed;
+            }
+            break;
+         case P_alu: {
+            int i = match_alu(as, t, a == F_CLASS);
+            if (i < 0)
+               alu_failed = True;
+            else {
+               int c;
+               if (i == ALU_ZERO)
+                  for (c=b+1; c < MAX_OPCODE_VARIANTS; ++c)
+                     if (opcode[a][c].param == P_lit)
+                        op->zero_instr = opcode[a][c].instr;
+               op->alu = i;
+               goto parsed;
+            }
+            break;
+         }
+         case P_lit: {
+            char *post=0;
+            int v = 0;
+            int neg = t[0] == '-' ? -1 : 1;
+            if (neg < 0) ++t;
+            if (*t == '$') {
+               v = strtol(t+1, &post, 16) * neg;
+               if (neg < 0) {
+                  if ((v << 20) >> 20 != v)
+                     vls_fail(as, line_number, "Constant %X would be truncated to %X.", v, ((v<<20)>>20) & 0xfff);
+               } else {
+                  if ((v & 0xfff) != v)
+                     vls_fail(as, line_number, "Constant %X would be truncated to %X.", v, v & 0xfff);
+               }
+            } else if (isdigit((unsigned char) *t)) {
+               v = strtol(t, &post, 10) * neg;
+               if ((v << 20) >> 20 != v)
+                  vls_fail(as, line_number, "Constant %d would be truncated to %d.", v, (v<<20)>>20);
+            } else {
+               lit_failed = True;
+               break;
+            }
+            post = skipwhite(post);
+            if (*post != ';' && *post != 0)
+               vls_fail(as, line_number, "Extra characters after constant %d.", v);
+            op->has_constant = True;
+            op->constant = v;
+            goto parsed;
+         }
+         case P_label: {
+            int *address = get_label(as, t);
+            if (address == NULL)
+               vls_fail(as, line_number, "Unknown label '%s' in %s.", t, unit_names[a]);
+            op->label = *address;
+            goto parsed;
+         }
+      }
+   }
+   if (alu_failed && lit_failed)
+      vls_fail(as, line_number, "unrecognized ALU operation or integer constant in %s.", unit_names[a]);
+   if (alu_failed)
+      vls_fail(as, line_number, "unrecognized ALU operation in %s.", unit_names[a]);
+   if (lit_failed)
+      vls_fail(as, line_number, "unrecognized integer constant operation in %s.", unit_names[a]);
+   vls_fail(as, line_number, "unrecognized opcode after %d commas.", tok);
+  parsed:
+   op->instr = opcode[a][b].instr;
+}
+
+enum
+{
+   RESOLVE_OK,
+   RESOLVE_UNIT_TWICE,
+   RESOLVE_TWO_LABELS,
+   RESOLVE_INCONSISTENT,
+   RESOLVE_NEEDS_ALU,
+   RESOLVE_PORTS,
+   RESOLVE_INTERNAL,
+};
+
+// The ALU and constant slots are shared between units, and the units using
+// them have to agree:
+//   - there is one ALU operation
+//   - there is one constant, or a constant and a label that can both be
+//     packed into the instruction (see the two_constants encoding)
+//   - B=0 and W=0 use the ALU if its operation is 0 or nothing else uses it,
+//     otherwise they're the constant 0
+// Each token is matched once and its demands on the slots collected, then
+// they're resolved, rather than retrying the whole parse with each token
+// going first until the ALU and constants fall out consistently.
+//
+// Returns RESOLVE_OK with the instruction in *ins, and whether it uses both
+// a constant and a label in *constant_and_label.
+static int resolve_unit_ops(const vls_unit_op *ops, int num_ops, vls_instruction *ins, Bool *constant_and_label)
+{
+   int units[11] = { 0 }; // 8 = ALU, 9 = literal, 10 = loop target
+   Bool needs_alu=False;
+   Bool has_alu=False;
+   Bool has_constant=False;
+   Bool has_zero=False;
+   Bool consistent=True;
+   int i, a_io_slot = -1, o_io_slot = -1;
+   units[8] = -1;
+   units[10] = -1;
+
+   for (i=0; i < num_ops; ++i) {
+      const vls_unit_op *op = &ops[i];
+      if (units[op->unit] != 0)
+         return RESOLVE_UNIT_TWICE;
+      units[op->unit] = op->instr;
+      if (op->needs_alu)
+         needs_alu = True;
+      if (op->label >= 0) {
+         if (units[10] >= 0 && units[10] != op->label)
+            return RESOLVE_TWO_LABELS;
+         units[10] = op->label;
+      }
+      if (op->has_constant) {
+         if (has_constant && units[9] != op->constant)
+            consistent = False;
+         has_constant = True;
+         units[9] = op->constant;
+      }
+      if (op->zero_instr)
+         has_zero = True;
+      else if (op->alu >= 0) {
+         if (units[8] >= 0 && units[8] != op->alu)
+            consistent = False;
+         units[8] = op->alu;
+      }
+   }
+
+   // B=0 and W=0
+   if (has_zero) {
+      if (units[8] < 0 || units[8] == ALU_ZERO)
+         units[8] = ALU_ZERO;
+      else {
+         for (i=0; i < num_ops; ++i) {
+            if (ops[i].zero_instr) {
+               units[ops[i].unit] = ops[i].zero_instr;
+               if (has_constant && units[9] != 0)
+                  consistent = False;
+               has_constant = True;
+               units[9] = 0;
+            }
+         }
+      }
+   }
+   has_alu = units[8] >= 0;
+   if (!has_alu)
+      units[8] = 0;
+
+   if (has_constant && units[10] >= 0 && units[10] != units[9] && (units[10] >= 64 || units[9] < -32 || units[9] > 31))
+      consistent = False;
+   if (!consistent)
+      return RESOLVE_INCONSISTENT;
+
+   if (needs_alu && !has_alu)
+      return RESOLVE_NEEDS_ALU;
+
+   if (units[0] == A_from_in1 || units[0] == A_from_in2)
+      a_io_slot = units[0] - A_from_in1;
+   if (units[5] == O_out1 || units[5] == O_out2)
+      o_io_slot = units[5] - O_out1;
+   if (a_io_slot >= 0 && o_io_slot >= 0 && a_io_slot != o_io_slot)
+      return RESOLVE_PORTS;
+
+   if (units[0] > A_from_in1) units[0] = A_from_in1;
+   if (units[5] > O_out1)     units[5] = O_out1;
+   ins->a = units[0];
+   ins->b = units[1];
+   ins->c = units[2];
+   ins->d = units[3];
+   ins->w = units[4];
+   ins->o = units[5];
+   ins->f = units[6];
+   ins->j = units[7];
+   ins->alu = units[8];
+   if (units[10] >= 0 && has_constant && units[10] != units[9]) {
+      if (units[10] >= 63 || units[9] < -32 || units[9] > 31)
+         return RESOLVE_INTERNAL;
+      ins->value = (units[9] << 6) | units[10];
+      ins->two_constants = 1;
+   } else {
+      ins->value = units[10] >= 0 ? units[10] : units[9];
+      ins->two_constants = 0;
+   }
+   if (a_io_slot >= 0)
+      ins->io = a_io_slot;
+   else if (o_io_slot >= 0)
+      ins->io = o_io_slot;
+   else
+      ins->io = 0;
+   *constant_and_label = has_constant && units[10] >= 0;
+   return RESOLVE_OK;
+}
+
+// Match the unit ops of one instruction into ops[num_ops]
+static void match_unit_ops(vls_assembler *as, char **unit_ops, int num_ops, int line_number, vls_unit_op *ops)
+{
+   unsigned int used = 0;
+   int tok, label = -1;
+
+   for (tok=0; tok < num_ops; ++tok) {
+      vls_unit_op *op = &ops[tok];
+      match_unit_op(as, unit_ops[tok], tok, line_number, op);
+      if (op->label >= 0) {
+         if (label >= 0 && label != op->label)
+            vls_fail(as, line_number, "Cannot branch to two different addresses in the same instruction.");
+         label = op->label;
+      }
+      if (used & (1 << op->unit))
+         vls_fail(as, line_number, "tried to use %s more than once.", unit_names[op->unit]);
+      used |= 1 << op->unit;
+   }
+}
+
+// Resolve matched unit ops into an instruction, failing if they don't fit one
+static vls_instruction resolve_instruction(vls_assembler *as, const vls_unit_op *ops, int num_ops, int line_number)
+{
+   vls_instruction ins;
+   Bool constant_and_label;
+
+   switch (resolve_unit_ops(ops, num_ops, &ins, &constant_and_label)) {
+      case RESOLVE_INCONSISTENT:
+         vls_fail(as, line_number, "couldn't find a consistent assignment of ALU and/or constants");
+         break;
+      case RESOLVE_NEEDS_ALU:
+         vls_fail(as, line_number, "F was assigned with implicit ALU, but no ALU operation was specified elsewhere.");
+         break;
+      case RESOLVE_PORTS:
+         vls_fail(as, line_number, "Attempted to use IN and OUT in same instruction with different port numbers.");
+         break;
+      case RESOLVE_INTERNAL:
+         vls_fail(as, line_number, "internal error detecting constant mismatch");
+         break;
+   }
+   return ins;
+}
+
+// Assemble the unit ops of one instruction, filling in ops[num_ops] if it
+// isn't NULL
+static vls_instruction vls_assemble_instruction(vls_assembler *as, char **unit_ops, int num_ops, int line_number, vls_unit_op *ops)
+{
+   if (ops == NULL)
+      ops = (vls_unit_op *) arena_alloc(as, sizeof(ops[0]) * num_ops);
+   match_unit_ops(as, unit_ops, num_ops, line_number, ops);
+   return resolve_instruction(as, ops, num_ops, line_number);
+}
+
+static unsigned int remap2(unsigned int n, unsigned int a, unsigned int b)
+{
+   if (n == a) return b;
+   if (n == b) return a;
+   return n;
+}
+
+uint32_t vls_encode(vls_instruction v)
+{
+   unsigned int a,b,c,d,w,f,j,o,io,x,k,l,alu;
+   alu = v.alu;
+   a = remap2(v.a, 1,2);
+   b = remap2(v.b, 1,2);
+   c = v.c;
+   d = v.d;
+   w = remap2(v.w, 1,2);
+   f = v.f;
+   j = v.j;
+   o = v.o;
+   io = v.io;
+   x = !v.two_constants;
+   k = (v.value >> 6) & 63;
+   l = v.value & 63;
+
+   return (alu << 28) | (a<<26) | (b<<24) | (c<<22) | (d<<21) | (w<<19) | (f<<17) | (j<<15) | (o<<14) | (io<<13) | (x<<12) | (k<<6) | l;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//   packing
+//
+// vls_assemble_ops takes one micro-op to a line, with the meaning of running
+// them one at a time, and packs them into instructions.  Every unit reads the
+// registers as they were at the start of the instruction, so a micro-op can
+// join an earlier instruction as long as it doesn't read a register written
+// by a micro-op in the same or a later instruction (or write one they read or
+// write), and the instruction still has room for it: a free unit, the same
+// ALU operation and constant, and the same IN/OUT port.  Micro-ops stay in
+// their basic block, which starts at a label and ends at a branch, and the
+// branch is in the block's last instruction.  Inputs and outputs stay in
+// order, and an input after an output is in a later instruction so it can
+// see the output through the FIFO.
+//
+// A line can still have several unit ops, which stay together.
+
+enum { REG_A, REG_B, REG_C, REG_D, REG_W, REG_F, NUM_REGS };
+
+#define R(r)  (1 << REG_##r)
+static const uint8_t alu_reads[NUM_ALU] =
+{
+   0, R(A), R(B), R(C), R(A), R(A)|R(B), R(A)|R(B), R(A)|R(B)|R(F), R(A)|R(B)|R(F),
+   R(A)|R(B), R(A)|R(B), R(A)|R(B), R(A),
+};
+
+typedef struct
+{
+   char **tokens;
+   int num_tokens;
+   vls_unit_op *ops;
+   int line;
+   unsigned int units;           // bit for each opcode class
+   unsigned int reads, writes;   // bit for each register
+   int in_port, out_port;        // or -1
+   Bool needs_alu;               // F takes the ALU result implicitly
+   Bool starts_block;            // labelled
+   Bool ends_block;              // branches
+} vls_micro_op;
+
+typedef struct
+{
+   vls_unit_op ops[NUM_OPCODE_CLASSES];
+   char *tokens[NUM_OPCODE_CLASSES];
+   int num_ops;
+   unsigned int units;
+   int line;                     // of its first micro-op
+} vls_bundle;
+
+static void micro_op_effects(vls_micro_op *m)
+{
+   int i;
+   m->units = m->reads = m->writes = 0;
+   m->in_port = m->out_port = -1;
+   m->ends_block = m->needs_alu = False;
+   for (i=0; i < m->num_tokens; ++i) {
+      const vls_unit_op *op = &m->ops[i];
+      m->units |= 1 << op->unit;
+      if (op->needs_alu)
+         m->needs_alu = True;
+      if (op->alu >= 0)
+         m->reads |= alu_reads[op->alu];
+      switch (op->unit) {
+         case A_CLASS:
+            m->writes |= R(A);
+            if (op->instr == A_from_D)
+               m->reads |= R(D);
+            else if (op->instr == A_from_in1 || op->instr == A_from_in2)
+               m->in_port = op->instr - A_from_in1;
+            break;
+         case B_CLASS:
+            m->writes |= R(B);
+            if (op->instr == B_from_A)
+               m->reads |= R(A);
+            break;
+         case C_CLASS:
+            m->writes |= R(C);
+            if (op->instr == DEC || op->instr == DECNZ)
+               m->reads |= R(C);
+            if (op->instr == DECNZ)
+               m->ends_block = True;
+            break;
+         case D_CLASS:
+            m->writes |= R(D);
+            m->reads |= R(A);
+            break;
+         case W_CLASS:
+            m->writes |= R(W);
+            if (op->instr == W_from_A)
+               m->reads |= R(A);
+            break;
+         case O_CLASS:
+            m->reads |= R(W);
+            m->out_port = op->instr - O_out1;
+            break;
+         case F_CLASS:
+            m->writes |= R(F);
+            break;
+         case J_CLASS:
+            if (op->instr != J_jump)
+               m->reads |= R(F);
+            m->ends_block = True;
+            break;
+      }
+   }
+}
+#undef R
+
+// Whether m can join bundle b
+static Bool bundle_fits(const vls_bundle *b, const vls_micro_op *m)
+{
+   vls_unit_op ops[NUM_OPCODE_CLASSES];
+   vls_instruction ins;
+   Bool constant_and_label;
+   if (b->units & m->units)
+      return False;
+   memcpy(ops, b->ops, sizeof(ops[0]) * b->num_ops);
+   memcpy(ops + b->num_ops, m->ops, sizeof(ops[0]) * m->num_tokens);
+   if (resolve_unit_ops(ops, b->num_ops + m->num_tokens, &ins, &constant_and_label) != RESOLVE_OK)
+      return False;
+   // Until the packing is done labels are at their micro-op's index, which is
+   // no less than the address they end up at.  So a constant and a label can
+   // share an instruction when they'd fit it at any smaller address, but not
+   // by being equal.
+   return !constant_and_label || ins.two_constants;
+}
+
+static void bundle_add(vls_bundle *b, const vls_micro_op *m)
+{
+   int i;
+   if (b->num_ops == 0)
+      b->line = m->line;
+   for (i=0; i < m->num_tokens; ++i) {
+      b->ops[b->num_ops] = m->ops[i];
+      b->tokens[b->num_ops++] = m->tokens[i];
+   }
+   b->units |= m->units;
+}
+
+// Pack the micro-ops into bundles, putting each in the first one its
+// dependencies and the units, ALU and constant it needs allow.  Records the
+// first bundle of each micro-op's block in block_start.
+static int pack_micro_ops(vls_micro_op *micro, int num_micro, vls_bundle *bundles, int *block_start)
+{
+   int last_write[NUM_REGS], last_read[NUM_REGS];
+   int last_io = -1, last_out = -1, last_used = -1;
+   int i, r, num_bundles = 0, start = 0;
+
+   for (i=0; i < num_micro; ++i) {
+      vls_micro_op *m = &micro[i];
+      int lo, b;
+      if (i == 0 || m->starts_block || micro[i-1].ends_block) {
+         start = num_bundles;
+         for (r=0; r < NUM_REGS; ++r)
+            last_write[r] = last_read[r] = -1;
+         last_io = last_out = last_used = -1;
+      }
+      block_start[i] = start;
+
+      lo = start;
+      for (r=0; r < NUM_REGS; ++r) {
+         if ((m->reads & (1 << r)) && last_write[r] + 1 > lo)
+            lo = last_write[r] + 1;
+         if (m->writes & (1 << r)) {
+            if (last_write[r] + 1 > lo) lo = last_write[r] + 1;
+            if (last_read[r] > lo)      lo = last_read[r];
+         }
+      }
+      if ((m->in_port >= 0 || m->out_port >= 0) && last_io > lo)
+         lo = last_io;
+      if (m->in_port >= 0 && last_out + 1 > lo)
+         lo = last_out + 1;
+      if (m->ends_block && last_used > lo)
+         lo = last_used;
+
+      for (b=lo; b < num_bundles; ++b)
+         if (bundle_fits(&bundles[b], m))
+            break;
+      if (b == num_bundles)
+         memset(&bundles[num_bundles++], 0, sizeof(bundles[0]));
+      bundle_add(&bundles[b], m);
+
+      for (r=0; r < NUM_REGS; ++r) {
+         if ((m->reads & (1 << r)) && b > last_read[r])
+            last_read[r] = b;
+         if (m->writes & (1 << r))
+            last_write[r] = b;
+      }
+      if ((m->in_port >= 0 || m->out_port >= 0) && b > last_io)
+         last_io = b;
+      if (m->out_port >= 0)
+         last_out = b;
+      if (b > last_used)
+         last_used = b;
+   }
+   return num_bundles;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//   optimizing
+//
+// With VLS_OPTIMIZE the assembled instructions are rewritten to take fewer
+// cycles, without changing what they do:
+//   - a branch to an instruction that does nothing but jump (or, for a
+//     conditional branch that leaves F alone, branches on F again) goes
+//     straight to where that leads
+//   - DEC, then F=ZERO(C), then JMPF loop, each alone in its instruction but
+//     for the DEC, becomes DECNZ loop in the DEC's instruction, if F isn't
+//     needed at the loop before being set again.  The other two are still
+//     there for when the loop ends.
+//   - an instruction that does nothing but jump is merged into the one before
+//     if that falls through to it and its J unit is free
+//   - instructions that can't be reached are removed
+// (Every instruction written uses some unit, so there are none that do
+// nothing at all to remove.)
+// A rewrite is only made if the instruction's constant and branch address
+// still fit in it.
+
+#define ALU_C      3     // "C", for F=ZERO(C)
+#define ALU_ADD_F  7     // "A+B+F"
+#define ALU_SUB_F  8     // "B-A-F"
+
+static Bool has_target(vls_instruction v)
+{
+   return v.c == DECNZ || v.j != J_step;
+}
+
+static int get_target(vls_instruction v)
+{
+   return v.two_constants ? (v.value & 63) : (v.value & 255);
+}
+
+// Branch to target, if the instruction's constant still fits with it
+static Bool set_target(vls_instruction *v, int target)
+{
+   int k;
+   if (v->b != B_from_const && v->w != W_from_const) {
+      v->value = target;
+      v->two_constants = 0;
+      return True;
+   }
+   k = v->two_constants ? (v->value >> 6) : v->value;
+   if (k == target) {
+      v->value = target;
+      v->two_constants = 0;
+      return True;
+   }
+   if (target >= 63 || k < -32 || k > 31)
+      return False;
+   v->value = (k << 6) | target;
+   v->two_constants = 1;
+   return True;
+}
+
+// Uses no unit but possibly J
+static Bool is_pure(vls_instruction v)
+{
+   return v.a == A_nop && v.b == B_nop && v.c == C_nop && v.d == D_nop && v.w == W_nop && v.o == O_nop && v.f == F_nop;
+}
+
+// Where instruction i can go next, an address past the end runs through
+// the empty instructions back to 0
+static int successors(vls_instruction v, int i, int *succ)
+{
+   int n = 0;
+   if (v.c == DECNZ)
+      succ[n++] = get_target(v);
+   if (v.j != J_jump)
+      succ[n++] = i+1;
+   if (v.j != J_step)
+      succ[n++] = get_target(v);
+   return n;
+}
+
+// Whether F is live at each instruction: on some path from it, F is read
+// before it's set.  Running off the end counts as reading it.
+static void flag_liveness(const vls_instruction *p, int n, Bool *live)
+{
+   Bool changed;
+   int i;
+   memset(live, 0, sizeof(live[0]) * n);
+   do {
+      changed = False;
+      for (i=n-1; i >= 0; --i) {
+         int succ[3], num_succ, s;
+         Bool l = p[i].j == J_jump_true || p[i].j == J_jump_false || p[i].alu == ALU_ADD_F || p[i].alu == ALU_SUB_F;
+         if (!l && p[i].f == F_nop) {
+            num_succ = successors(p[i], i, succ);
+            for (s=0; s < num_succ; ++s)
+               if (succ[s] >= n || live[succ[s]])
+                  l = True;
+         }
+         if (l != live[i]) {
+            live[i] = l;
+            changed = True;
+         }
+      }
+   } while (changed);
+}
+
+typedef struct
+{
+   vls_rewrite *rewrites;
+   int *at;                      // instruction each rewrite is at
+   int num_rewrites;
+   const int *line;
+} vls_optimizer;
+
+static void add_rewrite(vls_optimizer *opt, int i, int cycles, const char *what)
+{
+   vls_rewrite *r = &opt->rewrites[opt->num_rewrites];
+   opt->at[opt->num_rewrites++] = i;
+   r->line = opt->line[i];
+   r->loop_line = 0;             // set once the loops are known
+   r->cycles = cycles;
+   r->what = what;
+}
+
+static void optimize(vls_assembler *as, vls_program *out)
+{
+   vls_instruction *p = out->program;
+   int n = out->num_instructions;
+   int *loop = (int *) arena_alloc(as, sizeof(loop[0]) * n);
+   int *map = (int *) arena_alloc(as, sizeof(map[0]) * (n+1));
+   int *queue = (int *) arena_alloc(as, sizeof(queue[0]) * n);
+   Bool *live = (Bool *) arena_alloc(as, sizeof(live[0]) * n);
+   Bool *reached = (Bool *) arena_alloc(as, sizeof(reached[0]) * n);
+   vls_optimizer opt;
+   vls_instruction v;
+   const char *label[VLS_MAX_INSTRUCTIONS];
+   int line[VLS_MAX_INSTRUCTIONS];
+   int i, j, num_kept, num_queued, first_removal;
+
+   opt.rewrites = (vls_rewrite *) arena_alloc(as, sizeof(opt.rewrites[0]) * 3 * n);
+   opt.at = (int *) arena_alloc(as, sizeof(opt.at[0]) * 3 * n);
+   opt.num_rewrites = 0;
+   opt.line = out->line;
+
+   // DEC / F=ZERO(C) / JMPF loop to DECNZ loop
+   flag_liveness(p, n, live);
+   for (i=0; i < n; ++i) {
+      int y = i+1, z = i+2, t;
+      if (p[i].c != DEC || p[i].j != J_step || z >= n)
+         continue;
+      if (!is_pure(p[z]) || p[z].j != J_jump_false)
+         continue;
+      v = p[y];
+      v.f = F_nop;
+      if (!is_pure(v) || v.j != J_step || p[y].f != F_zero || p[y].alu != ALU_C)
+         continue;
+      t = get_target(p[z]);
+      v = p[i];
+      if (t >= n || live[t] || !set_target(&v, t))
+         continue;
+      v.c = DECNZ;
+      p[i] = v;
+      add_rewrite(&opt, i, 2, "DEC, F=ZERO(C), JMPF folded into DECNZ");
+      flag_liveness(p, n, live);
+   }
+
+   // merge jumps into the instruction before
+   for (i=n-1; i > 0; --i) {
+      v = p[i-1];
+      if (!is_pure(p[i]) || p[i].j != J_jump)
+         continue;
+      if (v.j != J_step || (v.c == DECNZ && get_target(v) != get_target(p[i])) || !set_target(&v, get_target(p[i])))
+         continue;
+      v.j = J_jump;
+      p[i-1] = v;
+      add_rewrite(&opt, i-1, 1, "jump merged into the instruction before");
+   }
+
+   // jump threading
+   for (i=0; i < n; ++i) {
+      int t, hops = 0;
+      Bool same_flag = p[i].f == F_nop && p[i].c != DECNZ && (p[i].j == J_jump_true || p[i].j == J_jump_false);
+      if (!has_target(p[i]))
+         continue;
+      t = get_target(p[i]);
+      while (hops < n) {
+         int u = t, next;
+         if (u >= n || !is_pure(p[u]) || p[u].j == J_step)
+            break;
+         if (p[u].j == J_jump)
+            next = get_target(p[u]);
+         else if (!same_flag)
+            break;
+         else if (p[u].j == p[i].j)
+            next = get_target(p[u]);
+         else
+            next = u+1;
+         if (next == t)
+            break;
+         t = next;
+         ++hops;
+      }
+      v = p[i];
+      if (hops > 0 && hops < n && set_target(&v, t)) {
+         p[i] = v;
+         add_rewrite(&opt, i, hops, "branch threaded past jumps");
+      }
+   }
+
+   // remove the instructions that can't be reached
+   memset(reached, 0, sizeof(reached[0]) * n);
+   reached[0] = True;
+   queue[0] = 0;
+   num_queued = 1;
+   for (i=0; i < num_queued; ++i) {
+      int succ[3], num_succ, s;
+      num_succ = successors(p[queue[i]], queue[i], succ);
+      for (s=0; s < num_succ; ++s) {
+         if (succ[s] < n && !reached[succ[s]]) {
+            reached[succ[s]] = True;
+            queue[num_queued++] = succ[s];
+         }
+      }
+   }
+   // the rewrites of those don't count
+   for (i=j=0; i < opt.num_rewrites; ++i) {
+      if (reached[opt.at[i]]) {
+         opt.rewrites[j] = opt.rewrites[i];
+         opt.at[j++] = opt.at[i];
+      }
+   }
+   opt.num_rewrites = j;
+
+   // the loops are the ranges from a reachable branch back to its target,
+   // and each instruction's is the innermost, starting last, of those it's in
+   for (i=0; i < n; ++i)
+      loop[i] = -1;
+   for (i=0; i < n; ++i) {
+      int t = get_target(p[i]);
+      if (reached[i] && has_target(p[i]) && t <= i)
+         for (j=t; j <= i; ++j)
+            if (loop[j] < 0 || loop[j] < t)
+               loop[j] = t;
+   }
+   for (i=0; i < opt.num_rewrites; ++i)
+      if (loop[opt.at[i]] >= 0)
+         opt.rewrites[i].loop_line = out->line[loop[opt.at[i]]];
+   first_removal = opt.num_rewrites;
+   num_kept = 0;
+   for (i=0; i < n; ++i) {
+      map[i] = num_kept;
+      if (reached[i])
+         ++num_kept;
+      else
+         add_rewrite(&opt, i, 0, "unreachable instruction removed");
+   }
+   map[n] = num_kept;
+
+   // the branches all have to fit their new addresses, or nothing is removed
+   for (i=0; i < n; ++i) {
+      v = p[i];
+      if (map[i] < map[i+1] && has_target(v) && !set_target(&v, map[get_target(v)]))
+         break;
+   }
+   if (i < n)
+      opt.num_rewrites = first_removal;
+   else {
+      memset(label, 0, sizeof(label));
+      for (i=0; i <= n && i < VLS_MAX_INSTRUCTIONS; ++i)
+         if (label[map[i]] == NULL)
+            label[map[i]] = out->label[i];
+      for (i=0; i < n; ++i) {
+         if (map[i] < map[i+1]) {
+            v = p[i];
+            if (has_target(v))
+               set_target(&v, map[get_target(v)]);
+            line[map[i]] = out->line[i];
+            p[map[i]] = v;
+         }
+      }
+      memcpy(out->label, label, sizeof(label));
+      memcpy(out->line, line, sizeof(line[0]) * num_kept);
+      out->num_instructions = num_kept;
+   }
+   out->rewrites = opt.rewrites;
+   out->num_rewrites = opt.num_rewrites;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//   analysis
+//
+// vls_analyze propagates the constants written to the registers from reset,
+// which leaves out the branches they show can't be taken, then splits the
+// program into basic blocks and finds its loops, each the range from a
+// branch back to its header to the last such branch.  A loop's iteration
+// cost is found over the paths from its header back to it, with each inner
+// loop on the way costing its trip count times its own iteration.  The trip
+// count is known when the loop is entered with the same constants every way
+// in and they decide its branches, as for a DECNZ or DEC / F=ZERO(C) / JMPF
+// loop counting down from a constant.
+
+enum { NOT_REACHED = -2, VARIES = -1 };   // or a constant: 0..4095, F 0 or 1
+
+typedef struct
+{
+   int num_succ[VLS_MAX_INSTRUCTIONS];
+   int succ[VLS_MAX_INSTRUCTIONS][3];     // running off the end is to 0
+   int regs[VLS_MAX_INSTRUCTIONS][3][NUM_REGS];   // the registers going each way
+   Bool reached[VLS_MAX_INSTRUCTIONS];
+} vls_flow;
+
+static int sign_extend(int v)
+{
+   return (v << 20) >> 20;
+}
+
+// 13-bit ALU result, with the carry, or VARIES
+static int alu_result(int op, const int *reg)
+{
+   int a = sign_extend(reg[REG_A]), b = sign_extend(reg[REG_B]), f = reg[REG_F], v;
+   if (((alu_reads[op] & (1 << REG_A)) && reg[REG_A] < 0)
+       || ((alu_reads[op] & (1 << REG_B)) && reg[REG_B] < 0)
+       || ((alu_reads[op] & (1 << REG_C)) && reg[REG_C] < 0)
+       || ((alu_reads[op] & (1 << REG_F)) && reg[REG_F] < 0))
+      return VARIES;
+   switch (op) {
+      case 1:  v = -a;                          break;
+      case 2:  v = b;                           break;
+      case 3:  v = sign_extend(reg[REG_C]);     break;
+      case 4:  v = ((a >> 1) & 0xfff) | ((a & 1) << 12); break;
+      case 5:  v = a + b;                       break;
+      case 6:  v = b - a;                       break;
+      case 7:  v = a + b + f;                   break;
+      case 8:  v = b - a - f;                   break;
+      case 9:  v = a | b;                       break;
+      case 10: v = a & b;                       break;
+      case 11: v = a ^ b;                       break;
+      case 12: v = ~a;                          break;
+      default: v = 0;                           break;
+   }
+   return v & 0x1fff;
+}
+
+// The registers after v, given them before
+static void constant_transfer(vls_instruction v, const int *in, int *out)
+{
+   int r = alu_result(v.alu, in);
+   int m = r < 0 ? VARIES : r & 0xfff;
+   int k = (v.two_constants ? v.value >> 6 : v.value) & 0xfff;
+   memcpy(out, in, sizeof(in[0]) * NUM_REGS);
+   switch (v.a) {
+      case A_from_D:   out[REG_A] = in[REG_D]; break;
+      case A_from_alu: out[REG_A] = m;         break;
+      case A_from_in1: out[REG_A] = VARIES;    break;
+   }
+   switch (v.b) {
+      case B_from_A:     out[REG_B] = in[REG_A]; break;
+      case B_from_alu:   out[REG_B] = m;         break;
+      case B_from_const: out[REG_B] = k;         break;
+   }
+   switch (v.c) {
+      case C_from_alu: out[REG_C] = m; break;
+      case DEC:
+      case DECNZ:      out[REG_C] = in[REG_C] < 0 ? VARIES : (in[REG_C] - 1) & 0xfff; break;
+   }
+   if (v.d == D_from_A)
+      out[REG_D] = in[REG_A];
+   switch (v.w) {
+      case W_from_A:     out[REG_W] = in[REG_A]; break;
+      case W_from_alu:   out[REG_W] = m;         break;
+      case W_from_const: out[REG_W] = k;         break;
+   }
+   if (v.f != F_nop && r < 0)
+      out[REG_F] = VARIES;
+   else if (v.f == F_zero)
+      out[REG_F] = r == 0;
+   else if (v.f == F_neg)
+      out[REG_F] = r >> 12;
+   else if (v.f == F_pos)
+      out[REG_F] = (r >> 12) == 0 && (r & 0xfff) != 0;
+}
+
+// The ways on from instruction i that can be taken given the registers
+// before it, and the registers going each way.  C is 0 when DECNZ falls
+// through.
+static int constant_successors(vls_instruction v, int i, int n, const int *in, int *succ, int (*out)[NUM_REGS])
+{
+   int after[NUM_REGS], num_succ = 0, s, t = get_target(v), f = in[REG_F];
+   Bool step = False, jump = False;
+   constant_transfer(v, in, after);
+   if (v.c == DECNZ) {
+      if (in[REG_C] != 1) {
+         succ[num_succ] = t;
+         memcpy(out[num_succ++], after, sizeof(after));
+      }
+      if (in[REG_C] >= 0 && in[REG_C] != 1)
+         return num_succ;
+      after[REG_C] = 0;
+   }
+   switch (v.j) {
+      case J_step:       step = True;                     break;
+      case J_jump:       jump = True;                     break;
+      case J_jump_true:  jump = f != 0; step = f != 1;    break;
+      case J_jump_false: jump = f != 1; step = f != 0;    break;
+   }
+   if (step) {
+      succ[num_succ] = i+1;
+      memcpy(out[num_succ++], after, sizeof(after));
+   }
+   if (jump) {
+      succ[num_succ] = t;
+      memcpy(out[num_succ++], after, sizeof(after));
+   }
+   for (s=0; s < num_succ; ++s)
+      if (succ[s] >= n)
+         succ[s] = 0;
+   return num_succ;
+}
+
+static Bool constant_meet(int *into, const int *from)
+{
+   Bool changed = False;
+   int r;
+   for (r=0; r < NUM_REGS; ++r) {
+      int v = into[r] == NOT_REACHED || into[r] == from[r] ? from[r] : VARIES;
+      if (v != into[r]) {
+         into[r] = v;
+         changed = True;
+      }
+   }
+   return changed;
+}
+
+// Find the ways on from each instruction.  Instructions that can't be
+// reached keep all of theirs.
+static void find_flow(const vls_instruction *p, int n, vls_flow *flow)
+{
+   int in[VLS_MAX_INSTRUCTIONS][NUM_REGS], out[3][NUM_REGS];
+   Bool changed;
+   int i, r, s;
+   for (i=0; i < n; ++i)
+      for (r=0; r < NUM_REGS; ++r)
+         in[i][r] = i == 0 ? 0 : NOT_REACHED;
+   do {
+      changed = False;
+      for (i=0; i < n; ++i) {
+         int succ[3], num_succ;
+         if (in[i][REG_A] == NOT_REACHED)
+            continue;
+         num_succ = constant_successors(p[i], i, n, in[i], succ, out);
+         for (s=0; s < num_succ; ++s)
+            if (constant_meet(in[succ[s]], out[s]))
+               changed = True;
+      }
+   } while (changed);
+
+   for (i=0; i < n; ++i) {
+      flow->reached[i] = in[i][REG_A] != NOT_REACHED;
+      if (flow->reached[i])
+         flow->num_succ[i] = constant_successors(p[i], i, n, in[i], flow->succ[i], out);
+      else {
+         flow->num_succ[i] = successors(p[i], i, flow->succ[i]);
+         for (s=0; s < flow->num_succ[i]; ++s) {
+            if (flow->succ[i][s] >= n)
+               flow->succ[i][s] = 0;
+            for (r=0; r < NUM_REGS; ++r)
+               out[s][r] = VARIES;
+         }
+      }
+      memcpy(flow->regs[i], out, sizeof(out));
+   }
+}
+
+#define MAX_TRIP_STEPS  (1 << 20)
+
+// Trip count of loop l, if it's entered with the same constants every way
+// and they decide every branch until it's left, or 0
+static int trip_count(const vls_instruction *p, int n, const vls_flow *flow, const vls_loop *l)
+{
+   int reg[NUM_REGS], out[3][NUM_REGS], succ[3];
+   int i, s, pc, steps, trips = 1;
+   for (i=0; i < NUM_REGS; ++i)
+      reg[i] = l->header == 0 ? 0 : NOT_REACHED;
+   for (i=0; i < n; ++i)
+      if (flow->reached[i] && (i < l->header || i > l->latch))
+         for (s=0; s < flow->num_succ[i]; ++s)
+            if (flow->succ[i][s] == l->header)
+               constant_meet(reg, flow->regs[i][s]);
+   if (reg[REG_A] == NOT_REACHED)
+      return 0;
+   pc = l->header;
+   for (steps=0; steps < MAX_TRIP_STEPS; ++steps) {
+      if (constant_successors(p[pc], pc, n, reg, succ, out) != 1)
+         return 0;
+      memcpy(reg, out[0], sizeof(reg));
+      if (succ[0] < l->header || succ[0] > l->latch)
+         return trips;
+      if (succ[0] == l->header)
+         ++trips;
+      pc = succ[0];
+   }
+   return 0;
+}
+
+typedef struct
+{
+   vls_cost min, max;
+   Bool valid;
+} vls_path;
+
+static void cost_add(vls_cost *c, const vls_cost *d)
+{
+   c->cycles += d->cycles;
+   c->in += d->in;
+   c->out += d->out;
+}
+
+// Choose between the ways on from an instruction in loop l
+static void path_choose(const vls_loop *l, const vls_path *best, int from, int to, vls_path *ways)
+{
+   static const vls_path round = { { 0, 0, 0 }, { 0, 0, 0 }, True };
+   const vls_path *w;
+   if (to == l->header)
+      w = &round;
+   else if (to > from && to <= l->latch && best[to].valid)
+      w = &best[to];
+   else
+      return;
+   if (!ways->valid)
+      *ways = *w;
+   else {
+      if (w->min.cycles < ways->min.cycles) ways->min = w->min;
+      if (w->max.cycles > ways->max.cycles) ways->max = w->max;
+   }
+}
+
+// Costs of the shortest and longest iterations of loop l, whose inner loops
+// are done
+static void loop_cost(const vls_instruction *p, const vls_flow *flow, vls_analysis *a, int l, vls_path *best)
+{
+   vls_loop *loop = &a->loop[l];
+   int i, j, s, k;
+   for (i=loop->latch; i >= loop->header; --i) {
+      vls_path ways;
+      vls_cost own;
+      int inner = -1;
+      ways.valid = False;
+      best[i].valid = False;
+      if (i != loop->header)
+         for (k=0; k < l; ++k)
+            if (a->loop[k].header == i && a->loop[k].parent == l)
+               inner = k;
+      if (inner >= 0) {
+         const vls_loop *c = &a->loop[inner];
+         int times = c->trip_count ? c->trip_count : 1;
+         if (c->min.cycles == 0)
+            continue;
+         if (c->trip_count == 0 || c->estimated)
+            loop->estimated = True;
+         for (j=c->header; j <= c->latch; ++j)
+            for (s=0; s < flow->num_succ[j]; ++s)
+               if (flow->succ[j][s] < c->header || flow->succ[j][s] > c->latch)
+                  path_choose(loop, best, c->latch, flow->succ[j][s], &ways);
+         if (!ways.valid)
+            continue;
+         own.cycles = c->min.cycles * times;
+         own.in = c->min.in * times;
+         own.out = c->min.out * times;
+         cost_add(&ways.min, &own);
+         own.cycles = c->max.cycles * times;
+         own.in = c->max.in * times;
+         own.out = c->max.out * times;
+         cost_add(&ways.max, &own);
+      } else {
+         for (s=0; s < flow->num_succ[i]; ++s)
+            path_choose(loop, best, i, flow->succ[i][s], &ways);
+         if (!ways.valid)
+            continue;
+         own.cycles = 1;
+         own.in = p[i].a == A_from_in1;
+         own.out = p[i].o != O_nop;
+         cost_add(&ways.min, &own);
+         cost_add(&ways.max, &own);
+      }
+      best[i] = ways;
+   }
+   if (best[loop->header].valid) {
+      loop->min = best[loop->header].min;
+      loop->max = best[loop->header].max;
+   }
+}
+
+void vls_analyze(const vls_program *program, vls_analysis *out)
+{
+   const vls_instruction *p = program->program;
+   int n = program->num_instructions;
+   int latch[VLS_MAX_INSTRUCTIONS];
+   Bool leader[VLS_MAX_INSTRUCTIONS+1];
+   vls_path best[VLS_MAX_INSTRUCTIONS];
+   vls_flow *flow = (vls_flow *) malloc(sizeof(*flow));
+   int i, j, k, s;
+
+   memset(out, 0, sizeof(*out));
+   out->steady = -1;
+   if (flow == NULL)
+      return;
+   find_flow(p, n, flow);
+
+   // basic blocks start at 0, at branch targets and after branches
+   memset(leader, 0, sizeof(leader));
+   leader[0] = True;
+   for (i=0; i < n; ++i) {
+      latch[i] = -1;
+      if (has_target(p[i])) {
+         leader[get_target(p[i]) < n ? get_target(p[i]) : 0] = True;
+         leader[i+1] = True;
+      }
+   }
+   for (i=0; i < n; ++i) {
+      if (leader[i])
+         out->block[out->num_blocks++].start = i;
+      out->block_of[i] = out->num_blocks-1;
+   }
+   for (k=0; k < out->num_blocks; ++k) {
+      vls_block *b = &out->block[k];
+      int last = (k+1 < out->num_blocks ? out->block[k+1].start : n) - 1;
+      b->end = last+1;
+      b->cycles = b->end - b->start;
+      for (s=0; s < flow->num_succ[last]; ++s) {
+         int t = last+1 == n && flow->succ[last][s] == 0 && p[last].j != J_jump ? -1 : out->block_of[flow->succ[last][s]];
+         if ((b->num_succ < 1 || b->succ[0] != t) && (b->num_succ < 2 || b->succ[1] != t))
+            b->succ[b->num_succ++] = t;
+      }
+   }
+
+   // loops, smallest first so inner loops come before the loops they're in
+   for (i=0; i < n; ++i)
+      for (s=0; s < flow->num_succ[i]; ++s)
+         if (flow->succ[i][s] <= i)
+            latch[flow->succ[i][s]] = i;
+   for (i=0; i < n; ++i) {
+      if (latch[i] >= 0) {
+         vls_loop *l = &out->loop[out->num_loops++];
+         l->header = i;
+         l->latch = latch[i];
+      }
+   }
+   for (i=1; i < out->num_loops; ++i) {
+      vls_loop l = out->loop[i];
+      for (j=i; j > 0 && out->loop[j-1].latch - out->loop[j-1].header > l.latch - l.header; --j)
+         out->loop[j] = out->loop[j-1];
+      out->loop[j] = l;
+   }
+
+   for (k=0; k < out->num_loops; ++k) {
+      vls_loop *l = &out->loop[k];
+      l->parent = -1;
+      for (j=k+1; j < out->num_loops && l->parent < 0; ++j)
+         if (out->loop[j].header <= l->header && out->loop[j].latch >= l->latch)
+            l->parent = j;
+      for (i=l->header; i <= l->latch; ++i)
+         for (s=0; s < flow->num_succ[i]; ++s)
+            if (flow->succ[i][s] < l->header || flow->succ[i][s] > l->latch)
+               l->exits = True;
+      l->trip_count = trip_count(p, n, flow, l);
+      loop_cost(p, flow, out, k, best);
+   }
+
+   for (k=0; k < out->num_blocks; ++k) {
+      vls_block *b = &out->block[k];
+      b->loop = -1;
+      for (j=0; j < out->num_loops && b->loop < 0; ++j)
+         if (out->loop[j].header <= b->start && out->loop[j].latch >= b->start)
+            b->loop = j;
+   }
+
+   // the program settles in the biggest outermost loop it can't leave, or
+   // failing that the biggest outermost loop
+   for (k=out->num_loops-1; k >= 0; --k)
+      if (out->loop[k].parent < 0 && !out->loop[k].exits)
+         break;
+   if (k < 0)
+      for (k=out->num_loops-1; k >= 0; --k)
+         if (out->loop[k].parent < 0)
+            break;
+   out->steady = k;
+   free(flow);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//   programs
+//
+
+// Copy the source into lines, which end at \n, \r\n or \r, without comments
+// or trailing white space and forced to upper-case
+static char **split_lines(vls_assembler *as, const char *source, size_t source_len, int *plen)
+{
+   const char *s = source, *end, *nul = (const char *) memchr(source, 0, source_len);
+   char *d = (char *) arena_alloc(as, source_len+1);
+   int n = 0, size = 256;
+   char **lines = (char **) arena_alloc(as, sizeof(lines[0]) * size);
+   end = nul ? nul : source + source_len;
+   while (s < end) {
+      char *line = d;
+      while (s < end && *s != '\n' && *s != '\r' && *s != ';')
+         *d++ = as->upper[(unsigned char) *s++];
+      while (s < end && *s != '\n' && *s != '\r')
+         ++s;
+      while (d > line && isspace((unsigned char) d[-1]))
+         --d;
+      *d++ = 0;
+      if (s < end && *s++ == '\r' && s < end && *s == '\n')
+         ++s;
+
+      if (n == size) {
+         char **grown = (char **) arena_alloc(as, sizeof(lines[0]) * size * 2);
+         memcpy(grown, lines, sizeof(lines[0]) * size);
+         lines = grown;
+         size *= 2;
+      }
+      lines[n++] = line;
+   }
+   *plen = n;
+   return lines;
+}
+
+// Split a line into unit op tokens
+static char **line_tokens(vls_assembler *as, char *line, int *count)
+{
+   int j, num_ins;
+   char **tokens = split_tokens(as, line, &num_ins);
+   for (j=0; j < num_ins;) {
+      if (tokens[j][0] && tokens[j][1] == '=' && tokens[j][2] && tokens[j][3] == '=') {
+         char *s,*t,**grown;
+         // multi-assignment needs to be split
+         ++num_ins;
+         grown = (char **) arena_alloc(as, sizeof(tokens[0]) * num_ins);
+         memcpy(grown, tokens, sizeof(tokens[0]) * (num_ins-1));
+         tokens = grown;
+
+         t = strrchr(tokens[j], '=');
+         s = (char *) arena_alloc(as, strlen(t)+2);
+         // the new token is the first LHS and the final RHS
+         sprintf(s, "%c%s", tokens[j][0], t);
+         tokens[num_ins-1] = s;
+         // the old token loses the first LHS
+         tokens[j] += 2;
+         // now try again, in case there's more than two assignments in tokens[j]
+      } else
+         ++j;
+   }
+   *count = num_ins;
+   return tokens;
+}
+
+static const char *display_label(vls_assembler *as, const char *name)
+{
+   size_t n = strlen(name);
+   return arena_strndup(as, name, n > VLS_LABEL_DISPLAY ? VLS_LABEL_DISPLAY : n);
+}
+
+// Assemble the micro-ops, one to a line, into packed instructions.  Labels
+// are at the index of their micro-op until then.
+static void assemble_micro_ops(vls_assembler *as, char **lines, int len, int num_micro, Bool *labelled,
+                               vls_label **labels, int num_labels, vls_program *out)
+{
+   vls_micro_op *micro = (vls_micro_op *) arena_alloc(as, sizeof(micro[0]) * num_micro);
+   vls_bundle *bundles = (vls_bundle *) arena_alloc(as, sizeof(bundles[0]) * num_micro);
+   int *block_start = (int *) arena_alloc(as, sizeof(block_start[0]) * num_micro);
+   int i, j, n = 0, num_bundles;
+   vls_instruction ins;
+
+   for (i=0; i < len; ++i) {
+      if (lines[i][0] != 0) {
+         vls_micro_op *m = &micro[n];
+         m->tokens = line_tokens(as, lines[i], &m->num_tokens);
+         m->ops = (vls_unit_op *) arena_alloc(as, sizeof(m->ops[0]) * m->num_tokens);
+         m->line = i+1;
+         // check it's an instruction by itself
+         ins = vls_assemble_instruction(as, m->tokens, m->num_tokens, i+1, m->ops);
+         micro_op_effects(m);
+         // if F takes its result from B=0 or W=0 using the ALU, they have to
+         // stay the ALU's 0 whatever they're packed with
+         if (m->needs_alu && ins.alu == ALU_ZERO)
+            for (j=0; j < m->num_tokens; ++j)
+               m->ops[j].zero_instr = 0;
+         m->starts_block = labelled[n];
+         ++n;
+      }
+   }
+
+   num_bundles = pack_micro_ops(micro, num_micro, bundles, block_start);
+   if (num_bundles > VLS_MAX_INSTRUCTIONS-1)
+      vls_fail(as, bundles[VLS_MAX_INSTRUCTIONS-1].line, "Program can be at most %d instructions long.", VLS_MAX_INSTRUCTIONS-1);
+
+   // move the labels to the start of their blocks, and assemble the
+   // instructions again with them there
+   for (i=0; i < num_labels; ++i) {
+      vls_label *l = labels[i];
+      l->address = l->address < num_micro ? block_start[l->address] : num_bundles;
+      out->label[l->address] = display_label(as, l->name);
+   }
+   for (i=0; i < num_bundles; ++i) {
+      vls_bundle *b = &bundles[i];
+      vls_unit_op ops[NUM_OPCODE_CLASSES];
+      match_unit_ops(as, b->tokens, b->num_ops, b->line, ops);
+      // keep the ALU 0s the packing kept, see above
+      for (j=0; j < b->num_ops; ++j)
+         ops[j].zero_instr = b->ops[j].zero_instr;
+      out->line[i] = b->line;
+      out->program[i] = resolve_instruction(as, ops, b->num_ops, b->line);
+   }
+   out->num_instructions = num_bundles;
+   out->num_micro_ops = num_micro;
+}
+
+static int assemble(vls_assembler *as, const char *source, size_t source_len, int flags, vls_program *out, vls_error *err)
+{
+   int i,len,pc,num_labels=0;
+   char **lines;
+   Bool pack = (flags & VLS_PACK) != 0;
+   Bool *labelled;
+   vls_label **labels;
+
+   arena_reset(as);
+   if (++as->generation == 0) {
+      memset(as->labels, 0, sizeof(as->labels));
+      as->generation = 1;
+   }
+   memset(out->label, 0, sizeof(out->label));
+   out->num_instructions = 0;
+   out->num_micro_ops = 0;
+   out->num_rewrites = 0;
+   out->rewrites = NULL;
+   err->line = 0;
+   err->message[0] = 0;
+   as->err = err;
+   if (setjmp(as->fail))
+      return 0;
+
+   lines = split_lines(as, source, source_len, &len);
+   labelled = (Bool *) arena_alloc(as, sizeof(labelled[0]) * (len+1));
+   memset(labelled, 0, sizeof(labelled[0]) * (len+1));
+   labels = (vls_label **) arena_alloc(as, sizeof(labels[0]) * len);
+
+   // assign addresses to labels
+   pc = 0;
+   for (i=0; i < len; ++i) {
+      if (lines[i][0] != 0 && !isspace((unsigned char) lines[i][0])) {
+         // if first row isn't empty, it should be a label
+         vls_label *l;
+         char *s = strchr(lines[i], ':');
+         if (s == 0)
+            vls_fail(as, i+1, "Labels must be terminated by ':'.");
+         *s = 0;
+         l = find_label(as, lines[i]);
+         if (l->name)
+            vls_fail(as, i+1, "Label defined more than once.");
+         l->name = lines[i];
+         l->address = pc;
+         l->generation = as->generation;
+         labels[num_labels++] = l;
+         lines[i] = s+1;
+      }
+      lines[i] = skipwhite(lines[i]);
+      if (lines[i][0] != 0) {
+         if (!pack && pc >= VLS_MAX_INSTRUCTIONS-1) vls_fail(as, i+1, "Program can be at most %d instructions long.", VLS_MAX_INSTRUCTIONS-1);
+         ++pc;
+      }
+   }
+   for (i=0; i < num_labels; ++i)
+      labelled[labels[i]->address] = True;
+
+   if (pc == 0)
+      vls_fail(as, 0, "program was empty");
+
+   if (pack)
+      assemble_micro_ops(as, lines, len, pc, labelled, labels, num_labels, out);
+   else {
+      for (i=0; i < num_labels; ++i)
+         out->label[labels[i]->address] = display_label(as, labels[i]->name);
+      for (i=0; i < len; ++i) {
+         if (lines[i][0] != 0) {
+            int num_ins;
+            char **tokens = line_tokens(as, lines[i], &num_ins);
+            out->line[out->num_instructions] = i+1;
+            out->program[out->num_instructions++] = vls_assemble_instruction(as, tokens, num_ins, i+1, NULL);
+         }
+      }
+      out->num_micro_ops = out->num_instructions;
+   }
+
+   if (flags & VLS_OPTIMIZE)
+      optimize(as, out);
+
+   for (i=0; i < out->num_instructions; ++i)
+      out->image[i] = vls_encode(out->program[i]);
+   return 1;
+}
+
+int vls_assemble(vls_assembler *as, const char *source, size_t source_len, vls_program *out, vls_error *err)
+{
+   return assemble(as, source, source_len, 0, out, err);
+}
+
+int vls_assemble_ops(vls_assembler *as, const char *source, size_t source_len, vls_program *out, vls_error *err)
+{
+   return assemble(as, source, source_len, VLS_PACK, out, err);
+}
+
+int vls_assemble_flags(vls_assembler *as, const char *source, size_t source_len, int flags, vls_program *out, vls_error *err)
+{
+   return assemble(as, source, source_len, flags, out, err);
+}
@@ -0,0 +1,201 @@
+// Hovalaag assembler core, split out of Sean Barrett's assembler.c (public
+// domain) so it can be embedded in other tools.
+//
+// vls_assemble assembles a source buffer into an instruction image in memory.
+// It keeps no global state and reports errors in a vls_error rather than
+// exiting.  Everything it allocates comes from the vls_assembler's arena,
+// which is reset at the start of each call, so a vls_assembler can be reused
+// for any number of calls without leaking or growing.  A vls_assembler must
+// only be used by one thread at a time; use one per thread.
+
+#ifndef VLS_H
+#define VLS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VLS_MAX_INSTRUCTIONS  256   // the program can be at most 255 long
+#define VLS_LABEL_DISPLAY     6     // labels are truncated to this for listings
+
+typedef struct
+{
+   uint8_t w:2;
+   uint8_t a:2;
+   uint8_t b:2;
+   uint8_t c:2;
+
+   uint8_t alu:4;
+   uint8_t f:2;
+   uint8_t j:2;
+
+   uint16_t d:1;
+   uint16_t o:1;
+   uint16_t io:1;
+   uint16_t two_constants:1;
+   int16_t  value:12;
+} vls_instruction; // 32 bits
+
+#define I(symbolic, string)          P(symbolic, string, P_none)
+
+#define A_UNIT               \
+   I(A_from_D  , "A=D")      \
+   P(A_from_alu, "A=",P_alu) \
+   I(A_from_in1, "A=IN1")    \
+   I(A_from_in2, "A=IN2")    \
+
+#define B_UNIT                 \
+   I(B_from_A,     "B=A")      \
+   P(B_from_alu  , "B=",P_alu) \
+   P(B_from_const, "B=",P_lit) \
+
+#define C_UNIT                 \
+   P(C_from_alu  , "C=",P_alu) \
+   I(DEC         , "DEC")      \
+   P(DECNZ       , "DECNZ ",P_label) \
+
+#define D_UNIT             \
+   I(D_from_A    , "D=A")
+
+#define W_UNIT                 \
+   I(W_from_A    , "W=A")      \
+   P(W_from_alu  , "W=",P_alu) \
+   P(W_from_const, "W=",P_lit) \
+
+#define O_UNIT               \
+   I(O_out1      , "OUT1=W") \
+   I(O_out2      , "OUT2=W") \
+
+#define F_UNIT                 \
+   I(F_zero      , "F=ZERO()") \
+   I(F_neg       , "F=NEG()")  \
+   I(F_pos       , "F=POS()")  \
+
+#define F_UNIT_2                    \
+   P(F_zero      , "F=ZERO(",P_alu) \
+   P(F_neg       , "F=NEG(" ,P_alu) \
+   P(F_pos       , "F=POS(" ,P_alu) \
+
+#define J_UNIT                       \
+   P(J_jump      , "JMP " , P_label) \
+   P(J_jump_true , "JMPT ", P_label) \
+   P(J_jump_false, "JMPF ", P_label) \
+
+#define P(a,b,c)  a,
+enum a_unit { A_nop, A_UNIT };
+enum b_unit { B_nop, B_UNIT };
+enum c_unit { C_nop, C_UNIT };
+enum d_unit { D_nop, D_UNIT };
+enum w_unit { W_nop, W_UNIT };
+enum o_unit { O_nop, O_UNIT };
+enum f_unit { F_nop, F_UNIT };
+enum j_unit { J_step,J_UNIT };
+#undef P
+#undef I
+
+typedef struct
+{
+   int line;            // source line the error is on, 0 if it isn't about one line
+   char message[256];   // without the "ASM error, line n: " prefix
+} vls_error;
+
+// A rewrite made by the optimizer (VLS_OPTIMIZE)
+typedef struct
+{
+   int line;            // source line of the instruction rewritten or removed
+   int loop_line;       // source line starting the innermost loop it's in, or 0
+   int cycles;          // cycles saved each time it's run (a branch: taken)
+   const char *what;
+} vls_rewrite;
+
+typedef struct
+{
+   int num_instructions;
+   vls_instruction program[VLS_MAX_INSTRUCTIONS];
+   uint32_t image[VLS_MAX_INSTRUCTIONS];        // machine code, as written to a.out
+   int line[VLS_MAX_INSTRUCTIONS];              // source line of each instruction
+   const char *label[VLS_MAX_INSTRUCTIONS];     // label at each address, truncated to
+                                                // VLS_LABEL_DISPLAY, or NULL.  In the arena.
+   int num_micro_ops;                           // source lines the instructions came from
+   int num_rewrites;                            // with VLS_OPTIMIZE, the rewrites made,
+   const vls_rewrite *rewrites;                 // in the arena
+} vls_program;
+
+typedef struct vls_assembler vls_assembler;
+
+vls_assembler *vls_create(void);
+void vls_destroy(vls_assembler *as);
+
+// Assemble len bytes of source.  Returns 1 with the program in *out, whose
+// labels stay valid until the next call, or 0 with the first error in *err.
+int vls_assemble(vls_assembler *as, const char *source, size_t len, vls_program *out, vls_error *err);
+
+// Assemble source written one micro-op to a line, meaning each runs after
+// the one before, packing them into as few instructions as their
+// dependencies and the units allow (see vls.c).
+int vls_assemble_ops(vls_assembler *as, const char *source, size_t len, vls_program *out, vls_error *err);
+
+#define VLS_PACK      1    // as vls_assemble_ops
+#define VLS_OPTIMIZE  2    // thread jumps, form DECNZ loops and remove dead instructions (see vls.c)
+
+// vls_assemble with any of the flags above
+int vls_assemble_flags(vls_assembler *as, const char *source, size_t len, int flags, vls_program *out, vls_error *err);
+
+// Static cycle costs, from vls_analyze.  Every instruction takes one cycle,
+// waiting for input aside.
+
+typedef struct
+{
+   int cycles;
+   int in;              // words read from IN1 and IN2
+   int out;             // words written to OUT1 and OUT2
+} vls_cost;
+
+typedef struct
+{
+   int start, end;      // instructions [start, end)
+   int cycles;
+   int num_succ;
+   int succ[2];         // blocks it can go to next, -1 for running off the end
+   int loop;            // innermost loop it's in, or -1
+} vls_block;
+
+typedef struct
+{
+   int header, latch;   // the loop is instructions [header, latch]
+   int parent;          // loop it's in, or -1
+   int trip_count;      // iterations each time it's entered if constants decide it,
+                        // as for a DECNZ loop with a constant count, or 0
+   int exits;           // whether it can be left
+   int estimated;       // costs take an inner loop without a trip count as running once
+   vls_cost min, max;   // shortest and longest iteration, inner loops included, or 0
+                        // cycles if no path goes round
+} vls_loop;
+
+typedef struct
+{
+   int num_blocks;
+   vls_block block[VLS_MAX_INSTRUCTIONS];
+   int block_of[VLS_MAX_INSTRUCTIONS];          // block of each instruction
+   int num_loops;
+   vls_loop loop[VLS_MAX_INSTRUCTIONS];         // inner loops before the loops they're in
+   int steady;                                  // outermost loop the program settles in, or -1
+} vls_analysis;
+
+// Find the basic blocks and loops of an assembled program and their costs
+void vls_analyze(const vls_program *program, vls_analysis *out);
+
+// Machine code for one instruction
+uint32_t vls_encode(vls_instruction v);
+
+// Bytes the arena holds, for checking repeated calls don't grow it
+size_t vls_arena_size(const vls_assembler *as);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
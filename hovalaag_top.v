@@ -19,7 +19,7 @@
 // If SW1 is down pressing BTN3 clocks the CPU once
 // If SW1 is up, the CPU clocks at about 12.5MHz (if SW3 up), or 1.5Hz (SW2 down) or 12Hz (SW2 up)
 // If SW4 is up, the CPU pauses on each write to OUT1, pressing BTN2 continues.
-// Pressing BTN0 resets the CPU.
+// Pressing BTN0 resets the CPU, as does setting bit 4 of the DEPP control register.
 module hovalaag_top(
     input clk,
 	 output [7:0] Led,
@@ -46,7 +46,8 @@ module hovalaag_top(
   
 	wire [31:0] instr;
 	wire [7:0] addr;
-	wire reset = btn[0];
+	wire cpu_hold;
+	wire reset = btn[0] | cpu_hold;
 
 	wire [11:0] A;
 	wire [11:0] B;
@@ -61,9 +62,19 @@ module hovalaag_top(
 	wire in2_set;
 	wire in1_rdy;
 	wire in2_rdy;
+	wire [1:0] in1_half_rdy;
+	wire [1:0] in2_half_rdy;
 	wire [10:0] input_addr;
 	wire [11:0] input_data;
 	
+	// Clocks the CPU has spent blocked on a read from a drained half of IN1 or
+	// IN2, read through DpimIf.  A drained half with no read pending, such as
+	// after the last input, doesn't count.
+	reg [31:0] in_stall_count = 32'h00000000;
+	always @(posedge clk)
+		if (!reset && ((in1_rdy && IN1_adv) || (in2_rdy && IN2_adv)))
+			in_stall_count <= in_stall_count + 1'b1;
+	
 	// Clock control
 	reg [23:0] counter = 24'b000000000000000000000000;
 	reg slow_clk = 1'b0;
@@ -107,15 +118,22 @@ module hovalaag_top(
 	
 	// Instantiate CPU and program block RAM
 	Hovalaag cpu(slow_clk, IN1, IN1_adv, IN2, IN2_adv, OUT, OUT_valid, OUT_select, instr, addr, A, B, C, D, reset);
-	DpimIf dpim(clk, EppAstb, EppDstb, EppWR, EppWait, EppDB, program_write, program_addr, program_data, in1_rdy, in2_rdy, in1_set, in2_set, input_addr, input_data);
+	DpimIf dpim(clk, EppAstb, EppDstb, EppWR, EppWait, EppDB, program_write, program_addr, program_data, in1_rdy, in2_rdy, in1_half_rdy, in2_half_rdy, in1_set, in2_set, input_addr, input_data, cpu_hold, in_stall_count);
 	Program prog(clk, addr, instr, program_write, program_addr, program_data);
 	
 	// Two input data banks version
 	//Input inp(clk, reset, IN1_adv & do_hoval_IN, IN2_adv & do_hoval_IN, IN1, IN2, in1_set, in2_set, input_addr[7:0], input_data);
+	//assign in1_half_rdy = 2'b00;
+	//assign in2_half_rdy = 2'b00;
+	
+	// Both inputs streamed version, for InjectS -2
+	//Input1 inp(clk, reset, IN1_adv & do_hoval_IN, IN1, in1_rdy, in1_half_rdy, in1_set, input_addr, input_data);
+	//Input1 inp2(clk, reset, IN2_adv & do_hoval_IN, IN2, in2_rdy, in2_half_rdy, in2_set, input_addr, input_data);
 	
 	// Loopback OUT2 to IN2 version
-	Input1 inp(clk, reset, IN1_adv & do_hoval_IN, IN1, in1_rdy, in1_set, input_addr, input_data);
+	Input1 inp(clk, reset, IN1_adv & do_hoval_IN, IN1, in1_rdy, in1_half_rdy, in1_set, input_addr, input_data);
 	assign in2_rdy = 1'b0;
+	assign in2_half_rdy = 2'b00;
 	Fifo fifo(clk, reset, OUT_select & OUT_valid & do_hoval_OUT, OUT, IN2, IN2_adv & do_hoval_IN);
 
 	// Handle output, currently just saved in a register.